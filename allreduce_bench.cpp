@@ -0,0 +1,140 @@
+#include "loopback_fabric.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <thread>
+
+// Allreduce benchmark on the in-process loopback backend.
+// Simulates 2..max_ranks ranks (powers of two), one thread each, and reports
+// algorithm and bus bandwidth for ring and tree allreduce of fp32 sums.
+//   ./allreduce_bench [-n bytes] [-r max_ranks] [-k chunk] [-i iterations]
+
+namespace {
+
+struct Options {
+    size_t bytes{4 * 1024 * 1024};
+    int max_ranks{64};
+    size_t chunk_size{256 * 1024};
+    int iterations{5};
+};
+
+Options parseArguments(int argc, char* argv[]) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            opts.bytes = std::strtoull(argv[++i], nullptr, 0) / sizeof(float) * sizeof(float);
+        } else if (std::strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            opts.max_ranks = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+            opts.chunk_size = std::strtoull(argv[++i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            opts.iterations = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-h") == 0) {
+            std::cout << "Usage: " << argv[0] << " [-n bytes] [-r max_ranks] [-k chunk] [-i iterations]\n";
+            std::exit(0);
+        }
+    }
+    return opts;
+}
+
+class Barrier {
+public:
+    explicit Barrier(int count) : count_(count) {}
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        uint64_t generation = generation_;
+        if (++waiting_ == count_) {
+            waiting_ = 0;
+            generation_++;
+            cv_.notify_all();
+        } else {
+            cv_.wait(lock, [&] { return generation != generation_; });
+        }
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    int count_;
+    int waiting_{0};
+    uint64_t generation_{0};
+};
+
+// Returns seconds per allreduce; throws if the first result is wrong
+double runRanks(const Options& opts, int ranks, Collectives::Algorithm algorithm) {
+    size_t buffer_size = opts.bytes + Collectives::scratchSize(opts.chunk_size, 8);
+    LoopbackNetwork network(ranks, buffer_size);
+    Barrier barrier(ranks);
+    std::vector<std::thread> threads;
+    std::vector<std::string> errors(ranks);
+    double seconds = 0.0;
+
+    for (int r = 0; r < ranks; ++r) {
+        threads.emplace_back([&, r] {
+            try {
+                LoopbackFabric& fabric = network.rank(r);
+                HostReducer reducer(fabric.buffer(), DataType::Float32, ReduceOp::Sum);
+                Collectives coll(fabric, reducer, opts.chunk_size, 8);
+
+                float* data = reinterpret_cast<float*>(fabric.buffer());
+                size_t count = opts.bytes / sizeof(float);
+                std::fill(data, data + count, static_cast<float>(r + 1));
+
+                coll.allreduce(0, opts.bytes, sizeof(float), algorithm);
+                float expected = ranks * (ranks + 1) / 2.0f;
+                for (size_t i = 0; i < count; ++i) {
+                    if (data[i] != expected) {
+                        throw std::runtime_error("rank " + std::to_string(r) + " element " + std::to_string(i) +
+                                                 " is " + std::to_string(data[i]));
+                    }
+                }
+
+                barrier.wait();
+                auto start = std::chrono::steady_clock::now();
+                for (int it = 0; it < opts.iterations; ++it) {
+                    std::fill(data, data + count, 1.0f);
+                    coll.allreduce(0, opts.bytes, sizeof(float), algorithm);
+                }
+                barrier.wait();
+                if (r == 0) {
+                    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                }
+            } catch (const std::exception& e) {
+                errors[r] = e.what();
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+
+    for (const auto& error : errors) {
+        if (!error.empty()) throw std::runtime_error(error);
+    }
+    return seconds / opts.iterations;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        Options opts = parseArguments(argc, argv);
+        std::cout << "Loopback Allreduce Benchmark\n============================\n";
+        std::cout << "Message size: " << opts.bytes << " bytes, chunk: " << opts.chunk_size << " bytes\n";
+        std::cout << "\nranks  algorithm      time(us)   algbw(GB/s)   busbw(GB/s)\n";
+
+        for (int ranks = 2; ranks <= opts.max_ranks; ranks *= 2) {
+            for (auto algorithm : {Collectives::Algorithm::Ring, Collectives::Algorithm::Tree}) {
+                double secs = runRanks(opts, ranks, algorithm);
+                double algbw = opts.bytes / secs / 1e9;
+                double busbw = algbw * 2.0 * (ranks - 1) / ranks;
+                std::printf("%5d  %-9s %13.1f %13.2f %13.2f\n", ranks,
+                            algorithm == Collectives::Algorithm::Ring ? "ring" : "tree",
+                            secs * 1e6, algbw, busbw);
+            }
+        }
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "allreduce_bench failed: " << e.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,255 @@
+#include "checkpoint_stream.hpp"
+#include "crc32c.hpp"
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <sys/stat.h>
+
+// Checkpoint streaming benchmark: the sender reads -f from disk with
+// io_uring and streams it to the receiver, which either keeps it in its
+// registered region (weight loading) or, with its own -f, writes it to disk
+// (checkpoint save). The sender first times a disk-only read of the file so
+// the streamed GB/s can be compared with it. -c creates a test file of that
+// many bytes first; files are opened with O_DIRECT unless -b is given.
+// Both sides check the data against a CRC32C of the source file.
+//   ./checkpoint_bench [-p port] [-s region_bytes] [-f sink_file] [-k chunk] [-q depth]   # receiver
+//   ./checkpoint_bench <server> -f file [-c bytes] [-p port] [-k chunk] [-q depth] [-b]  # sender
+
+namespace {
+
+struct Options {
+    std::string server_name;
+    int port{20000};
+    std::optional<std::string> ib_dev_name;
+    std::string file;
+    size_t create_bytes{0};
+    size_t region_size{256 * 1024 * 1024};
+    size_t chunk_size{CheckpointStream::DEFAULT_CHUNK_SIZE};
+    uint32_t depth{4};
+    bool buffered{false};
+};
+
+Options parseArguments(int argc, char* argv[]) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            opts.port = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            opts.ib_dev_name = argv[++i];
+        } else if (std::strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            opts.file = argv[++i];
+        } else if (std::strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            opts.create_bytes = std::strtoull(argv[++i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            opts.region_size = std::strtoull(argv[++i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+            opts.chunk_size = std::strtoull(argv[++i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "-q") == 0 && i + 1 < argc) {
+            opts.depth = static_cast<uint32_t>(std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "-b") == 0) {
+            opts.buffered = true;
+        } else if (std::strcmp(argv[i], "-h") == 0) {
+            std::cout << "Usage: " << argv[0] << " [server] [-p port] [-d ib_dev] [-f file] [-c create_bytes]"
+                      << " [-s region_bytes] [-k chunk] [-q depth] [-b]\n";
+            std::exit(0);
+        } else if (opts.server_name.empty()) {
+            opts.server_name = argv[i];
+        }
+    }
+    if (!opts.server_name.empty() && opts.file.empty()) {
+        throw std::runtime_error("The sender needs a file to stream (-f)");
+    }
+    return opts;
+}
+
+void createTestFile(const std::string& path, size_t bytes) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to create " + path);
+    }
+    std::vector<uint64_t> block(1024 * 1024 / sizeof(uint64_t));
+    for (size_t offset = 0; offset < bytes;) {
+        for (size_t i = 0; i < block.size(); ++i) {
+            block[i] = (offset / sizeof(uint64_t) + i) * 0x9e3779b97f4a7c15ull;
+        }
+        size_t n = std::min(bytes - offset, block.size() * sizeof(uint64_t));
+        if (write(fd, block.data(), n) != static_cast<ssize_t>(n)) {
+            close(fd);
+            throw std::runtime_error("Failed to write " + path);
+        }
+        offset += n;
+    }
+    fsync(fd);
+    close(fd);
+    std::cout << "✓ Created " << bytes << " byte test file " << path << "\n";
+}
+
+// O_DIRECT when the filesystem allows it
+int openFile(const std::string& path, int flags, bool buffered) {
+    int fd = buffered ? -1 : open(path.c_str(), flags | O_DIRECT, 0644);
+    if (fd < 0 && !buffered && errno == EINVAL) {
+        std::cout << "O_DIRECT unsupported for " << path << ", using the page cache\n";
+    }
+    if (fd < 0) {
+        fd = open(path.c_str(), flags, 0644);
+    }
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open " + path);
+    }
+    return fd;
+}
+
+uint32_t fileCrc(const std::string& path, size_t length) {
+    int fd = openFile(path, O_RDONLY, true);
+    std::vector<uint8_t> block(4 * 1024 * 1024);
+    uint32_t crc = 0;
+    for (size_t offset = 0; offset < length;) {
+        ssize_t n = pread(fd, block.data(), std::min(block.size(), length - offset), static_cast<off_t>(offset));
+        if (n <= 0) {
+            close(fd);
+            throw std::runtime_error("Failed to read back " + path);
+        }
+        crc = crc32c(block.data(), static_cast<size_t>(n), crc);
+        offset += static_cast<size_t>(n);
+    }
+    close(fd);
+    return crc;
+}
+
+// Reads the file with depth chunks in flight and no network, for comparison
+double diskOnlySeconds(int fd, size_t length, size_t chunk_size, uint32_t depth) {
+    uint8_t* buffer = static_cast<uint8_t*>(aligned_alloc(4096, depth * chunk_size));
+    if (!buffer) {
+        throw std::runtime_error("Failed to allocate read buffer");
+    }
+    IoRing ring(depth);
+    ring.registerBuffer(buffer, depth * chunk_size);
+    uint64_t chunks = (length + chunk_size - 1) / chunk_size, issued = 0, completed = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (completed < chunks) {
+        while (issued < chunks && issued < completed + depth) {
+            ring.read(fd, buffer + (issued % depth) * chunk_size, static_cast<uint32_t>(chunk_size),
+                      issued * chunk_size, issued);
+            issued++;
+        }
+        IoRing::Completion io[16];
+        int n = ring.poll(io, 16);
+        for (int i = 0; i < n; ++i) {
+            if (io[i].result <= 0) {
+                free(buffer);
+                throw std::runtime_error("Disk read failed");
+            }
+        }
+        completed += n;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    free(buffer);
+    return seconds;
+}
+
+void printStats(const char* label, const CheckpointStream::Stats& stats) {
+    std::printf("%-10s %8.2f GB/s  (%.3f s, %.3f s waiting on disk)\n", label,
+                stats.bytes / stats.seconds / 1e9, stats.seconds, stats.disk_wait_seconds);
+}
+
+void runSender(const Options& opts) {
+    if (opts.create_bytes) createTestFile(opts.file, opts.create_bytes);
+    int fd = openFile(opts.file, O_RDONLY, opts.buffered);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        throw std::runtime_error(opts.file + " is empty or unreadable");
+    }
+    uint64_t length = static_cast<uint64_t>(st.st_size);
+
+    double disk = diskOnlySeconds(fd, length, opts.chunk_size, opts.depth);
+    std::printf("\n%-10s %8.2f GB/s  (%.3f s)\n", "disk only", length / disk / 1e9, disk);
+
+    HpuManager hpu;
+    RdmaVerbs rdma;
+    hpu.initialize(opts.chunk_size);
+    rdma.initialize(opts.ib_dev_name.value_or(""), hpu);
+    rdma.connectQp(opts.server_name, opts.port);
+    struct ibv_qp* qp = rdma.createQp();
+    CmConData remote = rdma.connectQp(qp);
+
+    uint64_t net_length = htonll(length);
+    char mode = 'N';
+    if (write(rdma.getSock(), &net_length, sizeof(net_length)) != sizeof(net_length) ||
+        read(rdma.getSock(), &mode, 1) != 1 || mode == 'N') {
+        throw std::runtime_error("Receiver can't take " + std::to_string(length) + " bytes");
+    }
+
+    CheckpointStream stream(rdma, qp, remote, opts.chunk_size, opts.depth);
+    auto destination = mode == 'F' ? CheckpointStream::Destination::PeerFile
+                                   : CheckpointStream::Destination::PeerMemory;
+    auto stats = stream.sendFile(fd, length, destination);
+    printStats(mode == 'F' ? "to file" : "to memory", stats);
+    close(fd);
+
+    uint32_t crc = htonl(fileCrc(opts.file, length));
+    if (write(rdma.getSock(), &crc, sizeof(crc)) != sizeof(crc)) {
+        throw std::runtime_error("Failed to send checksum");
+    }
+    rdma.destroyQp(qp);
+}
+
+void runReceiver(const Options& opts) {
+    HpuManager hpu;
+    RdmaVerbs rdma;
+    hpu.initialize(opts.region_size);
+    rdma.initialize(opts.ib_dev_name.value_or(""), hpu);
+    rdma.connectQp(opts.server_name, opts.port);
+    struct ibv_qp* qp = rdma.createQp();
+    CmConData remote = rdma.connectQp(qp);
+
+    uint64_t length = 0;
+    if (read(rdma.getSock(), &length, sizeof(length)) != sizeof(length)) {
+        throw std::runtime_error("Failed to receive checkpoint size");
+    }
+    length = ntohll(length);
+    bool to_file = !opts.file.empty();
+    char mode = to_file ? 'F' : length <= rdma.getRegionSize() ? 'M' : 'N';
+    if (write(rdma.getSock(), &mode, 1) != 1 || mode == 'N') {
+        throw std::runtime_error("Checkpoint of " + std::to_string(length) + " bytes exceeds the region (-s)");
+    }
+
+    CheckpointStream stream(rdma, qp, remote, opts.chunk_size, opts.depth);
+    int fd = to_file ? openFile(opts.file, O_WRONLY | O_CREAT, opts.buffered) : -1;
+    auto stats = to_file ? stream.receiveToFile(fd, length) : stream.receiveToMemory(length);
+    if (fd >= 0) close(fd);
+    printStats(to_file ? "to file" : "to memory", stats);
+
+    uint32_t expected = 0;
+    if (read(rdma.getSock(), &expected, sizeof(expected)) != sizeof(expected)) {
+        throw std::runtime_error("Failed to receive checksum");
+    }
+    if (to_file) {
+        bool ok = fileCrc(opts.file, length) == ntohl(expected);
+        std::cout << (ok ? "✓ Written file verified\n" : "✗ Written file mismatch\n");
+    } else if (rdma.getHostBuffer()) {
+        bool ok = crc32c(rdma.getHostBuffer(), length) == ntohl(expected);
+        std::cout << (ok ? "✓ Received data verified\n" : "✗ Received data mismatch\n");
+    } else {
+        std::cout << "Data is in device memory, not verified\n";
+    }
+    rdma.destroyQp(qp);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        Options opts = parseArguments(argc, argv);
+        std::cout << "Checkpoint Streaming Benchmark\n==============================\n";
+        if (opts.server_name.empty()) {
+            runReceiver(opts);
+        } else {
+            runSender(opts);
+        }
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "checkpoint_bench failed: " << e.what() << "\n";
+        return 1;
+    }
+}
@@ -1,4 +1,5 @@
 #include "client.hpp"
+#include "startup.hpp"
 #include <cstring>
 #include <stdexcept>
 #include <unistd.h>
@@ -134,21 +135,19 @@ void DmabufClient::signalServerDone() {
 
 void DmabufClient::run() {
     try {
-        std::cout << "Initializing Gaudi DMA-buf...\n";
-        hpu_.initialize(buffer_size_);
+        // Device memory, the IB device and the TCP connection come up together
+        std::cout << "Initializing Gaudi DMA-buf and RDMA resources, connecting to server " << server_name_ << ":"
+                  << port_ << "...\n";
+        StartupProfile profile;
+        startInParallel(hpu_, buffer_size_, rdma_, ib_dev_name_.value_or(""), server_name_, port_, &profile);
         if (hpu_.getDmabufFd() >= 0) {
             std::cout << "✓ Gaudi DMA-buf allocated (fd=" << hpu_.getDmabufFd() << ", va=0x" << std::hex << hpu_.getDeviceVa() << std::dec << ")\n";
         } else {
             std::cout << "✓ Using regular memory buffer\n";
         }
-
-        std::cout << "\nInitializing RDMA resources...\n";
-        rdma_.initialize(ib_dev_name_.value_or(""), hpu_);
         std::cout << "✓ RDMA resources initialized\n";
-
-        std::cout << "\nConnecting to server " << server_name_ << ":" << port_ << "...\n";
-        rdma_.connectQp(server_name_, port_);
         std::cout << "✓ Connected to server\n";
+        profile.report(std::cout);
 
         communicationLoop();
 
@@ -0,0 +1,204 @@
+#include "loopback_fabric.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+// Broadcast and all-to-all(v) benchmark on the in-process loopback backend.
+// Broadcast: -n bytes from rank 0 down a chain and a binary tree.
+// All-to-all: rank r sends (r + p) % 4 + 1 units of -a bytes to peer p, the
+// uneven per-expert split of an MoE dispatch.
+//   ./collective_bench [-n bytes] [-a unit_bytes] [-r max_ranks] [-k chunk] [-i iterations]
+
+namespace {
+
+struct Options {
+    size_t bytes{16 * 1024 * 1024};
+    size_t unit_bytes{16 * 1024};
+    int max_ranks{64};
+    size_t chunk_size{256 * 1024};
+    int iterations{5};
+};
+
+Options parseArguments(int argc, char* argv[]) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            opts.bytes = std::strtoull(argv[++i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            opts.unit_bytes = std::strtoull(argv[++i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            opts.max_ranks = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+            opts.chunk_size = std::strtoull(argv[++i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            opts.iterations = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-h") == 0) {
+            std::cout << "Usage: " << argv[0]
+                      << " [-n bytes] [-a unit_bytes] [-r max_ranks] [-k chunk] [-i iterations]\n";
+            std::exit(0);
+        }
+    }
+    return opts;
+}
+
+class Barrier {
+public:
+    explicit Barrier(int count) : count_(count) {}
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        uint64_t generation = generation_;
+        if (++waiting_ == count_) {
+            waiting_ = 0;
+            generation_++;
+            cv_.notify_all();
+        } else {
+            cv_.wait(lock, [&] { return generation != generation_; });
+        }
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    int count_;
+    int waiting_{0};
+    uint64_t generation_{0};
+};
+
+uint8_t pattern(int src, int dst, size_t i) {
+    return static_cast<uint8_t>(src * 31 + dst * 7 + i);
+}
+
+size_t blockBytes(const Options& opts, int src, int dst) {
+    return ((src + dst) % 4 + 1) * opts.unit_bytes;
+}
+
+// Fills every rank's buffer, runs op once per rank to check it, then times
+// iterations of it. Returns seconds per call; throws if the check fails on any rank.
+using RankFill = std::function<void(LoopbackFabric&)>;
+using RankOp = std::function<void(Collectives&, LoopbackFabric&, bool check)>;
+
+double runRanks(const Options& opts, int ranks, size_t buffer_size, const RankFill& fill, const RankOp& op) {
+    LoopbackNetwork network(ranks, buffer_size + Collectives::scratchSize(opts.chunk_size, 8));
+    Barrier barrier(ranks);
+    std::vector<std::thread> threads;
+    std::vector<std::string> errors(ranks);
+    double seconds = 0.0;
+
+    for (int r = 0; r < ranks; ++r) {
+        threads.emplace_back([&, r] {
+            try {
+                LoopbackFabric& fabric = network.rank(r);
+                HostReducer reducer(fabric.buffer(), DataType::Float32, ReduceOp::Sum);
+                Collectives coll(fabric, reducer, opts.chunk_size, 8);
+
+                // Peers write into this buffer as soon as they start
+                fill(fabric);
+                barrier.wait();
+                op(coll, fabric, true);
+                barrier.wait();
+                auto start = std::chrono::steady_clock::now();
+                for (int it = 0; it < opts.iterations; ++it) {
+                    op(coll, fabric, false);
+                }
+                barrier.wait();
+                if (r == 0) {
+                    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                }
+            } catch (const std::exception& e) {
+                errors[r] = e.what();
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+
+    for (const auto& error : errors) {
+        if (!error.empty()) throw std::runtime_error(error);
+    }
+    return seconds / opts.iterations;
+}
+
+double runBroadcast(const Options& opts, int ranks, Collectives::BroadcastShape shape) {
+    auto fill = [&](LoopbackFabric& fabric) {
+        for (size_t i = 0; i < opts.bytes; ++i) {
+            fabric.buffer()[i] = fabric.rank() == 0 ? pattern(0, 0, i) : 0;
+        }
+    };
+    return runRanks(opts, ranks, opts.bytes, fill, [&](Collectives& coll, LoopbackFabric& fabric, bool check) {
+        uint8_t* data = fabric.buffer();
+        coll.broadcast(0, 0, opts.bytes, shape);
+        if (!check) return;
+        for (size_t i = 0; i < opts.bytes; ++i) {
+            if (data[i] != pattern(0, 0, i)) {
+                throw std::runtime_error("broadcast: rank " + std::to_string(fabric.rank()) + " byte " +
+                                         std::to_string(i) + " differs");
+            }
+        }
+    });
+}
+
+double runAllToAll(const Options& opts, int ranks) {
+    size_t stride = 4 * opts.unit_bytes;
+    size_t recv_offset = ranks * stride;
+    auto fill = [&](LoopbackFabric& fabric) {
+        size_t packed = 0;
+        for (int p = 0; p < ranks; ++p) {
+            for (size_t i = 0; i < blockBytes(opts, fabric.rank(), p); ++i) {
+                fabric.buffer()[packed++] = pattern(fabric.rank(), p, i);
+            }
+        }
+    };
+    return runRanks(opts, ranks, 2 * ranks * stride, fill, [&](Collectives& coll, LoopbackFabric& fabric, bool check) {
+        int r = fabric.rank();
+        uint8_t* data = fabric.buffer();
+        std::vector<size_t> send_bytes(ranks), recv_bytes;
+        for (int p = 0; p < ranks; ++p) {
+            send_bytes[p] = blockBytes(opts, r, p);
+        }
+
+        coll.allToAll(0, send_bytes, recv_offset, stride, recv_bytes);
+        if (!check) return;
+        for (int p = 0; p < ranks; ++p) {
+            bool ok = recv_bytes[p] == blockBytes(opts, p, r);
+            for (size_t i = 0; ok && i < recv_bytes[p]; ++i) {
+                ok = data[recv_offset + p * stride + i] == pattern(p, r, i);
+            }
+            if (!ok) {
+                throw std::runtime_error("all-to-all: rank " + std::to_string(r) + " block from " +
+                                         std::to_string(p) + " differs");
+            }
+        }
+    });
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        Options opts = parseArguments(argc, argv);
+        std::cout << "Loopback Broadcast / All-to-all Benchmark\n=========================================\n";
+        std::cout << "Broadcast size: " << opts.bytes << " bytes, all-to-all unit: " << opts.unit_bytes
+                  << " bytes, chunk: " << opts.chunk_size << " bytes\n";
+        std::cout << "\nranks  collective     time(us)   algbw(GB/s)\n";
+
+        for (int ranks = 2; ranks <= opts.max_ranks; ranks *= 2) {
+            double chain = runBroadcast(opts, ranks, Collectives::BroadcastShape::Chain);
+            double tree = runBroadcast(opts, ranks, Collectives::BroadcastShape::Tree);
+            double a2a = runAllToAll(opts, ranks);
+
+            // Bytes rank 0 sends in the all-to-all
+            double a2a_bytes = 0;
+            for (int p = 0; p < ranks; ++p) a2a_bytes += blockBytes(opts, 0, p);
+
+            std::printf("%5d  %-11s %11.1f %13.2f\n", ranks, "bcast-chain", chain * 1e6, opts.bytes / chain / 1e9);
+            std::printf("%5d  %-11s %11.1f %13.2f\n", ranks, "bcast-tree", tree * 1e6, opts.bytes / tree / 1e9);
+            std::printf("%5d  %-11s %11.1f %13.2f\n", ranks, "alltoallv", a2a * 1e6, a2a_bytes / a2a / 1e9);
+        }
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "collective_bench failed: " << e.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,172 @@
+#include "hpuverbs.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+// Latency of one-sided control traffic by where the target words live. The
+// responder allocates one control region in host memory and one in NIC
+// memory (host again if the device has none). The initiator then runs -i
+// round trips each of an 8-byte fetch-and-add, read and write against both,
+// one at a time, and prints median and p99. Reads and writes use the word
+// after the counter, so the responder can check every fetch-and-add landed.
+//   ./control_bench [-p port] [-d ib_dev]                     # responder
+//   ./control_bench <server> [-p port] [-d ib_dev] [-i iterations]
+
+namespace {
+
+constexpr size_t CONTROL_BYTES = 64;
+
+struct Options {
+    std::string server_name;
+    int port{20000};
+    std::optional<std::string> ib_dev_name;
+    int iterations{100000};
+};
+
+// Where the responder's words for one region are
+struct RegionInfo {
+    uint64_t addr;
+    uint32_t rkey;
+    uint8_t on_device;
+} __attribute__((packed));
+
+Options parseArguments(int argc, char* argv[]) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            opts.port = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            opts.ib_dev_name = argv[++i];
+        } else if (std::strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            opts.iterations = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-h") == 0) {
+            std::cout << "Usage: " << argv[0] << " [server] [-p port] [-d ib_dev] [-i iterations]\n";
+            std::exit(0);
+        } else if (opts.server_name.empty()) {
+            opts.server_name = argv[i];
+        }
+    }
+    if (opts.iterations <= 0) {
+        throw std::runtime_error("Need at least one iteration");
+    }
+    return opts;
+}
+
+// One signaled 8-byte operation against the peer's word, waited for
+double roundTrip(RdmaVerbs& rdma, struct ibv_qp* qp, const ControlRegion& local, uint64_t remote_addr,
+                 uint32_t rkey, int opcode) {
+    struct ibv_sge sge = {};
+    sge.addr = local.addr();
+    sge.length = sizeof(uint64_t);
+    sge.lkey = local.mr->lkey;
+    struct ibv_send_wr wr = {};
+    wr.opcode = static_cast<enum ibv_wr_opcode>(opcode);
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    wr.send_flags = IBV_SEND_SIGNALED;
+    if (opcode == IBV_WR_ATOMIC_FETCH_AND_ADD) {
+        wr.wr.atomic.remote_addr = remote_addr;
+        wr.wr.atomic.rkey = rkey;
+        wr.wr.atomic.compare_add = 1;
+    } else {
+        wr.wr.rdma.remote_addr = remote_addr;
+        wr.wr.rdma.rkey = rkey;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    rdma.postSend(qp, &wr);
+    struct ibv_wc wc;
+    while (rdma.pollCompletions(&wc, 1) == 0) {
+    }
+    if (wc.status != IBV_WC_SUCCESS) {
+        throw std::runtime_error(std::string("Control operation failed: ") + ibv_wc_status_str(wc.status));
+    }
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+void runInitiator(const Options& opts, RdmaVerbs& rdma, struct ibv_qp* qp) {
+    RegionInfo targets[2];
+    if (read(rdma.getSock(), targets, sizeof(targets)) != sizeof(targets)) {
+        throw std::runtime_error("Failed to receive control regions");
+    }
+    // Results and sources stay on this side's host; only the target moves
+    ControlRegion local = rdma.allocateControlRegion(CONTROL_BYTES, false);
+
+    const struct { int opcode; const char* name; uint64_t word; } ops[] = {
+        {IBV_WR_ATOMIC_FETCH_AND_ADD, "fetch-add", 0},
+        {IBV_WR_RDMA_READ, "read", 8},
+        {IBV_WR_RDMA_WRITE, "write", 8},
+    };
+    std::printf("\n%-10s %-6s %12s %12s\n", "op", "target", "median us", "p99 us");
+    for (const auto& op : ops) {
+        for (const RegionInfo& target : targets) {
+            std::vector<double> us(opts.iterations);
+            for (double& sample : us) {
+                sample = roundTrip(rdma, qp, local, ntohll(target.addr) + op.word, ntohl(target.rkey), op.opcode);
+            }
+            std::sort(us.begin(), us.end());
+            std::printf("%-10s %-6s %12.2f %12.2f\n", op.name, target.on_device ? "nic" : "host", us[us.size() / 2],
+                        us[us.size() * 99 / 100]);
+        }
+    }
+    rdma.freeControlRegion(local);
+
+    uint32_t adds = htonl(static_cast<uint32_t>(opts.iterations));
+    if (write(rdma.getSock(), &adds, sizeof(adds)) != sizeof(adds)) {
+        throw std::runtime_error("Failed to signal completion");
+    }
+}
+
+void runResponder(RdmaVerbs& rdma) {
+    ControlRegion regions[2] = {rdma.allocateControlRegion(CONTROL_BYTES, false),
+                                rdma.allocateControlRegion(CONTROL_BYTES, true)};
+    RegionInfo info[2];
+    for (int i = 0; i < 2; ++i) {
+        info[i] = {htonll(regions[i].addr()), htonl(regions[i].mr->rkey), regions[i].onDevice()};
+    }
+    if (write(rdma.getSock(), info, sizeof(info)) != sizeof(info)) {
+        throw std::runtime_error("Failed to send control regions");
+    }
+
+    std::cout << "Serving control operations...\n";
+    uint32_t adds = 0;
+    if (read(rdma.getSock(), &adds, sizeof(adds)) != sizeof(adds)) {
+        throw std::runtime_error("Initiator went away");
+    }
+    for (ControlRegion& region : regions) {
+        uint64_t counter = 0;
+        rdma.readControl(region, 0, &counter, sizeof(counter));
+        std::cout << (counter == ntohl(adds) ? "✓ " : "✗ ") << (region.onDevice() ? "NIC" : "Host") << " counter at "
+                  << counter << " of " << ntohl(adds) << " fetch-adds\n";
+        rdma.freeControlRegion(region);
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        Options opts = parseArguments(argc, argv);
+        std::cout << "Control Region Benchmark\n========================\n";
+
+        HpuManager hpu;
+        RdmaVerbs rdma;
+        hpu.initialize(RDMA_BUFFER_SIZE);
+        rdma.initialize(opts.ib_dev_name.value_or(""), hpu);
+        rdma.connectQp(opts.server_name, opts.port);
+        // A QP of its own so co-located runs still go through the NIC
+        struct ibv_qp* qp = rdma.createQp();
+        rdma.connectQp(qp);
+
+        if (opts.server_name.empty()) {
+            runResponder(rdma);
+        } else {
+            runInitiator(opts, rdma, qp);
+        }
+        rdma.destroyQp(qp);
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "control_bench failed: " << e.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,154 @@
+#include "endpoint_table.hpp"
+#include <chrono>
+#include <cstring>
+#include <sstream>
+
+// Sparse traffic over lazily connected endpoints. Start one process per
+// rank; rank r listens on port + r. Each rank writes -i messages, -b at a
+// time to one peer before moving to the next, so it touches every other
+// rank while holding at most -q QPs. Only every 16th write is signaled,
+// so evictions have to fence unsignaled writes. Every rank then serves its
+// peers for -w ms and prints connects, accepts, evictions and queued ops.
+//   ./endpoint_bench -r rank -n ranks [-H host0,host1,...] [-p port] [-q qp_budget]
+//                    [-i iterations] [-b burst] [-w linger_ms] [-d ib_dev]
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int SIGNAL_EVERY = 16;
+constexpr size_t MAX_SIGNALED = 32;
+
+struct Options {
+    int rank{-1};
+    int ranks{0};
+    std::vector<std::string> hosts;
+    int port{21000};
+    size_t qp_budget{2};
+    int iterations{10000};
+    int burst{64};
+    int linger_ms{2000};
+    std::optional<std::string> ib_dev_name;
+};
+
+Options parseArguments(int argc, char* argv[]) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            opts.rank = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            opts.ranks = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-H") == 0 && i + 1 < argc) {
+            std::stringstream list(argv[++i]);
+            std::string host;
+            while (std::getline(list, host, ',')) {
+                opts.hosts.push_back(host);
+            }
+        } else if (std::strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            opts.port = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-q") == 0 && i + 1 < argc) {
+            opts.qp_budget = std::strtoul(argv[++i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            opts.iterations = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            opts.burst = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            opts.linger_ms = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            opts.ib_dev_name = argv[++i];
+        } else if (std::strcmp(argv[i], "-h") == 0) {
+            std::cout << "Usage: " << argv[0] << " -r rank -n ranks [-H host0,host1,...] [-p port] [-q qp_budget]"
+                      << " [-i iterations] [-b burst] [-w linger_ms] [-d ib_dev]\n";
+            std::exit(0);
+        }
+    }
+    if (opts.ranks < 2 || opts.rank < 0 || opts.rank >= opts.ranks) {
+        throw std::runtime_error("Need -n of at least 2 and a rank below it");
+    }
+    if (opts.iterations <= 0 || opts.burst <= 0) {
+        throw std::runtime_error("Iterations and burst must be positive");
+    }
+    if (static_cast<size_t>(opts.ranks) * MSG_SIZE > RDMA_BUFFER_SIZE) {
+        throw std::runtime_error("Every rank needs its own slot in the peer buffer");
+    }
+    if (opts.hosts.empty()) {
+        opts.hosts.assign(opts.ranks, "127.0.0.1");
+    } else if (opts.hosts.size() != static_cast<size_t>(opts.ranks)) {
+        throw std::runtime_error("-H needs one host per rank");
+    }
+    return opts;
+}
+
+// Counts signaled completions, failing on any error
+size_t reap(EndpointTable& table) {
+    struct ibv_wc wc[16];
+    int ne = table.pollCompletions(wc, 16);
+    for (int i = 0; i < ne; ++i) {
+        if (wc[i].status != IBV_WC_SUCCESS) {
+            throw std::runtime_error(std::string("Write failed: ") + ibv_wc_status_str(wc[i].status));
+        }
+    }
+    return static_cast<size_t>(ne);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        Options opts = parseArguments(argc, argv);
+        std::cout << "Lazy Endpoint Benchmark\n=======================\n";
+
+        HpuManager hpu;
+        RdmaVerbs rdma;
+        hpu.initialize(RDMA_BUFFER_SIZE);
+        rdma.initialize(opts.ib_dev_name.value_or(""), hpu);
+
+        EndpointTable table(rdma, opts.rank, opts.port + opts.rank, opts.qp_budget);
+        for (int peer = 0; peer < opts.ranks; ++peer) {
+            if (peer != opts.rank) table.addPeer(peer, opts.hosts[peer], opts.port + peer);
+        }
+
+        // Each rank writes its own slot of every peer's buffer
+        RdmaOp op;
+        op.opcode = IBV_WR_RDMA_WRITE;
+        op.remote_addr = static_cast<uint64_t>(opts.rank) * MSG_SIZE;
+
+        size_t posted = 0, completed = 0;
+        auto start = Clock::now();
+        for (int i = 0; i < opts.iterations; ++i) {
+            int peer = (opts.rank + 1 + (i / opts.burst) % (opts.ranks - 1)) % opts.ranks;
+            op.wr_id = static_cast<uint64_t>(i);
+            op.signaled = i % SIGNAL_EVERY == SIGNAL_EVERY - 1 || i == opts.iterations - 1;
+            table.post(peer, op);
+            if (op.signaled) posted++;
+            do {
+                table.progress();
+                completed += reap(table);
+            } while (posted - completed >= MAX_SIGNALED);
+        }
+        while (completed < posted) {
+            table.progress();
+            completed += reap(table);
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        // Peers still need us to accept their connections and teardowns
+        auto linger = Clock::now() + std::chrono::milliseconds(opts.linger_ms);
+        while (Clock::now() < linger) {
+            table.progress();
+            reap(table);
+        }
+
+        const EndpointTable::Stats& stats = table.stats();
+        std::printf("\n%d writes to %d peers in %.3f s (%.0f/s) under a budget of %zu QPs\n", opts.iterations,
+                    opts.ranks - 1, seconds, opts.iterations / seconds, opts.qp_budget);
+        std::printf("connects %llu, accepts %llu, evictions %llu, queued ops %llu, QPs left %zu\n",
+                    static_cast<unsigned long long>(stats.connects), static_cast<unsigned long long>(stats.accepts),
+                    static_cast<unsigned long long>(stats.evictions),
+                    static_cast<unsigned long long>(stats.queued_ops), table.activeQps());
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "endpoint_bench failed: " << e.what() << "\n";
+        return 1;
+    }
+}
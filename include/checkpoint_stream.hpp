@@ -0,0 +1,78 @@
+#ifndef CHECKPOINT_STREAM_HPP
+#define CHECKPOINT_STREAM_HPP
+
+#include "hpuverbs.hpp"
+#include "io_ring.hpp"
+#include <vector>
+
+// Streams files between disk and a remote peer without a full copy in
+// memory. The sender reads chunk i+1 from disk with io_uring into a
+// registered host slot while chunk i is an RDMA write on the wire; the peer
+// either has the chunks land directly at an offset of its registered region
+// (e.g. a Gaudi DMA-buf, for weight loading) or receives them into its own
+// host slots and writes them to disk while the next ones arrive (checkpoint
+// save), returning a credit per slot once the chunk is on disk. In memory
+// the credit follows the reposted receive, so at most depth chunks are ever
+// unacknowledged and a stalled peer times out instead of hanging. Transfer
+// time then approaches the slower of disk and network rather than their sum.
+// Files may be opened with O_DIRECT: chunks are 4 KB multiples and the
+// unaligned tail is rounded up, then truncated away after a file sink.
+// Both sides construct the stream together (host slot addresses are swapped
+// over the connection socket) and the qp must be an extra QP, not the main
+// QP of an intra-node pair. The stream must be the only consumer of the CQ
+// while a transfer runs.
+class CheckpointStream {
+public:
+    enum class Destination { PeerMemory, PeerFile };
+
+    struct Stats {
+        uint64_t chunks{0};
+        uint64_t bytes{0};
+        double seconds{0.0};
+        double disk_wait_seconds{0.0};  // Network side idle, waiting on disk I/O
+    };
+
+    static constexpr size_t DEFAULT_CHUNK_SIZE = 4 * 1024 * 1024;
+
+    CheckpointStream(RdmaVerbs& rdma, struct ibv_qp* qp, const CmConData& remote,
+                     size_t chunk_size = DEFAULT_CHUNK_SIZE, uint32_t depth = 4);
+    ~CheckpointStream();
+
+    CheckpointStream(const CheckpointStream&) = delete;
+    CheckpointStream& operator=(const CheckpointStream&) = delete;
+
+    // Blocking; sends the first length bytes of fd. With PeerMemory the data
+    // lands at remote_offset of the peer's registered region and the peer
+    // calls receiveToMemory, with PeerFile the peer calls receiveToFile.
+    Stats sendFile(int fd, size_t length, Destination destination, uint64_t remote_offset = 0);
+
+    // Blocking counterparts of sendFile; return once every chunk has landed
+    // (in memory) or been written (to the file, not necessarily synced)
+    Stats receiveToMemory(size_t length);
+    Stats receiveToFile(int fd, size_t length);
+
+    bool usesUring() const { return ring_.usesUring(); }
+
+private:
+    uint64_t chunkCount(size_t length) const { return (length + chunk_size_ - 1) / chunk_size_; }
+    uint64_t chunkLength(uint64_t index, size_t length) const;
+    uint32_t ioLength(uint64_t index, size_t length, bool direct) const;
+    uint8_t* slot(uint64_t index) const { return slab_ + (index % depth_) * chunk_size_; }
+    void postChunk(uint64_t index, uint64_t length, uint64_t remote_addr, uint32_t rkey);
+    void postCredit(uint64_t index);
+    void postRecv();
+
+    RdmaVerbs& rdma_;
+    struct ibv_qp* qp_;
+    CmConData remote_;
+    size_t chunk_size_;
+    uint32_t depth_;
+    uint8_t* slab_{nullptr};
+    struct ibv_mr* slab_mr_{nullptr};
+    uint64_t peer_slab_addr_{0};
+    uint32_t peer_slab_rkey_{0};
+    IoRing ring_;
+    std::vector<uint32_t> done_bytes_;  // Per slot, read or written so far
+};
+
+#endif // CHECKPOINT_STREAM_HPP
@@ -0,0 +1,79 @@
+#ifndef CODEC_HPP
+#define CODEC_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Payload codecs for bandwidth-bound links.
+// Lz4: lossless, for generic payloads (needs liblz4 at build time).
+// Bf16 / Fp8: lossy fp32 quantization for gradients. Each element's rounding
+// error is kept per tensor id and added back before the next transfer of that
+// tensor (error feedback), so the error does not accumulate across steps.
+// Tensor id 0 carries no residual from one transfer to the next.
+enum class CodecType { None, Lz4, Bf16, Fp8 };
+
+const char* codecName(CodecType type);
+bool codecAvailable(CodecType type);
+
+class Codec {
+public:
+    virtual ~Codec() = default;
+
+    // Called before the first chunk of every transfer of tensor_id
+    virtual void begin(size_t length, uint64_t tensor_id) { (void)length; (void)tensor_id; }
+
+    // Encodes length bytes found at position in the transfer into dst.
+    // Returns the encoded size, or 0 if it would not fit in capacity.
+    // Chunks of one transfer may be encoded concurrently.
+    virtual size_t encode(const uint8_t* src, size_t length, uint64_t position, uint8_t* dst, size_t capacity) = 0;
+
+    // Decodes into exactly length bytes; throws on corrupt input
+    virtual void decode(const uint8_t* src, size_t encoded, uint8_t* dst, size_t length) = 0;
+};
+
+// Throws if the codec is not available in this build
+std::unique_ptr<Codec> makeCodec(CodecType type);
+
+// Worker threads running codec jobs. Handles increase with every job and
+// done() reports in submission order, like CopyEngine. A job's exception
+// is rethrown by the done() call that reaches it.
+class CodecPool {
+public:
+    explicit CodecPool(uint32_t threads);
+    ~CodecPool();
+
+    CodecPool(const CodecPool&) = delete;
+    CodecPool& operator=(const CodecPool&) = delete;
+
+    uint64_t submit(std::function<void()> job);
+    bool done(uint64_t handle);
+
+    // CPU time spent inside jobs since construction
+    double cpuSeconds();
+
+private:
+    void worker();
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::pair<uint64_t, std::function<void()>>> jobs_;
+    std::deque<bool> finished_;      // Completion flags of the jobs after completed_
+    std::exception_ptr error_;
+    uint64_t error_handle_{0};
+    uint64_t submitted_{0};
+    uint64_t completed_{0};
+    double cpu_seconds_{0.0};
+    bool stop_{false};
+    std::vector<std::thread> threads_;
+};
+
+#endif // CODEC_HPP
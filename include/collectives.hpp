@@ -0,0 +1,142 @@
+#ifndef COLLECTIVES_HPP
+#define COLLECTIVES_HPP
+
+#include "hpuverbs.hpp"
+#include "reduction.hpp"
+#include <chrono>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+// Point-to-point layer under the collectives: one-sided writes carrying a
+// 32-bit immediate into a peer's buffer, plus completion events for the
+// writer (WriteDone) and the target (Arrived). Writes between a pair of
+// ranks arrive in posting order. Every rank's buffer has the same size.
+class CollectiveFabric {
+public:
+    struct Event {
+        enum class Kind { WriteDone, Arrived } kind;
+        int peer;
+        uint32_t imm;
+    };
+
+    virtual ~CollectiveFabric() = default;
+
+    virtual int rank() const = 0;
+    virtual int size() const = 0;
+    virtual size_t bufferSize() const = 0;
+
+    virtual void write(int peer, uint64_t local_offset, uint64_t remote_offset, uint32_t length, uint32_t imm) = 0;
+    virtual int poll(Event* events, int max_events) = 0;
+
+    // Copy within the local buffer (a rank's own all-to-all block)
+    virtual void copy(uint64_t dst_offset, uint64_t src_offset, size_t length) = 0;
+};
+
+// Fabric over RDMA_WRITE_WITH_IMM on one connected QP per peer
+class RdmaFabric : public CollectiveFabric {
+public:
+    RdmaFabric(RdmaVerbs& rdma, int rank, int size);
+
+    // Posts the receives that immediates consume
+    void addPeer(int peer, struct ibv_qp* qp, const CmConData& remote);
+
+    int rank() const override { return rank_; }
+    int size() const override { return size_; }
+    size_t bufferSize() const override { return rdma_.getRegionSize(); }
+
+    void write(int peer, uint64_t local_offset, uint64_t remote_offset, uint32_t length, uint32_t imm) override;
+    int poll(Event* events, int max_events) override;
+    void copy(uint64_t dst_offset, uint64_t src_offset, size_t length) override;
+
+private:
+    struct Peer {
+        struct ibv_qp* qp;
+        CmConData remote;
+    };
+
+    void postRecv(int peer, struct ibv_qp* qp);
+
+    RdmaVerbs& rdma_;
+    int rank_;
+    int size_;
+    std::unordered_map<int, Peer> peers_;
+    std::unordered_map<uint32_t, int> qp_to_peer_;
+};
+
+// Chunk-pipelined collectives over a CollectiveFabric.
+// Ring: reduce-scatter then allgather around the ring, each segment split
+// into chunks so a rank forwards chunk k as soon as it is reduced.
+// Tree: chunks are reduced up a binary tree and broadcast back down.
+// Partial sums land in scratch slots at the top of the peer's buffer and a
+// credit returns each slot once reduced; final values are written straight
+// into the destination range.
+// Broadcast forwards each chunk down a chain or binary tree rooted at the
+// root as soon as it lands. All-to-all(v) writes to every peer at once and
+// ends on a completion-counted barrier: one end-of-block marker per peer in,
+// every local write completed.
+class Collectives {
+public:
+    enum class Algorithm { Ring, Tree };
+    enum class BroadcastShape { Chain, Tree };
+
+    struct Stats {
+        double seconds{0.0};
+        double algbw{0.0};   // GB/s, bytes / time
+        double busbw{0.0};   // GB/s, algbw * bus factor (2(n-1)/n for allreduce)
+        uint64_t writes{0};
+    };
+
+    Collectives(CollectiveFabric& fabric, Reducer& reducer,
+                size_t chunk_size = 256 * 1024, uint32_t slots = 8);
+
+    // Bytes reserved at the top of every rank's buffer
+    static size_t scratchSize(size_t chunk_size, uint32_t slots) { return 2 * chunk_size * slots; }
+
+    // In-place allreduce of [offset, offset + bytes); blocking
+    Stats allreduce(uint64_t offset, size_t bytes, size_t elem_size, Algorithm algorithm = Algorithm::Ring);
+
+    // Copies root's [offset, offset + bytes) to every rank; blocking
+    Stats broadcast(int root, uint64_t offset, size_t bytes, BroadcastShape shape = BroadcastShape::Tree);
+
+    // send_bytes[p] bytes, packed in peer order from send_offset, go to peer p
+    // and land at recv_offset + rank * recv_stride in its buffer. recv_bytes[p]
+    // is set to what peer p sent here. Blocks are limited to 1 GB; blocking.
+    Stats allToAll(uint64_t send_offset, const std::vector<size_t>& send_bytes,
+                   uint64_t recv_offset, size_t recv_stride, std::vector<size_t>& recv_bytes);
+
+private:
+    struct Link {
+        uint64_t arrived{0};       // Data writes received from the peer
+        uint64_t processed{0};
+        uint64_t credits{0};       // Scratch slots the peer handed back
+        uint64_t scratch_sent{0};
+        uint64_t scratch_recv{0};
+        uint64_t credits_owed{0};
+        std::deque<uint32_t> blocks;  // All-to-all block sizes announced by the peer
+    };
+
+    void ring(uint64_t offset, size_t bytes, size_t elem_size, size_t chunk);
+    void tree(uint64_t offset, size_t bytes, size_t chunk);
+    Stats finish(std::chrono::steady_clock::time_point start, uint64_t writes, size_t bytes, double bus_factor) const;
+
+    bool canPost() const;
+    bool canSendScratch(int peer);
+    void sendScratch(int peer, uint32_t link, uint64_t local_offset, uint64_t length);
+    void sendDirect(int peer, uint64_t offset, uint64_t length);
+    void sendCredits();
+    uint64_t scratchOffset(uint32_t link, uint64_t seq) const;
+    void progress();
+    void drain();
+
+    CollectiveFabric& fabric_;
+    Reducer& reducer_;
+    size_t chunk_size_;
+    uint32_t slots_;
+    uint64_t scratch_base_;
+    uint64_t outstanding_{0};
+    uint64_t writes_{0};
+    std::unordered_map<int, Link> links_;
+};
+
+#endif // COLLECTIVES_HPP
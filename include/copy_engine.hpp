@@ -0,0 +1,57 @@
+#ifndef COPY_ENGINE_HPP
+#define COPY_ENGINE_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// Asynchronous device <-> host copies used by the staging pipeline.
+// Addresses are as seen by the engine (device VAs for a Gaudi DMA engine).
+// Copies complete in submission order.
+class CopyEngine {
+public:
+    enum class Direction { DeviceToHost, HostToDevice };
+
+    virtual ~CopyEngine() = default;
+
+    // Start a copy, returns a handle that increases with every call
+    virtual uint64_t copyAsync(uint64_t dst, uint64_t src, size_t length, Direction dir) = 0;
+
+    // True once the copy behind handle (and every earlier one) finished
+    virtual bool done(uint64_t handle) = 0;
+};
+
+// Host-only engine for testing without a Gaudi: addresses are host
+// pointers and a worker thread does the memcpy. An optional rate limit
+// emulates DMA bandwidth so copy/RDMA overlap can be observed.
+class HostCopyEngine : public CopyEngine {
+public:
+    explicit HostCopyEngine(double gbps = 0.0);
+    ~HostCopyEngine() override;
+
+    uint64_t copyAsync(uint64_t dst, uint64_t src, size_t length, Direction dir) override;
+    bool done(uint64_t handle) override;
+
+private:
+    struct Job {
+        uint64_t dst;
+        uint64_t src;
+        size_t length;
+    };
+
+    void worker();
+
+    double gbps_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Job> jobs_;
+    uint64_t submitted_{0};
+    uint64_t completed_{0};
+    bool stop_{false};
+    std::thread thread_;
+};
+
+#endif // COPY_ENGINE_HPP
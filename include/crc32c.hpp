@@ -0,0 +1,18 @@
+#ifndef CRC32C_HPP
+#define CRC32C_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC32C (Castagnoli), the checksum of iSCSI and ext4.
+// Uses SSE4.2 crc32 on three interleaved lanes combined with PCLMUL when
+// the CPU has both, else a table-driven loop. Pass the previous result as
+// crc to continue a running checksum.
+uint32_t crc32c(const void* data, size_t length, uint32_t crc = 0);
+
+// Table-driven reference, always available
+uint32_t crc32cSoftware(const void* data, size_t length, uint32_t crc = 0);
+
+bool crc32cHardware();
+
+#endif // CRC32C_HPP
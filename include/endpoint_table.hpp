@@ -0,0 +1,95 @@
+#ifndef ENDPOINT_TABLE_HPP
+#define ENDPOINT_TABLE_HPP
+
+#include "hpuverbs.hpp"
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+// Lazily connected peer QPs sharing one RdmaVerbs context.
+// A QP is created and brought to RTS the first time an operation targets a
+// peer; operations posted before that are queued and flushed once connected.
+// The accepting side holds its queue until the connecting side reports RTR.
+// Idle QPs are torn down (least recently used first) to stay under qp_budget,
+// after a signaled fence has retired any unsignaled writes still in flight.
+class EndpointTable {
+public:
+    enum class State { Idle, Connecting, Handshake, Waiting, Synchronizing, Ready, Draining };
+
+    struct Stats {
+        uint64_t connects{0};
+        uint64_t accepts{0};
+        uint64_t evictions{0};
+        uint64_t queued_ops{0};
+    };
+
+    EndpointTable(RdmaVerbs& rdma, int rank, int listen_port, size_t qp_budget);
+    ~EndpointTable();
+
+    // Register where a peer listens; no connection is made until first use
+    void addPeer(int peer, const std::string& host, int port);
+
+    // Post an operation to a peer, connecting on demand.
+    // op.remote_addr is an offset into the peer's registered buffer.
+    void post(int peer, const RdmaOp& op);
+
+    // Accept incoming peers, drive handshakes and flush queued operations
+    void progress();
+
+    // Poll the shared CQ and account completions against their endpoint
+    int pollCompletions(struct ibv_wc* wc, int max_entries);
+
+    State state(int peer) const;
+    size_t activeQps() const { return active_qps_; }
+    const Stats& stats() const { return stats_; }
+
+private:
+    struct Endpoint {
+        std::string host;
+        int port{0};
+        State state{State::Idle};
+        int sock{-1};
+        struct ibv_qp* qp{nullptr};
+        CmConData remote{};
+        std::deque<RdmaOp> pending;
+        std::vector<uint8_t> rx;
+        size_t outstanding{0};
+        size_t unsignaled{0};  // Posted since the last signaled WR
+        uint64_t last_use{0};
+    };
+
+    struct Incoming {
+        int sock;
+        std::vector<uint8_t> rx;
+    };
+
+    void startConnect(int peer, Endpoint& ep);
+    void finishConnect(Endpoint& ep);
+    void finishHandshake(int peer, Endpoint& ep);
+    void failHandshake(int peer, Endpoint& ep);
+    void finishSync(Endpoint& ep);
+    void handleControl(Endpoint& ep);
+    void acceptIncoming();
+    bool handleHello(int sock, const std::vector<uint8_t>& hello);
+    bool sendHello(int sock, Endpoint& ep);
+    int readBytes(int sock, std::vector<uint8_t>& rx, size_t need);
+    bool reserveQp();
+    void createQp(int peer, Endpoint& ep);
+    void markReady(Endpoint& ep);
+    void postNow(Endpoint& ep, const RdmaOp& op);
+    bool quiesce(Endpoint& ep);
+    void teardown(Endpoint& ep);
+
+    RdmaVerbs& rdma_;
+    int rank_;
+    size_t qp_budget_;
+    int listen_fd_{-1};
+    size_t active_qps_{0};
+    uint64_t clock_{0};
+    Stats stats_;
+    std::unordered_map<int, Endpoint> peers_;
+    std::unordered_map<uint32_t, int> qp_to_peer_;
+    std::vector<Incoming> incoming_;
+};
+
+#endif // ENDPOINT_TABLE_HPP
@@ -0,0 +1,94 @@
+#ifndef FLOW_SCHEDULER_HPP
+#define FLOW_SCHEDULER_HPP
+
+#include "hpuverbs.hpp"
+#include <deque>
+#include <vector>
+
+// Sender-side scheduling of writes in traffic classes, one QP per class to
+// the same peer. Classes are numbered in the order they are added and that
+// order is their priority: a class only posts while every higher class has
+// nothing queued. Messages are cut into segments and each class keeps at
+// most max_inflight bytes on the wire, so a latency-critical message waits
+// behind at most that much of a bulk transfer instead of all of it. The
+// last segment of every message carries its immediate and is reported to
+// the peer as an arrival.
+// Both sides add the same classes in the same order (each addClass connects
+// a QP over the connection socket). The scheduler must be the only consumer
+// of the CQ.
+class FlowScheduler {
+public:
+    struct ClassConfig {
+        std::string name;
+        TrafficClass traffic;
+        size_t segment_size{64 * 1024};
+        size_t max_inflight{256 * 1024};
+    };
+
+    struct Event {
+        enum class Kind { Sent, Arrived } kind;
+        int cls;
+        uint64_t id;    // Message id for Sent, immediate for Arrived
+    };
+
+    struct ClassStats {
+        uint64_t messages{0};
+        uint64_t bytes{0};
+    };
+
+    explicit FlowScheduler(RdmaVerbs& rdma);
+    ~FlowScheduler();
+
+    FlowScheduler(const FlowScheduler&) = delete;
+    FlowScheduler& operator=(const FlowScheduler&) = delete;
+
+    // Returns the class number, which is also its priority (0 is highest)
+    int addClass(const ClassConfig& config);
+
+    // Queues a write of length bytes from the local to the remote region;
+    // returns the id its Sent event carries
+    uint64_t write(int cls, uint64_t local_offset, uint64_t remote_offset, size_t length, uint32_t imm);
+
+    // Posts what the priorities allow and reaps completions, non-blocking
+    int poll(Event* events, int max_events);
+
+    // Messages queued or on the wire
+    size_t pending(int cls) const;
+    const ClassStats& stats(int cls) const { return classes_.at(cls).stats; }
+
+private:
+    struct Message {
+        uint64_t id;
+        uint64_t local_offset;
+        uint64_t remote_offset;
+        size_t length;
+        size_t posted;      // Bytes handed to the QP so far
+        uint32_t imm;
+    };
+
+    struct Segment {
+        uint64_t id;
+        uint32_t length;
+        bool last;
+    };
+
+    struct FlowClass {
+        ClassConfig config;
+        struct ibv_qp* qp;
+        CmConData remote;
+        std::deque<Message> queue;
+        std::deque<Segment> inflight;   // RC completes them in order
+        size_t inflight_bytes{0};
+        ClassStats stats;
+    };
+
+    void schedule();
+    void postSegment(int cls);
+    void postRecv(int cls);
+
+    RdmaVerbs& rdma_;
+    std::vector<FlowClass> classes_;
+    uint64_t next_id_{1};
+};
+
+#endif // FLOW_SCHEDULER_HPP
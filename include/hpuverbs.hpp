@@ -3,8 +3,11 @@
 
 #include <unistd.h> 
 #include <cstdint>
+#include <deque>
 #include <string>
+#include <memory>
 #include <optional>
+#include <unordered_map>
 #include <vector>
 #include <iostream>
 #include <stdexcept>
@@ -15,19 +18,86 @@
 #include <sys/socket.h>
 #include <infiniband/verbs.h>
 #include "hlthunk.h"
+#include "paging.hpp"
+#include "path_config.hpp"
+
+class ShmTransport;
+class ProxyClient;
+class WorkloadRecorder;
+class StartupProfile;
 
 constexpr size_t MSG_SIZE = 1024;
 constexpr size_t RDMA_BUFFER_SIZE = 4 * 1024 * 1024; // 4MB default
+constexpr int CQ_DEPTH = 1024;      // Shared by every QP on the context
+constexpr uint32_t QP_DEPTH = 128;  // Send/receive queue depth per QP
+constexpr uint32_t MAX_SGE = 16;    // Upper bound on SGEs per WR, device caps permitting
 
-// Connection information exchanged between client and server
+// Connection information exchanged between client and server. The exchange
+// is a fixed-size read with no version, so both sides must be built with
+// the same layout; a peer from before mtu and rd_atomic were added can't connect.
 struct CmConData {
     uint64_t addr;      // Buffer address
     uint32_t rkey;      // Remote key
     uint32_t qp_num;    // Queue pair number
     uint16_t lid;       // Local ID
     uint8_t gid[16];    // Global ID
+    uint8_t mtu;        // Active MTU (enum ibv_mtu)
+    uint8_t rd_atomic;  // RDMA reads accepted at once
 } __attribute__((packed));
 
+// Work request posted on an arbitrary queue pair
+struct RdmaOp {
+    int opcode{IBV_WR_SEND};
+    size_t offset{0};           // Offset into the local registered buffer
+    uint32_t length{MSG_SIZE};
+    uint64_t remote_addr{0};    // Ignored for IBV_WR_SEND
+    uint32_t rkey{0};
+    uint64_t wr_id{0};
+    uint32_t imm_data{0};       // Network order, used by *_WITH_IMM opcodes
+    bool signaled{true};
+};
+
+// Per-QP quality of service, applied when the QP is brought up
+struct TrafficClass {
+    uint8_t service_level{0};     // IB SL; on RoCE mapped to a PCP priority by the NIC
+    uint8_t dscp{0};              // RoCE v2 IP DSCP (GRH traffic class >> 2)
+    uint32_t rate_limit_kbps{0};  // ibv_modify_qp_rate_limit pacing, 0 for none
+};
+
+// A few registered bytes for control words (flags, credits, counters) that
+// peers hit with atomics or small polled reads and writes. In NIC memory
+// those never cross PCIe to the host; the CPU then can't dereference it and
+// goes through RdmaVerbs::readControl/writeControl.
+struct ControlRegion {
+    struct ibv_mr* mr{nullptr};
+    struct ibv_dm* dm{nullptr};   // Set when the words live in NIC memory
+    uint8_t* host{nullptr};       // Set for the host memory fallback
+    size_t size{0};
+
+    // Work request address of byte 0 (device memory MRs are zero-based)
+    uint64_t addr() const { return dm ? 0 : reinterpret_cast<uintptr_t>(host); }
+    bool onDevice() const { return dm != nullptr; }
+};
+
+// Remote access to [addr, addr + length) of the registered buffer only,
+// through a type-2 memory window bound on one QP. Only that QP's peer can
+// use the rkey, and only until the grant is revoked or the peer invalidates
+// it (IBV_WR_SEND_WITH_INV).
+struct AccessGrant {
+    struct ibv_mw* mw{nullptr};
+    struct ibv_qp* qp{nullptr};
+    uint64_t addr{0};
+    uint32_t rkey{0};
+    size_t length{0};
+};
+
+// Registration of memory several processes map from the same fd
+struct SharedRegistration {
+    struct ibv_mr* mr{nullptr};
+    uint64_t addr{0};    // SGE and remote address of byte 0
+    uint32_t handle{0};  // Registration proxy's MR handle, 0 when registered locally
+};
+
 // HPU (Gaudi) management class
 class HpuManager {
 public:
@@ -36,12 +106,27 @@ public:
 
     // Initialize Gaudi device and allocate DMA-buf or fallback to regular memory
     void initialize(size_t size);
-    
+
+    // Record startup phases into profile (see startInParallel)
+    void setStartupProfile(StartupProfile* profile) { profile_ = profile; }
+
+    // Paging of a host-memory buffer (see Paging), set before initialize;
+    // defaults to HPU_ODP from the environment
+    void setPaging(Paging paging) { paging_ = paging; }
+    Paging getPaging() const { return paging_; }
+
     // Getters for buffer information
     void* getBuffer() const { return buffer_; }
     int getDmabufFd() const { return dmabuf_fd_; }
     uint64_t getDeviceVa() const { return device_va_; }
     size_t getBufferSize() const { return buffer_size_; }
+    uint64_t getHostDeviceVa() const { return host_device_va_; }
+
+    // DMA-buf or host memfd backing the buffer, -1 if it can't be shared
+    int getBufferFd() const { return dmabuf_fd_ >= 0 ? dmabuf_fd_ : host_fd_; }
+
+    // Device memory is not exported, transfers must go through the host buffer
+    bool needsStaging() const { return dmabuf_fd_ < 0 && device_va_ != 0; }
 
 private:
     void cleanup();
@@ -54,12 +139,15 @@ private:
 
     int gaudi_fd_{-1};
     int dmabuf_fd_{-1};
+    int host_fd_{-1};
     uint64_t gaudi_handle_{0};
     uint64_t device_va_{0};
     uint64_t host_device_va_{0};
     void* buffer_{nullptr};
     size_t buffer_size_{0};
     hlthunk_hw_ip_info hw_info_{};
+    StartupProfile* profile_{nullptr};
+    Paging paging_;
 };
 
 // RDMA verbs management class
@@ -71,8 +159,51 @@ public:
     // Initialize RDMA resources
     void initialize(const std::string& ib_dev_name, HpuManager& hpu);
 
-    // Connect queue pair
+    // initialize in two steps: openDevice (device, PD, CQ and main QP)
+    // needs no memory and can run while the HPU buffer is allocated
+    void openDevice(const std::string& ib_dev_name);
+    void registerBuffer(HpuManager& hpu);
+
+    // Record startup phases into profile (see startInParallel)
+    void setStartupProfile(StartupProfile* profile) { profile_ = profile; }
+
+    // Use the extended CQ (hardware completion timestamps) and the
+    // ibv_wr_* builder when the device has them; set before initialize
+    void setExtendedVerbs(bool enable) { extended_verbs_ = enable; }
+    bool hasCompletionTimestamps() const { return cq_ex_ != nullptr; }
+    bool hasWorkRequestBuilder() const { return extended_send_; }
+
+    // Log every posted send to path for replay_bench; HPU_RECORD=<path>
+    // in the environment does the same at initialize
+    void recordWorkload(const std::string& path);
+
+    // Share the device context, PD and registrations of the registration
+    // proxy listening on socket_name (see RegistrationProxy) instead of
+    // opening the device; set before initialize. HPU_REG_PROXY=<name> (1 for
+    // the default name) does the same. Without an answering proxy the device
+    // is opened as usual.
+    void setRegistrationProxy(const std::string& socket_name) { proxy_name_ = socket_name; }
+    bool usesRegistrationProxy() const { return proxy_ != nullptr; }
+
+    // Pin path attributes instead of deriving them from the port and
+    // device (see PathOverrides); set before initialize
+    void setPathOverrides(const PathOverrides& overrides) { path_overrides_ = overrides; }
+    const PathConfig& getPath() const { return path_; }
+
+    // Connect queue pair; a peer on the same host is reached through shared
+    // memory on the main QP unless disabled with setIntraNode(false) first
     void connectQp(const std::string& server_name, int port);
+    void setIntraNode(bool enable) { intra_node_ = enable; }
+    bool isIntraNode() const { return shm_ != nullptr; }
+
+    // Only the TCP connection; connectQp opens it when this wasn't called
+    void openConnection(const std::string& server_name, int port);
+    // Makes a server's openConnection, pending or later, fail instead of
+    // waiting for a client; callable from another thread
+    void cancelConnection();
+
+    // Bring up an extra QP to the already connected peer, returns its remote data
+    CmConData connectQp(struct ibv_qp* qp);
 
     // Post send and receive operations
     void postSend(int opcode);
@@ -81,32 +212,220 @@ public:
     // Poll for completion
     bool pollCompletion();
 
+    // Non-blocking poll of the shared CQ, returns number of completions
+    int pollCompletions(struct ibv_wc* wc, int max_entries);
+
+    // Same, also filling the NIC clock of each completion (0 when unknown)
+    int pollCompletions(struct ibv_wc* wc, uint64_t* timestamps, int max_entries);
+
+    // Current NIC clock, comparable with completion timestamps
+    uint64_t readNicClock() const;
+    double nicNanoseconds(uint64_t start, uint64_t end) const;
+
+    // Additional QPs on the same PD, CQ and MR (one per remote peer)
+    struct ibv_qp* createQp(uint32_t depth = QP_DEPTH, uint32_t max_sge = 1);
+    void bringUpQp(struct ibv_qp* qp, const CmConData& remote);
+    void destroyQp(struct ibv_qp* qp);
+
+    // Set before the QP is connected; QPs without one use SL 0 and DSCP 0
+    void setTrafficClass(struct ibv_qp* qp, const TrafficClass& traffic);
+    void postSend(struct ibv_qp* qp, const RdmaOp& op);
+
+    // Fault recovery without re-registering memory. Once enabled, sends and
+    // receives posted on the QP are journaled until they complete.
+    // recoverQp takes the QP through RESET back to RTS, re-exchanges only QP
+    // metadata and reposts what had not completed; the PD, MR and device
+    // memory are untouched. Only receives and RDMA WRITE/READ are reposted,
+    // since they are harmless if they had already landed; the wr_ids of
+    // other unfinished sends (SEND, WRITE_WITH_IMM, atomics) are returned
+    // for the caller to redo under its own duplicate detection. The peer
+    // recovers its end by calling recoverQp too or by picking the request up
+    // with serviceRecovery.
+    // Requests travel on a recovery connection of their own, opened by the
+    // first enableRecovery on each side (call it at the same point on both)
+    // and re-opened through a listener on the server if it drops. A sock
+    // given instead must carry nothing but recovery requests.
+    void enableRecovery(struct ibv_qp* qp);
+    std::vector<uint64_t> recoverQp(struct ibv_qp* qp, int sock = -1);
+    // Non-blocking; true when a peer's recovery request was found and served.
+    // A peer that closed the connection is taken as gone.
+    bool serviceRecovery(int sock = -1, std::vector<uint64_t>* unreplayed = nullptr);
+
+    // Post pre-built work request chains (caller fills lkeys)
+    void postSend(struct ibv_qp* qp, struct ibv_send_wr* wr);
+    void postReceive(struct ibv_qp* qp, struct ibv_recv_wr* wr);
+
+    // Paging the buffer was registered with: the HPU's choice when the
+    // device supports it, Pinned otherwise. prefetch faults a range in ahead
+    // of use (ibv_advise_mr), returning false if the device refused; it is a
+    // no-op for pinned buffers.
+    Paging getPaging() const { return paging_; }
+    bool prefetch(size_t offset, size_t length, bool for_write = true);
+    // With implicit paging, an lkey for SGEs anywhere in this process's
+    // address space (local access only); 0 otherwise
+    uint32_t getImplicitLkey() const { return implicit_mr_ ? implicit_mr_->lkey : 0; }
+
+    // Extra host memory registered on the same PD (bounce buffers etc.)
+    struct ibv_mr* registerHostMemory(void* addr, size_t size);
+    void deregisterMemory(struct ibv_mr* mr);
+
+    // Memory other processes also map from fd (memfd or DMA-buf), mapped
+    // here at addr. Through a registration proxy it is registered and pinned
+    // once per node, at the first registrant's address; otherwise locally.
+    SharedRegistration registerSharedMemory(int fd, size_t offset, size_t length, void* addr);
+    void deregisterSharedMemory(SharedRegistration& reg);
+
+    // Zeroed control region on the same PD, in NIC memory (ibv_alloc_dm)
+    // when on_device is set and the device has room, host memory otherwise.
+    // Offsets and lengths of readControl/writeControl are multiples of 4.
+    ControlRegion allocateControlRegion(size_t size, bool on_device = true);
+    void freeControlRegion(ControlRegion& region);
+    void readControl(const ControlRegion& region, size_t offset, void* dst, size_t length) const;
+    void writeControl(const ControlRegion& region, size_t offset, const void* src, size_t length);
+
+    // Narrow per-request rkeys through type-2 memory windows, bound and
+    // invalidated by work requests on qp instead of registering an MR. Each
+    // QP pools its own windows, so a rebind always queues behind the
+    // invalidate of the previous grant. Signaled binds and invalidations
+    // complete with the grant's rkey as wr_id. releaseAccess returns a
+    // window the peer has already invalidated. destroyQp frees the QP's
+    // windows, and its outstanding grants are void. Throws if the device
+    // has no type-2 windows or qp does not go through the NIC.
+    bool supportsWindows() const { return windows_; }
+    AccessGrant grantAccess(struct ibv_qp* qp, size_t offset, size_t length,
+                            int access = IBV_ACCESS_REMOTE_WRITE, bool signaled = false);
+    void revokeAccess(AccessGrant& grant, bool signaled = false);
+    void releaseAccess(AccessGrant& grant);
+
+    // Local connection data for a QP, in network byte order
+    CmConData localConnectionData(struct ibv_qp* qp) const;
+
     // Getters for socket and remote properties
     int getSock() const { return sock_; }
+    struct ibv_qp* getQp() const { return qp_; }
+    const CmConData& getRemoteProps() const { return remote_props_; }
+    uint64_t getLocalAddr() const { return local_addr_; }
+    // CPU mapping of the registered region, nullptr when it is device memory
+    uint8_t* getHostBuffer() const { return host_buffer_; }
+    uint32_t getLkey() const { return mr_->lkey; }
+    uint32_t getRkey() const { return mr_->rkey; }
+    size_t getRegionSize() const { return region_size_; }
+    const struct ibv_device_attr& getDeviceAttr() const { return device_attr_; }
+    uint32_t getMaxSge() const { return max_sge_; }
 
 private:
     void cleanup();
     bool initializeDevice(const std::string& ib_dev_name);
-    bool setupResources(HpuManager& hpu);
+    bool setupDeviceResources();
+    bool registerMemory(HpuManager& hpu);
+    bool registerOnDemand(HpuManager& hpu, int mr_flags);
+    bool allocateDeviceControl(ControlRegion& region, int mr_flags);
+    bool openThroughProxy();
+    bool registerThroughProxy(HpuManager& hpu, int mr_flags);
+    bool createExtendedCq();
+    struct ibv_qp* createRcQp(struct ibv_qp_init_attr& attr);
+    bool postBuilt(struct ibv_qp* qp, const RdmaOp& op);
+    int pollExtended(struct ibv_wc* wc, uint64_t* timestamps, int max_entries);
     bool setupSocket(const std::string& server_name, int port);
     bool exchangeConnectionData();
-    bool modifyQpToInit();
-    bool modifyQpToRtr();
-    bool modifyQpToRts();
+    bool setupIntraNode(bool listener);
+    bool modifyQpToInit(struct ibv_qp* qp);
+    bool modifyQpToRtr(struct ibv_qp* qp, const CmConData& remote);
+    bool modifyQpToRts(struct ibv_qp* qp, const CmConData& remote);
+    bool applyRateLimit(struct ibv_qp* qp, uint32_t rate_limit_kbps);
+    struct ibv_send_wr buildSendWr(const RdmaOp& op, struct ibv_sge* sge) const;
+    int pollDevice(struct ibv_wc* wc, uint64_t* timestamps, int max_entries);
+
+    struct SendRecord {
+        struct ibv_send_wr wr;
+        std::vector<struct ibv_sge> sge;
+        bool signaled;
+    };
+    struct RecvRecord {
+        struct ibv_recv_wr wr;
+        std::vector<struct ibv_sge> sge;
+    };
+    // Posted but not yet completed, oldest first (RC completes in order)
+    struct QpJournal {
+        std::deque<SendRecord> sends;
+        std::deque<RecvRecord> recvs;
+    };
+    struct QpPeer {
+        struct ibv_qp* qp;
+        uint32_t remote_qp_num;
+    };
+    struct WindowState {
+        uint32_t qp_num;  // A window is only ever bound on the QP that first bound it
+        uint32_t rkey;    // Last key issued; mw->rkey lags while a bind is in flight
+        bool bound;
+    };
+
+    void journalSend(struct ibv_qp* qp, const struct ibv_send_wr* wr);
+    void journalRecv(struct ibv_qp* qp, const struct ibv_recv_wr* wr);
+    void retireJournal(const struct ibv_wc* wc, int count);
+    void drainFailedQp(struct ibv_qp* qp);
+    std::vector<uint64_t> recover(struct ibv_qp* qp, int sock, const CmConData* peer_request);
+    void openRecoveryChannel();
+    bool reopenRecoveryChannel();
 
     struct ibv_context* ib_ctx_{nullptr};
     struct ibv_pd* pd_{nullptr};
     struct ibv_mr* mr_{nullptr};
+    struct ibv_mr* implicit_mr_{nullptr};  // Whole address space, local access, implicit paging only
+    std::unordered_map<uint32_t, struct ibv_mr*> host_mrs_;  // Other CPU-addressed MRs by lkey, for shm_
     struct ibv_cq* cq_{nullptr};
+    struct ibv_cq_ex* cq_ex_{nullptr};  // Same CQ, set when timestamps are on
     struct ibv_qp* qp_{nullptr};
     struct ibv_port_attr port_attr_{};
+    struct ibv_device_attr device_attr_{};
+    uint32_t max_sge_{1};
     CmConData remote_props_{};
     int sock_{-1};
+    int cancel_fd_{-1};             // eventfd, readable once cancelConnection was called
     HpuManager* hpu_{nullptr};
+    uint64_t local_addr_{0};        // SGE address of the registered buffer
+    uint8_t* host_buffer_{nullptr};
+    bool intra_node_{true};
+    bool extended_verbs_{true};
+    bool extended_send_{false};
+    uint64_t core_clock_khz_{0};
+    uint64_t timestamp_mask_{0};
+    std::unique_ptr<ShmTransport> shm_;
+    std::unique_ptr<WorkloadRecorder> recorder_;
+    std::unordered_map<uint32_t, TrafficClass> traffic_classes_;  // By QP number
+    PathOverrides path_overrides_;
+    PathConfig path_;
+    std::string server_name_;
+    int port_{0};
+    std::unordered_map<uint32_t, QpPeer> peers_;        // By local QP number
+    std::unordered_map<uint32_t, QpJournal> journals_;  // QPs with recovery enabled
+    int recovery_sock_{-1};
+    int recovery_listen_fd_{-1};  // Server only, for the client to re-open recovery_sock_
+    int recovery_port_{0};        // Client only, the server's recovery listener
+    std::vector<struct ibv_wc> deferred_;   // Other QPs' completions polled while draining a failed one
+    StartupProfile* profile_{nullptr};
+    Paging paging_{Paging::Pinned};
+    size_t region_size_{0};
+    bool windows_{false};  // Type-2 windows bindable on mr_
+    std::unordered_map<struct ibv_mw*, WindowState> window_states_;
+    std::unordered_map<uint32_t, std::vector<struct ibv_mw*>> free_windows_;  // By QP number, unbound
+    std::string proxy_name_;
+    std::unique_ptr<ProxyClient> proxy_;  // Set when ib_ctx_ and pd_ are the proxy's
+    uint32_t proxy_pd_handle_{0};
+    uint32_t proxy_mr_handle_{0};         // Set when mr_ is the proxy's
 };
 
 // Helper functions
 inline uint64_t htonll(uint64_t val) { return htobe64(val); }
 inline uint64_t ntohll(uint64_t val) { return be64toh(val); }
 
+inline CmConData connectionDataToHost(const CmConData& net) {
+    CmConData host = net;
+    host.addr = ntohll(net.addr);
+    host.rkey = ntohl(net.rkey);
+    host.qp_num = ntohl(net.qp_num);
+    host.lid = ntohs(net.lid);
+    return host;
+}
+
 #endif // RDMA_DMABUF_COMMON_HPP
\ No newline at end of file
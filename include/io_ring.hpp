@@ -0,0 +1,71 @@
+#ifndef IO_RING_HPP
+#define IO_RING_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <linux/io_uring.h>
+
+// Asynchronous file reads and writes through io_uring, driven by the raw
+// system calls so there is no liburing dependency. Requests are queued
+// without a system call and submitted together by the next poll(). When the
+// kernel has no io_uring (or it is blocked) every request runs synchronously
+// with pread/pwrite and completes at the next poll().
+class IoRing {
+public:
+    struct Completion {
+        uint64_t tag;
+        int result;     // Bytes transferred, or -errno
+    };
+
+    explicit IoRing(uint32_t entries);
+    ~IoRing();
+
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+
+    bool usesUring() const { return ring_fd_ >= 0; }
+
+    // Pins one buffer with the kernel so I/O inside it skips per-request
+    // page pinning (READ_FIXED/WRITE_FIXED); false when the kernel refuses
+    bool registerBuffer(void* addr, size_t length);
+
+    void read(int fd, void* buf, uint32_t length, uint64_t offset, uint64_t tag);
+    void write(int fd, const void* buf, uint32_t length, uint64_t offset, uint64_t tag);
+
+    // Submits what is queued and returns finished requests without blocking
+    int poll(Completion* completions, int max_completions);
+
+    uint32_t inFlight() const { return in_flight_; }
+
+private:
+    bool setup(uint32_t entries);
+    void queue(uint8_t opcode, int fd, void* buf, uint32_t length, uint64_t offset, uint64_t tag);
+    void unmap();
+
+    int ring_fd_{-1};
+    uint32_t entries_{0};
+    uint32_t in_flight_{0};
+    uint32_t unsubmitted_{0};
+
+    void* sq_ring_{nullptr};
+    void* cq_ring_{nullptr};
+    size_t sq_ring_size_{0};
+    size_t cq_ring_size_{0};
+    struct io_uring_sqe* sqes_{nullptr};
+
+    uint32_t* sq_tail_{nullptr};
+    uint32_t sq_mask_{0};
+    uint32_t* sq_array_{nullptr};
+    uint32_t* cq_head_{nullptr};
+    uint32_t* cq_tail_{nullptr};
+    uint32_t cq_mask_{0};
+    struct io_uring_cqe* cqes_{nullptr};
+
+    uint8_t* fixed_base_{nullptr};
+    size_t fixed_length_{0};
+
+    std::deque<Completion> done_;   // Synchronous fallback
+};
+
+#endif // IO_RING_HPP
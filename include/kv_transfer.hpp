@@ -0,0 +1,87 @@
+#ifndef KV_TRANSFER_HPP
+#define KV_TRANSFER_HPP
+
+#include "hpuverbs.hpp"
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Paged KV-cache block mover.
+// Both pools are arrays of fixed-size blocks: block i of the local pool is
+// at offset i * block_size in the RdmaVerbs registered buffer, block j of a
+// peer's pool at remote.addr + j * block_size. A request is a list of
+// (src block, dst block) pairs. Pairs with consecutive destinations become
+// one RDMA write whose source blocks are gathered with an SGE list
+// (consecutive sources share one SGE). Writes are pipelined per peer up to
+// `depth` in flight; only the last write of a request is always signaled.
+// The service must be the only consumer of the RdmaVerbs CQ while in use.
+class KvBlockTransfer {
+public:
+    using BlockPair = std::pair<uint32_t, uint32_t>;
+
+    struct Stats {
+        uint64_t requests{0};
+        uint64_t blocks{0};
+        uint64_t bytes{0};
+        uint64_t writes{0};
+        uint64_t sges{0};
+    };
+
+    KvBlockTransfer(RdmaVerbs& rdma, size_t block_size, uint32_t depth = 32);
+
+    // QP must be connected and created with at least sgeLimit() SGEs;
+    // remote_size is the byte size of the peer's pool at remote.addr
+    void addPeer(int peer, struct ibv_qp* qp, const CmConData& remote, uint64_t remote_size);
+
+    // Queue a block list for a peer; returns a request handle
+    uint64_t submit(int peer, std::vector<BlockPair> blocks);
+
+    bool test(uint64_t req);
+    void wait(uint64_t req);
+
+    // Post queued writes and reap completions, returns completions handled
+    int progress();
+
+    // SGEs per write this service uses on the given device
+    static uint32_t sgeLimit(const RdmaVerbs& rdma);
+
+    uint32_t maxSge() const { return max_sge_; }
+    size_t blockSize() const { return block_size_; }
+    const Stats& stats() const { return stats_; }
+
+private:
+    struct Write {
+        uint64_t remote_addr;
+        std::vector<struct ibv_sge> sges;
+        uint64_t request;
+        bool last;
+    };
+
+    struct Peer {
+        struct ibv_qp* qp;
+        CmConData remote;
+        uint64_t remote_blocks;
+        std::deque<Write> queue;
+        uint64_t posted{0};     // Writes posted so far
+        uint64_t completed{0};  // Writes known complete
+        uint64_t since_signal{0};
+        std::unordered_map<uint64_t, uint64_t> last_write;  // seq -> request
+    };
+
+    void buildWrites(Peer& peer, uint64_t request, std::vector<BlockPair>& blocks);
+    void postWrites(size_t index);
+
+    RdmaVerbs& rdma_;
+    size_t block_size_;
+    uint32_t depth_;
+    uint32_t max_sge_;
+    Stats stats_;
+    uint64_t next_req_{1};
+    std::vector<std::unique_ptr<Peer>> peers_;
+    std::unordered_map<int, size_t> rank_to_peer_;
+    std::unordered_map<uint64_t, bool> requests_;
+};
+
+#endif // KV_TRANSFER_HPP
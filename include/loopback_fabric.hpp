@@ -0,0 +1,62 @@
+#ifndef LOOPBACK_FABRIC_HPP
+#define LOOPBACK_FABRIC_HPP
+
+#include "collectives.hpp"
+#include "paging.hpp"
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class LoopbackNetwork;
+
+// One simulated rank: writes are memcpy into the target rank's buffer and
+// events are queued to both sides under a per-rank lock. The buffer is
+// populated up front when pinned and faulted in as touched otherwise, to
+// mirror the NIC's paging modes.
+class LoopbackFabric : public CollectiveFabric {
+public:
+    LoopbackFabric(LoopbackNetwork& network, int rank, size_t buffer_size, Paging paging = Paging::Pinned);
+    ~LoopbackFabric() override;
+
+    LoopbackFabric(const LoopbackFabric&) = delete;
+    LoopbackFabric& operator=(const LoopbackFabric&) = delete;
+
+    int rank() const override { return rank_; }
+    int size() const override;
+    size_t bufferSize() const override { return buffer_size_; }
+    uint8_t* buffer() { return buffer_; }
+
+    // Counterparts of RdmaVerbs::prefetch and a residency probe
+    void prefetch(size_t offset, size_t length);
+    size_t residentBytes() const;
+
+    void write(int peer, uint64_t local_offset, uint64_t remote_offset, uint32_t length, uint32_t imm) override;
+    int poll(Event* events, int max_events) override;
+    void copy(uint64_t dst_offset, uint64_t src_offset, size_t length) override;
+
+private:
+    void push(const Event& event);
+
+    LoopbackNetwork& network_;
+    int rank_;
+    size_t buffer_size_;
+    Paging paging_;
+    uint8_t* buffer_{nullptr};
+    std::mutex mutex_;
+    std::deque<Event> events_;
+};
+
+// N ranks in one process, each normally driven by its own thread
+class LoopbackNetwork {
+public:
+    LoopbackNetwork(int ranks, size_t buffer_size, Paging paging = Paging::Pinned);
+
+    int size() const { return static_cast<int>(ranks_.size()); }
+    LoopbackFabric& rank(int r) { return *ranks_.at(r); }
+
+private:
+    std::vector<std::unique_ptr<LoopbackFabric>> ranks_;
+};
+
+#endif // LOOPBACK_FABRIC_HPP
@@ -0,0 +1,136 @@
+#ifndef MESSAGE_LAYER_HPP
+#define MESSAGE_LAYER_HPP
+
+#include "hpuverbs.hpp"
+#include "tag_matcher.hpp"
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// Tagged two-sided messages over connected RC QPs, one per peer.
+// Payloads up to the eager threshold are copied through pre-posted host
+// bounce buffers. Larger ones use a rendezvous: the receiver answers the
+// sender's RTS with its buffer descriptor and the payload moves with one
+// RDMA write (with immediate) straight into the posted receive buffer.
+// Receives match on (source, tag) with ANY_SOURCE/ANY_TAG wildcards.
+// The layer must be the only consumer of the RdmaVerbs CQ while in use.
+class MessageLayer {
+public:
+    static constexpr size_t SLOT_SIZE = 8192;
+    static constexpr int RECV_SLOTS = 64;
+    static constexpr int SEND_SLOTS = 64;
+
+    struct Status {
+        int source;
+        uint64_t tag;
+        size_t length;
+        bool truncated;  // Message was longer than the receive; length is what was kept
+    };
+
+    // Side a peer plays in the threshold probe, if any
+    enum class Tune { None, Initiator, Responder };
+
+    MessageLayer(RdmaVerbs& rdma, HpuManager& hpu);
+    ~MessageLayer();
+
+    // Single peer (rank 0) on an already connected QP
+    MessageLayer(RdmaVerbs& rdma, HpuManager& hpu, struct ibv_qp* qp, Tune tune = Tune::None);
+
+    // Attach a connected QP to a peer; pre-posts its bounce buffers. With
+    // tune set, runs tuneThreshold with the peer before returning, so the
+    // peer has to attach this side with the opposite role.
+    void addPeer(int rank, struct ibv_qp* qp, Tune tune = Tune::None);
+
+    // Non-blocking send/receive of [offset, offset + length) in the registered buffer
+    uint64_t isend(int peer, size_t offset, size_t length, uint64_t tag = 0);
+    uint64_t irecv(int source, uint64_t tag, size_t offset, size_t capacity);
+
+    // Completion of a request; status reports the matched source, tag and size
+    bool test(uint64_t req, Status* status = nullptr);
+    Status wait(uint64_t req);
+
+    // Process completions and queued messages, returns completions handled
+    int progress();
+
+    // Ping-pong probe run by both sides of a peer pair, picks the
+    // eager/rendezvous crossover. Clobbers the start of the registered buffer.
+    size_t tuneThreshold(int peer, bool initiator);
+
+    size_t eagerThreshold() const { return eager_threshold_; }
+    void setEagerThreshold(size_t bytes);
+    size_t maxEagerSize() const;
+    const TagMatcher& matcher() const { return matcher_; }
+
+private:
+    struct Request {
+        size_t offset;
+        size_t length;
+        int source;
+        uint64_t tag;
+        bool done{false};
+        bool truncated{false};
+    };
+
+    struct Unexpected {
+        uint8_t type;
+        size_t peer;
+        uint32_t sreq;
+        uint64_t length;
+        std::vector<uint8_t> data;
+    };
+
+    struct Outgoing {
+        uint8_t type;
+        uint32_t sreq;
+        uint32_t rreq;
+        uint64_t tag;
+        uint64_t length;
+        uint64_t addr;
+        uint32_t rkey;
+    };
+
+    struct Peer {
+        int rank;
+        struct ibv_qp* qp;
+        uint8_t* slab{nullptr};
+        struct ibv_mr* slab_mr{nullptr};
+        std::vector<int> free_send_slots;
+        int credits{RECV_SLOTS};
+        int returned{0};
+        bool credit_queued{false};
+        bool hello{false};
+        bool mapped{false};
+        bool tune_received{false};
+        uint64_t tune{0};
+        std::deque<Outgoing> control_queue;
+        std::deque<Outgoing> data_queue;
+    };
+
+    uint32_t newRequest(size_t offset, size_t length, int source, uint64_t tag);
+    size_t peerIndex(int rank) const;
+    bool canEager(const Peer& peer, size_t length) const;
+    void postRecvSlot(size_t peer, int slot);
+    void handleRecv(size_t peer, int slot, const struct ibv_wc& wc);
+    void matchEager(uint32_t rreq, const uint8_t* data, uint64_t length);
+    void queueCts(size_t peer, uint32_t rreq, uint32_t sreq, uint64_t length);
+    bool trySend(size_t peer, const Outgoing& msg, int min_credits);
+    bool tryWrite(size_t peer, const Outgoing& msg);
+    void flushQueues(size_t peer);
+    uint8_t* slotAddr(const Peer& peer, int slot) const;
+
+    RdmaVerbs& rdma_;
+    HpuManager& hpu_;
+    size_t eager_threshold_;
+
+    std::vector<std::unique_ptr<Peer>> peers_;
+    std::unordered_map<int, size_t> rank_to_peer_;
+
+    TagMatcher matcher_;
+    uint32_t next_req_{1};
+    uint64_t next_unexpected_{0};
+    std::unordered_map<uint32_t, Request> requests_;
+    std::unordered_map<uint64_t, Unexpected> unexpected_;
+};
+
+#endif // MESSAGE_LAYER_HPP
@@ -0,0 +1,24 @@
+#ifndef PAGING_HPP
+#define PAGING_HPP
+
+#include <cstddef>
+
+// How a host buffer gets its physical pages. Pinned faults every page in
+// and registers (pins) the whole buffer up front. OnDemand registers it
+// with IBV_ACCESS_ON_DEMAND so pages are only faulted in as the NIC or CPU
+// touches them (or on prefetch); Implicit also registers the whole address
+// space once with an implicit ODP MR, for local access only. The peer still
+// reaches just the buffer. Devices without ODP fall back to Pinned.
+// HPU_ODP=1 (or "implicit") in the environment selects the mode.
+enum class Paging { Pinned, OnDemand, Implicit };
+
+Paging pagingFromEnvironment();
+const char* pagingName(Paging paging);
+
+// Faults [addr, addr + length) in for writing, one thread per 64 MB slab
+void populatePages(void* addr, size_t length);
+
+// Bytes of [addr, addr + length) currently backed by physical memory
+size_t residentBytes(const void* addr, size_t length);
+
+#endif // PAGING_HPP
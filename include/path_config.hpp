@@ -0,0 +1,55 @@
+#ifndef PATH_CONFIG_HPP
+#define PATH_CONFIG_HPP
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <infiniband/verbs.h>
+
+// Path attributes every QP is brought up with. resolvePath derives them from
+// the port and device: the active MTU, the RoCE v2 GID of the preferred
+// address family, the host's default TTL as hop limit on RoCE, and the
+// device's full RDMA read depth. The MTU and read depth actually used on a
+// connection are the lower of both sides' (they travel in CmConData).
+struct PathConfig {
+    enum ibv_mtu mtu{IBV_MTU_1024};
+    int gid_index{-1};              // -1 when no GRH is needed (InfiniBand, one subnet)
+    uint32_t gid_type{IBV_GID_TYPE_IB};
+    bool ipv4{false};               // GID is an IPv4-mapped address
+    uint8_t hop_limit{1};
+    uint8_t max_rd_atomic{1};       // RDMA reads/atomics this side keeps outstanding
+    uint8_t max_dest_rd_atomic{1};  // ... and accepts from the peer
+    uint8_t timeout{14};            // Local ACK timeout, 4.096 us * 2^timeout
+    uint8_t retry_cnt{7};
+    uint8_t rnr_retry{7};
+    uint8_t min_rnr_timer{12};
+};
+
+// Pins any of the resolved attributes. Fields left unset are taken from
+// the environment when present: HPU_MTU (256..4096 bytes), HPU_GID_INDEX,
+// HPU_GID_IPV6=1, HPU_HOP_LIMIT, HPU_RD_ATOMIC and HPU_QP_TIMEOUT.
+struct PathOverrides {
+    std::optional<enum ibv_mtu> mtu;
+    std::optional<int> gid_index;
+    bool prefer_ipv6{false};
+    std::optional<uint8_t> hop_limit;
+    std::optional<uint8_t> rd_atomic;
+    std::optional<uint8_t> timeout;
+
+    PathOverrides withEnvironment() const;
+};
+
+PathConfig resolvePath(struct ibv_context* ctx, uint8_t port_num, const struct ibv_port_attr& port_attr,
+                       const struct ibv_device_attr& device_attr, const PathOverrides& overrides);
+
+// RoCE v2 GID of the preferred family, else any RoCE v2 GID, else index 0
+int selectGid(struct ibv_context* ctx, uint8_t port_num, const struct ibv_port_attr& port_attr,
+              bool prefer_ipv6, uint32_t* gid_type = nullptr, bool* ipv4 = nullptr);
+
+// 256..4096 bytes to the verbs enum; nullopt for anything else
+std::optional<enum ibv_mtu> mtuFromBytes(int bytes);
+int mtuBytes(enum ibv_mtu mtu);
+
+std::string describePath(const PathConfig& path);
+
+#endif // PATH_CONFIG_HPP
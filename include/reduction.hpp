@@ -0,0 +1,51 @@
+#ifndef REDUCTION_HPP
+#define REDUCTION_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+enum class DataType { Float32, BFloat16, Float16, Int32 };
+enum class ReduceOp { Sum, Max, Min };
+
+// Widest kernel set the CPU supports, picked at runtime
+enum class SimdLevel { Scalar, Avx2, Avx512 };
+
+size_t dataTypeSize(DataType type);
+SimdLevel detectSimdLevel();
+const char* simdLevelName(SimdLevel level);
+
+// dst[i] = op(dst[i], src[i]) for count elements.
+// Half precision types are widened to fp32, combined and rounded back to
+// nearest even, so every level gives bit-identical results (NaN payloads aside).
+void reduceBuffer(void* dst, const void* src, size_t count, DataType type, ReduceOp op,
+                  SimdLevel level = detectSimdLevel());
+
+// Reduction step of a collective: dst = op(dst, src) over a byte range of
+// the registered buffer. Offsets rather than pointers so an implementation
+// can run where the buffer lives (host mapping or device VA).
+class Reducer {
+public:
+    virtual ~Reducer() = default;
+    virtual void reduce(uint64_t dst_offset, uint64_t src_offset, size_t bytes) = 0;
+
+    // Fold several sources into dst; defaults to one pass per source
+    virtual void reduce(uint64_t dst_offset, const uint64_t* src_offsets, size_t sources, size_t bytes);
+};
+
+// Reduces on the CPU through the buffer's host mapping. Multi-source
+// reductions walk dst in L1-sized blocks so it stays cached across sources.
+class HostReducer : public Reducer {
+public:
+    HostReducer(uint8_t* base, DataType type, ReduceOp op, SimdLevel level = detectSimdLevel());
+
+    void reduce(uint64_t dst_offset, uint64_t src_offset, size_t bytes) override;
+    void reduce(uint64_t dst_offset, const uint64_t* src_offsets, size_t sources, size_t bytes) override;
+
+private:
+    uint8_t* base_;
+    DataType type_;
+    ReduceOp op_;
+    SimdLevel level_;
+};
+
+#endif // REDUCTION_HPP
@@ -0,0 +1,100 @@
+#ifndef REGISTRATION_PROXY_HPP
+#define REGISTRATION_PROXY_HPP
+
+#include <infiniband/verbs.h>
+#include <map>
+#include <optional>
+#include <string>
+#include <sys/types.h>
+#include <tuple>
+#include <vector>
+
+// Abstract Unix socket name both sides default to
+constexpr const char* DEFAULT_PROXY_SOCKET = "gaudi-verbs-reg-proxy";
+
+// Node-local daemon owning one device context, one PD and every memory
+// registration of the worker processes on the node. Workers import the
+// context and PD (ibv_import_device/ibv_import_pd), so all their CQs and
+// QPs share one NIC context, and send the fds of their buffers (DMA-buf or
+// memfd) to be registered here. A buffer several workers map from the same
+// file is registered and pinned once; its MR is reference counted and
+// dropped with its last user, including workers that exit without saying so.
+// Everything else a worker creates through the imported context (CQs, QPs,
+// host MRs such as MessageLayer slabs from registerHostMemory) belongs to
+// the daemon's device file: if the worker crashes it stays allocated and
+// pinned until the daemon exits.
+// Only workers running as the daemon's user (or root), or with group as
+// their effective group, may connect.
+class RegistrationProxy {
+public:
+    RegistrationProxy(const std::string& ib_dev_name, const std::string& socket_name = DEFAULT_PROXY_SOCKET,
+                      std::optional<gid_t> group = std::nullopt);
+    ~RegistrationProxy();
+
+    RegistrationProxy(const RegistrationProxy&) = delete;
+    RegistrationProxy& operator=(const RegistrationProxy&) = delete;
+
+    // Serves workers until the process is killed
+    void run();
+
+private:
+    struct Registration {
+        struct ibv_mr* mr;
+        void* map;      // Daemon's mapping of a memfd, nullptr for DMA-bufs
+        size_t length;
+        uint64_t iova;
+        int users;
+    };
+    // Same file, same range, same rights
+    using Key = std::tuple<dev_t, ino_t, uint64_t, uint64_t, int>;
+
+    bool trusted(int client) const;
+    bool serve(int client);
+    bool registerBuffer(int client, int fd, uint64_t offset, uint64_t length, uint64_t iova, int access,
+                        uint32_t& handle);
+    bool release(int client, uint32_t handle);
+    void dropReference(uint32_t handle);
+    void disconnect(int client);
+    void report(const char* event) const;
+    void cleanup();
+
+    struct ibv_context* ctx_{nullptr};
+    struct ibv_pd* pd_{nullptr};
+    int listen_fd_{-1};
+    std::optional<gid_t> group_;                    // Also admitted besides the daemon's user
+    std::map<Key, Registration> registrations_;
+    std::map<uint32_t, Key> by_handle_;             // MR handle to its registration
+    std::map<int, std::vector<uint32_t>> clients_;  // Socket to the handles it holds
+    size_t requested_bytes_{0};                     // What separate registrations would have taken
+};
+
+// What a worker gets back for one buffer
+struct ProxyRegistration {
+    uint32_t handle{0};
+    uint32_t lkey{0};
+    uint32_t rkey{0};
+    uint64_t iova{0};  // SGE and remote address of byte 0 (the first registrant's)
+};
+
+// Worker side of the daemon's socket
+class ProxyClient {
+public:
+    explicit ProxyClient(const std::string& socket_name = DEFAULT_PROXY_SOCKET);
+    ~ProxyClient();
+
+    ProxyClient(const ProxyClient&) = delete;
+    ProxyClient& operator=(const ProxyClient&) = delete;
+
+    // The daemon's device context and PD, imported into this process
+    struct ibv_context* importDevice(uint32_t& pd_handle);
+
+    // Registers [offset, offset + length) of the file behind fd, at iova if
+    // no other worker registered it first; import the MR with ibv_import_mr
+    ProxyRegistration registerFd(int fd, uint64_t offset, uint64_t length, uint64_t iova, int access);
+    bool release(uint32_t handle);
+
+private:
+    int sock_{-1};
+};
+
+#endif // REGISTRATION_PROXY_HPP
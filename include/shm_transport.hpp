@@ -0,0 +1,106 @@
+#ifndef SHM_TRANSPORT_HPP
+#define SHM_TRANSPORT_HPP
+
+#include "hpuverbs.hpp"
+#include <atomic>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+constexpr uint32_t SHM_RING_SLOTS = 64;
+constexpr uint32_t SHM_INLINE_MAX = 8192;   // Largest SEND payload carried by the ring
+
+// Local registered buffer as seen by the shared-memory transport
+struct ShmRegion {
+    int fd{-1};             // DMA-buf or memfd backing the buffer
+    void* base{nullptr};    // CPU mapping
+    uint64_t addr{0};       // Address used in SGEs (RdmaVerbs::getLocalAddr)
+    size_t size{0};
+    uint32_t lkey{0};       // SGEs with another lkey are looked up in the host MRs
+};
+
+// Peer on the same host reached through shared mappings instead of the NIC.
+// Both buffers are exchanged as file descriptors over a Unix socket
+// (SCM_RIGHTS) and mapped into each other's address space. RDMA writes and
+// reads become memcpy; SENDs and immediates travel through a single-producer
+// ring in a memfd owned by the receiver. Work requests and completions keep
+// their verbs form so callers of RdmaVerbs do not see the difference, as
+// long as local SGEs are in the registered buffer or a host MR RdmaVerbs
+// registered (registerHostMemory, host control regions, the implicit ODP
+// MR). SGEs in NIC memory or proxy-imported MRs, and remote addresses
+// outside the peer's buffer, complete with an error and are logged.
+class ShmTransport {
+public:
+    ShmTransport() = default;
+    ~ShmTransport();
+
+    ShmTransport(const ShmTransport&) = delete;
+    ShmTransport& operator=(const ShmTransport&) = delete;
+
+    // Run by both sides over the connected TCP socket. Returns false (on both
+    // sides) when the peer is on another host or either buffer can't be shared.
+    bool connect(int sock, bool listener, bool enabled, const ShmRegion& local, uint64_t remote_addr);
+
+    // Completions carry qp_num; SGEs of host_mrs resolve to their CPU addresses
+    void setMainQp(uint32_t qp_num, const std::unordered_map<uint32_t, struct ibv_mr*>* host_mrs);
+
+    void postSend(struct ibv_send_wr* wr, bool signal_all);
+    void postReceive(struct ibv_recv_wr* wr);
+    int pollCompletions(struct ibv_wc* wc, int max_entries);
+
+private:
+    struct Slot {
+        uint32_t opcode;
+        uint32_t imm_data;
+        uint32_t length;
+        uint32_t pad;
+        uint8_t data[SHM_INLINE_MAX];
+    };
+
+    struct Ring {
+        alignas(64) std::atomic<uint64_t> head;  // Advanced by the producer
+        alignas(64) std::atomic<uint64_t> tail;  // Advanced by the consumer
+        Slot slots[SHM_RING_SLOTS];
+    };
+
+    struct PendingSend {
+        struct ibv_send_wr wr;
+        std::vector<struct ibv_sge> sges;
+    };
+
+    struct PendingRecv {
+        uint64_t wr_id;
+        std::vector<struct ibv_sge> sges;
+    };
+
+    bool createRing();
+    bool openUnixChannel(int sock, bool listener, int& channel);
+    bool exchangeFds(int channel);
+    bool execute(const PendingSend& send);
+    void flushSends();
+    void receive();
+    uint8_t* localPtr(uint32_t lkey, uint64_t addr, uint64_t length) const;
+    uint8_t* remotePtr(uint64_t addr, uint64_t length) const;
+    void reportUnreachable(const char* what, uint32_t key, uint64_t addr);
+    void complete(uint64_t wr_id, enum ibv_wc_opcode opcode, enum ibv_wc_status status, uint32_t byte_len,
+                  uint32_t imm_data = 0, bool with_imm = false);
+    void unmap();
+
+    ShmRegion local_;
+    uint32_t qp_num_{0};
+    const std::unordered_map<uint32_t, struct ibv_mr*>* host_mrs_{nullptr};
+    bool reported_{false};
+    uint64_t remote_addr_{0};
+    uint8_t* remote_base_{nullptr};
+    size_t remote_size_{0};
+
+    int inbound_fd_{-1};
+    Ring* inbound_{nullptr};   // Peer produces, we consume
+    Ring* outbound_{nullptr};  // We produce into the peer's ring
+
+    std::deque<PendingSend> pending_;
+    std::deque<PendingRecv> recvs_;
+    std::deque<struct ibv_wc> completions_;
+};
+
+#endif // SHM_TRANSPORT_HPP
@@ -0,0 +1,76 @@
+#ifndef STAGING_PIPELINE_HPP
+#define STAGING_PIPELINE_HPP
+
+#include "codec.hpp"
+#include "copy_engine.hpp"
+#include "hpuverbs.hpp"
+
+// Moves device memory over RDMA through the registered host buffer when the
+// device allocation could not be exported as a DMA-buf.
+// The first depth * chunk_size bytes of the registered buffer on both sides
+// are used as staging slots. The sender copies chunk i+1 device-to-host
+// while chunk i is on the wire; the receiver copies host-to-device and
+// returns a credit per chunk so the sender knows the remote slot is free.
+// One direction at a time per pipeline, and the pipeline must be the only
+// consumer of the CQ while a transfer runs.
+// With a codec both sides add depth encoded slots after the staging slots.
+// The sender encodes chunk i+1 on the codec pool while chunk i is on the
+// wire, and the receiver decodes before the host-to-device copy. Both
+// sides must enable the same codec.
+class StagingPipeline {
+public:
+    struct Stats {
+        uint64_t chunks{0};
+        uint64_t bytes{0};
+        uint64_t wire_bytes{0};     // Bytes written to the peer, headers included
+        double seconds{0.0};
+        double codec_seconds{0.0};  // CPU time spent encoding or decoding
+    };
+
+    // staging_engine_addr is the staging buffer as the copy engine sees it,
+    // e.g. HpuManager::getHostDeviceVa() for a Gaudi DMA engine
+    StagingPipeline(RdmaVerbs& rdma, CopyEngine& engine, struct ibv_qp* qp, const CmConData& remote,
+                    uint64_t staging_engine_addr, size_t chunk_size, uint32_t depth = 2);
+
+    // Needs depth * (2 * chunk_size + 8) bytes of registered buffer.
+    // The codec must outlive the pipeline.
+    void enableCodec(Codec& codec, uint32_t threads = 2);
+
+    // Blocking; returns once the receiver has the data in device memory.
+    // tensor_id keys a lossy codec's error feedback (see Codec::begin).
+    Stats send(uint64_t device_src, size_t length, uint64_t tensor_id = 0);
+
+    // Blocking counterpart of send
+    Stats receive(uint64_t device_dst, size_t length);
+
+private:
+    // Leads every encoded chunk; encoded_length == raw_length means stored as is
+    struct ChunkHeader {
+        uint32_t raw_length;
+        uint32_t encoded_length;
+    };
+
+    uint64_t chunkLength(uint64_t index, size_t length) const;
+    uint64_t slotOffset(uint64_t index) const { return (index % depth_) * chunk_size_; }
+    uint64_t encodedSlotOffset(uint64_t index) const {
+        return depth_ * chunk_size_ + (index % depth_) * (sizeof(ChunkHeader) + chunk_size_);
+    }
+    uint8_t* hostSlot(uint64_t offset) const { return rdma_.getHostBuffer() + offset; }
+    void encodeChunk(uint64_t index, uint64_t length);
+    void decodeChunk(uint64_t index, uint64_t length);
+    void postChunk(uint64_t index, uint64_t offset, uint64_t length);
+    void postCredit(uint64_t index);
+    void postRecv();
+
+    RdmaVerbs& rdma_;
+    CopyEngine& engine_;
+    struct ibv_qp* qp_;
+    CmConData remote_;
+    uint64_t staging_engine_addr_;
+    size_t chunk_size_;
+    uint32_t depth_;
+    Codec* codec_{nullptr};
+    std::unique_ptr<CodecPool> pool_;
+};
+
+#endif // STAGING_PIPELINE_HPP
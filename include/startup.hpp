@@ -0,0 +1,53 @@
+#ifndef STARTUP_HPP
+#define STARTUP_HPP
+
+#include "hpuverbs.hpp"
+#include <chrono>
+#include <mutex>
+
+// Wall-clock phases of bringing a rank up, recorded from any thread.
+// HpuManager and RdmaVerbs fill it in when given one; report() prints each
+// phase's start offset and duration so overlapping phases are visible.
+class StartupProfile {
+public:
+    class Phase {
+    public:
+        Phase(StartupProfile* profile, const char* name);
+        ~Phase();
+
+        Phase(const Phase&) = delete;
+        Phase& operator=(const Phase&) = delete;
+
+    private:
+        StartupProfile* profile_;
+        const char* name_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    StartupProfile();
+
+    void add(const char* name, std::chrono::steady_clock::time_point start,
+             std::chrono::steady_clock::time_point end);
+    void report(std::ostream& out) const;
+
+private:
+    struct Entry {
+        const char* name;
+        double start_ms;
+        double duration_ms;
+    };
+
+    std::chrono::steady_clock::time_point origin_;
+    mutable std::mutex mutex_;
+    std::vector<Entry> entries_;
+};
+
+// Same end state as hpu.initialize, rdma.initialize and rdma.connectQp in
+// turn, with the independent parts overlapped: the IB device is opened and
+// its PD, CQ and QP created, and the TCP connection to the peer set up, while
+// the HPU buffer is allocated, mapped and exported. Registration and the QP
+// exchange follow once all three are done.
+void startInParallel(HpuManager& hpu, size_t size, RdmaVerbs& rdma, const std::string& ib_dev_name,
+                     const std::string& server_name, int port, StartupProfile* profile = nullptr);
+
+#endif // STARTUP_HPP
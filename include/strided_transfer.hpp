@@ -0,0 +1,76 @@
+#ifndef STRIDED_TRANSFER_HPP
+#define STRIDED_TRANSFER_HPP
+
+#include "hpuverbs.hpp"
+#include <vector>
+
+// N-dimensional view into a registered buffer.
+// offset is the byte offset of element [0, ..., 0]; strides are in elements.
+// Empty strides mean a dense row-major layout.
+struct TensorSlice {
+    size_t offset{0};
+    std::vector<size_t> shape;
+    std::vector<size_t> strides;
+    size_t elem_size{1};
+
+    size_t elements() const;
+    size_t bytes() const { return elements() * elem_size; }
+};
+
+// Writes a local tensor slice into a slice of the peer's buffer.
+// Both slices are reduced to contiguous byte fragments. Each WR targets one
+// contiguous remote range of at most 1 GiB and gathers its local pieces with
+// up to as many SGEs as the QP was created with (createQp's max_sge); the
+// plan is split into as many WRs as needed and posted with a bounded number
+// in flight. When local fragments are tiny and the buffer is CPU mapped,
+// they are packed into a registered staging buffer first so the NIC moves a
+// few large pieces instead. write() reaps its completions from the RdmaVerbs
+// CQ, so nothing else may poll it while a write runs.
+class StridedTransfer {
+public:
+    struct Stats {
+        uint64_t writes{0};
+        uint64_t sges{0};
+        uint64_t bytes{0};
+        uint64_t packed_bytes{0};
+    };
+
+    // Average local fragment size below which the packed path is used
+    static constexpr size_t PACK_THRESHOLD = 256;
+
+    StridedTransfer(RdmaVerbs& rdma, HpuManager& hpu, size_t staging_size = 4 * 1024 * 1024);
+    ~StridedTransfer();
+
+    // Blocking write; remote slice offsets are relative to remote.addr and
+    // must stay within the remote_size bytes the peer registered there
+    Stats write(struct ibv_qp* qp, const CmConData& remote, uint64_t remote_size,
+                const TensorSlice& src, const TensorSlice& dst);
+
+    struct Fragment {
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    // Contiguous byte ranges of a slice in traversal order
+    static std::vector<Fragment> fragments(const TensorSlice& slice);
+
+private:
+    struct WritePlan {
+        uint64_t remote_addr;
+        std::vector<struct ibv_sge> sges;
+    };
+
+    std::vector<WritePlan> plan(const std::vector<Fragment>& src, uint64_t local_base, uint32_t lkey,
+                                const std::vector<Fragment>& dst, uint64_t remote_base, uint32_t max_sge) const;
+    void post(struct ibv_qp* qp, uint32_t rkey, std::vector<WritePlan>& writes, Stats& stats);
+    Stats writePacked(struct ibv_qp* qp, const CmConData& remote, uint32_t max_sge,
+                      const std::vector<Fragment>& src, const std::vector<Fragment>& dst);
+
+    RdmaVerbs& rdma_;
+    HpuManager& hpu_;
+    uint8_t* staging_{nullptr};
+    size_t staging_size_;
+    struct ibv_mr* staging_mr_{nullptr};
+};
+
+#endif // STRIDED_TRANSFER_HPP
@@ -0,0 +1,84 @@
+#ifndef TAG_MATCHER_HPP
+#define TAG_MATCHER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+constexpr int ANY_SOURCE = -1;
+constexpr uint64_t ANY_TAG = ~0ull;
+
+// Posted-receive / unexpected-message matching on (source, tag).
+// Receives may use ANY_SOURCE and/or ANY_TAG; messages never do. Matching
+// is MPI-ordered: an arriving message takes the earliest posted receive
+// that matches, a new receive takes the earliest matching unexpected
+// message. Entries live in hash buckets so the cost per operation does not
+// depend on the number of pending entries with other keys.
+class TagMatcher {
+public:
+    struct Match {
+        uint64_t cookie;
+        int source;
+        uint64_t tag;
+    };
+
+    explicit TagMatcher(size_t buckets = 1024);
+
+    // Match a new receive against unexpected messages, queue it otherwise
+    bool postReceive(int source, uint64_t tag, uint64_t cookie, Match* match);
+
+    // Match an arriving message against posted receives, queue it otherwise
+    bool arrive(int source, uint64_t tag, uint64_t cookie, Match* match);
+
+    size_t postedCount() const { return posted_count_; }
+    size_t unexpectedCount() const { return unexpected_count_; }
+
+private:
+    static constexpr uint32_t NIL = ~0u;
+
+    // Unexpected messages sit on one list per index, posted receives on one
+    enum Link { LINK_EXACT, LINK_TAG, LINK_SRC, LINK_ALL, LINK_COUNT };
+
+    struct Node {
+        int source;
+        uint64_t tag;
+        uint64_t seq;
+        uint64_t cookie;
+        uint32_t next[LINK_COUNT];
+        uint32_t prev[LINK_COUNT];
+    };
+
+    struct List {
+        uint32_t head{NIL};
+        uint32_t tail{NIL};
+    };
+
+    uint32_t allocNode(int source, uint64_t tag, uint64_t cookie);
+    void freeNode(uint32_t idx);
+    void append(List& list, uint32_t idx, int link);
+    void unlink(List& list, uint32_t idx, int link);
+    uint32_t findPosted(List& list, int source, uint64_t tag) const;
+    uint32_t findUnexpected(List& list, int link, int source, uint64_t tag) const;
+    size_t bucket(uint64_t key) const;
+
+    std::vector<Node> nodes_;
+    std::vector<uint32_t> free_nodes_;
+    uint64_t seq_{0};
+    size_t mask_;
+    size_t posted_count_{0};
+    size_t unexpected_count_{0};
+
+    // Posted receives, by wildcard class
+    std::vector<List> posted_exact_;
+    std::vector<List> posted_any_src_;
+    std::vector<List> posted_any_tag_;
+    List posted_any_;
+
+    // Unexpected messages, indexed every way a receive can look them up
+    std::vector<List> unexpected_exact_;
+    std::vector<List> unexpected_tag_;
+    std::vector<List> unexpected_src_;
+    List unexpected_all_;
+};
+
+#endif // TAG_MATCHER_HPP
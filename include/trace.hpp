@@ -0,0 +1,97 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Timeline tracing of verbs and memory operations.
+// Each thread records into its own ring of fixed size (oldest records are
+// overwritten) without locks; flush() merges the rings into a Chrome trace
+// JSON or a Perfetto protobuf trace. Setting HPU_TRACE=<file> in the
+// environment turns tracing on at initialize and flushes at exit, picking
+// the format from the extension (.json or .pftrace / .perfetto-trace).
+// With tracing off an instant trace point is one relaxed load and an untaken
+// branch; a TraceScope adds a second untaken branch on its stored start time
+// when it closes.
+
+enum class TraceKind : uint32_t {
+    PostSend,      // id = first wr_id, value = bytes, code = opcode
+    PostRecv,      // id = wr_id
+    Doorbell,      // id = wr_id; ibv_wr_complete on the builder path
+    Completion,    // id = wr_id, value = NIC timestamp, code = opcode | status << 16
+    Register,      // id = lkey, value = bytes
+    Deregister,    // id = lkey
+    Allocate,      // value = bytes, code = 1 for device memory
+    Map,           // id = address, value = bytes
+    Export,        // id = DMA-buf fd, value = bytes
+    Recover,       // id = QP number, value = work requests replayed
+};
+
+enum class TraceFormat { ChromeJson, Perfetto };
+
+struct TraceRecord {
+    uint64_t start_ns;
+    uint64_t duration_ns;  // 0 for instant events
+    uint64_t id;
+    uint64_t value;
+    uint32_t code;
+    TraceKind kind;
+};
+
+class Tracer {
+public:
+    // Records per thread; rounded up to a power of two
+    static constexpr size_t DEFAULT_CAPACITY = 64 * 1024;
+
+    static void enable(size_t capacity = DEFAULT_CAPACITY);
+    static void disable();
+    static bool enabled() { return __builtin_expect(enabled_.load(std::memory_order_relaxed), 0); }
+
+    // Enables tracing when HPU_TRACE is set, once per process
+    static void enableFromEnvironment();
+
+    static uint64_t now();
+    static void record(const TraceRecord& record);
+    static void instant(TraceKind kind, uint64_t id, uint64_t value = 0, uint32_t code = 0);
+
+    // Writes every thread's records; returns how many. Records overwritten
+    // while the flush runs are left out.
+    static size_t flush(const std::string& path, TraceFormat format);
+    static size_t flush(const std::string& path);
+
+private:
+    static inline std::atomic<bool> enabled_{false};
+};
+
+// Times the enclosing block as one event. start_ == 0 marks it disabled.
+class TraceScope {
+public:
+    explicit TraceScope(TraceKind kind, uint64_t id = 0, uint64_t value = 0, uint32_t code = 0)
+        : start_(Tracer::enabled() ? Tracer::now() : 0), id_(id), value_(value), code_(code), kind_(kind) {}
+
+    ~TraceScope() {
+        if (__builtin_expect(start_ != 0, 0)) {
+            uint64_t duration = Tracer::now() - start_;
+            Tracer::record({start_, duration ? duration : 1, id_, value_, code_, kind_});
+        }
+    }
+
+    // For results only known inside the block, such as a new lkey
+    bool active() const { return start_ != 0; }
+    void setId(uint64_t id) { id_ = id; }
+    void setValue(uint64_t value) { value_ = value; }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    uint64_t start_;
+    uint64_t id_;
+    uint64_t value_;
+    uint32_t code_;
+    TraceKind kind_;
+};
+
+#endif // TRACE_HPP
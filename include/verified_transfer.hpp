@@ -0,0 +1,55 @@
+#ifndef VERIFIED_TRANSFER_HPP
+#define VERIFIED_TRANSFER_HPP
+
+#include "collectives.hpp"
+#include <deque>
+
+// End-to-end checked bulk writes over a CollectiveFabric.
+// Every chunk travels with the CRC32C of its source bytes as the write's
+// immediate. The receiver recomputes the CRC where the chunk landed and
+// answers a mismatch with a retransmit request carrying the chunk index;
+// once every chunk checks out it sends a completion. Retransmits are posted
+// after all first copies, in request order, so the receiver can tell which
+// chunk each arrival is. Both buffers must be CPU mapped (the host path),
+// and the fabric must not be used by anything else during a transfer.
+class VerifiedTransfer {
+public:
+    struct Stats {
+        uint64_t chunks{0};
+        uint64_t bytes{0};
+        uint64_t retransmits{0};
+        double seconds{0.0};
+    };
+
+    // Chunks resent this many times without a match fail the transfer
+    static constexpr uint32_t MAX_RETRANSMITS = 4;
+
+    // base is the CPU mapping of the fabric's local buffer
+    VerifiedTransfer(CollectiveFabric& fabric, uint8_t* base, size_t chunk_size = 1024 * 1024,
+                     uint32_t window = 16);
+
+    // Blocking; returns once the receiver has confirmed every chunk
+    Stats send(int peer, uint64_t local_offset, uint64_t remote_offset, size_t length);
+
+    // Blocking counterpart of send for [offset, offset + length)
+    Stats receive(int peer, uint64_t offset, size_t length);
+
+    // Test hook: flips a byte of a landed chunk with this probability
+    // before it is checked, standing in for corruption on the way in
+    void setFaultRate(double rate) { fault_rate_ = rate; }
+
+private:
+    uint64_t chunkLength(uint64_t index, size_t length) const;
+    void postChunk(int peer, uint64_t index, uint64_t local_offset, uint64_t remote_offset, size_t length);
+    void injectFault(uint8_t* chunk, uint64_t bytes);
+
+    CollectiveFabric& fabric_;
+    uint8_t* base_;
+    size_t chunk_size_;
+    uint32_t window_;
+    uint64_t outstanding_{0};
+    double fault_rate_{0.0};
+    uint64_t fault_seed_{0x9e3779b97f4a7c15ull};
+};
+
+#endif // VERIFIED_TRANSFER_HPP
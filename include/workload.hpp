@@ -0,0 +1,54 @@
+#ifndef WORKLOAD_HPP
+#define WORKLOAD_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Posted work requests as recorded from a running RdmaVerbs.
+// Peers are numbered densely in order of first use of their QP.
+struct WorkloadOp {
+    uint64_t time_ns;   // Since the recording started
+    uint64_t offset;    // Into the registered buffer, or the SGE address for other MRs
+    uint32_t lkey;      // MR of the first SGE, 0 for none
+    uint32_t length;
+    uint16_t peer;
+    uint8_t opcode;     // ibv_wr_opcode
+};
+
+// Appends ops to a log file: an 8 byte magic, then per op the time delta,
+// peer, opcode, length, lkey and offset as varints (about 12 bytes an op).
+// At most 65536 peers are numbered; ops to further QPs are dropped and
+// counted. Thread safe; the file is complete once the recorder is destroyed.
+class WorkloadRecorder {
+public:
+    explicit WorkloadRecorder(const std::string& path);
+    ~WorkloadRecorder();
+
+    WorkloadRecorder(const WorkloadRecorder&) = delete;
+    WorkloadRecorder& operator=(const WorkloadRecorder&) = delete;
+
+    void record(uint32_t qp_num, int opcode, uint32_t lkey, uint64_t offset, uint32_t length);
+    uint64_t count() const;
+    uint64_t dropped() const;
+
+    static std::vector<WorkloadOp> load(const std::string& path);
+
+private:
+    void flushBuffer();
+
+    std::FILE* file_{nullptr};
+    mutable std::mutex mutex_;
+    std::string buffer_;
+    std::unordered_map<uint32_t, uint16_t> peers_;
+    uint64_t start_ns_;
+    uint64_t last_ns_;
+    uint64_t count_{0};
+    uint64_t dropped_{0};
+};
+
+#endif // WORKLOAD_HPP
@@ -0,0 +1,143 @@
+#include "crc32c.hpp"
+#include "loopback_fabric.hpp"
+#include "verified_transfer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+// CRC32C throughput and verified transfer benchmark.
+// Checksums -n bytes in chunks of 4 KB up to 4 MB with the hardware and
+// table-driven paths, then moves -n bytes between two loopback ranks with a
+// CRC per -k byte chunk, corrupting landed chunks with probability -f.
+//   ./integrity_bench [-n bytes] [-k chunk] [-f fault_rate] [-i iterations]
+
+namespace {
+
+struct Options {
+    size_t bytes{64 * 1024 * 1024};
+    size_t chunk_size{1024 * 1024};
+    double fault_rate{0.01};
+    int iterations{5};
+};
+
+Options parseArguments(int argc, char* argv[]) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            opts.bytes = std::strtoull(argv[++i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+            opts.chunk_size = std::strtoull(argv[++i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            opts.fault_rate = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            opts.iterations = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-h") == 0) {
+            std::cout << "Usage: " << argv[0] << " [-n bytes] [-k chunk] [-f fault_rate] [-i iterations]\n";
+            std::exit(0);
+        }
+    }
+    if (opts.bytes == 0 || opts.chunk_size == 0 || opts.iterations <= 0) {
+        throw std::runtime_error("Sizes and iterations must be positive");
+    }
+    return opts;
+}
+
+uint8_t pattern(size_t i) {
+    return static_cast<uint8_t>(i * 131 + (i >> 12));
+}
+
+using Checksum = uint32_t (*)(const void*, size_t, uint32_t);
+
+// Best of iterations, since one pass is short enough to be hit by noise
+double checksumRate(const Options& opts, const uint8_t* data, size_t chunk, Checksum checksum) {
+    double best = 0.0;
+    uint32_t sink = 0;
+    for (int it = 0; it < opts.iterations; ++it) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t offset = 0; offset + chunk <= opts.bytes; offset += chunk) {
+            sink ^= checksum(data + offset, chunk, 0);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        best = std::max(best, (opts.bytes / chunk) * chunk / seconds / 1e9);
+    }
+    volatile uint32_t keep = sink;
+    (void)keep;
+    return best;
+}
+
+VerifiedTransfer::Stats runTransfer(const Options& opts, LoopbackNetwork& network) {
+    VerifiedTransfer::Stats sent, received;
+    std::string errors[2];
+
+    for (size_t i = 0; i < opts.bytes; ++i) {
+        network.rank(0).buffer()[i] = pattern(i);
+    }
+    std::memset(network.rank(1).buffer(), 0, opts.bytes);
+
+    std::thread receiver([&] {
+        try {
+            VerifiedTransfer transfer(network.rank(1), network.rank(1).buffer(), opts.chunk_size);
+            transfer.setFaultRate(opts.fault_rate);
+            received = transfer.receive(0, 0, opts.bytes);
+        } catch (const std::exception& e) {
+            errors[1] = e.what();
+        }
+    });
+    try {
+        VerifiedTransfer transfer(network.rank(0), network.rank(0).buffer(), opts.chunk_size);
+        sent = transfer.send(1, 0, 0, opts.bytes);
+    } catch (const std::exception& e) {
+        errors[0] = e.what();
+    }
+    receiver.join();
+
+    for (const auto& error : errors) {
+        if (!error.empty()) throw std::runtime_error(error);
+    }
+    for (size_t i = 0; i < opts.bytes; ++i) {
+        if (network.rank(1).buffer()[i] != pattern(i)) {
+            throw std::runtime_error("Verified transfer: byte " + std::to_string(i) + " differs");
+        }
+    }
+    sent.retransmits = received.retransmits;
+    return sent;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        Options opts = parseArguments(argc, argv);
+        std::cout << "CRC32C Integrity Benchmark\n==========================\n";
+        std::cout << "Hardware CRC32C: " << (crc32cHardware() ? "SSE4.2 + PCLMUL" : "not available") << "\n";
+
+        std::vector<uint8_t> data(opts.bytes);
+        for (size_t i = 0; i < data.size(); ++i) data[i] = pattern(i);
+        if (crc32c(data.data(), data.size()) != crc32cSoftware(data.data(), data.size())) {
+            throw std::runtime_error("Hardware and software CRC32C disagree");
+        }
+
+        std::cout << "\n   chunk   hw(GB/s)   sw(GB/s)\n";
+        for (size_t chunk = 4096; chunk <= 4 * 1024 * 1024 && chunk <= opts.bytes; chunk *= 4) {
+            std::printf("%8zu %10.2f %10.2f\n", chunk, checksumRate(opts, data.data(), chunk, crc32c),
+                        checksumRate(opts, data.data(), chunk, crc32cSoftware));
+        }
+
+        std::cout << "\nVerified transfer: " << opts.bytes << " bytes, chunk " << opts.chunk_size
+                  << " bytes, fault rate " << opts.fault_rate << "\n";
+        LoopbackNetwork network(2, opts.bytes);
+        VerifiedTransfer::Stats stats;
+        double best = 0.0;
+        for (int it = 0; it < opts.iterations; ++it) {
+            stats = runTransfer(opts, network);
+            best = std::max(best, stats.bytes / stats.seconds / 1e9);
+        }
+        std::cout << "✓ " << stats.chunks << " chunks verified, " << stats.retransmits
+                  << " retransmits on the last run, best " << best << " GB/s\n";
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "integrity_bench failed: " << e.what() << "\n";
+        return 1;
+    }
+}
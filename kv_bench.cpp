@@ -0,0 +1,147 @@
+#include "kv_transfer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <random>
+
+// KV-cache block transfer benchmark.
+// Run without a server name on the target node and with one on the source:
+//   ./kv_bench [-p port] [-s pool_size]
+//   ./kv_bench <server> [-p port] [-s pool_size] [-q depth] [-n requests]
+
+namespace {
+
+struct Options {
+    std::string server_name;
+    int port{20000};
+    std::optional<std::string> ib_dev_name;
+    size_t buffer_size{256 * 1024 * 1024};
+    uint32_t depth{32};
+    int requests{64};
+};
+
+Options parseArguments(int argc, char* argv[]) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            opts.port = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            opts.ib_dev_name = argv[++i];
+        } else if (std::strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            opts.buffer_size = std::strtoull(argv[++i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "-q") == 0 && i + 1 < argc) {
+            opts.depth = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            opts.requests = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-h") == 0) {
+            std::cout << "Usage: " << argv[0] << " [server] [-p port] [-d ib_dev] [-s pool_size] [-q depth] [-n requests]\n";
+            std::exit(0);
+        } else if (opts.server_name.empty()) {
+            opts.server_name = argv[i];
+        }
+    }
+    return opts;
+}
+
+// Scattered source pages in short contiguous runs, contiguous destination
+std::vector<KvBlockTransfer::BlockPair> makeBlockList(uint32_t blocks, std::mt19937& rng) {
+    std::vector<std::pair<uint32_t, uint32_t>> runs;
+    for (uint32_t b = 0; b < blocks;) {
+        uint32_t len = std::min<uint32_t>(1 + rng() % 8, blocks - b);
+        runs.emplace_back(b, len);
+        b += len;
+    }
+    std::shuffle(runs.begin(), runs.end(), rng);
+
+    std::vector<KvBlockTransfer::BlockPair> list;
+    uint32_t dst = 0;
+    for (const auto& run : runs) {
+        for (uint32_t b = run.first; b < run.first + run.second; ++b) {
+            list.emplace_back(b, dst++);
+        }
+    }
+    return list;
+}
+
+// Each side's pool size, so the source can bound destination blocks
+uint64_t exchangePoolSize(RdmaVerbs& rdma) {
+    uint64_t local = htonll(rdma.getRegionSize()), remote = 0;
+    if (write(rdma.getSock(), &local, sizeof(local)) != sizeof(local) ||
+        read(rdma.getSock(), &remote, sizeof(remote)) != sizeof(remote)) {
+        throw std::runtime_error("Failed to exchange pool sizes");
+    }
+    return ntohll(remote);
+}
+
+void runSource(const Options& opts, RdmaVerbs& rdma, struct ibv_qp* qp, const CmConData& remote,
+               uint64_t remote_size) {
+    std::mt19937 rng(42);
+    std::cout << "\nblock_size   blocks/req   writes/req   sges/write      blocks/s       GB/s\n";
+
+    for (size_t block_size = 16 * 1024; block_size <= 2 * 1024 * 1024; block_size *= 2) {
+        uint32_t blocks = static_cast<uint32_t>(
+            std::min<size_t>(std::min<uint64_t>(opts.buffer_size, remote_size) / block_size, 4096));
+        if (blocks < 2) break;
+
+        KvBlockTransfer kv(rdma, block_size, opts.depth);
+        kv.addPeer(1, qp, remote, remote_size);
+        auto list = makeBlockList(blocks, rng);
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<uint64_t> reqs;
+        for (int r = 0; r < opts.requests; ++r) {
+            reqs.push_back(kv.submit(1, list));
+        }
+        for (uint64_t req : reqs) {
+            kv.wait(req);
+        }
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        const auto& st = kv.stats();
+        std::printf("%8zuK %12u %12.1f %12.2f %13.0f %10.2f\n",
+                    block_size / 1024, blocks,
+                    static_cast<double>(st.writes) / st.requests,
+                    static_cast<double>(st.sges) / st.writes,
+                    st.blocks / secs, st.bytes / secs / 1e9);
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        Options opts = parseArguments(argc, argv);
+        std::cout << "KV-cache Block Transfer Benchmark\n=================================\n";
+
+        HpuManager hpu;
+        RdmaVerbs rdma;
+        hpu.initialize(opts.buffer_size);
+        rdma.initialize(opts.ib_dev_name.value_or(""), hpu);
+        rdma.connectQp(opts.server_name, opts.port);
+
+        uint32_t max_sge = KvBlockTransfer::sgeLimit(rdma);
+        struct ibv_qp* qp = rdma.createQp(QP_DEPTH, max_sge);
+        CmConData remote = rdma.connectQp(qp);
+        std::cout << "✓ KV QP connected (max " << max_sge << " SGEs per write)\n";
+        uint64_t remote_size = exchangePoolSize(rdma);
+
+        char sync_byte = 'D';
+        if (opts.server_name.empty()) {
+            std::cout << "Serving as KV destination pool, waiting for source...\n";
+            if (read(rdma.getSock(), &sync_byte, 1) == 1) {
+                std::cout << "✓ Source finished\n";
+            }
+        } else {
+            runSource(opts, rdma, qp, remote, remote_size);
+            if (write(rdma.getSock(), &sync_byte, 1) != 1) {
+                std::cerr << "Failed to signal destination\n";
+            }
+        }
+
+        rdma.destroyQp(qp);
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "kv_bench failed: " << e.what() << "\n";
+        return 1;
+    }
+}
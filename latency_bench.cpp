@@ -0,0 +1,221 @@
+#include "hpuverbs.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+// RDMA write ping-pong latency benchmark.
+// Each ping is a WRITE_WITH_IMM answered by one from the peer. Latency is
+// reported from the CPU clock and, when the device has completion
+// timestamps, from the NIC clock: the pong's completion minus the NIC time
+// just before the ping was posted. The peer returns its own NIC-clocked
+// turnaround in the pong's immediate, so the wire time excludes it too.
+// -x uses the legacy CQ and ibv_post_send for comparison.
+//   ./latency_bench [-p port] [-n bytes] [-x]
+//   ./latency_bench <server> [-p port] [-n bytes] [-i iterations] [-x]
+
+namespace {
+
+constexpr uint32_t STOP_IMM = 0xffffffff;
+constexpr int RECV_DEPTH = 16;
+constexpr int WARMUP = 100;
+constexpr std::chrono::seconds IDLE_TIMEOUT(10);
+
+struct Options {
+    std::string server_name;
+    int port{20000};
+    std::optional<std::string> ib_dev_name;
+    uint32_t bytes{8};
+    int iterations{10000};
+    bool extended{true};
+};
+
+Options parseArguments(int argc, char* argv[]) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            opts.port = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            opts.ib_dev_name = argv[++i];
+        } else if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            opts.bytes = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 0));
+        } else if (std::strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            opts.iterations = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-x") == 0) {
+            opts.extended = false;
+        } else if (std::strcmp(argv[i], "-h") == 0) {
+            std::cout << "Usage: " << argv[0] << " [server] [-p port] [-d ib_dev] [-n bytes] [-i iterations] [-x]\n";
+            std::exit(0);
+        } else if (opts.server_name.empty()) {
+            opts.server_name = argv[i];
+        }
+    }
+    return opts;
+}
+
+void syncPeer(int sock) {
+    char byte = 'S';
+    if (write(sock, &byte, 1) != 1 || read(sock, &byte, 1) != 1) {
+        throw std::runtime_error("Failed to sync with peer");
+    }
+}
+
+void postRecv(RdmaVerbs& rdma) {
+    struct ibv_recv_wr wr = {};
+    wr.num_sge = 0;
+    rdma.postReceive(rdma.getQp(), &wr);
+}
+
+void postPing(RdmaVerbs& rdma, uint32_t bytes, uint32_t imm) {
+    RdmaOp op;
+    op.opcode = IBV_WR_RDMA_WRITE_WITH_IMM;
+    op.length = bytes;
+    op.remote_addr = rdma.getRemoteProps().addr;
+    op.rkey = rdma.getRemoteProps().rkey;
+    op.imm_data = htonl(imm);
+    rdma.postSend(rdma.getQp(), op);
+}
+
+// Polls until a write arrives, returning its immediate and NIC timestamp;
+// send completions seen on the way are counted in sends
+uint32_t waitArrival(RdmaVerbs& rdma, uint64_t& timestamp, int& sends) {
+    auto start = std::chrono::steady_clock::now();
+    while (true) {
+        struct ibv_wc wc[4];
+        uint64_t ts[4];
+        int ne = rdma.pollCompletions(wc, ts, 4);
+        int arrived = -1;
+        for (int i = 0; i < ne; ++i) {
+            if (wc[i].status != IBV_WC_SUCCESS) {
+                throw std::runtime_error("Ping-pong failed: " + std::string(ibv_wc_status_str(wc[i].status)));
+            }
+            if (wc[i].opcode == IBV_WC_RECV_RDMA_WITH_IMM) {
+                arrived = i;
+            } else {
+                sends++;
+            }
+        }
+        // One outstanding ping, so at most one arrival per poll
+        if (arrived >= 0) {
+            timestamp = ts[arrived];
+            postRecv(rdma);
+            return ntohl(wc[arrived].imm_data);
+        }
+        if (ne == 0 && std::chrono::steady_clock::now() - start > IDLE_TIMEOUT) {
+            throw std::runtime_error("Ping-pong timeout");
+        }
+    }
+}
+
+void drainSends(RdmaVerbs& rdma, int& sends, int expected) {
+    struct ibv_wc wc[4];
+    while (sends < expected) {
+        int ne = rdma.pollCompletions(wc, 4);
+        for (int i = 0; i < ne; ++i) {
+            if (wc[i].status != IBV_WC_SUCCESS) {
+                throw std::runtime_error("Ping-pong failed: " + std::string(ibv_wc_status_str(wc[i].status)));
+            }
+            sends++;
+        }
+    }
+}
+
+void runResponder(const Options& opts, RdmaVerbs& rdma) {
+    int sends = 0, pongs = 0;
+    while (true) {
+        uint64_t arrival = 0;
+        uint32_t imm = waitArrival(rdma, arrival, sends);
+        if (imm == STOP_IMM) break;
+
+        uint32_t turnaround = 0;
+        if (rdma.hasCompletionTimestamps()) {
+            turnaround = static_cast<uint32_t>(rdma.nicNanoseconds(arrival, rdma.readNicClock()));
+        }
+        postPing(rdma, opts.bytes, turnaround);
+        pongs++;
+    }
+    drainSends(rdma, sends, pongs);
+}
+
+void printRow(const char* label, std::vector<double>& samples) {
+    if (samples.empty()) {
+        std::printf("%-28s %10s %10s %10s\n", label, "n/a", "n/a", "n/a");
+        return;
+    }
+    std::sort(samples.begin(), samples.end());
+    std::printf("%-28s %10.2f %10.2f %10.2f\n", label, samples[samples.size() / 2],
+                samples[samples.size() * 99 / 100], samples.back());
+}
+
+void runInitiator(const Options& opts, RdmaVerbs& rdma) {
+    bool hardware = rdma.hasCompletionTimestamps();
+    std::vector<double> post, cpu, nic, wire;
+    int sends = 0;
+
+    for (int it = 0; it < WARMUP + opts.iterations; ++it) {
+        uint64_t posted = hardware ? rdma.readNicClock() : 0;
+        auto start = std::chrono::steady_clock::now();
+        postPing(rdma, opts.bytes, 0);
+        auto after_post = std::chrono::steady_clock::now();
+
+        uint64_t arrival = 0;
+        uint32_t turnaround = waitArrival(rdma, arrival, sends);
+        auto end = std::chrono::steady_clock::now();
+        if (it < WARMUP) continue;
+
+        post.push_back(std::chrono::duration<double, std::micro>(after_post - start).count());
+        cpu.push_back(std::chrono::duration<double, std::micro>(end - start).count() / 2);
+        if (hardware) {
+            double rtt = rdma.nicNanoseconds(posted, arrival) / 1e3;
+            nic.push_back(rtt / 2);
+            wire.push_back((rtt - turnaround / 1e3) / 2);
+        }
+    }
+    postPing(rdma, 0, STOP_IMM);
+    drainSends(rdma, sends, WARMUP + opts.iterations + 1);
+
+    std::cout << "\n" << opts.bytes << " byte writes, " << opts.iterations << " round trips\n";
+    std::printf("%-28s %10s %10s %10s\n", "(us)", "p50", "p99", "max");
+    printRow("post", post);
+    printRow("one-way, CPU clock", cpu);
+    printRow("one-way, NIC clock", nic);
+    printRow("one-way, minus peer", wire);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        Options opts = parseArguments(argc, argv);
+        std::cout << "RDMA Write Latency Benchmark\n============================\n";
+
+        HpuManager hpu;
+        RdmaVerbs rdma;
+        hpu.initialize(std::max<size_t>(opts.bytes, 4096));
+        rdma.setExtendedVerbs(opts.extended);
+        rdma.setIntraNode(false);
+        rdma.initialize(opts.ib_dev_name.value_or(""), hpu);
+        if (opts.bytes > rdma.getRegionSize()) {
+            throw std::runtime_error("Message does not fit the registered buffer");
+        }
+        rdma.connectQp(opts.server_name, opts.port);
+        std::cout << "Completion timestamps: " << (rdma.hasCompletionTimestamps() ? "yes" : "no")
+                  << ", work request builder: " << (rdma.hasWorkRequestBuilder() ? "yes" : "no") << "\n";
+
+        for (int i = 0; i < RECV_DEPTH; ++i) {
+            postRecv(rdma);
+        }
+        syncPeer(rdma.getSock());
+
+        if (opts.server_name.empty()) {
+            std::cout << "Answering pings...\n";
+            runResponder(opts, rdma);
+            std::cout << "✓ Initiator finished\n";
+        } else {
+            runInitiator(opts, rdma);
+        }
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "latency_bench failed: " << e.what() << "\n";
+        return 1;
+    }
+}
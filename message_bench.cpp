@@ -0,0 +1,179 @@
+#include "message_layer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+// Tagged message ping-pong over the message layer. Attaching the peer runs
+// the threshold probe, then every size from 64 bytes to -n is timed forced
+// eager (up to the bounce slot size), forced rendezvous, and at the tuned
+// threshold. The responder checks each payload. Last, a message longer than
+// its receive has to come back marked truncated.
+//   ./message_bench [-p port] [-d ib_dev] [-n max_bytes]                  # responder
+//   ./message_bench <server> [-p port] [-d ib_dev] [-n max_bytes] [-i iterations]
+
+namespace {
+
+constexpr uint64_t PING_TAG = 1;
+constexpr uint64_t PONG_TAG = 2;
+constexpr uint64_t TRUNCATE_TAG = 3;
+constexpr size_t TRUNCATE_CAPACITY = 64;
+constexpr int WARMUP = 10;
+
+struct Options {
+    std::string server_name;
+    int port{20000};
+    std::optional<std::string> ib_dev_name;
+    size_t max_bytes{1 << 20};
+    int iterations{1000};
+};
+
+enum class Mode { Eager, Rendezvous, Tuned };
+
+Options parseArguments(int argc, char* argv[]) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            opts.port = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            opts.ib_dev_name = argv[++i];
+        } else if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            opts.max_bytes = std::strtoull(argv[++i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            opts.iterations = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-h") == 0) {
+            std::cout << "Usage: " << argv[0] << " [server] [-p port] [-d ib_dev] [-n max_bytes] [-i iterations]\n";
+            std::exit(0);
+        } else if (opts.server_name.empty()) {
+            opts.server_name = argv[i];
+        }
+    }
+    if (opts.max_bytes < 64 || opts.iterations <= 0) {
+        throw std::runtime_error("Need -n of at least 64 and a positive iteration count");
+    }
+    return opts;
+}
+
+std::vector<size_t> messageSizes(size_t max_bytes) {
+    std::vector<size_t> sizes;
+    for (size_t size = 64; size <= max_bytes; size *= 4) {
+        sizes.push_back(size);
+    }
+    return sizes;
+}
+
+// Both sides run the same schedule, so they pick the same protocol per row
+void setMode(MessageLayer& layer, Mode mode, size_t tuned) {
+    layer.setEagerThreshold(mode == Mode::Eager ? layer.maxEagerSize() : mode == Mode::Rendezvous ? 0 : tuned);
+}
+
+// Sends go out of the first half of the buffer and land in the second
+void runResponder(const Options& opts, RdmaVerbs& rdma, MessageLayer& layer, size_t tuned) {
+    const uint8_t* host = rdma.getHostBuffer();
+    size_t half = rdma.getRegionSize() / 2;
+    uint64_t checked = 0, bad = 0;
+
+    for (size_t size : messageSizes(opts.max_bytes)) {
+        for (Mode mode : {Mode::Eager, Mode::Rendezvous, Mode::Tuned}) {
+            if (mode == Mode::Eager && size > layer.maxEagerSize()) continue;
+            setMode(layer, mode, tuned);
+            for (int it = 0; it < WARMUP + opts.iterations; ++it) {
+                MessageLayer::Status status = layer.wait(layer.irecv(0, PING_TAG, half, size));
+                uint8_t expected = static_cast<uint8_t>(it);
+                if (status.length != size || status.truncated ||
+                    (host && (host[half] != expected || host[half + size - 1] != expected))) {
+                    bad++;
+                }
+                checked++;
+                layer.wait(layer.isend(0, 0, size, PONG_TAG));
+            }
+        }
+    }
+
+    MessageLayer::Status status = layer.wait(layer.irecv(0, TRUNCATE_TAG, half, TRUNCATE_CAPACITY));
+    if (!status.truncated || status.length != TRUNCATE_CAPACITY) {
+        throw std::runtime_error("Oversized message was not reported as truncated");
+    }
+    std::cout << "✓ Oversized message reported as truncated to " << status.length << " bytes\n";
+    if (bad) {
+        throw std::runtime_error(std::to_string(bad) + " of " + std::to_string(checked) + " messages arrived wrong");
+    }
+    std::cout << "✓ " << checked << " messages checked\n";
+}
+
+// Median one-way time in microseconds, or a negative value when the mode does not apply
+double timeRow(const Options& opts, RdmaVerbs& rdma, MessageLayer& layer, size_t size, Mode mode, size_t tuned) {
+    if (mode == Mode::Eager && size > layer.maxEagerSize()) return -1;
+    setMode(layer, mode, tuned);
+    uint8_t* host = rdma.getHostBuffer();
+    size_t half = rdma.getRegionSize() / 2;
+    std::vector<double> samples;
+
+    for (int it = 0; it < WARMUP + opts.iterations; ++it) {
+        if (host) memset(host, static_cast<uint8_t>(it), size);
+        auto start = std::chrono::steady_clock::now();
+        uint64_t pong = layer.irecv(0, PONG_TAG, half, size);
+        layer.wait(layer.isend(0, 0, size, PING_TAG));
+        layer.wait(pong);
+        auto end = std::chrono::steady_clock::now();
+        if (it >= WARMUP) {
+            samples.push_back(std::chrono::duration<double, std::micro>(end - start).count() / 2);
+        }
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples[samples.size() / 2];
+}
+
+void runInitiator(const Options& opts, RdmaVerbs& rdma, MessageLayer& layer, size_t tuned) {
+    std::cout << "\nOne-way latency, median of " << opts.iterations << " round trips (us)\n";
+    std::printf("%10s %12s %12s %12s\n", "bytes", "eager", "rendezvous", "tuned");
+    for (size_t size : messageSizes(opts.max_bytes)) {
+        double eager = timeRow(opts, rdma, layer, size, Mode::Eager, tuned);
+        double rendezvous = timeRow(opts, rdma, layer, size, Mode::Rendezvous, tuned);
+        double at_tuned = timeRow(opts, rdma, layer, size, Mode::Tuned, tuned);
+        if (eager < 0) {
+            std::printf("%10zu %12s %12.2f %12.2f\n", size, "-", rendezvous, at_tuned);
+        } else {
+            std::printf("%10zu %12.2f %12.2f %12.2f\n", size, eager, rendezvous, at_tuned);
+        }
+    }
+
+    // The responder only has room for part of it
+    layer.setEagerThreshold(tuned);
+    layer.wait(layer.isend(0, 0, 2 * TRUNCATE_CAPACITY, TRUNCATE_TAG));
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        Options opts = parseArguments(argc, argv);
+        std::cout << "Message Layer Benchmark\n=======================\n";
+
+        HpuManager hpu;
+        RdmaVerbs rdma;
+        // The probe uses up to a bounce slot at the start of the buffer
+        hpu.initialize(2 * std::max(opts.max_bytes, MessageLayer::SLOT_SIZE));
+        rdma.setIntraNode(false);
+        rdma.initialize(opts.ib_dev_name.value_or(""), hpu);
+        rdma.connectQp(opts.server_name, opts.port);
+
+        bool initiator = !opts.server_name.empty();
+        MessageLayer layer(rdma, hpu, rdma.getQp(),
+                           initiator ? MessageLayer::Tune::Initiator : MessageLayer::Tune::Responder);
+        size_t tuned = layer.eagerThreshold();
+        if (!hpu.getBuffer()) {
+            std::cout << "Buffer is not CPU mapped, eager rows go through rendezvous too\n";
+        }
+
+        if (initiator) {
+            runInitiator(opts, rdma, layer, tuned);
+        } else {
+            std::cout << "Answering pings...\n";
+            runResponder(opts, rdma, layer, tuned);
+        }
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "message_bench failed: " << e.what() << "\n";
+        return 1;
+    }
+}
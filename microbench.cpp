@@ -0,0 +1,470 @@
+#include "loopback_fabric.hpp"
+#include "shm_transport.hpp"
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <sys/mman.h>
+
+// CPU cost of the hot-path calls, one benchmark per call:
+//   ShmPostSend/<batch>/<signal every>   chain of 64 byte RDMA writes
+//   ShmPostReceive/<batch>               chain of receives
+//   ShmPoll/<batch>                      reaping <batch> completions (0 = empty CQ)
+//   FabricWrite, FabricPoll              LoopbackFabric, as used by the collectives
+//   VerbsPostSend/<batch>/<signal every> RdmaVerbs on NIC loopback (--device only)
+//   VerbsPostOp/<signal every>           postSend(qp, RdmaOp), one op per call
+//   VerbsPoll/<batch>
+// The Shm and Fabric groups need no hardware. Items per second is WRs (or
+// completions) per second; the JSON output of two commits compares with
+// Google Benchmark's tools/compare.py.
+//   ./microbench [--device ib_dev] [--port port] [--benchmark_out=run.json --benchmark_out_format=json]
+
+namespace {
+
+constexpr size_t BENCH_BUFFER_SIZE = 1024 * 1024;
+constexpr uint32_t BENCH_WRITE_SIZE = 64;
+
+// Posted or completed between untimed drains
+constexpr int DRAIN_EVERY = 4096;
+
+// Receives wait on the peer ring's 64 slots, keep this below it
+constexpr int MAX_BATCH = 32;
+
+const std::vector<int64_t> BATCHES = {1, 4, 16, MAX_BATCH};
+const std::vector<int64_t> SIGNAL_RATIOS = {1, 4, 16};
+
+struct Options {
+    std::string ib_dev_name;
+    int port{20000};
+};
+
+// Removes our flags so benchmark::Initialize sees only its own
+Options parseArguments(int& argc, char* argv[]) {
+    Options opts;
+    int out = 1;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--device") == 0 && i + 1 < argc) {
+            opts.ib_dev_name = argv[++i];
+        } else if (std::strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            opts.port = std::atoi(argv[++i]);
+        } else {
+            argv[out++] = argv[i];
+        }
+    }
+    argc = out;
+    return opts;
+}
+
+// memfd backed buffer, what HpuManager hands the shared-memory transport
+// when there is no DMA-buf
+struct ShmBuffer {
+    ShmRegion region;
+
+    ShmBuffer() {
+        region.fd = memfd_create("microbench", MFD_CLOEXEC);
+        if (region.fd < 0 || ftruncate(region.fd, BENCH_BUFFER_SIZE) != 0) {
+            throw std::runtime_error("Failed to create benchmark buffer");
+        }
+        region.base = mmap(nullptr, BENCH_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, region.fd, 0);
+        if (region.base == MAP_FAILED) {
+            throw std::runtime_error("Failed to map benchmark buffer");
+        }
+        region.addr = reinterpret_cast<uintptr_t>(region.base);
+        region.size = BENCH_BUFFER_SIZE;
+    }
+
+    ~ShmBuffer() {
+        munmap(region.base, BENCH_BUFFER_SIZE);
+        close(region.fd);
+    }
+};
+
+// Two shared-memory transports connected over a socketpair, the main-QP
+// path of RdmaVerbs when both processes are on one host
+struct ShmPair {
+    ShmBuffer buffers[2];
+    ShmTransport sides[2];
+
+    ShmPair() {
+        int socks[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, socks)) {
+            throw std::runtime_error("Failed to create socketpair");
+        }
+        bool connected[2] = {false, false};
+        std::thread listener([&] {
+            connected[0] = sides[0].connect(socks[0], true, true, buffers[0].region, buffers[1].region.addr);
+        });
+        connected[1] = sides[1].connect(socks[1], false, true, buffers[1].region, buffers[0].region.addr);
+        listener.join();
+        close(socks[0]);
+        close(socks[1]);
+        if (!connected[0] || !connected[1]) {
+            throw std::runtime_error("Failed to connect shared-memory transports");
+        }
+    }
+
+    // Polls both sides until the sender has count completions
+    void reap(int sender, int64_t count) {
+        struct ibv_wc wc[64];
+        while (count > 0) {
+            count -= sides[sender].pollCompletions(wc, 64);
+            sides[1 - sender].pollCompletions(wc, 64);
+        }
+    }
+};
+
+ShmPair& shmPair() {
+    static ShmPair pair;
+    return pair;
+}
+
+// Chain of batch RDMA writes, every signal_every-th WR signaled
+struct WriteChain {
+    std::vector<struct ibv_sge> sges;
+    std::vector<struct ibv_send_wr> wrs;
+
+    WriteChain(int batch, uint64_t local_addr, uint32_t lkey, uint64_t remote_addr, uint32_t rkey)
+        : sges(batch), wrs(batch) {
+        for (int i = 0; i < batch; ++i) {
+            uint64_t offset = static_cast<uint64_t>(i) * BENCH_WRITE_SIZE;
+            sges[i] = {local_addr + offset, BENCH_WRITE_SIZE, lkey};
+            wrs[i] = {};
+            wrs[i].wr_id = i;
+            wrs[i].sg_list = &sges[i];
+            wrs[i].num_sge = 1;
+            wrs[i].opcode = IBV_WR_RDMA_WRITE;
+            wrs[i].wr.rdma.remote_addr = remote_addr + offset;
+            wrs[i].wr.rdma.rkey = rkey;
+            wrs[i].next = i + 1 < batch ? &wrs[i + 1] : nullptr;
+        }
+    }
+
+    // Signals by position in the whole stream; returns how many are signaled
+    int64_t mark(int64_t first, int64_t signal_every) {
+        int64_t signaled = 0;
+        for (size_t i = 0; i < wrs.size(); ++i) {
+            bool signal = (first + static_cast<int64_t>(i) + 1) % signal_every == 0;
+            wrs[i].send_flags = signal ? IBV_SEND_SIGNALED : 0;
+            signaled += signal;
+        }
+        return signaled;
+    }
+};
+
+void BM_ShmPostSend(benchmark::State& state) {
+    ShmPair& pair = shmPair();
+    int batch = static_cast<int>(state.range(0));
+    int64_t signal_every = state.range(1);
+    WriteChain chain(batch, pair.buffers[0].region.addr, 0, pair.buffers[1].region.addr, 0);
+
+    int64_t posted = 0, signaled = 0;
+    for (auto _ : state) {
+        signaled += chain.mark(posted, signal_every);
+        pair.sides[0].postSend(chain.wrs.data(), false);
+        posted += batch;
+        if (signaled >= DRAIN_EVERY) {
+            state.PauseTiming();
+            pair.reap(0, signaled);
+            signaled = 0;
+            state.ResumeTiming();
+        }
+    }
+    pair.reap(0, signaled);
+    state.SetItemsProcessed(posted);
+}
+BENCHMARK(BM_ShmPostSend)->ArgNames({"batch", "signal"})->ArgsProduct({BATCHES, SIGNAL_RATIOS});
+
+// Receives are consumed by zero-length writes with immediate from the peer
+void consumeReceives(ShmPair& pair, int64_t count) {
+    struct ibv_sge sge = {pair.buffers[1].region.addr, 0, 0};
+    struct ibv_send_wr wr = {};
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    wr.opcode = IBV_WR_RDMA_WRITE_WITH_IMM;
+    wr.wr.rdma.remote_addr = pair.buffers[0].region.addr;
+    wr.send_flags = IBV_SEND_SIGNALED;
+
+    struct ibv_wc wc[64];
+    for (int64_t sent = 0; sent < count; sent += MAX_BATCH) {
+        int64_t n = std::min<int64_t>(MAX_BATCH, count - sent);
+        for (int64_t i = 0; i < n; ++i) pair.sides[1].postSend(&wr, false);
+        for (int64_t received = 0; received < n;) {
+            received += pair.sides[0].pollCompletions(wc, 64);
+        }
+        pair.reap(1, n);
+    }
+}
+
+void BM_ShmPostReceive(benchmark::State& state) {
+    ShmPair& pair = shmPair();
+    int batch = static_cast<int>(state.range(0));
+    std::vector<struct ibv_sge> sges(batch, {pair.buffers[0].region.addr, static_cast<uint32_t>(MSG_SIZE), 0});
+    std::vector<struct ibv_recv_wr> wrs(batch);
+    for (int i = 0; i < batch; ++i) {
+        wrs[i] = {static_cast<uint64_t>(i), i + 1 < batch ? &wrs[i + 1] : nullptr, &sges[i], 1};
+    }
+
+    int64_t posted = 0, outstanding = 0;
+    for (auto _ : state) {
+        pair.sides[0].postReceive(wrs.data());
+        posted += batch;
+        outstanding += batch;
+        if (outstanding >= DRAIN_EVERY) {
+            state.PauseTiming();
+            consumeReceives(pair, outstanding);
+            outstanding = 0;
+            state.ResumeTiming();
+        }
+    }
+    consumeReceives(pair, outstanding);
+    state.SetItemsProcessed(posted);
+}
+BENCHMARK(BM_ShmPostReceive)->ArgName("batch")->ArgsProduct({BATCHES});
+
+// Completions are queued DRAIN_EVERY at a time outside the timed region
+void BM_ShmPoll(benchmark::State& state) {
+    ShmPair& pair = shmPair();
+    int batch = static_cast<int>(state.range(0));
+    WriteChain chain(MAX_BATCH, pair.buffers[0].region.addr, 0, pair.buffers[1].region.addr, 0);
+    chain.mark(0, 1);
+
+    struct ibv_wc wc[MAX_BATCH];
+    int64_t queued = 0, reaped = 0;
+    for (auto _ : state) {
+        if (queued < batch) {
+            state.PauseTiming();
+            for (; queued < DRAIN_EVERY; queued += MAX_BATCH) {
+                pair.sides[0].postSend(chain.wrs.data(), false);
+            }
+            state.ResumeTiming();
+        }
+        int ne = pair.sides[0].pollCompletions(wc, batch);
+        queued -= ne;
+        reaped += ne;
+    }
+    pair.reap(0, queued);
+    state.SetItemsProcessed(reaped);
+}
+BENCHMARK(BM_ShmPoll)->ArgName("batch")->Arg(0)->Arg(1)->Arg(4)->Arg(16)->Arg(MAX_BATCH);
+
+void BM_FabricWrite(benchmark::State& state) {
+    LoopbackNetwork network(2, BENCH_BUFFER_SIZE);
+    LoopbackFabric& fabric = network.rank(0);
+    uint32_t length = static_cast<uint32_t>(state.range(0));
+
+    CollectiveFabric::Event events[64];
+    int64_t outstanding = 0;
+    for (auto _ : state) {
+        fabric.write(1, 0, 0, length, 0);
+        if (++outstanding == DRAIN_EVERY) {
+            state.PauseTiming();
+            while (network.rank(0).poll(events, 64) > 0 || network.rank(1).poll(events, 64) > 0) {}
+            outstanding = 0;
+            state.ResumeTiming();
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * length);
+}
+BENCHMARK(BM_FabricWrite)->ArgName("bytes")->Arg(BENCH_WRITE_SIZE)->Arg(4096)->Arg(65536);
+
+void BM_FabricPoll(benchmark::State& state) {
+    LoopbackNetwork network(2, BENCH_BUFFER_SIZE);
+    LoopbackFabric& fabric = network.rank(0);
+    int batch = static_cast<int>(state.range(0));
+
+    CollectiveFabric::Event events[MAX_BATCH];
+    int64_t queued = 0, reaped = 0;
+    for (auto _ : state) {
+        if (queued < batch) {
+            state.PauseTiming();
+            for (; queued < DRAIN_EVERY; ++queued) fabric.write(1, 0, 0, BENCH_WRITE_SIZE, 0);
+            while (network.rank(1).poll(events, MAX_BATCH) > 0) {}
+            state.ResumeTiming();
+        }
+        int ne = fabric.poll(events, batch);
+        queued -= ne;
+        reaped += ne;
+    }
+    state.SetItemsProcessed(reaped);
+}
+// The empty poll yields the thread by design, so batch 0 is left out
+BENCHMARK(BM_FabricPoll)->ArgName("batch")->Arg(1)->Arg(4)->Arg(16)->Arg(MAX_BATCH);
+
+// Two RdmaVerbs in this process over the NIC (no shared-memory shortcut),
+// writing on an extra QP so signaling is per WR
+struct VerbsPair {
+    HpuManager hpus[2];
+    RdmaVerbs sides[2];
+    struct ibv_qp* qps[2]{nullptr, nullptr};
+    CmConData remote{};
+
+    explicit VerbsPair(const Options& opts) {
+        for (int i = 0; i < 2; ++i) {
+            hpus[i].initialize(BENCH_BUFFER_SIZE);
+            sides[i].setIntraNode(false);
+            sides[i].initialize(opts.ib_dev_name, hpus[i]);
+        }
+        std::exception_ptr failure;
+        std::thread listener([&] {
+            try {
+                sides[0].connectQp("", opts.port);
+                qps[0] = sides[0].createQp();
+                sides[0].connectQp(qps[0]);
+            } catch (...) {
+                failure = std::current_exception();
+            }
+        });
+        // The listener may not be bound yet
+        for (int attempt = 0;; ++attempt) {
+            try {
+                sides[1].connectQp("127.0.0.1", opts.port);
+                break;
+            } catch (const std::runtime_error&) {
+                if (attempt == 50) {
+                    listener.detach();
+                    throw;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+        }
+        qps[1] = sides[1].createQp();
+        remote = sides[1].connectQp(qps[1]);
+        listener.join();
+        if (failure) std::rethrow_exception(failure);
+    }
+
+    ~VerbsPair() {
+        for (int i = 0; i < 2; ++i) sides[i].destroyQp(qps[i]);
+    }
+
+    // Polls both sides until the writer has count completions
+    void reap(int64_t count) {
+        struct ibv_wc wc[64];
+        while (count > 0) {
+            int ne = sides[1].pollCompletions(wc, 64);
+            for (int i = 0; i < ne; ++i) {
+                if (wc[i].status != IBV_WC_SUCCESS) {
+                    throw std::runtime_error("Work completion error: " + std::string(ibv_wc_status_str(wc[i].status)));
+                }
+            }
+            count -= ne;
+            sides[0].pollCompletions(wc, 64);
+        }
+    }
+};
+
+std::unique_ptr<VerbsPair> verbs_pair;
+
+// An unsignaled WR holds its send queue slot until a later signaled one
+// completes, so the queue is drained whenever the next batch might not fit
+void BM_VerbsPostSend(benchmark::State& state) {
+    VerbsPair& pair = *verbs_pair;
+    int batch = static_cast<int>(state.range(0));
+    int64_t signal_every = state.range(1);
+    WriteChain chain(batch, pair.sides[1].getLocalAddr(), pair.sides[1].getLkey(), pair.remote.addr,
+                     pair.remote.rkey);
+
+    int64_t posted = 0, signaled = 0, in_queue = 0;
+    for (auto _ : state) {
+        if (in_queue + batch > static_cast<int64_t>(QP_DEPTH)) {
+            state.PauseTiming();
+            pair.reap(signaled);
+            signaled = 0;
+            in_queue = posted % signal_every;
+            state.ResumeTiming();
+        }
+        signaled += chain.mark(posted, signal_every);
+        pair.sides[1].postSend(pair.qps[1], chain.wrs.data());
+        posted += batch;
+        in_queue += batch;
+    }
+    pair.reap(signaled);
+    state.SetItemsProcessed(posted);
+}
+
+void BM_VerbsPostOp(benchmark::State& state) {
+    VerbsPair& pair = *verbs_pair;
+    int64_t signal_every = state.range(0);
+    RdmaOp op;
+    op.opcode = IBV_WR_RDMA_WRITE;
+    op.length = BENCH_WRITE_SIZE;
+    op.remote_addr = pair.remote.addr;
+    op.rkey = pair.remote.rkey;
+
+    int64_t posted = 0, signaled = 0, in_queue = 0;
+    for (auto _ : state) {
+        if (in_queue == static_cast<int64_t>(QP_DEPTH)) {
+            state.PauseTiming();
+            pair.reap(signaled);
+            signaled = 0;
+            in_queue = posted % signal_every;
+            state.ResumeTiming();
+        }
+        op.signaled = (posted + 1) % signal_every == 0;
+        pair.sides[1].postSend(pair.qps[1], op);
+        signaled += op.signaled;
+        posted++;
+        in_queue++;
+    }
+    pair.reap(signaled);
+    state.SetItemsProcessed(posted);
+}
+
+void BM_VerbsPoll(benchmark::State& state) {
+    VerbsPair& pair = *verbs_pair;
+    int batch = static_cast<int>(state.range(0));
+    WriteChain chain(MAX_BATCH, pair.sides[1].getLocalAddr(), pair.sides[1].getLkey(), pair.remote.addr,
+                     pair.remote.rkey);
+    chain.mark(0, 1);
+
+    struct ibv_wc wc[MAX_BATCH];
+    int64_t pending = 0, reaped = 0;
+    for (auto _ : state) {
+        if (pending < batch) {
+            // Refill and wait for the NIC, so only reaping is timed
+            state.PauseTiming();
+            for (; pending + MAX_BATCH <= static_cast<int64_t>(QP_DEPTH); pending += MAX_BATCH) {
+                pair.sides[1].postSend(pair.qps[1], chain.wrs.data());
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            state.ResumeTiming();
+        }
+        int ne = pair.sides[1].pollCompletions(wc, batch);
+        pending -= ne;
+        reaped += ne;
+    }
+    pair.reap(pending);
+    state.SetItemsProcessed(reaped);
+}
+
+void registerVerbsBenchmarks() {
+    benchmark::RegisterBenchmark("BM_VerbsPostSend", BM_VerbsPostSend)
+        ->ArgNames({"batch", "signal"})
+        ->ArgsProduct({BATCHES, SIGNAL_RATIOS});
+    benchmark::RegisterBenchmark("BM_VerbsPostOp", BM_VerbsPostOp)->ArgName("signal")->ArgsProduct({SIGNAL_RATIOS});
+    benchmark::RegisterBenchmark("BM_VerbsPoll", BM_VerbsPoll)
+        ->ArgName("batch")->Arg(0)->Arg(1)->Arg(4)->Arg(16)->Arg(MAX_BATCH);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        Options opts = parseArguments(argc, argv);
+        benchmark::Initialize(&argc, argv);
+        if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+
+        if (!opts.ib_dev_name.empty()) {
+            verbs_pair = std::make_unique<VerbsPair>(opts);
+            registerVerbsBenchmarks();
+        }
+        benchmark::RunSpecifiedBenchmarks();
+        benchmark::Shutdown();
+        verbs_pair.reset();
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "microbench failed: " << e.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,136 @@
+#include "hpuverbs.hpp"
+#include "loopback_fabric.hpp"
+#include <chrono>
+#include <cstring>
+
+// Cost of a large host fallback reservation under each paging mode. For
+// pinned, on-demand and implicit on-demand paging in turn it allocates and
+// registers -s bytes, prefetches a -w byte working set, then touches it from
+// the CPU, and reports each step's time and how much of the reservation
+// ended up resident. -l runs the loopback emulation instead of a NIC.
+//   ./odp_bench [-d ib_dev] [-s reservation_bytes] [-w working_set_bytes]
+//   ./odp_bench -l [-s reservation_bytes] [-w working_set_bytes]
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::optional<std::string> ib_dev_name;
+    size_t reservation{1ull << 30};
+    size_t working_set{64 * 1024 * 1024};
+    bool loopback{false};
+};
+
+struct Result {
+    Paging paging;
+    double register_ms;
+    double prefetch_ms;
+    double touch_ms;
+    size_t resident;
+};
+
+Options parseArguments(int argc, char* argv[]) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            opts.ib_dev_name = argv[++i];
+        } else if (std::strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            opts.reservation = std::strtoull(argv[++i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            opts.working_set = std::strtoull(argv[++i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "-l") == 0) {
+            opts.loopback = true;
+        } else if (std::strcmp(argv[i], "-h") == 0) {
+            std::cout << "Usage: " << argv[0] << " [-d ib_dev] [-s reservation_bytes] [-w working_set_bytes] [-l]\n";
+            std::exit(0);
+        }
+    }
+    if (opts.reservation == 0 || opts.working_set > opts.reservation) {
+        throw std::runtime_error("The working set must fit the reservation");
+    }
+    return opts;
+}
+
+double millisecondsSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Writes one byte per page, as a first pass over fresh data would
+void touch(uint8_t* buffer, size_t length) {
+    for (size_t offset = 0; offset < length; offset += 4096) {
+        buffer[offset] = static_cast<uint8_t>(offset);
+    }
+}
+
+Result runLoopback(const Options& opts, Paging paging) {
+    Result result{paging, 0, 0, 0, 0};
+    auto start = Clock::now();
+    LoopbackNetwork network(1, opts.reservation, paging);
+    result.register_ms = millisecondsSince(start);
+
+    LoopbackFabric& fabric = network.rank(0);
+    start = Clock::now();
+    fabric.prefetch(0, opts.working_set);
+    result.prefetch_ms = millisecondsSince(start);
+
+    start = Clock::now();
+    touch(fabric.buffer(), opts.working_set);
+    result.touch_ms = millisecondsSince(start);
+    result.resident = fabric.residentBytes();
+    return result;
+}
+
+Result runDevice(const Options& opts, Paging paging) {
+    Result result{paging, 0, 0, 0, 0};
+    HpuManager hpu;
+    RdmaVerbs rdma;
+    hpu.setPaging(paging);
+    auto start = Clock::now();
+    hpu.initialize(opts.reservation);
+    rdma.initialize(opts.ib_dev_name.value_or(""), hpu);
+    result.register_ms = millisecondsSince(start);
+    result.paging = rdma.getPaging();
+
+    start = Clock::now();
+    if (!rdma.prefetch(0, opts.working_set)) {
+        std::cout << "✗ Prefetch refused, pages will fault in on first access\n";
+    }
+    result.prefetch_ms = millisecondsSince(start);
+
+    uint8_t* buffer = static_cast<uint8_t*>(hpu.getBuffer());
+    if (!buffer) {
+        throw std::runtime_error("Buffer is not CPU-mapped, nothing to page");
+    }
+    start = Clock::now();
+    touch(buffer, opts.working_set);
+    result.touch_ms = millisecondsSince(start);
+    result.resident = residentBytes(buffer, hpu.getBufferSize());
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        Options opts = parseArguments(argc, argv);
+        std::cout << "On-Demand Paging Benchmark\n==========================\n";
+        std::printf("Reservation %zu MB, working set %zu MB, %s\n\n", opts.reservation >> 20, opts.working_set >> 20,
+                    opts.loopback ? "loopback emulation" : "NIC registration");
+
+        std::vector<Result> results;
+        for (Paging paging : {Paging::Pinned, Paging::OnDemand, Paging::Implicit}) {
+            results.push_back(opts.loopback ? runLoopback(opts, paging) : runDevice(opts, paging));
+        }
+
+        std::printf("\n%-20s %12s %12s %12s %14s\n", "paging", "register ms", "prefetch ms", "touch ms", "resident MB");
+        for (const Result& r : results) {
+            std::printf("%-20s %12.2f %12.2f %12.2f %14.1f\n", pagingName(r.paging), r.register_ms, r.prefetch_ms,
+                        r.touch_ms, r.resident / 1048576.0);
+        }
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "odp_bench failed: " << e.what() << "\n";
+        return 1;
+    }
+}
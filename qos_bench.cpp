@@ -0,0 +1,216 @@
+#include "flow_scheduler.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <unordered_set>
+
+// Small-message latency under bulk load, with and without traffic classes.
+// The initiator ping-pongs -m byte writes with the responder in three runs:
+// alone, sharing one class (and QP) with back-to-back -b byte bulk writes,
+// and in a strict-priority latency class (SL 1, DSCP 46) next to the bulk
+// class (SL 0, DSCP 10) limited to -w bytes in flight and optionally paced
+// to -r Gb/s. Reports round-trip p50/p99/max and the bulk GB/s of each run.
+//   ./qos_bench [-p port] [-b bulk_bytes]                                      # responder
+//   ./qos_bench <server> [-p port] [-n pings] [-m bytes] [-b bulk_bytes] [-w window] [-r gbps]
+
+namespace {
+
+constexpr uint32_t BULK_IMM = 0x80000000u;
+constexpr uint32_t STOP_IMM = 0xffffffffu;
+
+// Bulk messages kept queued so the link never idles
+constexpr size_t BULK_BACKLOG = 2;
+
+enum Class { LATENCY = 0, BULK = 1, SHARED = 2 };
+
+struct Options {
+    std::string server_name;
+    int port{20000};
+    std::optional<std::string> ib_dev_name;
+    int pings{10000};
+    size_t message_size{64};
+    size_t bulk_size{16 * 1024 * 1024};
+    size_t window{256 * 1024};
+    double rate_gbps{0.0};
+};
+
+Options parseArguments(int argc, char* argv[]) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            opts.port = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            opts.ib_dev_name = argv[++i];
+        } else if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            opts.pings = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            opts.message_size = std::strtoull(argv[++i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            opts.bulk_size = std::strtoull(argv[++i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            opts.window = std::strtoull(argv[++i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            opts.rate_gbps = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "-h") == 0) {
+            std::cout << "Usage: " << argv[0] << " [server] [-p port] [-d ib_dev] [-n pings] [-m bytes]"
+                      << " [-b bulk_bytes] [-w window] [-r gbps]\n";
+            std::exit(0);
+        } else if (opts.server_name.empty()) {
+            opts.server_name = argv[i];
+        }
+    }
+    if (opts.pings <= 0 || opts.message_size == 0 || opts.message_size > 4096 || opts.bulk_size == 0) {
+        throw std::runtime_error("Need pings, a message size up to 4 KB and a bulk size");
+    }
+    return opts;
+}
+
+// Both sides add the classes in this order; only the initiator's window
+// and pacing matter since the responder sends no bulk data
+void addClasses(FlowScheduler& scheduler, const Options& opts) {
+    FlowScheduler::ClassConfig latency{"latency", {1, 46, 0}, 4096, 64 * 1024};
+    FlowScheduler::ClassConfig bulk{"bulk", {0, 10, static_cast<uint32_t>(opts.rate_gbps * 1e6)},
+                                    std::min<size_t>(64 * 1024, opts.window), opts.window};
+    // No QoS: one FIFO with the whole backlog allowed on the wire
+    FlowScheduler::ClassConfig shared{"shared", {}, 64 * 1024, BULK_BACKLOG * opts.bulk_size};
+    scheduler.addClass(latency);
+    scheduler.addClass(bulk);
+    scheduler.addClass(shared);
+}
+
+struct RunResult {
+    std::vector<double> rtt_us;
+    double bulk_gbps{0.0};
+};
+
+RunResult run(FlowScheduler& scheduler, const Options& opts, int ping_class, int bulk_class, uint64_t ping_offset) {
+    RunResult result;
+    std::unordered_set<uint64_t> bulk_ids;
+    uint64_t bulk_bytes = 0;
+    auto topUp = [&] {
+        while (bulk_class >= 0 && bulk_ids.size() < BULK_BACKLOG) {
+            bulk_ids.insert(scheduler.write(bulk_class, 0, 0, opts.bulk_size, BULK_IMM));
+        }
+    };
+    // Returns true once the reply to seq is back
+    auto reap = [&](uint32_t seq) {
+        FlowScheduler::Event events[32];
+        int n = scheduler.poll(events, 32);
+        bool replied = false;
+        for (int i = 0; i < n; ++i) {
+            if (events[i].kind == FlowScheduler::Event::Kind::Arrived) {
+                replied |= events[i].id == seq;
+            } else if (bulk_ids.erase(events[i].id)) {
+                bulk_bytes += opts.bulk_size;
+            }
+        }
+        return replied;
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    for (int seq = 0; seq < opts.pings; ++seq) {
+        topUp();
+        auto sent = std::chrono::steady_clock::now();
+        scheduler.write(ping_class, ping_offset, ping_offset, opts.message_size, static_cast<uint32_t>(seq));
+        while (!reap(static_cast<uint32_t>(seq))) topUp();
+        result.rtt_us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - sent).count());
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.bulk_gbps = bulk_bytes / seconds / 1e9;
+
+    // Let the backlog drain so the next run starts idle
+    while (!bulk_ids.empty()) reap(UINT32_MAX);
+    return result;
+}
+
+void printResult(const char* label, RunResult& result) {
+    auto& rtt = result.rtt_us;
+    std::sort(rtt.begin(), rtt.end());
+    auto at = [&](double q) { return rtt[std::min(rtt.size() - 1, static_cast<size_t>(q * rtt.size()))]; };
+    std::printf("%-12s %10.2f %10.2f %10.2f %12.2f\n", label, at(0.5), at(0.99), rtt.back(), result.bulk_gbps);
+}
+
+void runInitiator(FlowScheduler& scheduler, const Options& opts, uint64_t ping_offset) {
+    std::printf("\nRound trip of %zu byte messages (us)\n", opts.message_size);
+    std::printf("%-12s %10s %10s %10s %12s\n", "", "p50", "p99", "max", "bulk GB/s");
+
+    RunResult idle = run(scheduler, opts, LATENCY, -1, ping_offset);
+    printResult("idle", idle);
+    RunResult shared = run(scheduler, opts, SHARED, SHARED, ping_offset);
+    printResult("shared", shared);
+    RunResult prioritized = run(scheduler, opts, LATENCY, BULK, ping_offset);
+    printResult("prioritized", prioritized);
+
+    scheduler.write(LATENCY, ping_offset, ping_offset, 0, STOP_IMM);
+    FlowScheduler::Event events[32];
+    while (scheduler.pending(LATENCY) > 0) scheduler.poll(events, 32);
+}
+
+// Echoes every ping on the class it came in on and absorbs the bulk writes
+void runResponder(FlowScheduler& scheduler, uint64_t ping_offset, size_t message_size) {
+    std::cout << "Responding to pings...\n";
+    uint64_t bulk = 0;
+    FlowScheduler::Event events[32];
+    for (bool stop = false; !stop;) {
+        int n = scheduler.poll(events, 32);
+        for (int i = 0; i < n; ++i) {
+            if (events[i].kind != FlowScheduler::Event::Kind::Arrived) continue;
+            uint32_t imm = static_cast<uint32_t>(events[i].id);
+            if (imm == STOP_IMM) {
+                stop = true;
+            } else if (imm & BULK_IMM) {
+                bulk++;
+            } else {
+                scheduler.write(events[i].cls, ping_offset, ping_offset, message_size, imm);
+            }
+        }
+    }
+    for (int cls = 0; cls < 3; ++cls) {
+        while (scheduler.pending(cls) > 0) scheduler.poll(events, 32);
+    }
+    std::cout << "✓ Done, " << bulk << " bulk messages received\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        Options opts = parseArguments(argc, argv);
+        std::cout << "Traffic Class Benchmark\n=======================\n";
+
+        // Bulk data at the start of the buffer, pings in the page after it
+        HpuManager hpu;
+        RdmaVerbs rdma;
+        hpu.initialize(opts.bulk_size + 4096);
+        rdma.initialize(opts.ib_dev_name.value_or(""), hpu);
+        rdma.connectQp(opts.server_name, opts.port);
+        uint64_t ping_offset = opts.bulk_size;
+
+        // The responder's ping size follows the initiator's and its region
+        // has to hold the initiator's bulk writes
+        uint64_t sizes[2] = {htonll(opts.message_size), htonll(opts.bulk_size)};
+        bool initiator = !opts.server_name.empty();
+        if (initiator ? write(rdma.getSock(), sizes, sizeof(sizes)) != sizeof(sizes)
+                      : read(rdma.getSock(), sizes, sizeof(sizes)) != sizeof(sizes)) {
+            throw std::runtime_error("Failed to exchange message sizes");
+        }
+        opts.message_size = ntohll(sizes[0]);
+        if (ntohll(sizes[1]) != opts.bulk_size) {
+            throw std::runtime_error("Both sides need the same bulk size (-b)");
+        }
+
+        FlowScheduler scheduler(rdma);
+        addClasses(scheduler, opts);
+        std::cout << "✓ Latency, bulk and shared class QPs connected\n";
+
+        if (initiator) {
+            runInitiator(scheduler, opts, ping_offset);
+        } else {
+            runResponder(scheduler, ping_offset, opts.message_size);
+        }
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "qos_bench failed: " << e.what() << "\n";
+        return 1;
+    }
+}
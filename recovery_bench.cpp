@@ -0,0 +1,220 @@
+#include "hpuverbs.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+// QP failover time. The initiator streams -n signaled writes with immediate
+// to the responder, -q in flight, and forces its QP into the error state -f
+// times along the way as a stand-in for a link flap. Each failure is
+// recovered in place with RdmaVerbs::recoverQp (reset, metadata exchange,
+// replay). Writes with immediate are not replayed by the library, so the
+// initiator reposts the ones it gets back and the responder drops repeats
+// by their sequence number; at the end every write must have arrived once.
+// For comparison it times what a restart would redo before even
+// reconnecting: allocating and registering the buffer again.
+//   ./recovery_bench [-p port] [-s buffer_bytes]                                  # responder
+//   ./recovery_bench <server> [-p port] [-s buffer_bytes] [-n writes] [-m bytes] [-q depth] [-f faults]
+
+namespace {
+
+constexpr uint32_t STOP_IMM = 0xffffffffu;
+
+struct Options {
+    std::string server_name;
+    int port{20000};
+    std::optional<std::string> ib_dev_name;
+    size_t buffer_size{64 * 1024 * 1024};
+    uint64_t writes{200000};
+    uint32_t message_size{4096};
+    uint32_t depth{64};
+    int faults{10};
+};
+
+Options parseArguments(int argc, char* argv[]) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            opts.port = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            opts.ib_dev_name = argv[++i];
+        } else if (std::strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            opts.buffer_size = std::strtoull(argv[++i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            opts.writes = std::strtoull(argv[++i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            opts.message_size = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 0));
+        } else if (std::strcmp(argv[i], "-q") == 0 && i + 1 < argc) {
+            opts.depth = static_cast<uint32_t>(std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            opts.faults = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-h") == 0) {
+            std::cout << "Usage: " << argv[0] << " [server] [-p port] [-d ib_dev] [-s buffer_bytes] [-n writes]"
+                      << " [-m bytes] [-q depth] [-f faults]\n";
+            std::exit(0);
+        } else if (opts.server_name.empty()) {
+            opts.server_name = argv[i];
+        }
+    }
+    if (opts.depth == 0 || opts.depth > QP_DEPTH || opts.message_size == 0 ||
+        static_cast<uint64_t>(opts.depth) * opts.message_size > opts.buffer_size || opts.writes == 0) {
+        throw std::runtime_error("Need writes, and a depth up to " + std::to_string(QP_DEPTH) +
+                                 " whose messages fit the buffer");
+    }
+    return opts;
+}
+
+void injectFault(struct ibv_qp* qp) {
+    struct ibv_qp_attr attr = {};
+    attr.qp_state = IBV_QPS_ERR;
+    if (ibv_modify_qp(qp, &attr, IBV_QP_STATE)) {
+        throw std::runtime_error("Failed to force QP into error");
+    }
+}
+
+// Write seq carries its sequence number as immediate data
+void postWrite(const Options& opts, RdmaVerbs& rdma, struct ibv_qp* qp, const CmConData& remote, uint64_t seq) {
+    RdmaOp op;
+    op.opcode = IBV_WR_RDMA_WRITE_WITH_IMM;
+    op.offset = (seq % opts.depth) * opts.message_size;
+    op.length = opts.message_size;
+    op.remote_addr = remote.addr + op.offset;
+    op.rkey = remote.rkey;
+    op.wr_id = seq;
+    op.imm_data = htonl(static_cast<uint32_t>(seq));
+    rdma.postSend(qp, op);
+}
+
+void runInitiator(const Options& opts, RdmaVerbs& rdma, struct ibv_qp* qp, const CmConData& remote) {
+    uint64_t fault_every = opts.faults > 0 ? std::max<uint64_t>(1, opts.writes / (opts.faults + 1)) : 0;
+    uint64_t posted = 0, completed = 0;
+    std::vector<double> recovery_ms;
+
+    auto start = std::chrono::steady_clock::now();
+    while (completed < opts.writes) {
+        while (posted < opts.writes && posted - completed < opts.depth) {
+            postWrite(opts, rdma, qp, remote, posted);
+            posted++;
+            if (fault_every && posted % fault_every == 0 && recovery_ms.size() < static_cast<size_t>(opts.faults)) {
+                injectFault(qp);
+            }
+        }
+
+        struct ibv_wc wc[32];
+        int ne = rdma.pollCompletions(wc, 32);
+        for (int i = 0; i < ne; ++i) {
+            if (wc[i].status == IBV_WC_SUCCESS) {
+                completed++;
+                continue;
+            }
+            // The rest of the batch is flushes; writes with immediate may have
+            // landed already, so they come back to be reposted here
+            auto failed = std::chrono::steady_clock::now();
+            for (uint64_t seq : rdma.recoverQp(qp)) {
+                postWrite(opts, rdma, qp, remote, seq);
+            }
+            recovery_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - failed).count());
+            break;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    RdmaOp stop;
+    stop.opcode = IBV_WR_RDMA_WRITE_WITH_IMM;
+    stop.length = 0;
+    stop.remote_addr = remote.addr;
+    stop.rkey = remote.rkey;
+    stop.imm_data = htonl(STOP_IMM);
+    rdma.postSend(qp, stop);
+    rdma.pollCompletion();
+
+    std::printf("\n%llu writes completed in %.3f s (%.2f GB/s) across %zu faults\n",
+                static_cast<unsigned long long>(completed), seconds,
+                completed * static_cast<double>(opts.message_size) / seconds / 1e9, recovery_ms.size());
+    if (!recovery_ms.empty()) {
+        std::sort(recovery_ms.begin(), recovery_ms.end());
+        std::printf("Recovery: min %.3f ms, median %.3f ms, max %.3f ms\n", recovery_ms.front(),
+                    recovery_ms[recovery_ms.size() / 2], recovery_ms.back());
+    }
+}
+
+void runResponder(RdmaVerbs& rdma, struct ibv_qp* qp) {
+    std::cout << "Receiving writes...\n";
+    auto postRecv = [&] {
+        struct ibv_recv_wr wr = {};
+        wr.num_sge = 0;
+        rdma.postReceive(qp, &wr);
+    };
+    for (uint32_t i = 0; i < QP_DEPTH; ++i) postRecv();
+
+    // Reposts can deliver a write twice; each sequence number counts once
+    std::vector<bool> seen;
+    uint64_t arrivals = 0, duplicates = 0, recoveries = 0;
+    for (bool stop = false; !stop;) {
+        struct ibv_wc wc[32];
+        int ne = rdma.pollCompletions(wc, 32);
+        for (int i = 0; i < ne && !stop; ++i) {
+            if (wc[i].status != IBV_WC_SUCCESS) {
+                rdma.recoverQp(qp);
+                recoveries++;
+                break;
+            }
+            uint32_t seq = ntohl(wc[i].imm_data);
+            if (seq == STOP_IMM) {
+                stop = true;
+                continue;
+            }
+            if (seq >= seen.size()) seen.resize(seq + 1, false);
+            if (seen[seq]) {
+                duplicates++;
+            } else {
+                seen[seq] = true;
+                arrivals++;
+            }
+            postRecv();
+        }
+        if (ne == 0 && rdma.serviceRecovery()) recoveries++;
+    }
+    std::cout << "✓ " << arrivals << " writes arrived, " << duplicates << " duplicates dropped, " << recoveries
+              << " recoveries\n";
+}
+
+// What a process restart repeats before it can reconnect
+double restartMilliseconds(const Options& opts) {
+    auto start = std::chrono::steady_clock::now();
+    HpuManager hpu;
+    RdmaVerbs rdma;
+    hpu.initialize(opts.buffer_size);
+    rdma.initialize(opts.ib_dev_name.value_or(""), hpu);
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        Options opts = parseArguments(argc, argv);
+        std::cout << "QP Recovery Benchmark\n=====================\n";
+
+        HpuManager hpu;
+        RdmaVerbs rdma;
+        hpu.initialize(opts.buffer_size);
+        rdma.initialize(opts.ib_dev_name.value_or(""), hpu);
+        rdma.connectQp(opts.server_name, opts.port);
+        struct ibv_qp* qp = rdma.createQp();
+        rdma.enableRecovery(qp);
+        CmConData remote = rdma.connectQp(qp);
+
+        if (opts.server_name.empty()) {
+            runResponder(rdma, qp);
+        } else {
+            runInitiator(opts, rdma, qp, remote);
+            std::printf("Restart (allocate and register %zu bytes, no connect): %.3f ms\n", opts.buffer_size,
+                        restartMilliseconds(opts));
+        }
+        rdma.destroyQp(qp);
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "recovery_bench failed: " << e.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,141 @@
+#include "reduction.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+// Host reduction kernel benchmark.
+// Reports GB/s (bytes of dst per second) of every data type and op at each
+// SIMD level the CPU supports, and checks each level against the scalar result.
+//   ./reduce_bench [-n bytes] [-i iterations]
+
+namespace {
+
+struct Options {
+    size_t bytes{1024 * 1024};
+    int iterations{200};
+};
+
+Options parseArguments(int argc, char* argv[]) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            opts.bytes = std::strtoull(argv[++i], nullptr, 0) / 4 * 4;
+        } else if (std::strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            opts.iterations = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-h") == 0) {
+            std::cout << "Usage: " << argv[0] << " [-n bytes] [-i iterations]\n";
+            std::exit(0);
+        }
+    }
+    return opts;
+}
+
+const char* typeName(DataType type) {
+    switch (type) {
+        case DataType::Float32: return "fp32";
+        case DataType::BFloat16: return "bf16";
+        case DataType::Float16: return "fp16";
+        case DataType::Int32: return "int32";
+    }
+    return "?";
+}
+
+const char* opName(ReduceOp op) {
+    switch (op) {
+        case ReduceOp::Sum: return "sum";
+        case ReduceOp::Max: return "max";
+        case ReduceOp::Min: return "min";
+    }
+    return "?";
+}
+
+// Finite, small-magnitude inputs so every encoding stays away from NaN/Inf
+void fill(std::vector<uint8_t>& buffer, DataType type, unsigned seed) {
+    size_t count = buffer.size() / dataTypeSize(type);
+    for (size_t i = 0; i < count; ++i) {
+        seed = seed * 1103515245 + 12345;
+        int value = static_cast<int>((seed >> 16) % 2001) - 1000;
+        float f = value / 64.0f;
+        uint32_t bits;
+        std::memcpy(&bits, &f, sizeof(bits));
+        switch (type) {
+            case DataType::Float32:
+                std::memcpy(&buffer[i * 4], &f, 4);
+                break;
+            case DataType::Int32:
+                std::memcpy(&buffer[i * 4], &value, 4);
+                break;
+            case DataType::BFloat16: {
+                uint16_t h = static_cast<uint16_t>(bits >> 16);
+                std::memcpy(&buffer[i * 2], &h, 2);
+                break;
+            }
+            case DataType::Float16: {
+                // value / 64 is exact in fp16: sign, rebased exponent, top mantissa bits
+                uint16_t h = 0;
+                if (value != 0) {
+                    uint32_t exp = ((bits >> 23) & 0xff) - 127 + 15;
+                    h = static_cast<uint16_t>(((bits >> 16) & 0x8000) | (exp << 10) | ((bits >> 13) & 0x3ff));
+                }
+                std::memcpy(&buffer[i * 2], &h, 2);
+                break;
+            }
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        Options opts = parseArguments(argc, argv);
+        SimdLevel best = detectSimdLevel();
+        std::cout << "Host Reduction Benchmark\n========================\n";
+        std::cout << "Buffer size: " << opts.bytes << " bytes, CPU level: " << simdLevelName(best) << "\n";
+        std::cout << "\ntype   op    level      GB/s   speedup\n";
+
+        std::vector<SimdLevel> levels = {SimdLevel::Scalar};
+        if (best >= SimdLevel::Avx2) levels.push_back(SimdLevel::Avx2);
+        if (best >= SimdLevel::Avx512) levels.push_back(SimdLevel::Avx512);
+
+        bool mismatch = false;
+        for (auto type : {DataType::Float32, DataType::BFloat16, DataType::Float16, DataType::Int32}) {
+            size_t count = opts.bytes / dataTypeSize(type);
+            std::vector<uint8_t> src(opts.bytes), init(opts.bytes);
+            fill(src, type, 1);
+            fill(init, type, 2);
+
+            for (auto op : {ReduceOp::Sum, ReduceOp::Max, ReduceOp::Min}) {
+                std::vector<uint8_t> reference = init;
+                reduceBuffer(reference.data(), src.data(), count, type, op, SimdLevel::Scalar);
+
+                double scalar_gbps = 0.0;
+                for (auto level : levels) {
+                    std::vector<uint8_t> dst = init;
+                    reduceBuffer(dst.data(), src.data(), count, type, op, level);
+                    bool match = dst == reference;
+                    mismatch = mismatch || !match;
+
+                    auto start = std::chrono::steady_clock::now();
+                    for (int it = 0; it < opts.iterations; ++it) {
+                        reduceBuffer(dst.data(), src.data(), count, type, op, level);
+                    }
+                    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                    double gbps = static_cast<double>(opts.bytes) * opts.iterations / secs / 1e9;
+                    if (level == SimdLevel::Scalar) scalar_gbps = gbps;
+
+                    std::printf("%-6s %-5s %-7s %8.2f %8.2fx%s\n", typeName(type), opName(op),
+                                simdLevelName(level), gbps, gbps / scalar_gbps, match ? "" : "  MISMATCH");
+                }
+            }
+        }
+        return mismatch ? 1 : 0;
+    } catch (const std::exception& e) {
+        std::cerr << "reduce_bench failed: " << e.what() << "\n";
+        return 1;
+    }
+}
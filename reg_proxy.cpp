@@ -0,0 +1,58 @@
+#include "registration_proxy.hpp"
+#include <cstring>
+#include <grp.h>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+
+// Node-local registration proxy. Start one per node before the workers and
+// run the workers with HPU_REG_PROXY=1 (or the -u name given here): they
+// then share this process's device context and PD, and their buffers are
+// registered here, once per distinct file range. Each change is logged with
+// the registered and pinned totals against what the workers asked for.
+// Workers must run as the same user, or with -g as their effective group.
+//   ./reg_proxy [-d ib_dev] [-u socket_name] [-g group]
+
+namespace {
+
+struct Options {
+    std::optional<std::string> ib_dev_name;
+    std::string socket_name{DEFAULT_PROXY_SOCKET};
+    std::optional<gid_t> group;
+};
+
+Options parseArguments(int argc, char* argv[]) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            opts.ib_dev_name = argv[++i];
+        } else if (std::strcmp(argv[i], "-u") == 0 && i + 1 < argc) {
+            opts.socket_name = argv[++i];
+        } else if (std::strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+            struct group* grp = getgrnam(argv[++i]);
+            if (!grp) {
+                throw std::runtime_error(std::string("Unknown group: ") + argv[i]);
+            }
+            opts.group = grp->gr_gid;
+        } else if (std::strcmp(argv[i], "-h") == 0) {
+            std::cout << "Usage: " << argv[0] << " [-d ib_dev] [-u socket_name] [-g group]\n";
+            std::exit(0);
+        }
+    }
+    return opts;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        Options opts = parseArguments(argc, argv);
+        std::cout << "Registration Proxy\n==================\n";
+        RegistrationProxy proxy(opts.ib_dev_name.value_or(""), opts.socket_name, opts.group);
+        proxy.run();
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "reg_proxy failed: " << e.what() << "\n";
+        return 1;
+    }
+}
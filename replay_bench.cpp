@@ -0,0 +1,241 @@
+#include "loopback_fabric.hpp"
+#include "workload.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+// Replays a workload log recorded with HPU_RECORD (or recordWorkload) as
+// RDMA writes from one rank to one rank per recorded peer, at the recorded
+// timing (-t) or as fast as the per-peer window allows. Reads and sends are
+// replayed as writes of the same size; offsets and lengths are folded into
+// the -s byte buffer. Reports throughput and per-op latency, and with -t how
+// far posts lagged behind the recorded schedule.
+//   ./replay_bench -w log -l [-s bytes] [-t]                  # loopback backend
+//   ./replay_bench [-p port] [-s bytes]                         # RDMA target
+//   ./replay_bench <server> -w log [-p port] [-s bytes] [-t]    # RDMA replayer
+
+namespace {
+
+// Writes in flight per peer, as in the collectives
+constexpr size_t PEER_WINDOW = QP_DEPTH / 2;
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string server_name;
+    int port{20000};
+    std::optional<std::string> ib_dev_name;
+    std::string log;
+    size_t buffer_size{64 * 1024 * 1024};
+    bool loopback{false};
+    bool original_timing{false};
+};
+
+Options parseArguments(int argc, char* argv[]) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            opts.port = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            opts.ib_dev_name = argv[++i];
+        } else if (std::strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            opts.log = argv[++i];
+        } else if (std::strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            opts.buffer_size = std::strtoull(argv[++i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "-l") == 0) {
+            opts.loopback = true;
+        } else if (std::strcmp(argv[i], "-t") == 0) {
+            opts.original_timing = true;
+        } else if (std::strcmp(argv[i], "-h") == 0) {
+            std::cout << "Usage: " << argv[0] << " [server] [-p port] [-d ib_dev] [-w log] [-s bytes] [-l] [-t]\n";
+            std::exit(0);
+        } else if (opts.server_name.empty()) {
+            opts.server_name = argv[i];
+        }
+    }
+    if ((opts.loopback || !opts.server_name.empty()) && opts.log.empty()) {
+        throw std::runtime_error("Replaying needs a workload log (-w)");
+    }
+    return opts;
+}
+
+struct Result {
+    uint64_t ops{0};
+    uint64_t bytes{0};
+    double seconds{0.0};
+    std::vector<double> latency_us;
+    std::vector<double> lag_us;
+};
+
+double micros(Clock::duration d) {
+    return std::chrono::duration<double, std::micro>(d).count();
+}
+
+int peerCount(const std::vector<WorkloadOp>& ops) {
+    int peers = 0;
+    for (const auto& op : ops) peers = std::max(peers, op.peer + 1);
+    return peers;
+}
+
+// Polls once, matching write completions to their posts per peer
+int reap(CollectiveFabric& fabric, std::vector<std::deque<Clock::time_point>>& inflight, Result& result) {
+    CollectiveFabric::Event events[32];
+    int ne = fabric.poll(events, 32);
+    auto now = Clock::now();
+    for (int i = 0; i < ne; ++i) {
+        if (events[i].kind != CollectiveFabric::Event::Kind::WriteDone) continue;
+        auto& posted = inflight.at(events[i].peer);
+        result.latency_us.push_back(micros(now - posted.front()));
+        posted.pop_front();
+    }
+    return ne;
+}
+
+// Replays from this rank to rank peer + 1 for every recorded peer
+Result replay(CollectiveFabric& fabric, const std::vector<WorkloadOp>& ops, bool original_timing) {
+    Result result;
+    int peers = fabric.size() - 1;
+    size_t buffer = fabric.bufferSize();
+    std::vector<std::deque<Clock::time_point>> inflight(fabric.size());
+    result.latency_us.reserve(ops.size());
+
+    auto start = Clock::now();
+    for (const auto& op : ops) {
+        int peer = op.peer % peers + 1;
+        uint32_t length = static_cast<uint32_t>(std::min<uint64_t>(op.length, buffer));
+        uint64_t offset = op.offset <= buffer - length ? op.offset : op.offset % (buffer - length + 1);
+
+        if (original_timing) {
+            auto due = start + std::chrono::nanoseconds(op.time_ns);
+            while (Clock::now() < due) reap(fabric, inflight, result);
+        }
+        while (inflight[peer].size() >= PEER_WINDOW) reap(fabric, inflight, result);
+
+        auto now = Clock::now();
+        if (original_timing) {
+            result.lag_us.push_back(micros(now - (start + std::chrono::nanoseconds(op.time_ns))));
+        }
+        fabric.write(peer, offset, offset, length, 0);
+        inflight[peer].push_back(now);
+        result.bytes += length;
+        reap(fabric, inflight, result);
+    }
+    while (result.latency_us.size() < ops.size()) reap(fabric, inflight, result);
+
+    result.ops = ops.size();
+    result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    return result;
+}
+
+void printPercentiles(const char* label, std::vector<double>& samples) {
+    if (samples.empty()) return;
+    std::sort(samples.begin(), samples.end());
+    auto at = [&](double q) { return samples[std::min(samples.size() - 1, static_cast<size_t>(q * samples.size()))]; };
+    std::printf("%-14s %10.2f %10.2f %10.2f %10.2f\n", label, at(0.5), at(0.99), at(0.999), samples.back());
+}
+
+void printResult(Result& result, int peers, const std::string& backend) {
+    std::cout << "\nReplayed " << result.ops << " ops (" << result.bytes << " bytes) to " << peers << " peers on "
+              << backend << " in " << result.seconds << " s\n";
+    std::printf("%.2f GB/s, %.3f Mops/s\n", result.bytes / result.seconds / 1e9, result.ops / result.seconds / 1e6);
+    std::printf("\n%-14s %10s %10s %10s %10s\n", "(us)", "p50", "p99", "p99.9", "max");
+    printPercentiles("latency", result.latency_us);
+    printPercentiles("schedule lag", result.lag_us);
+}
+
+void runLoopback(const Options& opts, const std::vector<WorkloadOp>& ops) {
+    int peers = peerCount(ops);
+    LoopbackNetwork network(peers + 1, opts.buffer_size);
+
+    // Targets only consume their arrivals
+    std::vector<uint64_t> expected(peers + 1, 0);
+    for (const auto& op : ops) expected[op.peer % peers + 1]++;
+    std::vector<std::thread> targets;
+    for (int r = 1; r <= peers; ++r) {
+        targets.emplace_back([&, r] {
+            CollectiveFabric::Event events[32];
+            for (uint64_t arrived = 0; arrived < expected[r];) {
+                arrived += network.rank(r).poll(events, 32);
+            }
+        });
+    }
+
+    Result result = replay(network.rank(0), ops, opts.original_timing);
+    for (auto& t : targets) t.join();
+    printResult(result, peers, "loopback");
+}
+
+// One QP per recorded peer, all to the same target
+void connectPeers(RdmaVerbs& rdma, RdmaFabric& fabric, int peers) {
+    for (int p = 1; p <= peers; ++p) {
+        struct ibv_qp* qp = rdma.createQp();
+        fabric.addPeer(p, qp, rdma.connectQp(qp));
+    }
+}
+
+void runRdma(const Options& opts) {
+    std::vector<WorkloadOp> ops;
+    if (!opts.server_name.empty()) {
+        ops = WorkloadRecorder::load(opts.log);
+        if (ops.empty()) {
+            throw std::runtime_error("Workload log is empty");
+        }
+    }
+
+    HpuManager hpu;
+    RdmaVerbs rdma;
+    hpu.initialize(opts.buffer_size);
+    rdma.initialize(opts.ib_dev_name.value_or(""), hpu);
+    rdma.connectQp(opts.server_name, opts.port);
+
+    uint32_t peers = static_cast<uint32_t>(peerCount(ops));
+    bool replayer = !opts.server_name.empty();
+    if (replayer ? write(rdma.getSock(), &peers, sizeof(peers)) != sizeof(peers)
+                 : read(rdma.getSock(), &peers, sizeof(peers)) != sizeof(peers)) {
+        throw std::runtime_error("Failed to exchange peer count");
+    }
+    RdmaFabric fabric(rdma, 0, static_cast<int>(peers) + 1);
+    connectPeers(rdma, fabric, static_cast<int>(peers));
+    std::cout << "✓ " << peers << " peer QPs connected\n";
+
+    char done = 'D';
+    if (replayer) {
+        Result result = replay(fabric, ops, opts.original_timing);
+        if (write(rdma.getSock(), &done, 1) != 1) {
+            std::cerr << "Failed to signal target\n";
+        }
+        printResult(result, static_cast<int>(peers), "RDMA");
+        return;
+    }
+
+    std::cout << "Receiving replayed writes...\n";
+    uint64_t arrived = 0;
+    CollectiveFabric::Event events[32];
+    while (recv(rdma.getSock(), &done, 1, MSG_DONTWAIT) != 1) {
+        arrived += fabric.poll(events, 32);
+    }
+    std::cout << "✓ Replay finished, " << arrived << " writes received\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        Options opts = parseArguments(argc, argv);
+        std::cout << "Workload Replay Benchmark\n=========================\n";
+        if (opts.loopback) {
+            auto ops = WorkloadRecorder::load(opts.log);
+            if (ops.empty()) {
+                throw std::runtime_error("Workload log is empty");
+            }
+            runLoopback(opts, ops);
+        } else {
+            runRdma(opts);
+        }
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "replay_bench failed: " << e.what() << "\n";
+        return 1;
+    }
+}
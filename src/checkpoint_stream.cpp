@@ -0,0 +1,329 @@
+#include "checkpoint_stream.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace {
+
+constexpr uint32_t MAX_STREAM_DEPTH = 16;
+
+// O_DIRECT offsets, lengths and buffers are multiples of this
+constexpr size_t DIRECT_ALIGNMENT = 4096;
+
+// No progress for this long means the peer or the disk is stuck
+constexpr std::chrono::seconds STREAM_IDLE_TIMEOUT(10);
+
+// Host slots of one side, swapped when the stream is constructed
+struct SlabInfo {
+    uint64_t addr;
+    uint32_t rkey;
+} __attribute__((packed));
+
+bool openedDirect(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0) {
+        throw std::runtime_error("Bad checkpoint file descriptor");
+    }
+    return flags & O_DIRECT;
+}
+
+double seconds(std::chrono::steady_clock::duration d) {
+    return std::chrono::duration<double>(d).count();
+}
+
+} // namespace
+
+CheckpointStream::CheckpointStream(RdmaVerbs& rdma, struct ibv_qp* qp, const CmConData& remote,
+                                   size_t chunk_size, uint32_t depth)
+    : rdma_(rdma), qp_(qp), remote_(remote), chunk_size_(chunk_size), depth_(depth), ring_(depth) {
+    if (depth_ == 0 || depth_ > MAX_STREAM_DEPTH) {
+        throw std::runtime_error("Stream depth must be between 1 and " + std::to_string(MAX_STREAM_DEPTH));
+    }
+    if (chunk_size_ == 0 || chunk_size_ % DIRECT_ALIGNMENT != 0 || chunk_size_ > (1u << 30)) {
+        throw std::runtime_error("Stream chunk size must be a multiple of 4 KB up to 1 GB");
+    }
+
+    size_t slab_size = depth_ * chunk_size_;
+    slab_ = static_cast<uint8_t*>(aligned_alloc(DIRECT_ALIGNMENT, slab_size));
+    if (!slab_) {
+        throw std::runtime_error("Failed to allocate stream slots");
+    }
+    slab_mr_ = rdma_.registerHostMemory(slab_, slab_size);
+    ring_.registerBuffer(slab_, slab_size);
+    done_bytes_.assign(depth_, 0);
+
+    SlabInfo local = {htonll(reinterpret_cast<uintptr_t>(slab_)), htonl(slab_mr_->rkey)}, peer = {};
+    if (write(rdma_.getSock(), &local, sizeof(local)) != sizeof(local) ||
+        read(rdma_.getSock(), &peer, sizeof(peer)) != sizeof(peer)) {
+        rdma_.deregisterMemory(slab_mr_);
+        free(slab_);
+        throw std::runtime_error("Failed to exchange stream slots");
+    }
+    peer_slab_addr_ = ntohll(peer.addr);
+    peer_slab_rkey_ = ntohl(peer.rkey);
+
+    // One receive per slot covers both credits and chunk notifications
+    for (uint32_t i = 0; i < depth_; ++i) {
+        postRecv();
+    }
+}
+
+CheckpointStream::~CheckpointStream() {
+    // A failed transfer may leave disk I/O targeting the slots
+    IoRing::Completion io[16];
+    while (ring_.inFlight() > 0) {
+        ring_.poll(io, 16);
+    }
+    rdma_.deregisterMemory(slab_mr_);
+    free(slab_);
+}
+
+uint64_t CheckpointStream::chunkLength(uint64_t index, size_t length) const {
+    return std::min<uint64_t>(chunk_size_, length - index * chunk_size_);
+}
+
+// Disk I/O size of a chunk; O_DIRECT rounds the tail up to a whole block
+uint32_t CheckpointStream::ioLength(uint64_t index, size_t length, bool direct) const {
+    uint64_t chunk = chunkLength(index, length);
+    if (direct) chunk = (chunk + DIRECT_ALIGNMENT - 1) / DIRECT_ALIGNMENT * DIRECT_ALIGNMENT;
+    return static_cast<uint32_t>(chunk);
+}
+
+void CheckpointStream::postChunk(uint64_t index, uint64_t length, uint64_t remote_addr, uint32_t rkey) {
+    struct ibv_sge sge = {};
+    sge.addr = reinterpret_cast<uintptr_t>(slot(index));
+    sge.length = static_cast<uint32_t>(length);
+    sge.lkey = slab_mr_->lkey;
+
+    struct ibv_send_wr wr = {};
+    wr.wr_id = index;
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    wr.opcode = IBV_WR_RDMA_WRITE_WITH_IMM;
+    wr.send_flags = IBV_SEND_SIGNALED;
+    wr.imm_data = htonl(static_cast<uint32_t>(index));
+    wr.wr.rdma.remote_addr = remote_addr;
+    wr.wr.rdma.rkey = rkey;
+    rdma_.postSend(qp_, &wr);
+}
+
+void CheckpointStream::postCredit(uint64_t index) {
+    struct ibv_send_wr wr = {};
+    wr.wr_id = index;
+    wr.num_sge = 0;
+    wr.opcode = IBV_WR_SEND_WITH_IMM;
+    wr.send_flags = IBV_SEND_SIGNALED;
+    wr.imm_data = htonl(static_cast<uint32_t>(index));
+    rdma_.postSend(qp_, &wr);
+}
+
+void CheckpointStream::postRecv() {
+    struct ibv_recv_wr wr = {};
+    wr.num_sge = 0;
+    rdma_.postReceive(qp_, &wr);
+}
+
+CheckpointStream::Stats CheckpointStream::sendFile(int fd, size_t length, Destination destination,
+                                                   uint64_t remote_offset) {
+    Stats stats;
+    bool direct = openedDirect(fd);
+    bool to_file = destination == Destination::PeerFile;
+    uint64_t chunks = chunkCount(length);
+    uint64_t next_read = 0, next_write = 0, write_done = 0, credits = 0;
+    std::fill(done_bytes_.begin(), done_bytes_.end(), 0);
+    auto start = std::chrono::steady_clock::now();
+    auto last_progress = start, last = start;
+
+    while (write_done < chunks || credits < chunks) {
+        bool progressed = false;
+
+        // Read ahead into every slot whose previous chunk is off the wire
+        while (next_read < chunks && next_read < write_done + depth_) {
+            ring_.read(fd, slot(next_read), ioLength(next_read, length, direct), next_read * chunk_size_, next_read);
+            next_read++;
+            progressed = true;
+        }
+
+        IoRing::Completion io[16];
+        int nio = ring_.poll(io, 16);
+        for (int i = 0; i < nio; ++i) {
+            uint64_t index = io[i].tag;
+            if (io[i].result < 0) {
+                throw std::runtime_error("Checkpoint read failed: " + std::string(strerror(-io[i].result)));
+            }
+            if (io[i].result == 0) {
+                throw std::runtime_error("Checkpoint file is shorter than " + std::to_string(length) + " bytes");
+            }
+            uint32_t& got = done_bytes_[index % depth_];
+            got += static_cast<uint32_t>(io[i].result);
+            if (got < chunkLength(index, length)) {
+                ring_.read(fd, slot(index) + got, ioLength(index, length, direct) - got,
+                           index * chunk_size_ + got, index);
+            }
+            progressed = true;
+        }
+
+        // Chunks go out in order, each on a credit: a freed slot for a file,
+        // a reposted receive for memory, so the peer never runs out of either
+        while (next_write < next_read && done_bytes_[next_write % depth_] >= chunkLength(next_write, length) &&
+               next_write < credits + depth_) {
+            if (to_file) {
+                postChunk(next_write, chunkLength(next_write, length),
+                          peer_slab_addr_ + (next_write % depth_) * chunk_size_, peer_slab_rkey_);
+            } else {
+                postChunk(next_write, chunkLength(next_write, length),
+                          remote_.addr + remote_offset + next_write * chunk_size_, remote_.rkey);
+            }
+            done_bytes_[next_write % depth_] = 0;
+            next_write++;
+            progressed = true;
+        }
+
+        struct ibv_wc wc[16];
+        int ne = rdma_.pollCompletions(wc, 16);
+        for (int i = 0; i < ne; ++i) {
+            if (wc[i].status != IBV_WC_SUCCESS) {
+                throw std::runtime_error("Checkpoint send failed: " + std::string(ibv_wc_status_str(wc[i].status)));
+            }
+            if (wc[i].opcode == IBV_WC_RDMA_WRITE) {
+                write_done++;
+            } else if (wc[i].opcode == IBV_WC_RECV) {
+                credits++;
+                postRecv();
+            }
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (next_write == write_done && ring_.inFlight() > 0) {
+            stats.disk_wait_seconds += seconds(now - last);
+        }
+        last = now;
+        if (progressed || ne > 0) {
+            last_progress = now;
+        } else if (now - last_progress > STREAM_IDLE_TIMEOUT) {
+            throw std::runtime_error("Checkpoint send timeout");
+        }
+    }
+
+    stats.chunks = chunks;
+    stats.bytes = length;
+    stats.seconds = seconds(std::chrono::steady_clock::now() - start);
+    return stats;
+}
+
+CheckpointStream::Stats CheckpointStream::receiveToMemory(size_t length) {
+    Stats stats;
+    uint64_t chunks = chunkCount(length);
+    uint64_t arrived = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto last_progress = start;
+
+    while (arrived < chunks) {
+        struct ibv_wc wc[16];
+        int ne = rdma_.pollCompletions(wc, 16);
+        for (int i = 0; i < ne; ++i) {
+            if (wc[i].status != IBV_WC_SUCCESS) {
+                throw std::runtime_error("Checkpoint receive failed: " +
+                                         std::string(ibv_wc_status_str(wc[i].status)));
+            }
+            if (wc[i].opcode != IBV_WC_RECV_RDMA_WITH_IMM) continue;
+            if (ntohl(wc[i].imm_data) != arrived) {
+                throw std::runtime_error("Checkpoint chunk " + std::to_string(ntohl(wc[i].imm_data)) +
+                                         " out of order");
+            }
+            postRecv();
+            postCredit(arrived);
+            arrived++;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (ne > 0) {
+            last_progress = now;
+        } else if (now - last_progress > STREAM_IDLE_TIMEOUT) {
+            throw std::runtime_error("Checkpoint receive timeout");
+        }
+    }
+
+    stats.chunks = chunks;
+    stats.bytes = length;
+    stats.seconds = seconds(std::chrono::steady_clock::now() - start);
+    return stats;
+}
+
+CheckpointStream::Stats CheckpointStream::receiveToFile(int fd, size_t length) {
+    Stats stats;
+    bool direct = openedDirect(fd);
+    uint64_t chunks = chunkCount(length);
+    uint64_t arrived = 0, done = 0;
+    std::fill(done_bytes_.begin(), done_bytes_.end(), 0);
+    auto start = std::chrono::steady_clock::now();
+    auto last_progress = start, last = start;
+
+    while (done < chunks) {
+        bool progressed = false;
+
+        // RC delivers writes in order, each into the slot of its index
+        struct ibv_wc wc[16];
+        int ne = rdma_.pollCompletions(wc, 16);
+        for (int i = 0; i < ne; ++i) {
+            if (wc[i].status != IBV_WC_SUCCESS) {
+                throw std::runtime_error("Checkpoint receive failed: " +
+                                         std::string(ibv_wc_status_str(wc[i].status)));
+            }
+            if (wc[i].opcode != IBV_WC_RECV_RDMA_WITH_IMM) continue;
+            uint64_t index = ntohl(wc[i].imm_data);
+            if (index != arrived) {
+                throw std::runtime_error("Checkpoint chunk " + std::to_string(index) + " out of order");
+            }
+            postRecv();
+            ring_.write(fd, slot(index), ioLength(index, length, direct), index * chunk_size_, index);
+            arrived++;
+        }
+
+        IoRing::Completion io[16];
+        int nio = ring_.poll(io, 16);
+        for (int i = 0; i < nio; ++i) {
+            uint64_t index = io[i].tag;
+            if (io[i].result <= 0) {
+                throw std::runtime_error("Checkpoint write failed: " +
+                                         std::string(io[i].result < 0 ? strerror(-io[i].result) : "no progress"));
+            }
+            uint32_t& written = done_bytes_[index % depth_];
+            written += static_cast<uint32_t>(io[i].result);
+            uint32_t total = ioLength(index, length, direct);
+            if (written < total) {
+                ring_.write(fd, slot(index) + written, total - written, index * chunk_size_ + written, index);
+            }
+            progressed = true;
+        }
+
+        // Slots go back in order once their chunk is on disk
+        while (done < arrived && done_bytes_[done % depth_] >= ioLength(done, length, direct)) {
+            postCredit(done);
+            done_bytes_[done % depth_] = 0;
+            done++;
+            progressed = true;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (arrived - done == depth_ && ring_.inFlight() > 0) {
+            stats.disk_wait_seconds += seconds(now - last);
+        }
+        last = now;
+        if (progressed || ne > 0) {
+            last_progress = now;
+        } else if (now - last_progress > STREAM_IDLE_TIMEOUT) {
+            throw std::runtime_error("Checkpoint receive timeout");
+        }
+    }
+
+    // Drops the rounded-up O_DIRECT tail and any older, longer contents
+    if (ftruncate(fd, static_cast<off_t>(length)) != 0) {
+        throw std::runtime_error("Failed to truncate checkpoint file");
+    }
+
+    stats.chunks = chunks;
+    stats.bytes = length;
+    stats.seconds = seconds(std::chrono::steady_clock::now() - start);
+    return stats;
+}
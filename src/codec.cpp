@@ -0,0 +1,310 @@
+#include "codec.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <string>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+namespace {
+
+inline float bitsToFloat(uint32_t bits) {
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+inline uint32_t floatToBits(float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+// Round to nearest even, NaN stays NaN
+inline uint16_t toBf16(float f) {
+    uint32_t bits = floatToBits(f);
+    if ((bits & 0x7fffffff) > 0x7f800000) {
+        return static_cast<uint16_t>((bits >> 16) | 0x40);
+    }
+    bits += 0x7fff + ((bits >> 16) & 1);
+    return static_cast<uint16_t>(bits >> 16);
+}
+
+inline float fromBf16(uint16_t h) {
+    return bitsToFloat(static_cast<uint32_t>(h) << 16);
+}
+
+// OCP FP8 E4M3: bias 7, no infinities, 0x7f is NaN, 448 is the largest finite
+constexpr float FP8_MAX = 448.0f;
+
+inline uint8_t toFp8(float f) {
+    uint32_t bits = floatToBits(f);
+    uint8_t sign = static_cast<uint8_t>((bits >> 24) & 0x80);
+    uint32_t abs = bits & 0x7fffffff;
+
+    if (abs > 0x7f800000) return sign | 0x7f;
+    if (abs >= floatToBits(FP8_MAX)) return sign | 0x7e;
+    // Below 2^-6 the format is subnormal in steps of 2^-9
+    if (abs < 0x3c800000) {
+        return sign | static_cast<uint8_t>(std::lrint(bitsToFloat(abs) * 512.0f));
+    }
+    // Rebias the exponent and round 23 mantissa bits to 3, nearest even
+    uint32_t v = ((((abs >> 23) - 127 + 7) << 23) | (abs & 0x7fffff));
+    v += 0x7ffff + ((v >> 20) & 1);
+    return sign | static_cast<uint8_t>(std::min<uint32_t>(v >> 20, 0x7e));
+}
+
+struct Fp8Table {
+    float values[256];
+
+    Fp8Table() {
+        for (int c = 0; c < 256; ++c) {
+            int exp = (c >> 3) & 0xf;
+            int mant = c & 7;
+            float v = exp == 0 ? std::ldexp(mant / 8.0f, -6) : std::ldexp(1.0f + mant / 8.0f, exp - 7);
+            if ((c & 0x7f) == 0x7f) v = std::nanf("");
+            values[c] = (c & 0x80) ? -v : v;
+        }
+    }
+};
+
+const Fp8Table FP8_TABLE;
+
+class Lz4Codec : public Codec {
+public:
+    size_t encode(const uint8_t* src, size_t length, uint64_t, uint8_t* dst, size_t capacity) override {
+#ifdef HAVE_LZ4
+        int n = LZ4_compress_default(reinterpret_cast<const char*>(src), reinterpret_cast<char*>(dst),
+                                     static_cast<int>(length), static_cast<int>(std::min<size_t>(capacity, INT32_MAX)));
+        return n > 0 ? static_cast<size_t>(n) : 0;
+#else
+        (void)src; (void)length; (void)dst; (void)capacity;
+        return 0;
+#endif
+    }
+
+    void decode(const uint8_t* src, size_t encoded, uint8_t* dst, size_t length) override {
+#ifdef HAVE_LZ4
+        int n = LZ4_decompress_safe(reinterpret_cast<const char*>(src), reinterpret_cast<char*>(dst),
+                                    static_cast<int>(encoded), static_cast<int>(length));
+        if (n < 0 || static_cast<size_t>(n) != length) {
+            throw std::runtime_error("Corrupt LZ4 chunk");
+        }
+#else
+        (void)src; (void)encoded; (void)dst; (void)length;
+        throw std::runtime_error("LZ4 support not built in");
+#endif
+    }
+};
+
+// fp32 quantization with a per-element error feedback residual
+class QuantCodec : public Codec {
+public:
+    void begin(size_t length, uint64_t tensor_id) override {
+        if (length % sizeof(float) != 0) {
+            throw std::runtime_error("Quantized transfer is not a whole number of fp32 elements");
+        }
+        // A tensor that changed size starts over, as does every untracked one
+        residual_ = &residuals_[tensor_id];
+        if (tensor_id == 0 || residual_->size() != length / sizeof(float)) {
+            residual_->assign(length / sizeof(float), 0.0f);
+        }
+    }
+
+protected:
+    float* residual(uint64_t position, size_t length) {
+        if (position % sizeof(float) != 0 || length % sizeof(float) != 0 ||
+            !residual_ || (position + length) / sizeof(float) > residual_->size()) {
+            throw std::runtime_error("Quantized chunk outside the transfer");
+        }
+        return residual_->data() + position / sizeof(float);
+    }
+
+private:
+    std::map<uint64_t, std::vector<float>> residuals_;  // By tensor id
+    std::vector<float>* residual_{nullptr};              // The current transfer's
+};
+
+class Bf16Codec : public QuantCodec {
+public:
+    size_t encode(const uint8_t* src, size_t length, uint64_t position, uint8_t* dst, size_t capacity) override {
+        size_t count = length / sizeof(float);
+        if (count * sizeof(uint16_t) > capacity) return 0;
+        float* r = residual(position, length);
+        const float* in = reinterpret_cast<const float*>(src);
+        uint16_t* out = reinterpret_cast<uint16_t*>(dst);
+
+        for (size_t i = 0; i < count; ++i) {
+            float x = in[i] + r[i];
+            out[i] = toBf16(x);
+            r[i] = x - fromBf16(out[i]);
+        }
+        return count * sizeof(uint16_t);
+    }
+
+    void decode(const uint8_t* src, size_t encoded, uint8_t* dst, size_t length) override {
+        size_t count = length / sizeof(float);
+        if (encoded != count * sizeof(uint16_t)) {
+            throw std::runtime_error("Corrupt BF16 chunk");
+        }
+        const uint16_t* in = reinterpret_cast<const uint16_t*>(src);
+        float* out = reinterpret_cast<float*>(dst);
+        for (size_t i = 0; i < count; ++i) {
+            out[i] = fromBf16(in[i]);
+        }
+    }
+};
+
+// Per-chunk scale maps the chunk's largest magnitude onto FP8_MAX.
+// Encoded chunk: fp32 scale, then one byte per element.
+class Fp8Codec : public QuantCodec {
+public:
+    size_t encode(const uint8_t* src, size_t length, uint64_t position, uint8_t* dst, size_t capacity) override {
+        size_t count = length / sizeof(float);
+        if (sizeof(float) + count > capacity) return 0;
+        float* r = residual(position, length);
+        const float* in = reinterpret_cast<const float*>(src);
+
+        float amax = 0.0f;
+        for (size_t i = 0; i < count; ++i) {
+            amax = std::max(amax, std::fabs(in[i] + r[i]));
+        }
+        float scale = amax > 0.0f && std::isfinite(amax) ? amax / FP8_MAX : 1.0f;
+        float inverse = 1.0f / scale;
+        memcpy(dst, &scale, sizeof(scale));
+
+        uint8_t* out = dst + sizeof(float);
+        for (size_t i = 0; i < count; ++i) {
+            float x = in[i] + r[i];
+            out[i] = toFp8(x * inverse);
+            r[i] = x - FP8_TABLE.values[out[i]] * scale;
+        }
+        return sizeof(float) + count;
+    }
+
+    void decode(const uint8_t* src, size_t encoded, uint8_t* dst, size_t length) override {
+        size_t count = length / sizeof(float);
+        if (encoded != sizeof(float) + count) {
+            throw std::runtime_error("Corrupt FP8 chunk");
+        }
+        float scale;
+        memcpy(&scale, src, sizeof(scale));
+        const uint8_t* in = src + sizeof(float);
+        float* out = reinterpret_cast<float*>(dst);
+        for (size_t i = 0; i < count; ++i) {
+            out[i] = FP8_TABLE.values[in[i]] * scale;
+        }
+    }
+};
+
+double threadCpuSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+} // namespace
+
+const char* codecName(CodecType type) {
+    switch (type) {
+    case CodecType::None: return "none";
+    case CodecType::Lz4: return "lz4";
+    case CodecType::Bf16: return "bf16";
+    case CodecType::Fp8: return "fp8";
+    }
+    return "unknown";
+}
+
+bool codecAvailable(CodecType type) {
+#ifndef HAVE_LZ4
+    if (type == CodecType::Lz4) return false;
+#endif
+    return type != CodecType::None;
+}
+
+std::unique_ptr<Codec> makeCodec(CodecType type) {
+    if (!codecAvailable(type)) {
+        throw std::runtime_error(std::string("Codec not available: ") + codecName(type));
+    }
+    switch (type) {
+    case CodecType::Lz4: return std::make_unique<Lz4Codec>();
+    case CodecType::Bf16: return std::make_unique<Bf16Codec>();
+    default: return std::make_unique<Fp8Codec>();
+    }
+}
+
+CodecPool::CodecPool(uint32_t threads) {
+    if (threads == 0) {
+        throw std::runtime_error("Codec pool needs at least one thread");
+    }
+    for (uint32_t i = 0; i < threads; ++i) {
+        threads_.emplace_back(&CodecPool::worker, this);
+    }
+}
+
+CodecPool::~CodecPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& t : threads_) t.join();
+}
+
+uint64_t CodecPool::submit(std::function<void()> job) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    jobs_.emplace_back(++submitted_, std::move(job));
+    finished_.push_back(false);
+    cv_.notify_one();
+    return submitted_;
+}
+
+bool CodecPool::done(uint64_t handle) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (error_ && handle >= error_handle_) {
+        std::rethrow_exception(error_);
+    }
+    return completed_ >= handle;
+}
+
+double CodecPool::cpuSeconds() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return cpu_seconds_;
+}
+
+void CodecPool::worker() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        cv_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+        if (stop_ && jobs_.empty()) return;
+
+        auto job = std::move(jobs_.front());
+        jobs_.pop_front();
+        lock.unlock();
+
+        std::exception_ptr error;
+        double start = threadCpuSeconds();
+        try {
+            job.second();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        double cpu = threadCpuSeconds() - start;
+
+        lock.lock();
+        cpu_seconds_ += cpu;
+        if (error && (!error_ || job.first < error_handle_)) {
+            error_ = error;
+            error_handle_ = job.first;
+        }
+        finished_[job.first - completed_ - 1] = true;
+        while (!finished_.empty() && finished_.front()) {
+            finished_.pop_front();
+            completed_++;
+        }
+    }
+}
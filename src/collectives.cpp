@@ -0,0 +1,460 @@
+#include "collectives.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace {
+
+// Immediate of a credit write: flag plus the number of slots returned
+constexpr uint32_t CREDIT_FLAG = 1u << 31;
+
+// Immediate of an all-to-all end-of-block marker: flag plus the block bytes
+constexpr uint32_t BLOCK_FLAG = 1u << 30;
+
+// Writes in flight per rank, keeps every peer QP well under its depth
+constexpr uint64_t MAX_OUTSTANDING = QP_DEPTH / 2;
+
+int wrapRank(int64_t rank, int size) {
+    return static_cast<int>(((rank % size) + size) % size);
+}
+
+} // namespace
+
+RdmaFabric::RdmaFabric(RdmaVerbs& rdma, int rank, int size)
+    : rdma_(rdma), rank_(rank), size_(size) {}
+
+void RdmaFabric::addPeer(int peer, struct ibv_qp* qp, const CmConData& remote) {
+    peers_[peer] = {qp, remote};
+    qp_to_peer_[qp->qp_num] = peer;
+    for (uint32_t i = 0; i < QP_DEPTH; ++i) {
+        postRecv(peer, qp);
+    }
+}
+
+void RdmaFabric::postRecv(int peer, struct ibv_qp* qp) {
+    struct ibv_recv_wr wr = {};
+    wr.wr_id = static_cast<uint64_t>(peer);
+    wr.num_sge = 0;
+    rdma_.postReceive(qp, &wr);
+}
+
+void RdmaFabric::write(int peer, uint64_t local_offset, uint64_t remote_offset, uint32_t length, uint32_t imm) {
+    auto it = peers_.find(peer);
+    if (it == peers_.end()) {
+        throw std::runtime_error("Unknown collective peer " + std::to_string(peer));
+    }
+
+    RdmaOp op;
+    op.opcode = IBV_WR_RDMA_WRITE_WITH_IMM;
+    op.offset = local_offset;
+    op.length = length;
+    op.remote_addr = it->second.remote.addr + remote_offset;
+    op.rkey = it->second.remote.rkey;
+    op.wr_id = static_cast<uint64_t>(peer);
+    op.imm_data = htonl(imm);
+    rdma_.postSend(it->second.qp, op);
+}
+
+int RdmaFabric::poll(Event* events, int max_events) {
+    struct ibv_wc wc[32];
+    int ne = rdma_.pollCompletions(wc, std::min(max_events, 32));
+
+    for (int i = 0; i < ne; ++i) {
+        if (wc[i].status != IBV_WC_SUCCESS) {
+            throw std::runtime_error("Collective write failed: " + std::string(ibv_wc_status_str(wc[i].status)));
+        }
+        int peer = static_cast<int>(wc[i].wr_id);
+        if (wc[i].opcode == IBV_WC_RECV_RDMA_WITH_IMM) {
+            events[i] = {Event::Kind::Arrived, peer, ntohl(wc[i].imm_data)};
+            postRecv(peer, peers_[peer].qp);
+        } else {
+            events[i] = {Event::Kind::WriteDone, peer, 0};
+        }
+    }
+    return ne;
+}
+
+void RdmaFabric::copy(uint64_t dst_offset, uint64_t src_offset, size_t length) {
+    uint8_t* base = rdma_.getHostBuffer();
+    if (!base) {
+        throw std::runtime_error("Local copy needs a host-mapped buffer");
+    }
+    if (dst_offset + length > bufferSize() || src_offset + length > bufferSize()) {
+        throw std::runtime_error("Local copy out of bounds");
+    }
+    memmove(base + dst_offset, base + src_offset, length);
+}
+
+Collectives::Collectives(CollectiveFabric& fabric, Reducer& reducer, size_t chunk_size, uint32_t slots)
+    : fabric_(fabric), reducer_(reducer), chunk_size_(chunk_size), slots_(slots) {
+    if (chunk_size_ == 0 || chunk_size_ > UINT32_MAX || slots_ == 0) {
+        throw std::runtime_error("Invalid collective chunk configuration");
+    }
+    if (fabric_.bufferSize() < scratchSize(chunk_size_, slots_)) {
+        throw std::runtime_error("Buffer too small for collective scratch slots");
+    }
+    scratch_base_ = fabric_.bufferSize() - scratchSize(chunk_size_, slots_);
+}
+
+Collectives::Stats Collectives::allreduce(uint64_t offset, size_t bytes, size_t elem_size, Algorithm algorithm) {
+    if (elem_size == 0 || bytes % elem_size != 0) {
+        throw std::runtime_error("Allreduce size is not a whole number of elements");
+    }
+    if (offset + bytes > scratch_base_) {
+        throw std::runtime_error("Allreduce range overlaps the scratch slots");
+    }
+    size_t chunk = chunk_size_ / elem_size * elem_size;
+    if (chunk == 0) {
+        throw std::runtime_error("Chunk size smaller than one element");
+    }
+
+    int n = fabric_.size();
+    uint64_t writes = writes_;
+    auto start = std::chrono::steady_clock::now();
+
+    if (n > 1 && bytes > 0) {
+        if (algorithm == Algorithm::Ring) {
+            ring(offset, bytes, elem_size, chunk);
+        } else {
+            tree(offset, bytes, chunk);
+        }
+    }
+    return finish(start, writes, bytes, 2.0 * (n - 1) / n);
+}
+
+Collectives::Stats Collectives::broadcast(int root, uint64_t offset, size_t bytes, BroadcastShape shape) {
+    int n = fabric_.size();
+    if (root < 0 || root >= n) {
+        throw std::runtime_error("Broadcast root out of range");
+    }
+    if (offset + bytes > scratch_base_) {
+        throw std::runtime_error("Broadcast range overlaps the scratch slots");
+    }
+
+    uint64_t writes = writes_;
+    auto start = std::chrono::steady_clock::now();
+    if (n == 1 || bytes == 0) {
+        return finish(start, writes, bytes, 1.0);
+    }
+
+    // Position relative to the root, then parent and children in that order
+    int v = wrapRank(fabric_.rank() - root, n);
+    int parent = -1;
+    std::vector<int> children;
+    if (shape == BroadcastShape::Chain) {
+        if (v > 0) parent = wrapRank(v - 1 + root, n);
+        if (v + 1 < n) children.push_back(wrapRank(v + 1 + root, n));
+    } else {
+        if (v > 0) parent = wrapRank((v - 1) / 2 + root, n);
+        for (int c = 2 * v + 1; c <= 2 * v + 2 && c < n; ++c) {
+            children.push_back(wrapRank(c + root, n));
+        }
+    }
+
+    uint64_t chunks = (bytes + chunk_size_ - 1) / chunk_size_;
+    uint64_t parent_base = parent >= 0 ? links_[parent].processed : 0;
+    uint64_t ready = parent >= 0 ? 0 : chunks;
+    std::vector<uint64_t> down_sent(children.size(), 0);
+
+    for (;;) {
+        if (parent >= 0) {
+            Link& link = links_[parent];
+            while (link.arrived > link.processed && link.processed - parent_base < chunks) {
+                link.processed++;
+            }
+            ready = link.processed - parent_base;
+        }
+
+        // Forward every chunk that has landed
+        bool done = ready == chunks;
+        for (size_t i = 0; i < children.size(); ++i) {
+            while (down_sent[i] < ready && canPost()) {
+                uint64_t begin = down_sent[i]++ * chunk_size_;
+                sendDirect(children[i], offset + begin, std::min<uint64_t>(chunk_size_, bytes - begin));
+            }
+            done = done && down_sent[i] == chunks;
+        }
+        if (done) break;
+
+        progress();
+    }
+    drain();
+    return finish(start, writes, bytes, 1.0);
+}
+
+Collectives::Stats Collectives::allToAll(uint64_t send_offset, const std::vector<size_t>& send_bytes,
+                                         uint64_t recv_offset, size_t recv_stride, std::vector<size_t>& recv_bytes) {
+    int n = fabric_.size();
+    int r = fabric_.rank();
+    if (send_bytes.size() != static_cast<size_t>(n)) {
+        throw std::runtime_error("All-to-all needs one send size per rank");
+    }
+
+    std::vector<uint64_t> displs(n + 1, 0);
+    for (int p = 0; p < n; ++p) {
+        if (send_bytes[p] > recv_stride || send_bytes[p] >= BLOCK_FLAG) {
+            throw std::runtime_error("All-to-all block for rank " + std::to_string(p) + " too large");
+        }
+        displs[p + 1] = displs[p] + send_bytes[p];
+    }
+    if (send_offset + displs[n] > scratch_base_ || recv_offset + n * recv_stride > scratch_base_) {
+        throw std::runtime_error("All-to-all range overlaps the scratch slots");
+    }
+
+    uint64_t writes = writes_;
+    auto start = std::chrono::steady_clock::now();
+
+    recv_bytes.assign(n, 0);
+    fabric_.copy(recv_offset + r * recv_stride, send_offset + displs[r], send_bytes[r]);
+    recv_bytes[r] = send_bytes[r];
+
+    std::vector<uint64_t> sent(n, 0);
+    std::vector<bool> announced(n, false), received(n, false);
+    announced[r] = received[r] = true;
+    int pending = 2 * (n - 1);
+
+    while (pending > 0) {
+        // One chunk per peer per pass, starting right of this rank so the
+        // ranks do not all converge on the same target
+        bool posted = true;
+        while (posted && canPost()) {
+            posted = false;
+            for (int i = 1; i < n && canPost(); ++i) {
+                int p = wrapRank(r + i, n);
+                if (announced[p]) continue;
+                if (sent[p] < send_bytes[p]) {
+                    uint64_t length = std::min<uint64_t>(chunk_size_, send_bytes[p] - sent[p]);
+                    fabric_.write(p, send_offset + displs[p] + sent[p], recv_offset + r * recv_stride + sent[p],
+                                  static_cast<uint32_t>(length), 0);
+                    sent[p] += length;
+                    writes_++;
+                } else {
+                    fabric_.write(p, 0, 0, 0, BLOCK_FLAG | static_cast<uint32_t>(send_bytes[p]));
+                    announced[p] = true;
+                    pending--;
+                }
+                outstanding_++;
+                posted = true;
+            }
+        }
+
+        // Writes between a pair arrive in order, so a peer's marker means its
+        // whole block is in place
+        for (int p = 0; p < n; ++p) {
+            Link& link = links_[p];
+            if (received[p] || link.blocks.empty()) continue;
+            recv_bytes[p] = link.blocks.front();
+            link.blocks.pop_front();
+            link.processed += (recv_bytes[p] + chunk_size_ - 1) / chunk_size_;
+            received[p] = true;
+            pending--;
+        }
+
+        progress();
+    }
+    drain();
+    return finish(start, writes, displs[n], n > 1 ? (n - 1.0) / n : 1.0);
+}
+
+Collectives::Stats Collectives::finish(std::chrono::steady_clock::time_point start, uint64_t writes,
+                                       size_t bytes, double bus_factor) const {
+    Stats stats;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    stats.writes = writes_ - writes;
+    if (stats.seconds > 0) {
+        stats.algbw = bytes / stats.seconds / 1e9;
+        stats.busbw = stats.algbw * bus_factor;
+    }
+    return stats;
+}
+
+void Collectives::ring(uint64_t offset, size_t bytes, size_t elem_size, size_t chunk) {
+    int n = fabric_.size();
+    int r = fabric_.rank();
+    int right = wrapRank(r + 1, n);
+    int left = wrapRank(r - 1, n);
+
+    uint64_t seg = (bytes / elem_size + n - 1) / n * elem_size;
+    uint64_t chunks = std::max<uint64_t>(1, (seg + chunk - 1) / chunk);
+    uint64_t scatter = (n - 1) * chunks;
+    uint64_t total = 2 * scatter;
+
+    // Byte range of the j-th send (or receive) of this rank's schedule
+    auto piece = [&](uint64_t j, bool recv) {
+        int64_t step = static_cast<int64_t>(j / chunks);
+        uint64_t k = j % chunks;
+        int64_t owner = step < n - 1 ? r - step : r + 1 - (step - (n - 1));
+        uint64_t index = wrapRank(owner - (recv ? 1 : 0), n);
+        uint64_t begin = std::min<uint64_t>(index * seg + k * chunk, bytes);
+        uint64_t end = std::min<uint64_t>({begin + chunk, (index + 1) * seg, bytes});
+        return std::make_pair(offset + begin, end - begin);
+    };
+
+    Link& in = links_[left];
+    uint64_t base = in.processed;
+    uint64_t sent = 0;
+
+    while (in.processed - base < total || sent < total) {
+        // Chunk j forwards what receive j - chunks produced
+        while (sent < total && (sent < chunks || in.processed - base > sent - chunks)) {
+            auto range = piece(sent, false);
+            if (sent < scatter) {
+                if (!canSendScratch(right)) break;
+                sendScratch(right, 0, range.first, range.second);
+            } else {
+                if (!canPost()) break;
+                sendDirect(right, range.first, range.second);
+            }
+            sent++;
+        }
+
+        while (in.arrived > in.processed && in.processed - base < total) {
+            uint64_t j = in.processed - base;
+            if (j < scatter) {
+                auto range = piece(j, true);
+                uint64_t src = scratchOffset(0, in.scratch_recv++);
+                if (range.second) reducer_.reduce(range.first, src, range.second);
+                in.credits_owed++;
+            }
+            in.processed++;
+        }
+
+        progress();
+    }
+    drain();
+}
+
+void Collectives::tree(uint64_t offset, size_t bytes, size_t chunk) {
+    int n = fabric_.size();
+    int r = fabric_.rank();
+    int parent = r > 0 ? (r - 1) / 2 : -1;
+    std::vector<int> children;
+    for (int c = 2 * r + 1; c <= 2 * r + 2 && c < n; ++c) {
+        children.push_back(c);
+    }
+
+    uint64_t chunks = (bytes + chunk - 1) / chunk;
+    auto piece = [&](uint64_t k) {
+        return std::make_pair(offset + k * chunk, std::min<uint64_t>(chunk, bytes - k * chunk));
+    };
+
+    std::vector<uint64_t> down_sent(children.size(), 0);
+    uint64_t parent_base = parent >= 0 ? links_[parent].processed : 0;
+    uint64_t reduced = children.empty() ? chunks : 0;
+    uint64_t up_sent = 0;
+
+    for (;;) {
+        // Fold chunk k of every child in one pass once all of them have it
+        while (reduced < chunks && !children.empty()) {
+            bool available = true;
+            for (int c : children) {
+                const Link& link = links_[c];
+                available = available && link.arrived > link.processed;
+            }
+            if (!available) break;
+
+            uint64_t srcs[2];
+            for (size_t i = 0; i < children.size(); ++i) {
+                Link& link = links_[children[i]];
+                srcs[i] = scratchOffset(i, link.scratch_recv++);
+                link.credits_owed++;
+                link.processed++;
+            }
+            auto range = piece(reduced++);
+            reducer_.reduce(range.first, srcs, children.size(), range.second);
+        }
+
+        uint64_t ready = reduced;
+        if (parent >= 0) {
+            while (up_sent < reduced && canSendScratch(parent)) {
+                auto range = piece(up_sent++);
+                sendScratch(parent, static_cast<uint32_t>((r - 1) % 2), range.first, range.second);
+            }
+            // Final values come back down in chunk order
+            Link& link = links_[parent];
+            while (link.arrived > link.processed && link.processed - parent_base < chunks) {
+                link.processed++;
+            }
+            ready = link.processed - parent_base;
+        }
+
+        bool done = ready == chunks;
+        for (size_t i = 0; i < children.size(); ++i) {
+            while (down_sent[i] < ready && canPost()) {
+                auto range = piece(down_sent[i]++);
+                sendDirect(children[i], range.first, range.second);
+            }
+            done = done && down_sent[i] == chunks;
+        }
+        if (done) break;
+
+        progress();
+    }
+    drain();
+}
+
+bool Collectives::canPost() const {
+    return outstanding_ < MAX_OUTSTANDING;
+}
+
+bool Collectives::canSendScratch(int peer) {
+    Link& link = links_[peer];
+    return canPost() && link.scratch_sent - link.credits < slots_;
+}
+
+uint64_t Collectives::scratchOffset(uint32_t link, uint64_t seq) const {
+    return scratch_base_ + (static_cast<uint64_t>(link) * slots_ + seq % slots_) * chunk_size_;
+}
+
+void Collectives::sendScratch(int peer, uint32_t link, uint64_t local_offset, uint64_t length) {
+    uint64_t remote = scratchOffset(link, links_[peer].scratch_sent++);
+    fabric_.write(peer, local_offset, remote, static_cast<uint32_t>(length), 0);
+    outstanding_++;
+    writes_++;
+}
+
+void Collectives::sendDirect(int peer, uint64_t offset, uint64_t length) {
+    fabric_.write(peer, offset, offset, static_cast<uint32_t>(length), 0);
+    outstanding_++;
+    writes_++;
+}
+
+void Collectives::sendCredits() {
+    for (auto& entry : links_) {
+        Link& link = entry.second;
+        if (link.credits_owed == 0 || !canPost()) continue;
+        fabric_.write(entry.first, 0, 0, 0, CREDIT_FLAG | static_cast<uint32_t>(link.credits_owed));
+        link.credits_owed = 0;
+        outstanding_++;
+    }
+}
+
+void Collectives::progress() {
+    sendCredits();
+
+    CollectiveFabric::Event events[32];
+    int ne = fabric_.poll(events, 32);
+    for (int i = 0; i < ne; ++i) {
+        if (events[i].kind == CollectiveFabric::Event::Kind::WriteDone) {
+            outstanding_--;
+        } else if (events[i].imm & CREDIT_FLAG) {
+            links_[events[i].peer].credits += events[i].imm & ~CREDIT_FLAG;
+        } else if (events[i].imm & BLOCK_FLAG) {
+            links_[events[i].peer].blocks.push_back(events[i].imm & ~BLOCK_FLAG);
+        } else {
+            links_[events[i].peer].arrived++;
+        }
+    }
+}
+
+void Collectives::drain() {
+    auto owed = [this] {
+        for (const auto& entry : links_) {
+            if (entry.second.credits_owed) return true;
+        }
+        return false;
+    };
+    while (outstanding_ > 0 || owed()) {
+        progress();
+    }
+}
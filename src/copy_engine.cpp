@@ -0,0 +1,51 @@
+#include "copy_engine.hpp"
+#include <chrono>
+#include <cstring>
+
+HostCopyEngine::HostCopyEngine(double gbps)
+    : gbps_(gbps), thread_(&HostCopyEngine::worker, this) {}
+
+HostCopyEngine::~HostCopyEngine() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+}
+
+uint64_t HostCopyEngine::copyAsync(uint64_t dst, uint64_t src, size_t length, Direction) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    jobs_.push_back({dst, src, length});
+    cv_.notify_one();
+    return ++submitted_;
+}
+
+bool HostCopyEngine::done(uint64_t handle) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return completed_ >= handle;
+}
+
+void HostCopyEngine::worker() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        cv_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+        if (stop_ && jobs_.empty()) return;
+
+        Job job = jobs_.front();
+        jobs_.pop_front();
+        lock.unlock();
+
+        auto start = std::chrono::steady_clock::now();
+        memcpy(reinterpret_cast<void*>(job.dst), reinterpret_cast<const void*>(job.src), job.length);
+        if (gbps_ > 0.0) {
+            auto budget = std::chrono::duration<double>(job.length / (gbps_ * 1e9));
+            while (std::chrono::steady_clock::now() - start < budget) {
+                std::this_thread::yield();
+            }
+        }
+
+        lock.lock();
+        completed_++;
+    }
+}
@@ -0,0 +1,234 @@
+#include "crc32c.hpp"
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CRC_TARGET __attribute__((target("sse4.2,pclmul")))
+#endif
+
+namespace {
+
+// Castagnoli polynomial, bit-reflected
+constexpr uint32_t CRC32C_POLY = 0x82f63b78;
+
+// Lane length of the three-way interleaved loop for what fused blocks leave
+constexpr size_t LANE = 256;
+
+// Fused blocks: a folded vector region followed by three crc32 lanes, sized
+// so the PCLMUL and crc32 units finish together (64 vs 3 x 24 bytes a step)
+constexpr size_t FUSED_STEPS = 64;
+constexpr size_t FUSED_VECTOR = 64 * FUSED_STEPS;
+constexpr size_t FUSED_LANE = 24 * FUSED_STEPS;
+constexpr size_t FUSED_BLOCK = FUSED_VECTOR + 3 * FUSED_LANE;
+
+// Slicing-by-8 tables
+struct Crc32cTable {
+    uint32_t t[8][256];
+
+    Crc32cTable() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int k = 0; k < 8; ++k) {
+                crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+            }
+            t[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; ++i) {
+            for (int k = 1; k < 8; ++k) {
+                t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+            }
+        }
+    }
+};
+
+const Crc32cTable TABLE;
+
+uint32_t softwareUpdate(const uint8_t* p, size_t n, uint32_t crc) {
+    while (n >= 8) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        v ^= crc;
+        crc = TABLE.t[7][v & 0xff] ^ TABLE.t[6][(v >> 8) & 0xff] ^ TABLE.t[5][(v >> 16) & 0xff] ^
+              TABLE.t[4][(v >> 24) & 0xff] ^ TABLE.t[3][(v >> 32) & 0xff] ^ TABLE.t[2][(v >> 40) & 0xff] ^
+              TABLE.t[1][(v >> 48) & 0xff] ^ TABLE.t[0][v >> 56];
+        p += 8;
+        n -= 8;
+    }
+    while (n--) {
+        crc = (crc >> 8) ^ TABLE.t[0][(crc ^ *p++) & 0xff];
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+
+// x^n mod P, bit-reflected
+uint32_t xPowMod(uint64_t n) {
+    uint32_t r = 0x80000000;
+    while (n--) {
+        r = (r >> 1) ^ ((r & 1) ? CRC32C_POLY : 0);
+    }
+    return r;
+}
+
+// Multipliers that advance a lane CRC over 8 * bytes zero bits. The carry-less
+// product carries one extra x and the final crc32 reduction adds x^32, hence -33.
+struct LaneShift {
+    uint32_t one;
+    uint32_t two;
+
+    explicit LaneShift(size_t lane) : one(xPowMod(8 * lane - 33)), two(xPowMod(16 * lane - 33)) {}
+};
+
+const LaneShift LANE_SHIFT(LANE);
+
+// Folding a 128-bit accumulator forward by bytes: the low (higher degree)
+// half is multiplied by x^(8 * bytes + 64 - 33), the high half by x^(8 * bytes - 33)
+struct FoldConstant {
+    uint64_t low;
+    uint64_t high;
+
+    explicit FoldConstant(size_t bytes) : low(xPowMod(8 * bytes + 31)), high(xPowMod(8 * bytes - 33)) {}
+};
+
+struct FusedConstants {
+    FoldConstant fold64{64};
+    FoldConstant fold48{48};
+    FoldConstant fold32{32};
+    FoldConstant fold16{16};
+    uint32_t lane1{xPowMod(8 * FUSED_LANE - 33)};
+    uint32_t lane2{xPowMod(16 * FUSED_LANE - 33)};
+    uint32_t lane3{xPowMod(24 * FUSED_LANE - 33)};
+};
+
+const FusedConstants FUSED;
+
+CRC_TARGET inline uint32_t shiftCrc(uint32_t crc, uint32_t multiplier) {
+    __m128i product = _mm_clmulepi64_si128(_mm_cvtsi32_si128(static_cast<int>(crc)),
+                                           _mm_cvtsi32_si128(static_cast<int>(multiplier)), 0);
+    return static_cast<uint32_t>(_mm_crc32_u64(0, static_cast<uint64_t>(_mm_cvtsi128_si64(product))));
+}
+
+CRC_TARGET inline uint64_t load64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+CRC_TARGET inline __m128i fold(__m128i acc, const FoldConstant& k) {
+    __m128i multiplier = _mm_set_epi64x(static_cast<long long>(k.high), static_cast<long long>(k.low));
+    return _mm_xor_si128(_mm_clmulepi64_si128(acc, multiplier, 0x00), _mm_clmulepi64_si128(acc, multiplier, 0x11));
+}
+
+// One fused block: four accumulators fold the vector region while three
+// crc32 lanes cover the rest, then all partial CRCs are shifted into place
+CRC_TARGET uint32_t fusedBlock(const uint8_t* p, uint32_t crc) {
+    const uint8_t* lane = p + FUSED_VECTOR;
+    __m128i acc[4];
+    for (int j = 0; j < 4; ++j) {
+        acc[j] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16 * j));
+    }
+    acc[0] = _mm_xor_si128(acc[0], _mm_cvtsi32_si128(static_cast<int>(crc)));
+
+    uint64_t c0 = 0, c1 = 0, c2 = 0;
+    for (size_t step = 0; step < FUSED_STEPS; ++step) {
+        if (step > 0) {
+            const uint8_t* v = p + 64 * step;
+            for (int j = 0; j < 4; ++j) {
+                acc[j] = _mm_xor_si128(fold(acc[j], FUSED.fold64),
+                                       _mm_loadu_si128(reinterpret_cast<const __m128i*>(v + 16 * j)));
+            }
+        }
+        const uint8_t* l = lane + 24 * step;
+        for (size_t i = 0; i < 24; i += 8) {
+            c0 = _mm_crc32_u64(c0, load64(l + i));
+            c1 = _mm_crc32_u64(c1, load64(l + FUSED_LANE + i));
+            c2 = _mm_crc32_u64(c2, load64(l + 2 * FUSED_LANE + i));
+        }
+    }
+
+    __m128i v = _mm_xor_si128(_mm_xor_si128(fold(acc[0], FUSED.fold48), fold(acc[1], FUSED.fold32)),
+                              _mm_xor_si128(fold(acc[2], FUSED.fold16), acc[3]));
+    uint64_t vector_crc = _mm_crc32_u64(0, static_cast<uint64_t>(_mm_cvtsi128_si64(v)));
+    vector_crc = _mm_crc32_u64(vector_crc, static_cast<uint64_t>(_mm_extract_epi64(v, 1)));
+
+    return shiftCrc(static_cast<uint32_t>(vector_crc), FUSED.lane3) ^
+           shiftCrc(static_cast<uint32_t>(c0), FUSED.lane2) ^
+           shiftCrc(static_cast<uint32_t>(c1), FUSED.lane1) ^ static_cast<uint32_t>(c2);
+}
+
+// crc32 has a three cycle latency and one per cycle throughput, so three
+// independent lanes keep the unit busy; the lane CRCs are then folded into
+// one with two carry-less multiplies
+CRC_TARGET uint32_t lanes(const uint8_t*& p, size_t& n, uint32_t crc, size_t lane, const LaneShift& shift) {
+    uint64_t c0 = crc;
+    while (n >= 3 * lane) {
+        uint64_t c1 = 0, c2 = 0;
+        for (size_t i = 0; i < lane; i += 8) {
+            c0 = _mm_crc32_u64(c0, load64(p + i));
+            c1 = _mm_crc32_u64(c1, load64(p + lane + i));
+            c2 = _mm_crc32_u64(c2, load64(p + 2 * lane + i));
+        }
+        c0 = shiftCrc(static_cast<uint32_t>(c0), shift.two) ^ shiftCrc(static_cast<uint32_t>(c1), shift.one) ^
+             static_cast<uint32_t>(c2);
+        p += 3 * lane;
+        n -= 3 * lane;
+    }
+    return static_cast<uint32_t>(c0);
+}
+
+CRC_TARGET uint32_t hardwareUpdate(const uint8_t* p, size_t n, uint32_t crc) {
+    while (n && (reinterpret_cast<uintptr_t>(p) & 7)) {
+        crc = _mm_crc32_u8(crc, *p++);
+        n--;
+    }
+    while (n >= FUSED_BLOCK) {
+        crc = fusedBlock(p, crc);
+        p += FUSED_BLOCK;
+        n -= FUSED_BLOCK;
+    }
+    crc = lanes(p, n, crc, LANE, LANE_SHIFT);
+
+    uint64_t c = crc;
+    while (n >= 8) {
+        c = _mm_crc32_u64(c, load64(p));
+        p += 8;
+        n -= 8;
+    }
+    crc = static_cast<uint32_t>(c);
+    while (n--) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+
+bool detectHardware() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul");
+}
+
+#endif
+
+} // namespace
+
+bool crc32cHardware() {
+#if defined(__x86_64__)
+    static const bool supported = detectHardware();
+    return supported;
+#else
+    return false;
+#endif
+}
+
+uint32_t crc32cSoftware(const void* data, size_t length, uint32_t crc) {
+    return ~softwareUpdate(static_cast<const uint8_t*>(data), length, ~crc);
+}
+
+uint32_t crc32c(const void* data, size_t length, uint32_t crc) {
+#if defined(__x86_64__)
+    if (crc32cHardware()) {
+        return ~hardwareUpdate(static_cast<const uint8_t*>(data), length, ~crc);
+    }
+#endif
+    return crc32cSoftware(data, length, crc);
+}
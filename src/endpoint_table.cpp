@@ -0,0 +1,423 @@
+#include "endpoint_table.hpp"
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <netinet/in.h>
+
+namespace {
+
+// First message on every endpoint socket, in network byte order
+struct EndpointHello {
+    uint32_t rank;
+    CmConData data;
+} __attribute__((packed));
+
+// Control bytes exchanged on a connected endpoint socket
+constexpr char CTRL_TEARDOWN = 'X';
+constexpr char CTRL_ACCEPT = 'Y';
+constexpr char CTRL_REFUSE = 'N';
+constexpr char CTRL_RTR = 'Q';  // Connecting side's QP is up, as in connectQp
+
+// wr_id of the zero-length write that retires unsignaled writes before teardown
+constexpr uint64_t FENCE_WR_ID = ~0ull;
+
+bool isRdmaOpcode(int opcode) {
+    return opcode != IBV_WR_SEND && opcode != IBV_WR_SEND_WITH_IMM;
+}
+
+} // namespace
+
+EndpointTable::EndpointTable(RdmaVerbs& rdma, int rank, int listen_port, size_t qp_budget)
+    : rdma_(rdma), rank_(rank), qp_budget_(qp_budget ? qp_budget : 1) {
+    listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (listen_fd_ < 0) {
+        throw std::runtime_error("Failed to create endpoint listen socket");
+    }
+
+    int reuse = 1;
+    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(listen_port);
+    if (bind(listen_fd_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) ||
+        listen(listen_fd_, 64)) {
+        close(listen_fd_);
+        throw std::runtime_error("Failed to listen on endpoint port " + std::to_string(listen_port));
+    }
+}
+
+EndpointTable::~EndpointTable() {
+    for (auto& entry : peers_) {
+        teardown(entry.second);
+    }
+    for (auto& in : incoming_) {
+        close(in.sock);
+    }
+    if (listen_fd_ >= 0) {
+        close(listen_fd_);
+    }
+}
+
+void EndpointTable::addPeer(int peer, const std::string& host, int port) {
+    Endpoint& ep = peers_[peer];
+    ep.host = host;
+    ep.port = port;
+}
+
+void EndpointTable::post(int peer, const RdmaOp& op) {
+    Endpoint& ep = peers_[peer];
+    ep.last_use = ++clock_;
+
+    if (ep.state == State::Ready) {
+        postNow(ep, op);
+        return;
+    }
+
+    ep.pending.push_back(op);
+    stats_.queued_ops++;
+    if (ep.state == State::Idle) {
+        startConnect(peer, ep);
+    }
+}
+
+void EndpointTable::progress() {
+    acceptIncoming();
+
+    for (size_t i = 0; i < incoming_.size();) {
+        int rc = readBytes(incoming_[i].sock, incoming_[i].rx, sizeof(EndpointHello));
+        if (rc == 0) {
+            ++i;
+            continue;
+        }
+        if (rc < 0 || !handleHello(incoming_[i].sock, incoming_[i].rx)) {
+            close(incoming_[i].sock);
+        }
+        incoming_.erase(incoming_.begin() + i);
+    }
+
+    for (auto& entry : peers_) {
+        Endpoint& ep = entry.second;
+        switch (ep.state) {
+        case State::Idle:
+            if (!ep.pending.empty()) startConnect(entry.first, ep);
+            break;
+        case State::Connecting:
+            finishConnect(ep);
+            break;
+        case State::Handshake:
+            finishHandshake(entry.first, ep);
+            break;
+        case State::Synchronizing:
+            finishSync(ep);
+            break;
+        case State::Ready:
+        case State::Draining:
+            handleControl(ep);
+            break;
+        case State::Waiting:
+            break;
+        }
+    }
+}
+
+int EndpointTable::pollCompletions(struct ibv_wc* wc, int max_entries) {
+    int ne = rdma_.pollCompletions(wc, max_entries);
+    int kept = 0;
+    for (int i = 0; i < ne; ++i) {
+        if (!(wc[i].opcode & IBV_WC_RECV)) {
+            auto it = qp_to_peer_.find(wc[i].qp_num);
+            if (it != qp_to_peer_.end()) {
+                Endpoint& ep = peers_[it->second];
+                if (ep.outstanding) ep.outstanding--;
+            }
+            // Eviction fences are ours, the caller never posted them
+            if (wc[i].wr_id == FENCE_WR_ID && wc[i].status == IBV_WC_SUCCESS) continue;
+        }
+        wc[kept++] = wc[i];
+    }
+    return kept;
+}
+
+EndpointTable::State EndpointTable::state(int peer) const {
+    auto it = peers_.find(peer);
+    return it == peers_.end() ? State::Idle : it->second.state;
+}
+
+void EndpointTable::startConnect(int peer, Endpoint& ep) {
+    if (ep.host.empty()) {
+        // Unknown address, the peer has to connect to us
+        ep.state = State::Waiting;
+        return;
+    }
+    if (!ep.qp) {
+        if (!reserveQp()) return;
+        createQp(peer, ep);
+    }
+
+    struct addrinfo hints = {}, *res;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    std::string port_str = std::to_string(ep.port);
+    if (getaddrinfo(ep.host.c_str(), port_str.c_str(), &hints, &res)) {
+        std::cerr << "Failed to resolve peer " << peer << " (" << ep.host << ")\n";
+        return;
+    }
+
+    ep.sock = socket(res->ai_family, res->ai_socktype | SOCK_NONBLOCK, res->ai_protocol);
+    if (ep.sock < 0) {
+        freeaddrinfo(res);
+        return;
+    }
+
+    int rc = connect(ep.sock, res->ai_addr, res->ai_addrlen);
+    freeaddrinfo(res);
+    if (rc == 0) {
+        if (sendHello(ep.sock, ep)) {
+            ep.state = State::Handshake;
+            return;
+        }
+    } else if (errno == EINPROGRESS) {
+        ep.state = State::Connecting;
+        return;
+    }
+
+    // Peer not listening yet, retried on the next progress() call
+    close(ep.sock);
+    ep.sock = -1;
+    ep.state = State::Idle;
+}
+
+void EndpointTable::finishConnect(Endpoint& ep) {
+    struct pollfd pfd = { ep.sock, POLLOUT, 0 };
+    if (poll(&pfd, 1, 0) <= 0) return;
+
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(ep.sock, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (err || !sendHello(ep.sock, ep)) {
+        close(ep.sock);
+        ep.sock = -1;
+        ep.state = State::Idle;
+        return;
+    }
+    ep.state = State::Handshake;
+}
+
+void EndpointTable::finishHandshake(int peer, Endpoint& ep) {
+    int rc = readBytes(ep.sock, ep.rx, sizeof(EndpointHello));
+    if (rc == 0) return;
+    if (rc < 0) {
+        failHandshake(peer, ep);
+        return;
+    }
+
+    EndpointHello hello;
+    memcpy(&hello, ep.rx.data(), sizeof(hello));
+    ep.rx.clear();
+    ep.remote = connectionDataToHost(hello.data);
+    rdma_.bringUpQp(ep.qp, ep.remote);
+    // The acceptor's QP was up before its hello; ours is now, so both may post
+    if (send(ep.sock, &CTRL_RTR, 1, MSG_NOSIGNAL) != 1) {
+        failHandshake(peer, ep);
+        return;
+    }
+    stats_.connects++;
+    markReady(ep);
+}
+
+void EndpointTable::finishSync(Endpoint& ep) {
+    char ctrl;
+    ssize_t n = recv(ep.sock, &ctrl, 1, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+    if (n != 1 || ctrl != CTRL_RTR) {
+        teardown(ep);
+        return;
+    }
+    stats_.accepts++;
+    markReady(ep);
+}
+
+void EndpointTable::failHandshake(int peer, Endpoint& ep) {
+    // A lower rank closes our socket when both sides connect at once and
+    // then connects to us itself; a higher rank is simply retried.
+    close(ep.sock);
+    ep.sock = -1;
+    ep.rx.clear();
+    ep.state = peer < rank_ ? State::Waiting : State::Idle;
+}
+
+void EndpointTable::handleControl(Endpoint& ep) {
+    char ctrl;
+    ssize_t n = recv(ep.sock, &ctrl, 1, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+    if (n <= 0) {
+        teardown(ep);
+        return;
+    }
+
+    if (ctrl == CTRL_TEARDOWN) {
+        // Refused until a fence has retired what we still have in flight
+        bool idle = ep.pending.empty() && quiesce(ep);
+        if (ep.state == State::Draining || idle) {
+            send(ep.sock, &CTRL_ACCEPT, 1, MSG_NOSIGNAL);
+            teardown(ep);
+        } else {
+            send(ep.sock, &CTRL_REFUSE, 1, MSG_NOSIGNAL);
+        }
+    } else if (ep.state == State::Draining) {
+        if (ctrl == CTRL_ACCEPT) {
+            teardown(ep);
+        } else {
+            markReady(ep);
+        }
+    }
+}
+
+void EndpointTable::acceptIncoming() {
+    for (;;) {
+        int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK);
+        if (fd < 0) return;
+        incoming_.push_back({fd, {}});
+    }
+}
+
+bool EndpointTable::handleHello(int sock, const std::vector<uint8_t>& rx) {
+    EndpointHello hello;
+    memcpy(&hello, rx.data(), sizeof(hello));
+    int peer = static_cast<int>(ntohl(hello.rank));
+    Endpoint& ep = peers_[peer];
+
+    if ((ep.state == State::Connecting || ep.state == State::Handshake) && peer > rank_) {
+        // Crossed connect, ours wins
+        return false;
+    }
+    if (ep.state == State::Synchronizing || ep.state == State::Ready || ep.state == State::Draining) {
+        // Peer restarted without a clean teardown
+        teardown(ep);
+    }
+
+    if (ep.sock >= 0) {
+        close(ep.sock);
+    }
+    ep.sock = sock;
+    ep.rx.clear();
+    if (!ep.qp) {
+        // Incoming peers are never refused, eviction only starts here
+        reserveQp();
+        createQp(peer, ep);
+    }
+
+    ep.remote = connectionDataToHost(hello.data);
+    rdma_.bringUpQp(ep.qp, ep.remote);
+    if (!sendHello(sock, ep)) {
+        ep.sock = -1;
+        teardown(ep);
+        return false;
+    }
+    // Nothing is posted until the connecting side's QP has reached RTR
+    ep.state = State::Synchronizing;
+    return true;
+}
+
+bool EndpointTable::sendHello(int sock, Endpoint& ep) {
+    EndpointHello hello;
+    hello.rank = htonl(rank_);
+    hello.data = rdma_.localConnectionData(ep.qp);
+    return send(sock, &hello, sizeof(hello), MSG_NOSIGNAL) == sizeof(hello);
+}
+
+int EndpointTable::readBytes(int sock, std::vector<uint8_t>& rx, size_t need) {
+    size_t have = rx.size();
+    rx.resize(need);
+    ssize_t n = recv(sock, rx.data() + have, need - have, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        rx.resize(have);
+        return 0;
+    }
+    if (n <= 0) {
+        rx.clear();
+        return -1;
+    }
+    rx.resize(have + n);
+    return rx.size() == need ? 1 : 0;
+}
+
+bool EndpointTable::reserveQp() {
+    if (active_qps_ < qp_budget_) return true;
+
+    // Ask the least recently used idle endpoint to tear down
+    Endpoint* victim = nullptr;
+    for (auto& entry : peers_) {
+        Endpoint& ep = entry.second;
+        if (ep.state != State::Ready || ep.outstanding || !ep.pending.empty()) continue;
+        if (!victim || ep.last_use < victim->last_use) victim = &ep;
+    }
+    // A victim with unsignaled writes is fenced now and asked on a later call
+    if (victim && quiesce(*victim) && send(victim->sock, &CTRL_TEARDOWN, 1, MSG_NOSIGNAL) == 1) {
+        victim->state = State::Draining;
+        stats_.evictions++;
+    }
+    return false;
+}
+
+void EndpointTable::createQp(int peer, Endpoint& ep) {
+    ep.qp = rdma_.createQp();
+    active_qps_++;
+    qp_to_peer_[ep.qp->qp_num] = peer;
+}
+
+void EndpointTable::markReady(Endpoint& ep) {
+    ep.state = State::Ready;
+    while (!ep.pending.empty()) {
+        postNow(ep, ep.pending.front());
+        ep.pending.pop_front();
+    }
+}
+
+void EndpointTable::postNow(Endpoint& ep, const RdmaOp& op) {
+    RdmaOp wr = op;
+    if (isRdmaOpcode(op.opcode)) {
+        wr.remote_addr += ep.remote.addr;
+        wr.rkey = ep.remote.rkey;
+    }
+    rdma_.postSend(ep.qp, wr);
+    if (wr.signaled) {
+        // RC completes in order, so this completion covers the earlier ones
+        ep.outstanding++;
+        ep.unsignaled = 0;
+    } else {
+        ep.unsignaled++;
+    }
+}
+
+// True when nothing is in flight; otherwise posts a fence if one is needed
+bool EndpointTable::quiesce(Endpoint& ep) {
+    if (ep.unsignaled > 0) {
+        RdmaOp fence;
+        fence.opcode = IBV_WR_RDMA_WRITE;
+        fence.length = 0;
+        fence.wr_id = FENCE_WR_ID;
+        postNow(ep, fence);
+    }
+    return ep.outstanding == 0;
+}
+
+void EndpointTable::teardown(Endpoint& ep) {
+    if (ep.qp) {
+        qp_to_peer_.erase(ep.qp->qp_num);
+        rdma_.destroyQp(ep.qp);
+        ep.qp = nullptr;
+        active_qps_--;
+    }
+    if (ep.sock >= 0) {
+        close(ep.sock);
+        ep.sock = -1;
+    }
+    ep.rx.clear();
+    ep.outstanding = 0;
+    ep.unsignaled = 0;
+    ep.remote = {};
+    ep.state = State::Idle;
+}
@@ -0,0 +1,125 @@
+#include "flow_scheduler.hpp"
+#include <algorithm>
+
+FlowScheduler::FlowScheduler(RdmaVerbs& rdma) : rdma_(rdma) {}
+
+FlowScheduler::~FlowScheduler() {
+    for (auto& flow : classes_) {
+        rdma_.destroyQp(flow.qp);
+    }
+}
+
+int FlowScheduler::addClass(const ClassConfig& config) {
+    if (config.segment_size == 0 || config.segment_size > UINT32_MAX || config.max_inflight < config.segment_size) {
+        throw std::runtime_error("Class " + config.name + " needs a segment size up to its in-flight limit");
+    }
+
+    FlowClass flow;
+    flow.config = config;
+    flow.qp = rdma_.createQp();
+    rdma_.setTrafficClass(flow.qp, config.traffic);
+    flow.remote = rdma_.connectQp(flow.qp);
+
+    int cls = static_cast<int>(classes_.size());
+    classes_.push_back(std::move(flow));
+    for (uint32_t i = 0; i < QP_DEPTH; ++i) {
+        postRecv(cls);
+    }
+    return cls;
+}
+
+uint64_t FlowScheduler::write(int cls, uint64_t local_offset, uint64_t remote_offset, size_t length, uint32_t imm) {
+    if (cls < 0 || cls >= static_cast<int>(classes_.size())) {
+        throw std::runtime_error("Unknown traffic class " + std::to_string(cls));
+    }
+    if (local_offset + length > rdma_.getRegionSize()) {
+        throw std::runtime_error("Write exceeds registered buffer");
+    }
+    uint64_t id = next_id_++;
+    classes_[cls].queue.push_back({id, local_offset, remote_offset, length, 0, imm});
+    return id;
+}
+
+size_t FlowScheduler::pending(int cls) const {
+    const FlowClass& flow = classes_.at(cls);
+    size_t on_wire = std::count_if(flow.inflight.begin(), flow.inflight.end(),
+                                   [](const Segment& s) { return s.last; });
+    return flow.queue.size() + on_wire;
+}
+
+void FlowScheduler::postRecv(int cls) {
+    struct ibv_recv_wr wr = {};
+    wr.wr_id = static_cast<uint64_t>(cls);
+    wr.num_sge = 0;
+    rdma_.postReceive(classes_[cls].qp, &wr);
+}
+
+void FlowScheduler::postSegment(int cls) {
+    FlowClass& flow = classes_[cls];
+    Message& msg = flow.queue.front();
+    uint32_t length = static_cast<uint32_t>(std::min(flow.config.segment_size, msg.length - msg.posted));
+    bool last = msg.posted + length == msg.length;
+
+    RdmaOp op;
+    op.opcode = last ? IBV_WR_RDMA_WRITE_WITH_IMM : IBV_WR_RDMA_WRITE;
+    op.offset = msg.local_offset + msg.posted;
+    op.length = length;
+    op.remote_addr = flow.remote.addr + msg.remote_offset + msg.posted;
+    op.rkey = flow.remote.rkey;
+    op.wr_id = static_cast<uint64_t>(cls);
+    op.imm_data = htonl(msg.imm);
+    rdma_.postSend(flow.qp, op);
+
+    flow.inflight.push_back({msg.id, length, last});
+    flow.inflight_bytes += length;
+    msg.posted += length;
+    if (last) flow.queue.pop_front();
+}
+
+// Strict priority: a lower class waits while a higher one has queued data,
+// even if that class is held back by its own in-flight limit
+void FlowScheduler::schedule() {
+    for (int cls = 0; cls < static_cast<int>(classes_.size()); ++cls) {
+        FlowClass& flow = classes_[cls];
+        while (!flow.queue.empty() && flow.inflight.size() < QP_DEPTH) {
+            const Message& msg = flow.queue.front();
+            size_t next = std::min(flow.config.segment_size, msg.length - msg.posted);
+            if (flow.inflight_bytes > 0 && flow.inflight_bytes + next > flow.config.max_inflight) break;
+            postSegment(cls);
+        }
+        if (!flow.queue.empty()) return;
+    }
+}
+
+int FlowScheduler::poll(Event* events, int max_events) {
+    schedule();
+
+    struct ibv_wc wc[32];
+    int ne = rdma_.pollCompletions(wc, std::min(max_events, 32));
+    int out = 0;
+    for (int i = 0; i < ne; ++i) {
+        if (wc[i].status != IBV_WC_SUCCESS) {
+            throw std::runtime_error("Scheduled write failed: " + std::string(ibv_wc_status_str(wc[i].status)));
+        }
+        int cls = static_cast<int>(wc[i].wr_id);
+        FlowClass& flow = classes_.at(cls);
+        if (wc[i].opcode == IBV_WC_RECV_RDMA_WITH_IMM) {
+            events[out++] = {Event::Kind::Arrived, cls, ntohl(wc[i].imm_data)};
+            postRecv(cls);
+            continue;
+        }
+
+        Segment segment = flow.inflight.front();
+        flow.inflight.pop_front();
+        flow.inflight_bytes -= segment.length;
+        flow.stats.bytes += segment.length;
+        if (segment.last) {
+            flow.stats.messages++;
+            events[out++] = {Event::Kind::Sent, cls, segment.id};
+        }
+    }
+
+    // Freed window goes to the highest class right away
+    if (ne > 0) schedule();
+    return out;
+}
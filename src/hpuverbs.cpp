@@ -1,15 +1,34 @@
 #include "hpuverbs.hpp"
-
-HpuManager::HpuManager() = default;
+#include "paging.hpp"
+#include "registration_proxy.hpp"
+#include "shm_transport.hpp"
+#include "startup.hpp"
+#include "trace.hpp"
+#include "workload.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+HpuManager::HpuManager() : paging_(pagingFromEnvironment()) {}
 
 HpuManager::~HpuManager() {
     cleanup();
 }
 
 void HpuManager::initialize(size_t size) {
+    Tracer::enableFromEnvironment();
     buffer_size_ = size;
 
-    if (!tryOpenGaudiDevice()) {
+    bool opened;
+    {
+        StartupProfile::Phase phase(profile_, "Gaudi open");
+        opened = tryOpenGaudiDevice();
+    }
+    if (!opened) {
         std::cout << "No Gaudi device found, using regular memory\n";
         if (!allocateHostMemory(size)) {
             throw std::runtime_error("Failed to allocate host memory");
@@ -53,6 +72,7 @@ void HpuManager::initialize(size_t size) {
         }
     } else {
         std::cout << "DMA-buf created successfully (fd=" << dmabuf_fd_ << ")\n";
+        StartupProfile::Phase phase(profile_, "DMA-buf CPU mapping");
         buffer_ = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, dmabuf_fd_, 0);
         if (buffer_ == MAP_FAILED) {
             buffer_ = nullptr;
@@ -79,30 +99,52 @@ bool HpuManager::tryOpenGaudiDevice() {
 }
 
 bool HpuManager::allocateDeviceMemory(size_t size) {
+    StartupProfile::Phase phase(profile_, "Device memory alloc");
+    TraceScope trace(TraceKind::Allocate, 0, size, 1);
     gaudi_handle_ = hlthunk_device_memory_alloc(gaudi_fd_, size, 0, true, true);
     return gaudi_handle_ != 0;
 }
 
 bool HpuManager::mapDeviceMemory() {
+    StartupProfile::Phase phase(profile_, "Device memory map");
+    TraceScope trace(TraceKind::Map, 0, buffer_size_);
     device_va_ = hlthunk_device_memory_map(gaudi_fd_, gaudi_handle_, 0);
+    trace.setId(device_va_);
     return device_va_ != 0;
 }
 
 bool HpuManager::exportDmabuf() {
+    StartupProfile::Phase phase(profile_, "DMA-buf export");
+    TraceScope trace(TraceKind::Export, 0, buffer_size_);
     dmabuf_fd_ = hlthunk_device_mapped_memory_export_dmabuf_fd(
         gaudi_fd_, device_va_, buffer_size_, 0, (O_RDWR | O_CLOEXEC));
+    trace.setId(static_cast<uint64_t>(dmabuf_fd_));
     return dmabuf_fd_ >= 0;
 }
 
 bool HpuManager::allocateHostMemory(size_t size) {
-    buffer_ = aligned_alloc(4096, size);
-    if (!buffer_) return false;
-    memset(buffer_, 0, size);
+    StartupProfile::Phase phase(profile_, "Host memory alloc");
+    TraceScope trace(TraceKind::Allocate, 0, size, 0);
+    // memfd backed so a peer on the same host can map it
+    host_fd_ = memfd_create("gaudi-verbs-buffer", MFD_CLOEXEC);
+    if (host_fd_ < 0 || ftruncate(host_fd_, size) != 0) return false;
+    buffer_ = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, host_fd_, 0);
+    if (buffer_ == MAP_FAILED) {
+        buffer_ = nullptr;
+        return false;
+    }
+    // Pinned buffers are faulted in here in parallel, so that registration
+    // only pins them; on-demand ones stay unpopulated until touched
+    if (paging_ == Paging::Pinned) {
+        populatePages(buffer_, size);
+    }
     return true;
 }
 
 bool HpuManager::mapHostMemoryToGaudi() {
+    TraceScope trace(TraceKind::Map, 0, buffer_size_);
     host_device_va_ = hlthunk_host_memory_map(gaudi_fd_, buffer_, 0, buffer_size_);
+    trace.setId(host_device_va_);
     return host_device_va_ != 0;
 }
 
@@ -112,15 +154,19 @@ void HpuManager::cleanup() {
         dmabuf_fd_ = -1;
     }
 
-    if (buffer_ && dmabuf_fd_ < 0) {
+    if (buffer_) {
         if (host_device_va_ && gaudi_fd_ >= 0) {
             hlthunk_memory_unmap(gaudi_fd_, host_device_va_);
+            host_device_va_ = 0;
         }
-        free(buffer_);
-    } else if (buffer_) {
         munmap(buffer_, buffer_size_);
+        buffer_ = nullptr;
+    }
+
+    if (host_fd_ >= 0) {
+        close(host_fd_);
+        host_fd_ = -1;
     }
-    buffer_ = nullptr;
 
     if (gaudi_handle_) {
         if (device_va_) {
@@ -137,69 +183,276 @@ void HpuManager::cleanup() {
     }
 }
 
-RdmaVerbs::RdmaVerbs() = default;
+namespace {
+
+uint64_t chainBytes(const struct ibv_send_wr* wr, bool whole_chain = true) {
+    uint64_t bytes = 0;
+    for (; wr; wr = whole_chain ? wr->next : nullptr) {
+        for (int i = 0; i < wr->num_sge; ++i) bytes += wr->sg_list[i].length;
+    }
+    return bytes;
+}
+
+// Opcodes postBuilt has an ibv_wr_* builder for
+bool builderOpcode(int opcode) {
+    switch (opcode) {
+    case IBV_WR_SEND:
+    case IBV_WR_SEND_WITH_IMM:
+    case IBV_WR_RDMA_WRITE:
+    case IBV_WR_RDMA_WRITE_WITH_IMM:
+    case IBV_WR_RDMA_READ:
+        return true;
+    default:
+        return false;
+    }
+}
+
+} // namespace
+
+RdmaVerbs::RdmaVerbs() : cancel_fd_(eventfd(0, EFD_CLOEXEC)) {}
 
 RdmaVerbs::~RdmaVerbs() {
     cleanup();
+    if (cancel_fd_ >= 0) close(cancel_fd_);
 }
 
 void RdmaVerbs::initialize(const std::string& ib_dev_name, HpuManager& hpu) {
-    hpu_ = &hpu;
-    if (!initializeDevice(ib_dev_name)) {
-        throw std::runtime_error("Failed to initialize IB device");
+    openDevice(ib_dev_name);
+    registerBuffer(hpu);
+}
+
+void RdmaVerbs::openDevice(const std::string& ib_dev_name) {
+    Tracer::enableFromEnvironment();
+    {
+        StartupProfile::Phase phase(profile_, "IB device open");
+        if (!initializeDevice(ib_dev_name)) {
+            throw std::runtime_error("Failed to initialize IB device");
+        }
     }
-    if (!setupResources(hpu)) {
+    StartupProfile::Phase phase(profile_, "PD, CQ and QP");
+    if (!setupDeviceResources()) {
         throw std::runtime_error("Failed to setup RDMA resources");
     }
 }
 
-void RdmaVerbs::connectQp(const std::string& server_name, int port) {
+void RdmaVerbs::registerBuffer(HpuManager& hpu) {
+    hpu_ = &hpu;
+    {
+        StartupProfile::Phase phase(profile_, "Memory registration");
+        if (!registerMemory(hpu)) {
+            throw std::runtime_error("Failed to register memory");
+        }
+    }
+
+    const char* record_path = std::getenv("HPU_RECORD");
+    if (record_path && *record_path) {
+        recordWorkload(record_path);
+    }
+}
+
+void RdmaVerbs::recordWorkload(const std::string& path) {
+    recorder_ = std::make_unique<WorkloadRecorder>(path);
+    std::cout << "Recording posted work requests to " << path << "\n";
+}
+
+void RdmaVerbs::openConnection(const std::string& server_name, int port) {
+    StartupProfile::Phase phase(profile_, "TCP connect");
+    server_name_ = server_name;
+    port_ = port;
     if (!setupSocket(server_name, port)) {
         throw std::runtime_error("Failed to establish TCP connection");
     }
+}
+
+void RdmaVerbs::cancelConnection() {
+    uint64_t one = 1;
+    if (cancel_fd_ < 0 || write(cancel_fd_, &one, sizeof(one)) != sizeof(one)) {
+        std::cerr << "Failed to cancel the TCP connection\n";
+    }
+}
+
+void RdmaVerbs::connectQp(const std::string& server_name, int port) {
+    if (sock_ < 0) {
+        openConnection(server_name, port);
+    }
+    StartupProfile::Phase phase(profile_, "QP connect");
     if (!exchangeConnectionData()) {
         throw std::runtime_error("Failed to exchange connection data");
     }
-    if (!modifyQpToInit()) {
+    bringUpQp(qp_, remote_props_);
+
+    if (setupIntraNode(server_name.empty())) {
+        std::cout << "✓ Peer is on this host, main QP traffic uses shared memory\n";
+    }
+}
+
+CmConData RdmaVerbs::connectQp(struct ibv_qp* qp) {
+    CmConData local_con_data = localConnectionData(qp);
+    CmConData remote = {};
+
+    if (write(sock_, &local_con_data, sizeof(CmConData)) != sizeof(CmConData) ||
+        read(sock_, &remote, sizeof(CmConData)) != sizeof(CmConData)) {
+        throw std::runtime_error("Failed to exchange QP connection data");
+    }
+    remote = connectionDataToHost(remote);
+    bringUpQp(qp, remote);
+
+    // Both sides must reach RTR before either posts
+    char temp_char;
+    if (write(sock_, "Q", 1) != 1 || read(sock_, &temp_char, 1) != 1) {
+        throw std::runtime_error("Failed to sync QP bring-up");
+    }
+    return remote;
+}
+
+void RdmaVerbs::bringUpQp(struct ibv_qp* qp, const CmConData& remote) {
+    if (!modifyQpToInit(qp)) {
         throw std::runtime_error("Failed to modify QP to INIT");
     }
-    if (!modifyQpToRtr()) {
+    if (!modifyQpToRtr(qp, remote)) {
         throw std::runtime_error("Failed to modify QP to RTR");
     }
-    if (!modifyQpToRts()) {
+    if (!modifyQpToRts(qp, remote)) {
         throw std::runtime_error("Failed to modify QP to RTS");
     }
+
+    auto traffic = traffic_classes_.find(qp->qp_num);
+    if (traffic != traffic_classes_.end() && traffic->second.rate_limit_kbps) {
+        applyRateLimit(qp, traffic->second.rate_limit_kbps);
+    }
+    peers_[qp->qp_num] = {qp, remote.qp_num};
+}
+
+void RdmaVerbs::setTrafficClass(struct ibv_qp* qp, const TrafficClass& traffic) {
+    if (traffic.service_level > 15 || traffic.dscp > 63) {
+        throw std::runtime_error("Service level must be below 16 and DSCP below 64");
+    }
+    traffic_classes_[qp->qp_num] = traffic;
 }
 
 void RdmaVerbs::postSend(int opcode) {
-    struct ibv_sge sge = {
-        .addr = hpu_->getDmabufFd() >= 0 ? hpu_->getDeviceVa() : reinterpret_cast<uintptr_t>(hpu_->getBuffer()),
-        .length = MSG_SIZE,
+    RdmaOp op;
+    op.opcode = opcode;
+    op.remote_addr = remote_props_.addr;
+    op.rkey = remote_props_.rkey;
+    postSend(qp_, op);
+}
+
+void RdmaVerbs::postSend(struct ibv_qp* qp, const RdmaOp& op) {
+    if (postBuilt(qp, op)) return;
+
+    struct ibv_sge sge;
+    struct ibv_send_wr sr = buildSendWr(op, &sge);
+    postSend(qp, &sr);
+}
+
+struct ibv_send_wr RdmaVerbs::buildSendWr(const RdmaOp& op, struct ibv_sge* sge) const {
+    *sge = {
+        .addr = getLocalAddr() + op.offset,
+        .length = op.length,
         .lkey = mr_->lkey
     };
 
     struct ibv_send_wr sr = {
-        .wr_id = 0,
-        .sg_list = &sge,
+        .wr_id = op.wr_id,
+        .sg_list = sge,
         .num_sge = 1,
-        .opcode = static_cast<ibv_wr_opcode>(opcode),
-        .send_flags = IBV_SEND_SIGNALED,
+        .opcode = static_cast<ibv_wr_opcode>(op.opcode),
+        .send_flags = op.signaled ? static_cast<unsigned int>(IBV_SEND_SIGNALED) : 0u,
     };
+    sr.imm_data = op.imm_data;
+
+    if (op.opcode != IBV_WR_SEND && op.opcode != IBV_WR_SEND_WITH_IMM) {
+        sr.wr.rdma.remote_addr = op.remote_addr;
+        sr.wr.rdma.rkey = op.rkey;
+    }
+    return sr;
+}
+
+// ibv_wr_* builder path; false when the op has to go through ibv_post_send
+bool RdmaVerbs::postBuilt(struct ibv_qp* qp, const RdmaOp& op) {
+    // Decided before tracing and recording, which postSend does otherwise
+    if (!extended_send_ || (shm_ && qp == qp_) || !builderOpcode(op.opcode)) return false;
+    struct ibv_qp_ex* qpx = ibv_qp_to_qp_ex(qp);
+    if (!qpx) return false;
+    TraceScope trace(TraceKind::PostSend, op.wr_id, op.length, static_cast<uint32_t>(op.opcode));
+    if (recorder_) recorder_->record(qp->qp_num, op.opcode, mr_->lkey, op.offset, op.length);
+
+    ibv_wr_start(qpx);
+    qpx->wr_id = op.wr_id;
+    qpx->wr_flags = op.signaled ? IBV_SEND_SIGNALED : 0;
+    switch (op.opcode) {
+    case IBV_WR_SEND:
+        ibv_wr_send(qpx);
+        break;
+    case IBV_WR_SEND_WITH_IMM:
+        ibv_wr_send_imm(qpx, op.imm_data);
+        break;
+    case IBV_WR_RDMA_WRITE:
+        ibv_wr_rdma_write(qpx, op.rkey, op.remote_addr);
+        break;
+    case IBV_WR_RDMA_WRITE_WITH_IMM:
+        ibv_wr_rdma_write_imm(qpx, op.rkey, op.remote_addr, op.imm_data);
+        break;
+    case IBV_WR_RDMA_READ:
+        ibv_wr_rdma_read(qpx, op.rkey, op.remote_addr);
+        break;
+    }
+    ibv_wr_set_sge(qpx, mr_->lkey, getLocalAddr() + op.offset, op.length);
 
-    if (opcode != IBV_WR_SEND) {
-        sr.wr.rdma.remote_addr = remote_props_.addr;
-        sr.wr.rdma.rkey = remote_props_.rkey;
+    TraceScope doorbell(TraceKind::Doorbell, op.wr_id);
+    if (ibv_wr_complete(qpx)) {
+        throw std::runtime_error("Failed to post send");
+    }
+    if (!journals_.empty()) {
+        struct ibv_sge sge;
+        struct ibv_send_wr sr = buildSendWr(op, &sge);
+        journalSend(qp, &sr);
     }
+    return true;
+}
 
+void RdmaVerbs::postSend(struct ibv_qp* qp, struct ibv_send_wr* wr) {
+    TraceScope trace(TraceKind::PostSend, wr->wr_id, 0, wr->opcode);
+    if (trace.active()) trace.setValue(chainBytes(wr));
+    if (recorder_) {
+        for (struct ibv_send_wr* w = wr; w; w = w->next) {
+            // Control regions and staging slabs are other MRs, their addresses are kept as is
+            uint32_t lkey = w->num_sge > 0 ? w->sg_list[0].lkey : 0;
+            uint64_t offset = w->num_sge == 0 ? 0
+                              : lkey == mr_->lkey ? w->sg_list[0].addr - getLocalAddr()
+                                                  : w->sg_list[0].addr;
+            recorder_->record(qp->qp_num, w->opcode, lkey, offset, static_cast<uint32_t>(chainBytes(w, false)));
+        }
+    }
+    if (shm_ && qp == qp_) {
+        // Main QP is created with sq_sig_all
+        shm_->postSend(wr, true);
+        return;
+    }
     struct ibv_send_wr* bad_wr;
-    if (ibv_post_send(qp_, &sr, &bad_wr)) {
+    if (ibv_post_send(qp, wr, &bad_wr)) {
         throw std::runtime_error("Failed to post send");
     }
+    if (!journals_.empty()) journalSend(qp, wr);
+}
+
+void RdmaVerbs::postReceive(struct ibv_qp* qp, struct ibv_recv_wr* wr) {
+    TraceScope trace(TraceKind::PostRecv, wr->wr_id);
+    if (shm_ && qp == qp_) {
+        shm_->postReceive(wr);
+        return;
+    }
+    struct ibv_recv_wr* bad_wr;
+    if (ibv_post_recv(qp, wr, &bad_wr)) {
+        throw std::runtime_error("Failed to post receive");
+    }
+    if (!journals_.empty()) journalRecv(qp, wr);
 }
 
 void RdmaVerbs::postReceive() {
     struct ibv_sge sge = {
-        .addr = hpu_->getDmabufFd() >= 0 ? hpu_->getDeviceVa() : reinterpret_cast<uintptr_t>(hpu_->getBuffer()),
+        .addr = getLocalAddr(),
         .length = MSG_SIZE,
         .lkey = mr_->lkey
     };
@@ -210,34 +463,144 @@ void RdmaVerbs::postReceive() {
         .num_sge = 1,
     };
 
-    struct ibv_recv_wr* bad_wr;
-    if (ibv_post_recv(qp_, &rr, &bad_wr)) {
-        throw std::runtime_error("Failed to post receive");
-    }
+    postReceive(qp_, &rr);
 }
 
 bool RdmaVerbs::pollCompletion() {
     struct ibv_wc wc;
     int polls = 0;
+    int recoveries = 0;
 
     while (polls++ < 1000000) {
-        int ne = ibv_poll_cq(cq_, 1, &wc);
-        if (ne < 0) {
-            throw std::runtime_error("Poll CQ failed");
-        }
-        if (ne > 0) {
+        if (pollCompletions(&wc, 1) > 0) {
             if (wc.status != IBV_WC_SUCCESS) {
-                throw std::runtime_error("Work completion error: " + std::string(ibv_wc_status_str(wc.status)));
+                // A QP with recovery enabled comes back and replays the failed
+                // RDMA write or read, whose completion is then the one returned
+                auto peer = peers_.find(wc.qp_num);
+                if (peer == peers_.end() || !journals_.count(wc.qp_num) || recoveries++ == 3) {
+                    throw std::runtime_error("Work completion error: " + std::string(ibv_wc_status_str(wc.status)));
+                }
+                std::cerr << "Work completion error: " << ibv_wc_status_str(wc.status) << ", recovering\n";
+                if (!recoverQp(peer->second.qp).empty()) {
+                    throw std::runtime_error("Sends lost in recovery could not be replayed");
+                }
+                polls = 0;
+                continue;
             }
             return true;
         }
+        if (!journals_.empty() && polls % 1000 == 0) {
+            std::vector<uint64_t> lost;
+            if (serviceRecovery(-1, &lost) && !lost.empty()) {
+                throw std::runtime_error("Sends lost in recovery could not be replayed");
+            }
+        }
         usleep(1);
     }
 
     throw std::runtime_error("Poll timeout");
 }
 
+int RdmaVerbs::pollCompletions(struct ibv_wc* wc, int max_entries) {
+    return pollCompletions(wc, nullptr, max_entries);
+}
+
+int RdmaVerbs::pollCompletions(struct ibv_wc* wc, uint64_t* timestamps, int max_entries) {
+    int deferred = 0;
+    if (!deferred_.empty()) {
+        deferred = std::min(max_entries, static_cast<int>(deferred_.size()));
+        std::copy(deferred_.begin(), deferred_.begin() + deferred, wc);
+        deferred_.erase(deferred_.begin(), deferred_.begin() + deferred);
+        if (timestamps) std::fill(timestamps, timestamps + deferred, 0);
+        if (deferred == max_entries) return deferred;
+    }
+    return deferred + pollDevice(wc + deferred, timestamps ? timestamps + deferred : nullptr, max_entries - deferred);
+}
+
+int RdmaVerbs::pollDevice(struct ibv_wc* wc, uint64_t* timestamps, int max_entries) {
+    int local = shm_ ? shm_->pollCompletions(wc, max_entries) : 0;
+    if (timestamps) std::fill(timestamps, timestamps + local, 0);
+
+    int ne = 0;
+    if (local < max_entries && cq_ex_) {
+        ne = pollExtended(wc + local, timestamps ? timestamps + local : nullptr, max_entries - local);
+    } else if (local < max_entries) {
+        ne = ibv_poll_cq(cq_, max_entries - local, wc + local);
+        if (ne < 0) {
+            throw std::runtime_error("Poll CQ failed");
+        }
+        if (timestamps) std::fill(timestamps + local, timestamps + local + ne, 0);
+    }
+
+    if (Tracer::enabled()) {
+        for (int i = 0; i < local + ne; ++i) {
+            Tracer::instant(TraceKind::Completion, wc[i].wr_id, timestamps ? timestamps[i] : 0,
+                            static_cast<uint32_t>(wc[i].opcode) | static_cast<uint32_t>(wc[i].status) << 16);
+        }
+    }
+    if (!journals_.empty()) retireJournal(wc + local, ne);
+    return local + ne;
+}
+
+// Reads extended completions back into ibv_wc so callers see one format
+int RdmaVerbs::pollExtended(struct ibv_wc* wc, uint64_t* timestamps, int max_entries) {
+    struct ibv_poll_cq_attr attr = {};
+    int ret = ibv_start_poll(cq_ex_, &attr);
+    if (ret == ENOENT) return 0;
+    if (ret) {
+        throw std::runtime_error("Poll CQ failed");
+    }
+
+    int ne = 0;
+    do {
+        struct ibv_wc& c = wc[ne];
+        c = {};
+        c.wr_id = cq_ex_->wr_id;
+        c.status = cq_ex_->status;
+        uint64_t timestamp = 0;
+        // Error completions only carry wr_id, status, vendor_err and the QP
+        if (c.status != IBV_WC_SUCCESS) {
+            c.vendor_err = ibv_wc_read_vendor_err(cq_ex_);
+            c.qp_num = ibv_wc_read_qp_num(cq_ex_);
+        } else {
+            c.opcode = ibv_wc_read_opcode(cq_ex_);
+            c.wc_flags = ibv_wc_read_wc_flags(cq_ex_);
+            c.byte_len = ibv_wc_read_byte_len(cq_ex_);
+            c.qp_num = ibv_wc_read_qp_num(cq_ex_);
+            if (c.wc_flags & IBV_WC_WITH_IMM) c.imm_data = ibv_wc_read_imm_data(cq_ex_);
+            timestamp = ibv_wc_read_completion_ts(cq_ex_);
+        }
+        if (timestamps) timestamps[ne] = timestamp;
+        ne++;
+    } while (ne < max_entries && (ret = ibv_next_poll(cq_ex_)) == 0);
+    ibv_end_poll(cq_ex_);
+
+    if (ret && ret != ENOENT) {
+        throw std::runtime_error("Poll CQ failed");
+    }
+    return ne;
+}
+
+uint64_t RdmaVerbs::readNicClock() const {
+    struct ibv_values_ex values = {};
+    values.comp_mask = IBV_VALUES_MASK_RAW_CLOCK;
+    if (!cq_ex_ || ibv_query_rt_values_ex(ib_ctx_, &values) || !(values.comp_mask & IBV_VALUES_MASK_RAW_CLOCK)) {
+        throw std::runtime_error("NIC clock not readable");
+    }
+    return static_cast<uint64_t>(values.raw_clock.tv_sec) * 1000000000ull +
+           static_cast<uint64_t>(values.raw_clock.tv_nsec);
+}
+
+double RdmaVerbs::nicNanoseconds(uint64_t start, uint64_t end) const {
+    if (!core_clock_khz_) return 0.0;
+    return static_cast<double>((end - start) & timestamp_mask_) * 1e6 / core_clock_khz_;
+}
+
 bool RdmaVerbs::initializeDevice(const std::string& ib_dev_name) {
+    if (openThroughProxy()) {
+        return true;
+    }
+
     int num_devices;
     struct ibv_device** dev_list = ibv_get_device_list(&num_devices);
     if (!dev_list || num_devices == 0) {
@@ -270,42 +633,121 @@ bool RdmaVerbs::initializeDevice(const std::string& ib_dev_name) {
     return true;
 }
 
-bool RdmaVerbs::setupResources(HpuManager& hpu) {
+// Leaves the device closed when no proxy is configured or none answers
+bool RdmaVerbs::openThroughProxy() {
+    std::string name = proxy_name_;
+    const char* env = std::getenv("HPU_REG_PROXY");
+    if (name.empty() && env && *env && std::strcmp(env, "0") != 0) {
+        name = std::strcmp(env, "1") == 0 ? DEFAULT_PROXY_SOCKET : env;
+    }
+    if (name.empty()) return false;
+
+    try {
+        auto proxy = std::make_unique<ProxyClient>(name);
+        ib_ctx_ = proxy->importDevice(proxy_pd_handle_);
+        proxy_ = std::move(proxy);
+    } catch (const std::exception& e) {
+        std::cout << "✗ " << e.what() << ", opening the device directly\n";
+        return false;
+    }
+    std::cout << "✓ Sharing the device context of the registration proxy @" << name << "\n";
+    return true;
+}
+
+bool RdmaVerbs::setupDeviceResources() {
     if (ibv_query_port(ib_ctx_, 1, &port_attr_)) {
         std::cerr << "Failed to query port\n";
         return false;
     }
 
-    pd_ = ibv_alloc_pd(ib_ctx_);
+    if (ibv_query_device(ib_ctx_, &device_attr_)) {
+        std::cerr << "Failed to query device\n";
+        return false;
+    }
+    max_sge_ = std::max(1u, std::min<uint32_t>(device_attr_.max_sge, MAX_SGE));
+    // Lets grantAccess hand out windows onto the buffer; QPs are created with the bind ops
+    windows_ = device_attr_.max_mw > 0 &&
+               (device_attr_.device_cap_flags & (IBV_DEVICE_MEM_WINDOW_TYPE_2A | IBV_DEVICE_MEM_WINDOW_TYPE_2B));
+
+    path_ = resolvePath(ib_ctx_, 1, port_attr_, device_attr_, path_overrides_.withEnvironment());
+    std::cout << "✓ Path: " << describePath(path_) << "\n";
+
+    pd_ = proxy_ ? ibv_import_pd(ib_ctx_, proxy_pd_handle_) : ibv_alloc_pd(ib_ctx_);
     if (!pd_) {
         std::cerr << "Failed to allocate PD\n";
         return false;
     }
 
-    cq_ = ibv_create_cq(ib_ctx_, 10, nullptr, nullptr, 0);
+    extended_send_ = extended_verbs_;
+    if (!extended_verbs_ || !createExtendedCq()) {
+        cq_ = ibv_create_cq(ib_ctx_, CQ_DEPTH, nullptr, nullptr, 0);
+    }
     if (!cq_) {
         std::cerr << "Failed to create CQ\n";
         return false;
     }
 
+    // The QP needs only the PD and CQ, so it is ready before the memory is
+    struct ibv_qp_init_attr qp_init_attr = {};
+    qp_init_attr.send_cq = cq_;
+    qp_init_attr.recv_cq = cq_;
+    qp_init_attr.cap.max_send_wr = QP_DEPTH;
+    qp_init_attr.cap.max_recv_wr = QP_DEPTH;
+    qp_init_attr.cap.max_send_sge = max_sge_;
+    qp_init_attr.cap.max_recv_sge = max_sge_;
+    qp_init_attr.qp_type = IBV_QPT_RC;
+    qp_init_attr.sq_sig_all = 1;
+
+    qp_ = createRcQp(qp_init_attr);
+    if (!qp_) {
+        std::cerr << "Failed to create QP\n";
+        return false;
+    }
+    if (extended_send_) {
+        std::cout << "✓ Posting through the ibv_wr_* work request builder\n";
+    }
+
+    return true;
+}
+
+bool RdmaVerbs::registerMemory(HpuManager& hpu) {
+    // Fixed for the lifetime of the MR, so the post paths don't ask the HPU
+    bool device_memory = hpu.getDmabufFd() >= 0;
+    local_addr_ = device_memory ? hpu.getDeviceVa() : reinterpret_cast<uintptr_t>(hpu.getBuffer());
+    host_buffer_ = device_memory ? nullptr : static_cast<uint8_t*>(hpu.getBuffer());
+
     int mr_flags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ | 
                    IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_ATOMIC;
+    if (windows_) mr_flags |= IBV_ACCESS_MW_BIND;
+
+    if (proxy_ && registerThroughProxy(hpu, mr_flags)) {
+        region_size_ = hpu.getBufferSize();
+        return true;
+    }
 
     if (hpu.getDmabufFd() >= 0) {
+        TraceScope trace(TraceKind::Register, 0, hpu.getBufferSize());
         mr_ = ibv_reg_dmabuf_mr(pd_, 0, hpu.getBufferSize(), hpu.getDeviceVa(), hpu.getDmabufFd(), mr_flags);
         if (mr_) {
+            trace.setId(mr_->lkey);
             std::cout << "DMA-buf registered successfully with IB\n";
         } else {
             std::cout << "DMA-buf registration failed, trying fallback\n";
         }
     }
 
+    if (!mr_ && hpu.getBuffer() && hpu.getPaging() != Paging::Pinned) {
+        registerOnDemand(hpu, mr_flags);
+    }
+
     if (!mr_ && hpu.getBuffer()) {
+        TraceScope trace(TraceKind::Register, 0, hpu.getBufferSize());
         mr_ = ibv_reg_mr(pd_, hpu.getBuffer(), hpu.getBufferSize(), mr_flags);
         if (!mr_) {
             std::cerr << "Failed to register memory\n";
             return false;
         }
+        trace.setId(mr_->lkey);
         std::cout << "Regular memory registered with IB\n";
     }
 
@@ -313,27 +755,425 @@ bool RdmaVerbs::setupResources(HpuManager& hpu) {
         std::cerr << "No memory could be registered\n";
         return false;
     }
+    region_size_ = hpu.getBufferSize();
+    return true;
+}
+
+// Leaves mr_ unset for a local registration when the proxy can't help
+bool RdmaVerbs::registerThroughProxy(HpuManager& hpu, int mr_flags) {
+    int fd = hpu.getBufferFd();
+    if (fd < 0) return false;
+
+    TraceScope trace(TraceKind::Register, 0, hpu.getBufferSize());
+    ProxyRegistration shared;
+    try {
+        shared = proxy_->registerFd(fd, 0, hpu.getBufferSize(), local_addr_, mr_flags);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return false;
+    }
+    mr_ = ibv_import_mr(pd_, shared.handle);
+    if (!mr_) {
+        std::cerr << "Failed to import the proxy's registration\n";
+        proxy_->release(shared.handle);
+        return false;
+    }
+    trace.setId(mr_->lkey);
+    proxy_mr_handle_ = shared.handle;
+    // Another worker may have registered the same file first
+    local_addr_ = shared.iova;
+    std::cout << "✓ Buffer registered through the registration proxy\n";
+    return true;
+}
+
+// Leaves mr_ unset when the device can't page RC traffic on demand
+bool RdmaVerbs::registerOnDemand(HpuManager& hpu, int mr_flags) {
+    struct ibv_device_attr_ex attr = {};
+    const uint32_t needed = IBV_ODP_SUPPORT_SEND | IBV_ODP_SUPPORT_RECV | IBV_ODP_SUPPORT_WRITE | IBV_ODP_SUPPORT_READ;
+    if (ibv_query_device_ex(ib_ctx_, nullptr, &attr) || !(attr.odp_caps.general_caps & IBV_ODP_SUPPORT) ||
+        (attr.odp_caps.per_transport_caps.rc_odp_caps & needed) != needed) {
+        std::cout << "✗ Device has no on-demand paging for RC, pinning the buffer\n";
+        return false;
+    }
+    mr_flags |= IBV_ACCESS_ON_DEMAND;
+    if (!(attr.odp_caps.per_transport_caps.rc_odp_caps & IBV_ODP_SUPPORT_ATOMIC)) {
+        mr_flags &= ~IBV_ACCESS_REMOTE_ATOMIC;
+    }
+
+    bool implicit = hpu.getPaging() == Paging::Implicit;
+    if (implicit && !(attr.odp_caps.general_caps & IBV_ODP_SUPPORT_IMPLICIT)) {
+        std::cout << "No implicit on-demand paging, registering the buffer on demand\n";
+        implicit = false;
+    }
+
+    // An implicit MR covers the whole address space with one key. Its rkey
+    // would open all of it to the peer, so it gets no remote rights; the
+    // peer reaches the buffer through a bounded ODP MR as with OnDemand.
+    if (implicit) {
+        implicit_mr_ = ibv_reg_mr(pd_, nullptr, SIZE_MAX, IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_ON_DEMAND);
+        if (!implicit_mr_) {
+            std::cout << "Implicit on-demand registration failed, registering the buffer on demand\n";
+            implicit = false;
+        }
+    }
+
+    TraceScope trace(TraceKind::Register, 0, hpu.getBufferSize());
+    mr_ = ibv_reg_mr(pd_, hpu.getBuffer(), hpu.getBufferSize(), mr_flags);
+    if (!mr_) {
+        std::cout << "✗ On-demand registration failed, pinning the buffer\n";
+        if (implicit_mr_) {
+            ibv_dereg_mr(implicit_mr_);
+            implicit_mr_ = nullptr;
+        }
+        return false;
+    }
+    trace.setId(mr_->lkey);
+    if (implicit_mr_) host_mrs_[implicit_mr_->lkey] = implicit_mr_;
+    paging_ = implicit ? Paging::Implicit : Paging::OnDemand;
+    std::cout << "✓ Host memory registered with " << pagingName(paging_) << " paging\n";
+    return true;
+}
+
+bool RdmaVerbs::prefetch(size_t offset, size_t length, bool for_write) {
+    if (paging_ == Paging::Pinned || length == 0) return true;
+    if (offset + length > region_size_) {
+        throw std::runtime_error("Prefetch exceeds registered buffer");
+    }
+    // One SGE holds at most 4 GB; flush makes the call wait for the faults
+    constexpr size_t CHUNK = 1ull << 30;
+    for (size_t done = 0; done < length; done += CHUNK) {
+        struct ibv_sge sge = {};
+        sge.addr = getLocalAddr() + offset + done;
+        sge.length = static_cast<uint32_t>(std::min(CHUNK, length - done));
+        sge.lkey = mr_->lkey;
+        int ret = ibv_advise_mr(pd_, for_write ? IBV_ADVISE_MR_ADVICE_PREFETCH_WRITE : IBV_ADVISE_MR_ADVICE_PREFETCH,
+                                IBV_ADVISE_MR_FLAG_FLUSH, &sge, 1);
+        if (ret) {
+            std::cerr << "Prefetch of " << sge.length << " bytes failed: " << strerror(ret) << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool RdmaVerbs::createExtendedCq() {
+    struct ibv_device_attr_ex attr = {};
+    if (ibv_query_device_ex(ib_ctx_, nullptr, &attr)) {
+        std::cout << "Extended device query unsupported, using legacy CQ\n";
+        return false;
+    }
+    if (!attr.completion_timestamp_mask || !attr.hca_core_clock) {
+        std::cout << "No hardware completion timestamps, using legacy CQ\n";
+        return false;
+    }
+
+    struct ibv_cq_init_attr_ex cq_attr = {};
+    cq_attr.cqe = CQ_DEPTH;
+    cq_attr.wc_flags = IBV_WC_EX_WITH_BYTE_LEN | IBV_WC_EX_WITH_IMM | IBV_WC_EX_WITH_QP_NUM |
+                       IBV_WC_EX_WITH_COMPLETION_TIMESTAMP;
+    cq_ex_ = ibv_create_cq_ex(ib_ctx_, &cq_attr);
+    if (!cq_ex_) {
+        std::cout << "Extended CQ creation failed, using legacy CQ\n";
+        return false;
+    }
 
+    cq_ = ibv_cq_ex_to_cq(cq_ex_);
+    core_clock_khz_ = attr.hca_core_clock;
+    timestamp_mask_ = attr.completion_timestamp_mask;
+    std::cout << "✓ Hardware completion timestamps (" << core_clock_khz_ / 1000 << " MHz NIC clock)\n";
+    return true;
+}
+
+// Created with ibv_create_qp_ex for the builder while the device accepts
+// it; the first refusal turns the builder off for later QPs too
+struct ibv_qp* RdmaVerbs::createRcQp(struct ibv_qp_init_attr& attr) {
+    if (extended_send_) {
+        struct ibv_qp_init_attr_ex attr_ex = {};
+        attr_ex.send_cq = attr.send_cq;
+        attr_ex.recv_cq = attr.recv_cq;
+        attr_ex.cap = attr.cap;
+        attr_ex.qp_type = attr.qp_type;
+        attr_ex.sq_sig_all = attr.sq_sig_all;
+        attr_ex.pd = pd_;
+        attr_ex.comp_mask = IBV_QP_INIT_ATTR_PD | IBV_QP_INIT_ATTR_SEND_OPS_FLAGS;
+        attr_ex.send_ops_flags = IBV_QP_EX_WITH_SEND | IBV_QP_EX_WITH_SEND_WITH_IMM | IBV_QP_EX_WITH_RDMA_WRITE |
+                                 IBV_QP_EX_WITH_RDMA_WRITE_WITH_IMM | IBV_QP_EX_WITH_RDMA_READ;
+        if (windows_) attr_ex.send_ops_flags |= IBV_QP_EX_WITH_BIND_MW | IBV_QP_EX_WITH_LOCAL_INV;
+
+        struct ibv_qp* qp = ibv_create_qp_ex(ib_ctx_, &attr_ex);
+        if (qp) return qp;
+        std::cout << "Work request builder unsupported, using ibv_post_send\n";
+        extended_send_ = false;
+    }
+    return ibv_create_qp(pd_, &attr);
+}
+
+struct ibv_qp* RdmaVerbs::createQp(uint32_t depth, uint32_t max_sge) {
     struct ibv_qp_init_attr qp_init_attr = {};
     qp_init_attr.send_cq = cq_;
     qp_init_attr.recv_cq = cq_;
-    qp_init_attr.cap.max_send_wr = 1;
-    qp_init_attr.cap.max_recv_wr = 1;
-    qp_init_attr.cap.max_send_sge = 1;
-    qp_init_attr.cap.max_recv_sge = 1;
+    qp_init_attr.cap.max_send_wr = depth;
+    qp_init_attr.cap.max_recv_wr = depth;
+    qp_init_attr.cap.max_send_sge = max_sge;
+    qp_init_attr.cap.max_recv_sge = max_sge;
     qp_init_attr.qp_type = IBV_QPT_RC;
-    qp_init_attr.sq_sig_all = 1;
+    qp_init_attr.sq_sig_all = 0;
 
+    struct ibv_qp* qp = createRcQp(qp_init_attr);
+    if (!qp) {
+        throw std::runtime_error("Failed to create QP");
+    }
+    return qp;
+}
 
-    qp_ = ibv_create_qp(pd_, &qp_init_attr);
-    if (!qp_) {
-        std::cerr << "Failed to create QP\n";
+struct ibv_mr* RdmaVerbs::registerHostMemory(void* addr, size_t size) {
+    int mr_flags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ |
+                   IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_ATOMIC;
+    TraceScope trace(TraceKind::Register, 0, size);
+    struct ibv_mr* mr = ibv_reg_mr(pd_, addr, size, mr_flags);
+    if (!mr) {
+        throw std::runtime_error("Failed to register host memory");
+    }
+    trace.setId(mr->lkey);
+    host_mrs_[mr->lkey] = mr;
+    return mr;
+}
+
+ControlRegion RdmaVerbs::allocateControlRegion(size_t size, bool on_device) {
+    if (size == 0) {
+        throw std::runtime_error("Control region needs a size");
+    }
+    int mr_flags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ |
+                   IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_ATOMIC;
+    ControlRegion region;
+    // Device memory is handed out in 64-byte blocks; atomics want 8-byte words
+    region.size = (size + 63) & ~size_t{63};
+    if (on_device && allocateDeviceControl(region, mr_flags)) {
+        return region;
+    }
+
+    region.host = static_cast<uint8_t*>(aligned_alloc(64, region.size));
+    if (!region.host) {
+        throw std::runtime_error("Failed to allocate control region");
+    }
+    memset(region.host, 0, region.size);
+    TraceScope trace(TraceKind::Register, 0, region.size);
+    region.mr = ibv_reg_mr(pd_, region.host, region.size, mr_flags);
+    if (!region.mr) {
+        free(region.host);
+        throw std::runtime_error("Failed to register control region");
+    }
+    trace.setId(region.mr->lkey);
+    host_mrs_[region.mr->lkey] = region.mr;
+    return region;
+}
+
+// Leaves the region untouched when the device has no memory to spare
+bool RdmaVerbs::allocateDeviceControl(ControlRegion& region, int mr_flags) {
+    struct ibv_device_attr_ex attr = {};
+    if (ibv_query_device_ex(ib_ctx_, nullptr, &attr) || attr.max_dm_size < region.size) {
+        std::cout << "✗ No NIC memory for a " << region.size << " byte control region, using host memory\n";
         return false;
     }
 
+    struct ibv_alloc_dm_attr dm_attr = {};
+    dm_attr.length = region.size;
+    struct ibv_dm* dm = ibv_alloc_dm(ib_ctx_, &dm_attr);
+    if (!dm) {
+        std::cout << "✗ NIC memory allocation failed, using host memory\n";
+        return false;
+    }
+    std::vector<uint8_t> zeros(region.size, 0);
+    if (ibv_memcpy_to_dm(dm, 0, zeros.data(), region.size)) {
+        std::cerr << "Failed to clear NIC control memory\n";
+        ibv_free_dm(dm);
+        return false;
+    }
+
+    TraceScope trace(TraceKind::Register, 0, region.size);
+    region.mr = ibv_reg_dm_mr(pd_, dm, 0, region.size, mr_flags | IBV_ACCESS_ZERO_BASED);
+    if (!region.mr) {
+        std::cerr << "Failed to register NIC control memory: " << strerror(errno) << "\n";
+        ibv_free_dm(dm);
+        return false;
+    }
+    trace.setId(region.mr->lkey);
+    region.dm = dm;
+    std::cout << "✓ " << region.size << " byte control region in NIC memory\n";
     return true;
 }
 
+void RdmaVerbs::freeControlRegion(ControlRegion& region) {
+    if (region.mr) {
+        TraceScope trace(TraceKind::Deregister, region.mr->lkey);
+        host_mrs_.erase(region.mr->lkey);
+        ibv_dereg_mr(region.mr);
+    }
+    if (region.dm) ibv_free_dm(region.dm);
+    free(region.host);
+    region = ControlRegion{};
+}
+
+void RdmaVerbs::readControl(const ControlRegion& region, size_t offset, void* dst, size_t length) const {
+    if (offset + length > region.size || (offset | length) % 4 != 0) {
+        throw std::runtime_error("Control read out of bounds or unaligned");
+    }
+    if (!region.dm) {
+        memcpy(dst, region.host + offset, length);
+    } else if (ibv_memcpy_from_dm(dst, region.dm, offset, length)) {
+        throw std::runtime_error("Failed to read NIC control memory");
+    }
+}
+
+void RdmaVerbs::writeControl(const ControlRegion& region, size_t offset, const void* src, size_t length) {
+    if (offset + length > region.size || (offset | length) % 4 != 0) {
+        throw std::runtime_error("Control write out of bounds or unaligned");
+    }
+    if (!region.dm) {
+        memcpy(region.host + offset, src, length);
+    } else if (ibv_memcpy_to_dm(region.dm, offset, src, length)) {
+        throw std::runtime_error("Failed to write NIC control memory");
+    }
+}
+
+AccessGrant RdmaVerbs::grantAccess(struct ibv_qp* qp, size_t offset, size_t length, int access, bool signaled) {
+    if (!windows_) {
+        throw std::runtime_error("Device has no type-2 memory windows");
+    }
+    if (!qp || (shm_ && qp == qp_)) {
+        throw std::runtime_error("Access grants need a QP that goes through the NIC");
+    }
+    if (offset + length > region_size_ || length == 0) {
+        throw std::runtime_error("Access grant exceeds registered buffer");
+    }
+
+    AccessGrant grant;
+    std::vector<struct ibv_mw*>& free_windows = free_windows_[qp->qp_num];
+    if (free_windows.empty()) {
+        grant.mw = ibv_alloc_mw(pd_, IBV_MW_TYPE_2);
+        if (!grant.mw) {
+            throw std::runtime_error("Failed to allocate memory window");
+        }
+        window_states_[grant.mw] = {qp->qp_num, grant.mw->rkey, false};
+    } else {
+        grant.mw = free_windows.back();
+        free_windows.pop_back();
+    }
+    WindowState& state = window_states_[grant.mw];
+    grant.qp = qp;
+    grant.addr = getLocalAddr() + offset;
+    grant.length = length;
+    // A fresh tag each bind, so a key from an earlier grant can't hit this one
+    grant.rkey = ibv_inc_rkey(state.rkey);
+
+    struct ibv_send_wr wr = {};
+    wr.wr_id = grant.rkey;
+    wr.opcode = IBV_WR_BIND_MW;
+    wr.send_flags = signaled ? IBV_SEND_SIGNALED : 0;
+    wr.bind_mw.mw = grant.mw;
+    wr.bind_mw.rkey = grant.rkey;
+    wr.bind_mw.bind_info.mr = mr_;
+    wr.bind_mw.bind_info.addr = grant.addr;
+    wr.bind_mw.bind_info.length = length;
+    wr.bind_mw.bind_info.mw_access_flags = static_cast<unsigned int>(access);
+    try {
+        postSend(qp, &wr);
+    } catch (...) {
+        free_windows.push_back(grant.mw);
+        throw;
+    }
+    // Tracked here rather than in mw->rkey, which only the completed bind updates
+    state.rkey = grant.rkey;
+    state.bound = true;
+    return grant;
+}
+
+void RdmaVerbs::revokeAccess(AccessGrant& grant, bool signaled) {
+    auto state = window_states_.find(grant.mw);
+    // Nothing to invalidate if the grant was released or its QP destroyed
+    if (state != window_states_.end() && state->second.bound) {
+        struct ibv_send_wr wr = {};
+        wr.wr_id = grant.rkey;
+        wr.opcode = IBV_WR_LOCAL_INV;
+        wr.send_flags = signaled ? IBV_SEND_SIGNALED : 0;
+        wr.invalidate_rkey = grant.rkey;
+        postSend(grant.qp, &wr);
+    }
+    releaseAccess(grant);
+}
+
+void RdmaVerbs::releaseAccess(AccessGrant& grant) {
+    auto state = window_states_.find(grant.mw);
+    if (state != window_states_.end() && state->second.bound) {
+        // Back to its own QP, whose send queue orders the next bind after the invalidate
+        state->second.bound = false;
+        free_windows_[state->second.qp_num].push_back(grant.mw);
+    }
+    grant = AccessGrant{};
+}
+
+SharedRegistration RdmaVerbs::registerSharedMemory(int fd, size_t offset, size_t length, void* addr) {
+    SharedRegistration reg;
+    if (!proxy_) {
+        reg.mr = registerHostMemory(addr, length);
+        reg.addr = reinterpret_cast<uintptr_t>(addr);
+        return reg;
+    }
+
+    int mr_flags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ |
+                   IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_ATOMIC;
+    TraceScope trace(TraceKind::Register, 0, length);
+    ProxyRegistration shared = proxy_->registerFd(fd, offset, length, reinterpret_cast<uintptr_t>(addr), mr_flags);
+    reg.mr = ibv_import_mr(pd_, shared.handle);
+    if (!reg.mr) {
+        proxy_->release(shared.handle);
+        throw std::runtime_error("Failed to import the proxy's registration");
+    }
+    trace.setId(reg.mr->lkey);
+    reg.addr = shared.iova;
+    reg.handle = shared.handle;
+    return reg;
+}
+
+void RdmaVerbs::deregisterSharedMemory(SharedRegistration& reg) {
+    if (reg.handle) {
+        TraceScope trace(TraceKind::Deregister, reg.mr->lkey);
+        ibv_unimport_mr(reg.mr);
+        proxy_->release(reg.handle);
+    } else {
+        deregisterMemory(reg.mr);
+    }
+    reg = SharedRegistration{};
+}
+
+void RdmaVerbs::deregisterMemory(struct ibv_mr* mr) {
+    if (mr && mr != mr_) {
+        TraceScope trace(TraceKind::Deregister, mr->lkey);
+        host_mrs_.erase(mr->lkey);
+        ibv_dereg_mr(mr);
+    }
+}
+
+void RdmaVerbs::destroyQp(struct ibv_qp* qp) {
+    if (qp && qp != qp_) {
+        traffic_classes_.erase(qp->qp_num);
+        peers_.erase(qp->qp_num);
+        journals_.erase(qp->qp_num);
+        free_windows_.erase(qp->qp_num);
+        uint32_t qp_num = qp->qp_num;
+        ibv_destroy_qp(qp);
+        // The QP's windows go with it, bound or not
+        for (auto it = window_states_.begin(); it != window_states_.end();) {
+            if (it->second.qp_num == qp_num) {
+                ibv_dealloc_mw(it->first);
+                it = window_states_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+}
+
 bool RdmaVerbs::setupSocket(const std::string& server_name, int port) {
     struct addrinfo hints = {}, *res;
     std::string port_str = std::to_string(port);
@@ -366,28 +1206,44 @@ bool RdmaVerbs::setupSocket(const std::string& server_name, int port) {
             freeaddrinfo(res);
             return false;
         }
-        int client_fd = accept(sock_, nullptr, nullptr);
+        // Whichever comes first, the client or cancelConnection
+        struct pollfd pfds[2] = {{sock_, POLLIN, 0}, {cancel_fd_, POLLIN, 0}};
+        int client_fd = -1;
+        if (poll(pfds, cancel_fd_ >= 0 ? 2 : 1, -1) > 0 && !(pfds[1].revents & POLLIN)) {
+            client_fd = accept(sock_, nullptr, nullptr);
+        }
         close(sock_);
         sock_ = client_fd;
+        if (client_fd < 0) {
+            freeaddrinfo(res);
+            return false;
+        }
     }
 
     freeaddrinfo(res);
     return true;
 }
 
-bool RdmaVerbs::exchangeConnectionData() {
+CmConData RdmaVerbs::localConnectionData(struct ibv_qp* qp) const {
     CmConData local_con_data = {};
     union ibv_gid my_gid = {};
 
-    if (port_attr_.link_layer == IBV_LINK_LAYER_ETHERNET) {
-        ibv_query_gid(ib_ctx_, 1, 0, &my_gid);
+    if (path_.gid_index >= 0) {
+        ibv_query_gid(ib_ctx_, 1, path_.gid_index, &my_gid);
     }
 
-    local_con_data.addr = htonll(hpu_->getDmabufFd() >= 0 ? hpu_->getDeviceVa() : reinterpret_cast<uintptr_t>(hpu_->getBuffer()));
+    local_con_data.addr = htonll(getLocalAddr());
     local_con_data.rkey = htonl(mr_->rkey);
-    local_con_data.qp_num = htonl(qp_->qp_num);
+    local_con_data.qp_num = htonl(qp->qp_num);
     local_con_data.lid = htons(port_attr_.lid);
     memcpy(local_con_data.gid, &my_gid, 16);
+    local_con_data.mtu = static_cast<uint8_t>(path_.mtu);
+    local_con_data.rd_atomic = path_.max_dest_rd_atomic;
+    return local_con_data;
+}
+
+bool RdmaVerbs::exchangeConnectionData() {
+    CmConData local_con_data = localConnectionData(qp_);
 
     char temp_char;
     if (write(sock_, &local_con_data, sizeof(CmConData)) != sizeof(CmConData) ||
@@ -395,10 +1251,7 @@ bool RdmaVerbs::exchangeConnectionData() {
         return false;
     }
 
-    remote_props_.addr = ntohll(remote_props_.addr);
-    remote_props_.rkey = ntohl(remote_props_.rkey);
-    remote_props_.qp_num = ntohl(remote_props_.qp_num);
-    remote_props_.lid = ntohs(remote_props_.lid);
+    remote_props_ = connectionDataToHost(remote_props_);
 
     if (write(sock_, "Q", 1) != 1 || read(sock_, &temp_char, 1) != 1) {
         return false;
@@ -407,7 +1260,24 @@ bool RdmaVerbs::exchangeConnectionData() {
     return true;
 }
 
-bool RdmaVerbs::modifyQpToInit() {
+bool RdmaVerbs::setupIntraNode(bool listener) {
+    ShmRegion region;
+    region.fd = hpu_->getBufferFd();
+    region.base = hpu_->getBuffer();
+    region.addr = getLocalAddr();
+    region.size = region_size_;
+    region.lkey = mr_->lkey;
+
+    auto shm = std::make_unique<ShmTransport>();
+    if (!shm->connect(sock_, listener, intra_node_, region, remote_props_.addr)) {
+        return false;
+    }
+    shm->setMainQp(qp_->qp_num, &host_mrs_);
+    shm_ = std::move(shm);
+    return true;
+}
+
+bool RdmaVerbs::modifyQpToInit(struct ibv_qp* qp) {
     struct ibv_qp_attr attr = {};
     attr.qp_state = IBV_QPS_INIT;
     attr.port_num = 1;
@@ -418,73 +1288,424 @@ bool RdmaVerbs::modifyQpToInit() {
                            IBV_ACCESS_REMOTE_ATOMIC;
 
     int flags = IBV_QP_STATE | IBV_QP_PKEY_INDEX | IBV_QP_PORT | IBV_QP_ACCESS_FLAGS;
-    return ibv_modify_qp(qp_, &attr, flags) == 0;
+    return ibv_modify_qp(qp, &attr, flags) == 0;
 }
 
 
-bool RdmaVerbs::modifyQpToRtr() {
-        
+bool RdmaVerbs::modifyQpToRtr(struct ibv_qp* qp, const CmConData& remote) {
     struct ibv_qp_attr attr = {};
     attr.qp_state = IBV_QPS_RTR;
-    attr.path_mtu = IBV_MTU_4096;
-    attr.dest_qp_num = remote_props_.qp_num;
+    // Both ends must agree on the MTU, so take the smaller active one
+    attr.path_mtu = std::min(path_.mtu, static_cast<enum ibv_mtu>(remote.mtu));
+    attr.dest_qp_num = remote.qp_num;
     attr.rq_psn = 0;
-    attr.max_dest_rd_atomic = 1;
-    attr.min_rnr_timer = 12;
+    attr.max_dest_rd_atomic = path_.max_dest_rd_atomic;
+    attr.min_rnr_timer = path_.min_rnr_timer;
+
+    auto traffic = traffic_classes_.find(qp->qp_num);
+    TrafficClass tc = traffic != traffic_classes_.end() ? traffic->second : TrafficClass{};
 
     attr.ah_attr.is_global = 0;
-    attr.ah_attr.dlid = remote_props_.lid;
-    attr.ah_attr.sl = 0;
+    attr.ah_attr.dlid = remote.lid;
+    attr.ah_attr.sl = tc.service_level;
     attr.ah_attr.src_path_bits = 0;
     attr.ah_attr.port_num = 1;
 
 
-    if (memcmp(remote_props_.gid, "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0", 16)) {
+    if (memcmp(remote.gid, "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0", 16)) {
         attr.ah_attr.is_global = 1;
-        memcpy(&attr.ah_attr.grh.dgid, remote_props_.gid, 16);
-        attr.ah_attr.grh.sgid_index = 0;
-        attr.ah_attr.grh.hop_limit = 1;
+        memcpy(&attr.ah_attr.grh.dgid, remote.gid, 16);
+        attr.ah_attr.grh.sgid_index = static_cast<uint8_t>(std::max(path_.gid_index, 0));
+        attr.ah_attr.grh.hop_limit = path_.hop_limit;
+        attr.ah_attr.grh.traffic_class = static_cast<uint8_t>(tc.dscp << 2);
     }
 
-    return ibv_modify_qp(qp_, &attr, IBV_QP_STATE | IBV_QP_AV | IBV_QP_PATH_MTU |
+    return ibv_modify_qp(qp, &attr, IBV_QP_STATE | IBV_QP_AV | IBV_QP_PATH_MTU |
                          IBV_QP_DEST_QPN | IBV_QP_RQ_PSN | IBV_QP_MAX_DEST_RD_ATOMIC | 
                          IBV_QP_MIN_RNR_TIMER) == 0;
 }
 
-bool RdmaVerbs::modifyQpToRts() {
+bool RdmaVerbs::modifyQpToRts(struct ibv_qp* qp, const CmConData& remote) {
     struct ibv_qp_attr attr = {};
     attr.qp_state = IBV_QPS_RTS;
-    attr.timeout = 14;
-    attr.retry_cnt = 7;
-    attr.rnr_retry = 7;
+    attr.timeout = path_.timeout;
+    attr.retry_cnt = path_.retry_cnt;
+    attr.rnr_retry = path_.rnr_retry;
     attr.sq_psn = 0;
-    attr.max_rd_atomic = 1;
+    // No more reads in flight than the peer has responder resources for
+    attr.max_rd_atomic = std::min(path_.max_rd_atomic, remote.rd_atomic);
 
-    return ibv_modify_qp(qp_, &attr, IBV_QP_STATE | IBV_QP_TIMEOUT | IBV_QP_RETRY_CNT |
+    return ibv_modify_qp(qp, &attr, IBV_QP_STATE | IBV_QP_TIMEOUT | IBV_QP_RETRY_CNT |
                          IBV_QP_RNR_RETRY | IBV_QP_SQ_PSN | IBV_QP_MAX_QP_RD_ATOMIC) == 0;
 }
 
+// Pacing is optional hardware support; the QP still works unpaced without it
+bool RdmaVerbs::applyRateLimit(struct ibv_qp* qp, uint32_t rate_limit_kbps) {
+    struct ibv_qp_rate_limit_attr attr = {};
+    attr.rate_limit = rate_limit_kbps;
+    if (ibv_modify_qp_rate_limit(qp, &attr)) {
+        std::cerr << "Failed to rate limit QP " << qp->qp_num << " to " << rate_limit_kbps << " kbps\n";
+        return false;
+    }
+    return true;
+}
+
+namespace {
+
+// Sent by each side when recovering a QP, in network byte order
+struct RecoveryRequest {
+    char tag;
+    uint32_t qp_num;    // The receiver's QP number
+    CmConData data;     // The sender's QP after reset
+} __attribute__((packed));
+
+constexpr char RECOVERY_TAG = 'R';
+
+// How long a side waits for the other to re-open the recovery connection
+constexpr std::chrono::seconds RECOVERY_REOPEN_TIMEOUT(5);
+
+// Retried until the deadline, the peer may still be on its way to accept
+int connectRecovery(const std::string& host, int port) {
+    struct addrinfo hints = {}, *res;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    std::string port_str = std::to_string(port);
+    if (getaddrinfo(host.c_str(), port_str.c_str(), &hints, &res)) {
+        return -1;
+    }
+    auto deadline = std::chrono::steady_clock::now() + RECOVERY_REOPEN_TIMEOUT;
+    int fd = -1;
+    do {
+        fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+        if (fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) == 0) break;
+        if (fd >= 0) close(fd);
+        fd = -1;
+        usleep(10000);
+    } while (std::chrono::steady_clock::now() < deadline);
+    freeaddrinfo(res);
+    return fd;
+}
+
+// -1 when nobody connected within timeout_ms
+int acceptRecovery(int listen_fd, int timeout_ms) {
+    struct pollfd pfd = {listen_fd, POLLIN, 0};
+    if (poll(&pfd, 1, timeout_ms) <= 0) return -1;
+    return accept(listen_fd, nullptr, nullptr);
+}
+
+// Sends that land the same way however often they are posted
+bool replayable(int opcode) {
+    return opcode == IBV_WR_RDMA_WRITE || opcode == IBV_WR_RDMA_READ;
+}
+
+} // namespace
+
+void RdmaVerbs::enableRecovery(struct ibv_qp* qp) {
+    if (shm_ && qp == qp_) {
+        return;     // Shared memory has no link to lose
+    }
+    openRecoveryChannel();
+    journals_[qp->qp_num];
+}
+
+// The server listens on an ephemeral port and tells the client over the
+// connection socket; the listener stays open for re-opening
+void RdmaVerbs::openRecoveryChannel() {
+    if (recovery_sock_ >= 0 || recovery_listen_fd_ >= 0 || recovery_port_ || sock_ < 0) return;
+
+    uint16_t port = 0;
+    if (server_name_.empty()) {
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        socklen_t len = sizeof(addr);
+        recovery_listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        if (recovery_listen_fd_ < 0 || bind(recovery_listen_fd_, reinterpret_cast<struct sockaddr*>(&addr), len) ||
+            listen(recovery_listen_fd_, 1) ||
+            getsockname(recovery_listen_fd_, reinterpret_cast<struct sockaddr*>(&addr), &len)) {
+            throw std::runtime_error("Failed to open the recovery listener");
+        }
+        port = addr.sin_port;
+        if (write(sock_, &port, sizeof(port)) != sizeof(port)) {
+            throw std::runtime_error("Failed to send the recovery port");
+        }
+        recovery_sock_ = acceptRecovery(recovery_listen_fd_,
+                                        std::chrono::milliseconds(RECOVERY_REOPEN_TIMEOUT).count());
+    } else {
+        if (read(sock_, &port, sizeof(port)) != sizeof(port)) {
+            throw std::runtime_error("Failed to receive the recovery port");
+        }
+        recovery_port_ = ntohs(port);
+        recovery_sock_ = connectRecovery(server_name_, recovery_port_);
+    }
+    if (recovery_sock_ < 0) {
+        throw std::runtime_error("Failed to open the recovery connection");
+    }
+}
+
+void RdmaVerbs::journalSend(struct ibv_qp* qp, const struct ibv_send_wr* wr) {
+    auto journal = journals_.find(qp->qp_num);
+    if (journal == journals_.end()) return;
+    for (; wr; wr = wr->next) {
+        SendRecord record{*wr, std::vector<struct ibv_sge>(wr->sg_list, wr->sg_list + wr->num_sge),
+                          qp == qp_ || (wr->send_flags & IBV_SEND_SIGNALED)};
+        record.wr.next = nullptr;
+        journal->second.sends.push_back(std::move(record));
+    }
+}
+
+void RdmaVerbs::journalRecv(struct ibv_qp* qp, const struct ibv_recv_wr* wr) {
+    auto journal = journals_.find(qp->qp_num);
+    if (journal == journals_.end()) return;
+    for (; wr; wr = wr->next) {
+        RecvRecord record{*wr, std::vector<struct ibv_sge>(wr->sg_list, wr->sg_list + wr->num_sge)};
+        record.wr.next = nullptr;
+        journal->second.recvs.push_back(std::move(record));
+    }
+}
+
+// A signaled send completion also completes the unsignaled sends before it
+void RdmaVerbs::retireJournal(const struct ibv_wc* wc, int count) {
+    for (int i = 0; i < count; ++i) {
+        if (wc[i].status != IBV_WC_SUCCESS) continue;
+        auto journal = journals_.find(wc[i].qp_num);
+        if (journal == journals_.end()) continue;
+        if (wc[i].opcode & IBV_WC_RECV) {
+            if (!journal->second.recvs.empty()) journal->second.recvs.pop_front();
+            continue;
+        }
+        auto& sends = journal->second.sends;
+        while (!sends.empty()) {
+            bool signaled = sends.front().signaled;
+            sends.pop_front();
+            if (signaled) break;
+        }
+    }
+}
+
+std::vector<uint64_t> RdmaVerbs::recoverQp(struct ibv_qp* qp, int sock) {
+    return recover(qp, sock < 0 ? recovery_sock_ : sock, nullptr);
+}
+
+bool RdmaVerbs::serviceRecovery(int sock, std::vector<uint64_t>* unreplayed) {
+    if (sock < 0 && recovery_listen_fd_ >= 0) {
+        // The client lost its connection and opened a new one
+        int fd = acceptRecovery(recovery_listen_fd_, 0);
+        if (fd >= 0) {
+            if (recovery_sock_ >= 0) close(recovery_sock_);
+            recovery_sock_ = fd;
+        }
+    }
+    int fd = sock < 0 ? recovery_sock_ : sock;
+    if (fd < 0) return false;
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, 0) <= 0) return false;
+
+    RecoveryRequest request;
+    ssize_t n = recv(fd, &request, sizeof(request), MSG_WAITALL);
+    if (n == 0) {
+        // The peer is gone; if it was only its connection, it re-opens one
+        if (fd == recovery_sock_) {
+            close(recovery_sock_);
+            recovery_sock_ = -1;
+        }
+        return false;
+    }
+    if (n != sizeof(request) || request.tag != RECOVERY_TAG) {
+        throw std::runtime_error("Failed to read recovery request");
+    }
+    auto peer = peers_.find(ntohl(request.qp_num));
+    if (peer == peers_.end()) {
+        throw std::runtime_error("Recovery requested for unknown QP " + std::to_string(ntohl(request.qp_num)));
+    }
+    std::vector<uint64_t> lost = recover(peer->second.qp, fd, &request.data);
+    if (unreplayed) unreplayed->insert(unreplayed->end(), lost.begin(), lost.end());
+    return true;
+}
+
+std::vector<uint64_t> RdmaVerbs::recover(struct ibv_qp* qp, int sock, const CmConData* peer_request) {
+    auto start = std::chrono::steady_clock::now();
+    auto peer = peers_.find(qp->qp_num);
+    if (peer == peers_.end()) {
+        throw std::runtime_error("QP " + std::to_string(qp->qp_num) + " was never connected");
+    }
+    if (shm_ && qp == qp_) {
+        return {};
+    }
+
+    struct ibv_qp_attr attr = {};
+    attr.qp_state = IBV_QPS_ERR;
+    if (ibv_modify_qp(qp, &attr, IBV_QP_STATE)) {
+        throw std::runtime_error("Failed to move QP to ERR");
+    }
+    drainFailedQp(qp);
+    attr.qp_state = IBV_QPS_RESET;
+    if (ibv_modify_qp(qp, &attr, IBV_QP_STATE)) {
+        throw std::runtime_error("Failed to reset QP");
+    }
+
+    // Only QP metadata is exchanged; the MR and its rkey stay as they were
+    RecoveryRequest local = {RECOVERY_TAG, htonl(peer->second.remote_qp_num), localConnectionData(qp)};
+    RecoveryRequest remote = {};
+    if (peer_request) {
+        remote.tag = RECOVERY_TAG;
+        remote.qp_num = htonl(qp->qp_num);
+        remote.data = *peer_request;
+    }
+    for (int attempt = 0;; ++attempt) {
+        bool sent = sock >= 0 && send(sock, &local, sizeof(local), MSG_NOSIGNAL) == sizeof(local);
+        if (sent && (peer_request || recv(sock, &remote, sizeof(remote), MSG_WAITALL) == sizeof(remote))) break;
+        if (attempt > 0 || sock != recovery_sock_ || peer_request || !reopenRecoveryChannel()) {
+            throw std::runtime_error("Failed to exchange QP recovery data");
+        }
+        sock = recovery_sock_;
+    }
+    if (remote.tag != RECOVERY_TAG || ntohl(remote.qp_num) != qp->qp_num) {
+        throw std::runtime_error("Peer is recovering a different QP");
+    }
+
+    CmConData remote_data = connectionDataToHost(remote.data);
+    bringUpQp(qp, remote_data);
+    if (qp == qp_) {
+        remote_props_ = remote_data;
+    }
+    char temp_char;
+    if (send(sock, "Q", 1, MSG_NOSIGNAL) != 1 || recv(sock, &temp_char, 1, MSG_WAITALL) != 1) {
+        throw std::runtime_error("Failed to sync QP recovery");
+    }
+
+    // Receives first so replayed sends from the peer find them
+    size_t replayed = 0;
+    std::vector<uint64_t> unreplayed;
+    auto journal = journals_.find(qp->qp_num);
+    if (journal != journals_.end()) {
+        for (auto& record : journal->second.recvs) {
+            record.wr.sg_list = record.sge.data();
+            struct ibv_recv_wr* bad_wr;
+            if (ibv_post_recv(qp, &record.wr, &bad_wr)) {
+                throw std::runtime_error("Failed to repost receive");
+            }
+        }
+        // A send that reached the peer before the fault would take a second
+        // receive and credit there if posted again; those go back to the caller
+        std::deque<SendRecord> kept;
+        for (auto& record : journal->second.sends) {
+            if (!replayable(record.wr.opcode)) {
+                unreplayed.push_back(record.wr.wr_id);
+                continue;
+            }
+            record.wr.sg_list = record.sge.data();
+            struct ibv_send_wr* bad_wr;
+            if (ibv_post_send(qp, &record.wr, &bad_wr)) {
+                throw std::runtime_error("Failed to replay send");
+            }
+            kept.push_back(std::move(record));
+        }
+        journal->second.sends = std::move(kept);
+        replayed = journal->second.recvs.size() + journal->second.sends.size();
+    }
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    Tracer::instant(TraceKind::Recover, qp->qp_num, replayed);
+    std::cout << "✓ QP " << qp->qp_num << " recovered in " << ms << " ms, " << replayed << " work requests replayed, "
+              << unreplayed.size() << " left to the caller\n";
+    return unreplayed;
+}
+
+// Throws away the failed QP's flushed completions; other QPs' completions
+// are kept for the next poll
+void RdmaVerbs::drainFailedQp(struct ibv_qp* qp) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(50);
+    struct ibv_wc wc[32];
+    int idle = 0;
+    while (idle < 2 && std::chrono::steady_clock::now() < deadline) {
+        int ne = pollDevice(wc, nullptr, 32);
+        for (int i = 0; i < ne; ++i) {
+            if (wc[i].qp_num != qp->qp_num || wc[i].status == IBV_WC_SUCCESS) {
+                deferred_.push_back(wc[i]);
+            }
+        }
+        if (ne == 0) {
+            idle++;
+            usleep(100);
+        } else {
+            idle = 0;
+        }
+    }
+}
+
+// The client connects again, the server waits on its listener; both give up
+// after RECOVERY_REOPEN_TIMEOUT rather than block on a peer that is gone
+bool RdmaVerbs::reopenRecoveryChannel() {
+    if (recovery_sock_ >= 0) {
+        close(recovery_sock_);
+        recovery_sock_ = -1;
+    }
+    if (recovery_listen_fd_ >= 0) {
+        recovery_sock_ = acceptRecovery(recovery_listen_fd_,
+                                        std::chrono::milliseconds(RECOVERY_REOPEN_TIMEOUT).count());
+    } else if (recovery_port_) {
+        recovery_sock_ = connectRecovery(server_name_, recovery_port_);
+    }
+    if (recovery_sock_ < 0) {
+        std::cerr << "Failed to re-open the recovery connection\n";
+        return false;
+    }
+    std::cout << "Recovery connection re-opened\n";
+    return true;
+}
+
 void RdmaVerbs::cleanup() {
+    recorder_.reset();
+    shm_.reset();
     if (qp_) {
         ibv_destroy_qp(qp_);
         qp_ = nullptr;
     }
-    if (mr_) {
+    for (auto& window : window_states_) ibv_dealloc_mw(window.first);
+    window_states_.clear();
+    free_windows_.clear();
+    if (mr_ && proxy_mr_handle_) {
+        // The proxy deregisters once no worker holds it any more
+        ibv_unimport_mr(mr_);
+        proxy_->release(proxy_mr_handle_);
+        proxy_mr_handle_ = 0;
+        mr_ = nullptr;
+    } else if (mr_) {
         ibv_dereg_mr(mr_);
         mr_ = nullptr;
     }
+    if (implicit_mr_) {
+        ibv_dereg_mr(implicit_mr_);
+        implicit_mr_ = nullptr;
+    }
+    host_mrs_.clear();
     if (cq_) {
         ibv_destroy_cq(cq_);
         cq_ = nullptr;
+        cq_ex_ = nullptr;
     }
     if (pd_) {
-        ibv_dealloc_pd(pd_);
+        if (proxy_) {
+            ibv_unimport_pd(pd_);
+        } else {
+            ibv_dealloc_pd(pd_);
+        }
         pd_ = nullptr;
     }
     if (ib_ctx_) {
         ibv_close_device(ib_ctx_);
         ib_ctx_ = nullptr;
     }
+    proxy_.reset();
+    if (recovery_sock_ >= 0) {
+        close(recovery_sock_);
+        recovery_sock_ = -1;
+    }
+    if (recovery_listen_fd_ >= 0) {
+        close(recovery_listen_fd_);
+        recovery_listen_fd_ = -1;
+    }
     if (sock_ >= 0) {
         close(sock_);
         sock_ = -1;
@@ -0,0 +1,182 @@
+#include "io_ring.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+IoRing::IoRing(uint32_t entries) : entries_(entries) {
+    if (entries_ == 0) {
+        throw std::runtime_error("I/O ring needs at least one entry");
+    }
+    if (!setup(entries_)) {
+        unmap();
+        std::cout << "io_uring unavailable, using synchronous file I/O\n";
+    }
+}
+
+IoRing::~IoRing() {
+    unmap();
+}
+
+void IoRing::unmap() {
+    if (sqes_) {
+        munmap(sqes_, entries_ * sizeof(struct io_uring_sqe));
+        sqes_ = nullptr;
+    }
+    if (cq_ring_ && cq_ring_ != sq_ring_) {
+        munmap(cq_ring_, cq_ring_size_);
+    }
+    cq_ring_ = nullptr;
+    if (sq_ring_) {
+        munmap(sq_ring_, sq_ring_size_);
+        sq_ring_ = nullptr;
+    }
+    if (ring_fd_ >= 0) {
+        close(ring_fd_);
+        ring_fd_ = -1;
+    }
+}
+
+bool IoRing::setup(uint32_t entries) {
+    struct io_uring_params params = {};
+    ring_fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (ring_fd_ < 0) {
+        return false;
+    }
+    entries_ = params.sq_entries;
+
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+
+    void* sq = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_,
+                    IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) {
+        std::cerr << "Failed to map io_uring submission ring\n";
+        return false;
+    }
+    sq_ring_ = sq;
+
+    void* cq = sq;
+    if (!single_mmap) {
+        cq = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_,
+                  IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) {
+            std::cerr << "Failed to map io_uring completion ring\n";
+            return false;
+        }
+    }
+    cq_ring_ = cq;
+
+    void* sqes = mmap(nullptr, entries_ * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        std::cerr << "Failed to map io_uring submission entries\n";
+        return false;
+    }
+    sqes_ = static_cast<struct io_uring_sqe*>(sqes);
+
+    uint8_t* sq_base = static_cast<uint8_t*>(sq_ring_);
+    uint8_t* cq_base = static_cast<uint8_t*>(cq_ring_);
+    sq_tail_ = reinterpret_cast<uint32_t*>(sq_base + params.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<uint32_t*>(sq_base + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<uint32_t*>(sq_base + params.sq_off.array);
+    cq_head_ = reinterpret_cast<uint32_t*>(cq_base + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<uint32_t*>(cq_base + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<uint32_t*>(cq_base + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq_base + params.cq_off.cqes);
+    return true;
+}
+
+bool IoRing::registerBuffer(void* addr, size_t length) {
+    if (!usesUring()) return false;
+    struct iovec iov = {addr, length};
+    if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_BUFFERS, &iov, 1) != 0) {
+        std::cout << "io_uring buffer registration failed (" << strerror(errno) << "), pinning per request\n";
+        return false;
+    }
+    fixed_base_ = static_cast<uint8_t*>(addr);
+    fixed_length_ = length;
+    return true;
+}
+
+void IoRing::read(int fd, void* buf, uint32_t length, uint64_t offset, uint64_t tag) {
+    queue(IORING_OP_READ, fd, buf, length, offset, tag);
+}
+
+void IoRing::write(int fd, const void* buf, uint32_t length, uint64_t offset, uint64_t tag) {
+    queue(IORING_OP_WRITE, fd, const_cast<void*>(buf), length, offset, tag);
+}
+
+void IoRing::queue(uint8_t opcode, int fd, void* buf, uint32_t length, uint64_t offset, uint64_t tag) {
+    if (!usesUring()) {
+        ssize_t n = opcode == IORING_OP_READ ? pread(fd, buf, length, static_cast<off_t>(offset))
+                                             : pwrite(fd, buf, length, static_cast<off_t>(offset));
+        done_.push_back({tag, n < 0 ? -errno : static_cast<int>(n)});
+        return;
+    }
+    if (in_flight_ == entries_) {
+        throw std::runtime_error("I/O ring full");
+    }
+
+    uint32_t tail = *sq_tail_;
+    uint32_t index = tail & sq_mask_;
+    struct io_uring_sqe& sqe = sqes_[index];
+    memset(&sqe, 0, sizeof(sqe));
+
+    uint8_t* data = static_cast<uint8_t*>(buf);
+    bool fixed = fixed_base_ && data >= fixed_base_ && data + length <= fixed_base_ + fixed_length_;
+    if (fixed) {
+        opcode = opcode == IORING_OP_READ ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+        sqe.buf_index = 0;
+    }
+    sqe.opcode = opcode;
+    sqe.fd = fd;
+    sqe.addr = reinterpret_cast<uintptr_t>(buf);
+    sqe.len = length;
+    sqe.off = offset;
+    sqe.user_data = tag;
+
+    sq_array_[index] = index;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    in_flight_++;
+    unsubmitted_++;
+}
+
+int IoRing::poll(Completion* completions, int max_completions) {
+    int n = 0;
+    if (!usesUring()) {
+        while (n < max_completions && !done_.empty()) {
+            completions[n++] = done_.front();
+            done_.pop_front();
+        }
+        return n;
+    }
+
+    if (unsubmitted_ > 0) {
+        long submitted = syscall(__NR_io_uring_enter, ring_fd_, unsubmitted_, 0, 0, nullptr, 0);
+        if (submitted < 0 && errno != EAGAIN && errno != EBUSY && errno != EINTR) {
+            throw std::runtime_error("io_uring submit failed: " + std::string(strerror(errno)));
+        }
+        if (submitted > 0) unsubmitted_ -= static_cast<uint32_t>(submitted);
+    }
+
+    uint32_t head = *cq_head_;
+    uint32_t tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    while (n < max_completions && head != tail) {
+        const struct io_uring_cqe& cqe = cqes_[head & cq_mask_];
+        completions[n++] = {cqe.user_data, cqe.res};
+        head++;
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    in_flight_ -= static_cast<uint32_t>(n);
+    return n;
+}
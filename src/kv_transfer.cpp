@@ -0,0 +1,195 @@
+#include "kv_transfer.hpp"
+#include <algorithm>
+
+namespace {
+
+// Keep single writes well under the port's max message size
+constexpr uint64_t KV_MAX_WRITE_BYTES = 1ull << 30;
+
+constexpr uint64_t WR_PEER_SHIFT = 48;
+constexpr uint64_t WR_SEQ_MASK = (1ull << WR_PEER_SHIFT) - 1;
+
+} // namespace
+
+KvBlockTransfer::KvBlockTransfer(RdmaVerbs& rdma, size_t block_size, uint32_t depth)
+    : rdma_(rdma), block_size_(block_size), depth_(std::min(std::max(depth, 2u), QP_DEPTH)) {
+    if (block_size_ == 0 || block_size_ > KV_MAX_WRITE_BYTES) {
+        throw std::runtime_error("Invalid KV block size");
+    }
+    max_sge_ = sgeLimit(rdma_);
+}
+
+uint32_t KvBlockTransfer::sgeLimit(const RdmaVerbs& rdma) {
+    return rdma.getMaxSge();
+}
+
+void KvBlockTransfer::addPeer(int peer, struct ibv_qp* qp, const CmConData& remote, uint64_t remote_size) {
+    auto entry = std::make_unique<Peer>();
+    entry->qp = qp;
+    entry->remote = remote;
+    entry->remote_blocks = remote_size / block_size_;
+    rank_to_peer_[peer] = peers_.size();
+    peers_.push_back(std::move(entry));
+}
+
+uint64_t KvBlockTransfer::submit(int peer, std::vector<BlockPair> blocks) {
+    auto it = rank_to_peer_.find(peer);
+    if (it == rank_to_peer_.end()) {
+        throw std::runtime_error("Unknown KV transfer peer " + std::to_string(peer));
+    }
+
+    // A bad destination would otherwise only show up as a remote access error that kills the QP
+    size_t local_blocks = rdma_.getRegionSize() / block_size_;
+    uint64_t remote_blocks = peers_[it->second]->remote_blocks;
+    for (const auto& pair : blocks) {
+        if (pair.first >= local_blocks) {
+            throw std::runtime_error("KV source block " + std::to_string(pair.first) + " out of range");
+        }
+        if (pair.second >= remote_blocks) {
+            throw std::runtime_error("KV destination block " + std::to_string(pair.second) + " out of range");
+        }
+    }
+
+    uint64_t request = next_req_++;
+    requests_[request] = blocks.empty();
+    stats_.requests++;
+    stats_.blocks += blocks.size();
+    stats_.bytes += blocks.size() * block_size_;
+
+    if (!blocks.empty()) {
+        buildWrites(*peers_[it->second], request, blocks);
+        postWrites(it->second);
+    }
+    return request;
+}
+
+void KvBlockTransfer::buildWrites(Peer& peer, uint64_t request, std::vector<BlockPair>& blocks) {
+    std::sort(blocks.begin(), blocks.end(),
+              [](const BlockPair& a, const BlockPair& b) { return a.second < b.second; });
+
+    uint64_t local_base = rdma_.getLocalAddr();
+    uint32_t lkey = rdma_.getLkey();
+    size_t first_write = peer.queue.size();
+
+    Write write = {};
+    uint64_t write_bytes = 0;
+    uint32_t prev_dst = 0;
+
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        uint64_t src = local_base + static_cast<uint64_t>(blocks[i].first) * block_size_;
+        uint32_t dst = blocks[i].second;
+
+        bool contiguous_dst = i > 0 && dst == prev_dst + 1;
+        bool merge_sge = contiguous_dst && !write.sges.empty() &&
+                         write.sges.back().addr + write.sges.back().length == src;
+        bool fits = write_bytes + block_size_ <= KV_MAX_WRITE_BYTES &&
+                    (merge_sge || write.sges.size() < max_sge_);
+
+        if (!contiguous_dst || !fits) {
+            if (!write.sges.empty()) {
+                peer.queue.push_back(std::move(write));
+            }
+            write = {};
+            write.remote_addr = peer.remote.addr + static_cast<uint64_t>(dst) * block_size_;
+            write.request = request;
+            write_bytes = 0;
+            merge_sge = false;
+        }
+
+        if (merge_sge) {
+            write.sges.back().length += static_cast<uint32_t>(block_size_);
+        } else {
+            write.sges.push_back({src, static_cast<uint32_t>(block_size_), lkey});
+        }
+        write_bytes += block_size_;
+        prev_dst = dst;
+    }
+    peer.queue.push_back(std::move(write));
+
+    for (size_t i = first_write; i < peer.queue.size(); ++i) {
+        stats_.writes++;
+        stats_.sges += peer.queue[i].sges.size();
+    }
+    peer.queue.back().last = true;
+}
+
+void KvBlockTransfer::postWrites(size_t index) {
+    Peer& peer = *peers_[index];
+    uint64_t budget = depth_ - (peer.posted - peer.completed);
+    size_t count = std::min<size_t>(budget, peer.queue.size());
+    if (count == 0) return;
+
+    // One doorbell for the whole chain
+    std::vector<struct ibv_send_wr> wrs(count);
+    for (size_t i = 0; i < count; ++i) {
+        Write& write = peer.queue[i];
+        uint64_t seq = peer.posted + i + 1;
+        bool signaled = write.last || ++peer.since_signal >= depth_ / 2;
+        if (signaled) peer.since_signal = 0;
+        if (write.last) peer.last_write[seq] = write.request;
+
+        struct ibv_send_wr& wr = wrs[i];
+        wr = {};
+        wr.wr_id = (static_cast<uint64_t>(index) << WR_PEER_SHIFT) | seq;
+        wr.sg_list = write.sges.data();
+        wr.num_sge = static_cast<int>(write.sges.size());
+        wr.opcode = IBV_WR_RDMA_WRITE;
+        wr.send_flags = signaled ? static_cast<unsigned int>(IBV_SEND_SIGNALED) : 0u;
+        wr.wr.rdma.remote_addr = write.remote_addr;
+        wr.wr.rdma.rkey = peer.remote.rkey;
+        wr.next = i + 1 < count ? &wrs[i + 1] : nullptr;
+    }
+
+    rdma_.postSend(peer.qp, wrs.data());
+    peer.posted += count;
+    peer.queue.erase(peer.queue.begin(), peer.queue.begin() + count);
+}
+
+int KvBlockTransfer::progress() {
+    struct ibv_wc wc[32];
+    int ne = rdma_.pollCompletions(wc, 32);
+
+    for (int i = 0; i < ne; ++i) {
+        if (wc[i].status != IBV_WC_SUCCESS) {
+            throw std::runtime_error("KV block write failed: " + std::string(ibv_wc_status_str(wc[i].status)));
+        }
+        size_t index = wc[i].wr_id >> WR_PEER_SHIFT;
+        uint64_t seq = wc[i].wr_id & WR_SEQ_MASK;
+        Peer& peer = *peers_[index];
+
+        // RC completes in order, everything up to seq is done
+        peer.completed = seq;
+        auto it = peer.last_write.find(seq);
+        if (it != peer.last_write.end()) {
+            requests_[it->second] = true;
+            peer.last_write.erase(it);
+        }
+    }
+
+    for (size_t index = 0; index < peers_.size(); ++index) {
+        if (!peers_[index]->queue.empty()) postWrites(index);
+    }
+    return ne;
+}
+
+bool KvBlockTransfer::test(uint64_t req) {
+    auto it = requests_.find(req);
+    if (it == requests_.end()) {
+        throw std::runtime_error("Unknown KV transfer request");
+    }
+    if (!it->second) return false;
+    requests_.erase(it);
+    return true;
+}
+
+void KvBlockTransfer::wait(uint64_t req) {
+    int polls = 0;
+    while (!test(req)) {
+        if (progress() == 0) {
+            if (++polls > 1000000) {
+                throw std::runtime_error("KV transfer wait timeout");
+            }
+            usleep(1);
+        }
+    }
+}
@@ -0,0 +1,86 @@
+#include "loopback_fabric.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+#include <thread>
+
+LoopbackFabric::LoopbackFabric(LoopbackNetwork& network, int rank, size_t buffer_size, Paging paging)
+    : network_(network), rank_(rank), buffer_size_(buffer_size), paging_(paging) {
+    // Anonymous pages read as zero and are only backed once touched, which
+    // is what an on-demand registration of the same buffer would see
+    void* mem = mmap(nullptr, buffer_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem == MAP_FAILED) {
+        throw std::runtime_error("Failed to allocate loopback buffer");
+    }
+    buffer_ = static_cast<uint8_t*>(mem);
+    if (paging_ == Paging::Pinned) {
+        populatePages(buffer_, buffer_size_);
+    }
+}
+
+LoopbackFabric::~LoopbackFabric() {
+    munmap(buffer_, buffer_size_);
+}
+
+void LoopbackFabric::prefetch(size_t offset, size_t length) {
+    if (offset + length > buffer_size_) {
+        throw std::runtime_error("Loopback prefetch out of bounds");
+    }
+    if (paging_ != Paging::Pinned && length > 0) {
+        populatePages(buffer_ + offset, length);
+    }
+}
+
+size_t LoopbackFabric::residentBytes() const {
+    return ::residentBytes(buffer_, buffer_size_);
+}
+
+int LoopbackFabric::size() const {
+    return network_.size();
+}
+
+void LoopbackFabric::write(int peer, uint64_t local_offset, uint64_t remote_offset, uint32_t length, uint32_t imm) {
+    LoopbackFabric& target = network_.rank(peer);
+    if (local_offset + length > buffer_size_ || remote_offset + length > target.buffer_size_) {
+        throw std::runtime_error("Loopback write out of bounds");
+    }
+
+    memcpy(target.buffer_ + remote_offset, buffer_ + local_offset, length);
+    target.push({Event::Kind::Arrived, rank_, imm});
+    push({Event::Kind::WriteDone, peer, 0});
+}
+
+void LoopbackFabric::push(const Event& event) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    events_.push_back(event);
+}
+
+int LoopbackFabric::poll(Event* events, int max_events) {
+    int ne = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        while (ne < max_events && !events_.empty()) {
+            events[ne++] = events_.front();
+            events_.pop_front();
+        }
+    }
+    // Ranks usually outnumber cores, let the peers run
+    if (ne == 0) std::this_thread::yield();
+    return ne;
+}
+
+void LoopbackFabric::copy(uint64_t dst_offset, uint64_t src_offset, size_t length) {
+    if (dst_offset + length > buffer_size_ || src_offset + length > buffer_size_) {
+        throw std::runtime_error("Loopback copy out of bounds");
+    }
+    memmove(buffer_ + dst_offset, buffer_ + src_offset, length);
+}
+
+LoopbackNetwork::LoopbackNetwork(int ranks, size_t buffer_size, Paging paging) {
+    if (ranks < 1) {
+        throw std::runtime_error("Loopback network needs at least one rank");
+    }
+    for (int r = 0; r < ranks; ++r) {
+        ranks_.push_back(std::make_unique<LoopbackFabric>(*this, r, buffer_size, paging));
+    }
+}
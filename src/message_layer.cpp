@@ -0,0 +1,509 @@
+#include "message_layer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace {
+
+enum MsgType : uint8_t {
+    OUT_RDMA_WRITE = 0, // Queued rendezvous write, never sent as a header
+    MSG_HELLO,          // length = sender's buffer is CPU mapped
+    MSG_EAGER,
+    MSG_RTS,
+    MSG_CTS,
+    MSG_CREDIT,
+    MSG_TUNE,           // length = eager threshold picked by the probe
+};
+
+struct MsgHeader {
+    uint8_t type;
+    uint8_t pad;
+    uint16_t credits;   // Receive slots reposted since the last header
+    uint32_t sreq;
+    uint32_t rreq;
+    uint32_t rkey;
+    uint64_t tag;
+    uint64_t length;
+    uint64_t addr;
+} __attribute__((packed));
+
+// wr_id layout: kind (4 bits) | peer index (20 bits) | slot or request (40 bits)
+constexpr uint64_t WR_KIND_SHIFT = 60;
+constexpr uint64_t WR_PEER_SHIFT = 40;
+constexpr uint64_t WR_SEND_SLOT = 1ull << WR_KIND_SHIFT;
+constexpr uint64_t WR_RECV_SLOT = 2ull << WR_KIND_SHIFT;
+constexpr uint64_t WR_WRITE = 3ull << WR_KIND_SHIFT;
+constexpr uint64_t WR_PEER_MASK = (1ull << (WR_KIND_SHIFT - WR_PEER_SHIFT)) - 1;
+constexpr uint64_t WR_INDEX_MASK = (1ull << WR_PEER_SHIFT) - 1;
+
+// The last credit only ever carries MSG_CREDIT, so two peers that run out
+// at the same time can still return slots to each other
+constexpr int CREDIT_RESERVE = 1;
+// New data also leaves one for the CTS and write replies that finish transfers
+constexpr int DATA_RESERVE = CREDIT_RESERVE + 1;
+
+constexpr size_t DEFAULT_EAGER_THRESHOLD = 4096;
+
+// Reserved tag for threshold probe traffic
+constexpr uint64_t TUNE_TAG = ANY_TAG - 1;
+
+uint64_t wrId(uint64_t kind, size_t peer, uint64_t index) {
+    return kind | (static_cast<uint64_t>(peer) << WR_PEER_SHIFT) | index;
+}
+
+} // namespace
+
+MessageLayer::MessageLayer(RdmaVerbs& rdma, HpuManager& hpu)
+    : rdma_(rdma), hpu_(hpu), eager_threshold_(DEFAULT_EAGER_THRESHOLD) {}
+
+MessageLayer::MessageLayer(RdmaVerbs& rdma, HpuManager& hpu, struct ibv_qp* qp, Tune tune)
+    : MessageLayer(rdma, hpu) {
+    addPeer(0, qp, tune);
+}
+
+MessageLayer::~MessageLayer() {
+    for (auto& peer : peers_) {
+        rdma_.deregisterMemory(peer->slab_mr);
+        free(peer->slab);
+    }
+}
+
+void MessageLayer::addPeer(int rank, struct ibv_qp* qp, Tune tune) {
+    if (rank_to_peer_.count(rank)) {
+        throw std::runtime_error("Peer " + std::to_string(rank) + " already attached");
+    }
+
+    auto peer = std::make_unique<Peer>();
+    peer->rank = rank;
+    peer->qp = qp;
+
+    size_t slab_size = (SEND_SLOTS + RECV_SLOTS) * SLOT_SIZE;
+    peer->slab = static_cast<uint8_t*>(aligned_alloc(4096, slab_size));
+    if (!peer->slab) {
+        throw std::runtime_error("Failed to allocate bounce buffers");
+    }
+    peer->slab_mr = rdma_.registerHostMemory(peer->slab, slab_size);
+    for (int i = SEND_SLOTS - 1; i >= 0; --i) {
+        peer->free_send_slots.push_back(i);
+    }
+
+    size_t index = peers_.size();
+    peers_.push_back(std::move(peer));
+    rank_to_peer_[rank] = index;
+
+    for (int i = 0; i < RECV_SLOTS; ++i) {
+        postRecvSlot(index, SEND_SLOTS + i);
+    }
+
+    Outgoing hello = {};
+    hello.type = MSG_HELLO;
+    hello.length = hpu_.getBuffer() ? 1 : 0;
+    peers_[index]->control_queue.push_back(hello);
+    flushQueues(index);
+
+    if (tune != Tune::None) {
+        tuneThreshold(rank, tune == Tune::Initiator);
+    }
+}
+
+size_t MessageLayer::maxEagerSize() const {
+    return SLOT_SIZE - sizeof(MsgHeader);
+}
+
+void MessageLayer::setEagerThreshold(size_t bytes) {
+    eager_threshold_ = std::min(bytes, maxEagerSize());
+}
+
+size_t MessageLayer::peerIndex(int rank) const {
+    auto it = rank_to_peer_.find(rank);
+    if (it == rank_to_peer_.end()) {
+        throw std::runtime_error("Unknown peer " + std::to_string(rank));
+    }
+    return it->second;
+}
+
+bool MessageLayer::canEager(const Peer& peer, size_t length) const {
+    return length <= eager_threshold_ && hpu_.getBuffer() && peer.hello && peer.mapped;
+}
+
+uint32_t MessageLayer::newRequest(size_t offset, size_t length, int source, uint64_t tag) {
+    if (offset + length > hpu_.getBufferSize()) {
+        throw std::runtime_error("Message exceeds registered buffer");
+    }
+    uint32_t id = next_req_++;
+    if (next_req_ == 0) next_req_ = 1;
+    requests_[id] = Request{offset, length, source, tag};
+    return id;
+}
+
+uint64_t MessageLayer::isend(int peer, size_t offset, size_t length, uint64_t tag) {
+    if (tag == ANY_TAG) {
+        throw std::runtime_error("ANY_TAG is only valid for receives");
+    }
+    size_t index = peerIndex(peer);
+    uint32_t id = newRequest(offset, length, peer, tag);
+
+    Outgoing msg = {};
+    msg.type = canEager(*peers_[index], length) ? MSG_EAGER : MSG_RTS;
+    msg.sreq = id;
+    msg.tag = tag;
+    msg.length = length;
+    peers_[index]->data_queue.push_back(msg);
+    flushQueues(index);
+    return id;
+}
+
+uint64_t MessageLayer::irecv(int source, uint64_t tag, size_t offset, size_t capacity) {
+    uint32_t id = newRequest(offset, capacity, source, tag);
+
+    TagMatcher::Match match;
+    if (!matcher_.postReceive(source, tag, id, &match)) {
+        return id;
+    }
+
+    auto it = unexpected_.find(match.cookie);
+    Unexpected msg = std::move(it->second);
+    unexpected_.erase(it);
+
+    Request& req = requests_[id];
+    req.source = match.source;
+    req.tag = match.tag;
+    if (msg.type == MSG_EAGER) {
+        matchEager(id, msg.data.data(), msg.length);
+    } else {
+        queueCts(msg.peer, id, msg.sreq, msg.length);
+        flushQueues(msg.peer);
+    }
+    return id;
+}
+
+bool MessageLayer::test(uint64_t req, Status* status) {
+    auto it = requests_.find(static_cast<uint32_t>(req));
+    if (it == requests_.end()) {
+        throw std::runtime_error("Unknown message request");
+    }
+    if (!it->second.done) return false;
+    if (status) *status = {it->second.source, it->second.tag, it->second.length, it->second.truncated};
+    requests_.erase(it);
+    return true;
+}
+
+MessageLayer::Status MessageLayer::wait(uint64_t req) {
+    Status status = {};
+    int polls = 0;
+    while (!test(req, &status)) {
+        if (progress() == 0) {
+            if (++polls > 1000000) {
+                throw std::runtime_error("Message wait timeout");
+            }
+            usleep(1);
+        }
+    }
+    return status;
+}
+
+int MessageLayer::progress() {
+    struct ibv_wc wc[16];
+    int ne = rdma_.pollCompletions(wc, 16);
+
+    for (int i = 0; i < ne; ++i) {
+        if (wc[i].status != IBV_WC_SUCCESS) {
+            throw std::runtime_error("Work completion error: " + std::string(ibv_wc_status_str(wc[i].status)));
+        }
+
+        uint64_t kind = wc[i].wr_id & ~((1ull << WR_KIND_SHIFT) - 1);
+        size_t peer = (wc[i].wr_id >> WR_PEER_SHIFT) & WR_PEER_MASK;
+        uint64_t index = wc[i].wr_id & WR_INDEX_MASK;
+        if (kind == WR_SEND_SLOT) {
+            peers_[peer]->free_send_slots.push_back(static_cast<int>(index));
+        } else if (kind == WR_RECV_SLOT) {
+            handleRecv(peer, static_cast<int>(index), wc[i]);
+        } else if (kind == WR_WRITE) {
+            auto it = requests_.find(static_cast<uint32_t>(index));
+            if (it != requests_.end()) it->second.done = true;
+        }
+    }
+
+    for (size_t p = 0; p < peers_.size(); ++p) {
+        Peer& peer = *peers_[p];
+        if (peer.returned >= RECV_SLOTS / 4 && !peer.credit_queued) {
+            Outgoing credit = {};
+            credit.type = MSG_CREDIT;
+            // Ahead of anything waiting for credits the peer is waiting to get back
+            peer.control_queue.push_front(credit);
+            peer.credit_queued = true;
+        }
+        flushQueues(p);
+    }
+    return ne;
+}
+
+void MessageLayer::handleRecv(size_t p, int slot, const struct ibv_wc& wc) {
+    Peer& peer = *peers_[p];
+
+    if (wc.opcode == IBV_WC_RECV_RDMA_WITH_IMM) {
+        // Rendezvous payload landed, imm carries our receive request
+        auto it = requests_.find(ntohl(wc.imm_data));
+        if (it != requests_.end()) it->second.done = true;
+        postRecvSlot(p, slot);
+        peer.returned++;
+        return;
+    }
+
+    MsgHeader hdr;
+    memcpy(&hdr, slotAddr(peer, slot), sizeof(hdr));
+    const uint8_t* payload = slotAddr(peer, slot) + sizeof(hdr);
+    peer.credits += hdr.credits;
+
+    switch (hdr.type) {
+    case MSG_HELLO:
+        peer.hello = true;
+        peer.mapped = hdr.length != 0;
+        break;
+    case MSG_TUNE:
+        peer.tune = hdr.length;
+        peer.tune_received = true;
+        break;
+    case MSG_EAGER:
+    case MSG_RTS: {
+        uint64_t cookie = next_unexpected_++;
+        TagMatcher::Match match;
+        if (!matcher_.arrive(peer.rank, hdr.tag, cookie, &match)) {
+            Unexpected msg = {hdr.type, p, hdr.sreq, hdr.length, {}};
+            if (hdr.type == MSG_EAGER) {
+                msg.data.assign(payload, payload + hdr.length);
+            }
+            unexpected_.emplace(cookie, std::move(msg));
+            break;
+        }
+
+        uint32_t rreq = static_cast<uint32_t>(match.cookie);
+        Request& req = requests_[rreq];
+        req.source = match.source;
+        req.tag = match.tag;
+        if (hdr.type == MSG_EAGER) {
+            matchEager(rreq, payload, hdr.length);
+        } else {
+            queueCts(p, rreq, hdr.sreq, hdr.length);
+        }
+        break;
+    }
+    case MSG_CTS: {
+        Outgoing write = {};
+        write.type = OUT_RDMA_WRITE;
+        write.sreq = hdr.sreq;
+        write.rreq = hdr.rreq;
+        write.length = hdr.length;
+        write.addr = hdr.addr;
+        write.rkey = hdr.rkey;
+        peer.control_queue.push_back(write);
+        break;
+    }
+    case MSG_CREDIT:
+        break;
+    default:
+        std::cerr << "Unknown message type " << static_cast<int>(hdr.type) << "\n";
+        break;
+    }
+
+    postRecvSlot(p, slot);
+    peer.returned++;
+}
+
+void MessageLayer::matchEager(uint32_t rreq, const uint8_t* data, uint64_t length) {
+    Request& req = requests_[rreq];
+    req.truncated = length > req.length;
+    req.length = std::min<uint64_t>(req.length, length);
+    memcpy(static_cast<uint8_t*>(hpu_.getBuffer()) + req.offset, data, req.length);
+    req.done = true;
+}
+
+void MessageLayer::queueCts(size_t peer, uint32_t rreq, uint32_t sreq, uint64_t length) {
+    Request& req = requests_[rreq];
+    req.truncated = length > req.length;
+    req.length = std::min<uint64_t>(req.length, length);
+
+    Outgoing cts = {};
+    cts.type = MSG_CTS;
+    cts.sreq = sreq;
+    cts.rreq = rreq;
+    cts.length = req.length;
+    cts.addr = rdma_.getLocalAddr() + req.offset;
+    cts.rkey = rdma_.getRkey();
+    peers_[peer]->control_queue.push_back(cts);
+}
+
+bool MessageLayer::trySend(size_t p, const Outgoing& msg, int min_credits) {
+    Peer& peer = *peers_[p];
+    if (peer.free_send_slots.empty() || peer.credits < min_credits) return false;
+
+    int slot = peer.free_send_slots.back();
+    peer.free_send_slots.pop_back();
+    uint8_t* buf = slotAddr(peer, slot);
+
+    MsgHeader hdr = {};
+    hdr.type = msg.type;
+    hdr.credits = static_cast<uint16_t>(peer.returned);
+    hdr.sreq = msg.sreq;
+    hdr.rreq = msg.rreq;
+    hdr.rkey = msg.rkey;
+    hdr.tag = msg.tag;
+    hdr.length = msg.length;
+    hdr.addr = msg.addr;
+    memcpy(buf, &hdr, sizeof(hdr));
+
+    uint32_t length = sizeof(hdr);
+    if (msg.type == MSG_EAGER) {
+        Request& req = requests_[msg.sreq];
+        memcpy(buf + sizeof(hdr), static_cast<uint8_t*>(hpu_.getBuffer()) + req.offset, req.length);
+        length += static_cast<uint32_t>(req.length);
+        // Payload is copied out, the user buffer is free again
+        req.done = true;
+    }
+
+    struct ibv_sge sge = {};
+    sge.addr = reinterpret_cast<uintptr_t>(buf);
+    sge.length = length;
+    sge.lkey = peer.slab_mr->lkey;
+
+    struct ibv_send_wr wr = {};
+    wr.wr_id = wrId(WR_SEND_SLOT, p, slot);
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    wr.opcode = IBV_WR_SEND;
+    wr.send_flags = IBV_SEND_SIGNALED;
+    rdma_.postSend(peer.qp, &wr);
+
+    peer.credits--;
+    peer.returned = 0;
+    return true;
+}
+
+bool MessageLayer::tryWrite(size_t p, const Outgoing& msg) {
+    Peer& peer = *peers_[p];
+    // The immediate consumes one of the peer's receive slots
+    if (peer.credits < CREDIT_RESERVE + 1) return false;
+
+    Request& req = requests_[msg.sreq];
+    RdmaOp op;
+    op.opcode = IBV_WR_RDMA_WRITE_WITH_IMM;
+    op.offset = req.offset;
+    op.length = static_cast<uint32_t>(std::min<uint64_t>(req.length, msg.length));
+    op.remote_addr = msg.addr;
+    op.rkey = msg.rkey;
+    op.wr_id = wrId(WR_WRITE, p, msg.sreq);
+    op.imm_data = htonl(msg.rreq);
+    rdma_.postSend(peer.qp, op);
+
+    peer.credits--;
+    return true;
+}
+
+void MessageLayer::flushQueues(size_t p) {
+    Peer& peer = *peers_[p];
+    while (!peer.control_queue.empty()) {
+        const Outgoing& msg = peer.control_queue.front();
+        bool sent;
+        if (msg.type == MSG_CREDIT) {
+            // Nothing left to return if other headers carried it already
+            sent = peer.returned == 0 || trySend(p, msg, 1);
+            if (sent) peer.credit_queued = false;
+        } else {
+            sent = msg.type == OUT_RDMA_WRITE ? tryWrite(p, msg) : trySend(p, msg, CREDIT_RESERVE + 1);
+        }
+        if (!sent) break;
+        peer.control_queue.pop_front();
+    }
+
+    while (!peer.data_queue.empty() && trySend(p, peer.data_queue.front(), DATA_RESERVE + 1)) {
+        peer.data_queue.pop_front();
+    }
+}
+
+void MessageLayer::postRecvSlot(size_t p, int slot) {
+    Peer& peer = *peers_[p];
+    struct ibv_sge sge = {};
+    sge.addr = reinterpret_cast<uintptr_t>(slotAddr(peer, slot));
+    sge.length = SLOT_SIZE;
+    sge.lkey = peer.slab_mr->lkey;
+
+    struct ibv_recv_wr wr = {};
+    wr.wr_id = wrId(WR_RECV_SLOT, p, slot);
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    rdma_.postReceive(peer.qp, &wr);
+}
+
+uint8_t* MessageLayer::slotAddr(const Peer& peer, int slot) const {
+    return peer.slab + static_cast<size_t>(slot) * SLOT_SIZE;
+}
+
+size_t MessageLayer::tuneThreshold(int rank, bool initiator) {
+    static const size_t probe_sizes[] = { 64, 256, 1024, 4096, 0 };
+    constexpr int iters = 32;
+
+    Peer& peer = *peers_[peerIndex(rank)];
+    while (!peer.hello) {
+        progress();
+    }
+    if (!hpu_.getBuffer() || !peer.mapped) {
+        // No CPU access on one side, everything goes through rendezvous
+        eager_threshold_ = 0;
+        return eager_threshold_;
+    }
+
+    size_t saved = eager_threshold_;
+    size_t best = 0;
+    bool crossed = false;
+
+    for (size_t size : probe_sizes) {
+        if (size == 0) size = maxEagerSize();
+        double elapsed[2] = {};
+
+        for (int mode = 0; mode < 2; ++mode) {
+            if (initiator) {
+                eager_threshold_ = mode == 0 ? maxEagerSize() : 0;
+                auto start = std::chrono::steady_clock::now();
+                std::vector<uint64_t> reqs;
+                for (int i = 0; i < iters; ++i) reqs.push_back(isend(rank, 0, size, TUNE_TAG));
+                for (uint64_t req : reqs) wait(req);
+                wait(irecv(rank, TUNE_TAG, 0, sizeof(uint64_t)));
+                elapsed[mode] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            } else {
+                eager_threshold_ = maxEagerSize();
+                std::vector<uint64_t> reqs;
+                for (int i = 0; i < iters; ++i) reqs.push_back(irecv(rank, TUNE_TAG, 0, size));
+                for (uint64_t req : reqs) wait(req);
+                wait(isend(rank, 0, sizeof(uint64_t), TUNE_TAG));
+            }
+        }
+
+        if (initiator && !crossed) {
+            if (elapsed[0] <= elapsed[1]) {
+                best = size;
+            } else {
+                crossed = true;
+            }
+        }
+    }
+
+    if (initiator) {
+        Outgoing tune = {};
+        tune.type = MSG_TUNE;
+        tune.length = best;
+        size_t index = peerIndex(rank);
+        peers_[index]->control_queue.push_back(tune);
+        flushQueues(index);
+    } else {
+        while (!peer.tune_received) {
+            progress();
+        }
+        peer.tune_received = false;
+        best = peer.tune;
+    }
+
+    eager_threshold_ = saved;
+    setEagerThreshold(best);
+    std::cout << "Eager/rendezvous threshold: " << eager_threshold_ << " bytes\n";
+    return eager_threshold_;
+}
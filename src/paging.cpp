@@ -0,0 +1,64 @@
+#include "paging.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23  // Linux 5.14, missing from older libc headers
+#endif
+
+Paging pagingFromEnvironment() {
+    const char* mode = std::getenv("HPU_ODP");
+    if (!mode || !*mode || std::strcmp(mode, "0") == 0) return Paging::Pinned;
+    return std::strcmp(mode, "implicit") == 0 ? Paging::Implicit : Paging::OnDemand;
+}
+
+const char* pagingName(Paging paging) {
+    switch (paging) {
+        case Paging::OnDemand: return "on-demand";
+        case Paging::Implicit: return "implicit on-demand";
+        default: return "pinned";
+    }
+}
+
+void populatePages(void* addr, size_t length) {
+    constexpr size_t SLAB = 64 * 1024 * 1024;
+    size_t slabs = (length + SLAB - 1) / SLAB;
+    size_t workers = std::min<size_t>(slabs, std::max(1u, std::thread::hardware_concurrency()));
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    auto populate = [&](size_t worker) {
+        for (size_t slab = worker; slab < slabs; slab += workers) {
+            uint8_t* begin = static_cast<uint8_t*>(addr) + slab * SLAB;
+            size_t bytes = std::min(SLAB, length - slab * SLAB);
+            if (madvise(begin, bytes, MADV_POPULATE_WRITE) == 0) continue;
+            // Kernels before 5.14; a read-modify-write keeps the contents
+            for (size_t offset = 0; offset < bytes; offset += page) {
+                volatile uint8_t* p = begin + offset;
+                *p = *p;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t worker = 1; worker < workers; ++worker) {
+        threads.emplace_back(populate, worker);
+    }
+    populate(0);
+    for (auto& thread : threads) thread.join();
+}
+
+size_t residentBytes(const void* addr, size_t length) {
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    uintptr_t start = reinterpret_cast<uintptr_t>(addr) & ~(page - 1);
+    size_t pages = (reinterpret_cast<uintptr_t>(addr) + length - start + page - 1) / page;
+    std::vector<unsigned char> vec(pages);
+    if (mincore(reinterpret_cast<void*>(start), pages * page, vec.data()) != 0) return 0;
+    size_t resident = 0;
+    for (unsigned char v : vec) resident += v & 1;
+    return resident * page;
+}
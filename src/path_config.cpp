@@ -0,0 +1,170 @@
+#include "path_config.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+std::optional<int> envInt(const char* name) {
+    const char* value = std::getenv(name);
+    if (!value || !*value) return std::nullopt;
+    return std::atoi(value);
+}
+
+std::optional<uint8_t> envByte(const char* name) {
+    auto value = envInt(name);
+    if (value && (*value < 0 || *value > 255)) {
+        std::cerr << "Ignoring " << name << "=" << *value << ", not 0..255\n";
+        return std::nullopt;
+    }
+    return value ? std::optional<uint8_t>(static_cast<uint8_t>(*value)) : std::nullopt;
+}
+
+bool isIpv4Mapped(const union ibv_gid& gid) {
+    static const uint8_t prefix[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+    return memcmp(gid.raw, prefix, sizeof(prefix)) == 0;
+}
+
+bool isLinkLocal(const union ibv_gid& gid) {
+    return gid.raw[0] == 0xfe && (gid.raw[1] & 0xc0) == 0x80;
+}
+
+// Kernels without ibv_query_gid_ex support still list the type in sysfs
+bool queryGidSysfs(struct ibv_context* ctx, uint8_t port_num, int index, union ibv_gid* gid, uint32_t* type) {
+    if (ibv_query_gid(ctx, port_num, index, gid)) return false;
+    std::ifstream file(std::string("/sys/class/infiniband/") + ibv_get_device_name(ctx->device) + "/ports/" +
+                       std::to_string(port_num) + "/gid_attrs/types/" + std::to_string(index));
+    std::string name;
+    if (!std::getline(file, name)) return false;
+    *type = name.find("v2") != std::string::npos ? IBV_GID_TYPE_ROCE_V2
+          : name.find("RoCE") != std::string::npos ? IBV_GID_TYPE_ROCE_V1 : IBV_GID_TYPE_IB;
+    return true;
+}
+
+// The host's default for IP packets it originates
+uint8_t defaultHopLimit(bool ipv4) {
+    std::ifstream file(ipv4 ? "/proc/sys/net/ipv4/ip_default_ttl" : "/proc/sys/net/ipv6/conf/default/hop_limit");
+    int value = 0;
+    if (file >> value && value > 0 && value <= 255) return static_cast<uint8_t>(value);
+    return 64;
+}
+
+} // namespace
+
+PathOverrides PathOverrides::withEnvironment() const {
+    PathOverrides merged = *this;
+    if (!merged.mtu) {
+        if (auto bytes = envInt("HPU_MTU")) {
+            merged.mtu = mtuFromBytes(*bytes);
+            if (!merged.mtu) std::cerr << "Ignoring HPU_MTU=" << *bytes << ", not 256..4096\n";
+        }
+    }
+    if (!merged.gid_index) merged.gid_index = envInt("HPU_GID_INDEX");
+    if (auto ipv6 = envInt("HPU_GID_IPV6")) merged.prefer_ipv6 |= *ipv6 != 0;
+    if (!merged.hop_limit) merged.hop_limit = envByte("HPU_HOP_LIMIT");
+    if (!merged.rd_atomic) merged.rd_atomic = envByte("HPU_RD_ATOMIC");
+    if (!merged.timeout) merged.timeout = envByte("HPU_QP_TIMEOUT");
+    return merged;
+}
+
+int selectGid(struct ibv_context* ctx, uint8_t port_num, const struct ibv_port_attr& port_attr,
+              bool prefer_ipv6, uint32_t* gid_type, bool* ipv4) {
+    int best = -1, best_rank = 0;
+    uint32_t best_type = IBV_GID_TYPE_IB;
+    bool best_ipv4 = false;
+
+    for (int i = 0; i < port_attr.gid_tbl_len; ++i) {
+        struct ibv_gid_entry entry = {};
+        int err = ibv_query_gid_ex(ctx, port_num, static_cast<uint32_t>(i), &entry, 0);
+        if (err && err != ENODATA) {
+            if (!queryGidSysfs(ctx, port_num, i, &entry.gid, &entry.gid_type)) continue;
+        } else if (err) {
+            continue;   // Empty slot
+        }
+        if (entry.gid.global.interface_id == 0 && entry.gid.global.subnet_prefix == 0) continue;
+
+        // Preferred family beats the other, routable beats link-local, RoCE v2 beats v1
+        bool mapped = isIpv4Mapped(entry.gid);
+        int rank = entry.gid_type == IBV_GID_TYPE_ROCE_V2 ? 4 : 1;
+        if (entry.gid_type == IBV_GID_TYPE_ROCE_V2 && mapped != prefer_ipv6) rank += 2;
+        if (entry.gid_type == IBV_GID_TYPE_ROCE_V2 && !mapped && !isLinkLocal(entry.gid)) rank += 1;
+        if (rank > best_rank) {
+            best = i;
+            best_rank = rank;
+            best_type = entry.gid_type;
+            best_ipv4 = mapped;
+        }
+    }
+
+    if (gid_type) *gid_type = best >= 0 ? best_type : static_cast<uint32_t>(IBV_GID_TYPE_ROCE_V1);
+    if (ipv4) *ipv4 = best_ipv4;
+    return best >= 0 ? best : 0;
+}
+
+PathConfig resolvePath(struct ibv_context* ctx, uint8_t port_num, const struct ibv_port_attr& port_attr,
+                       const struct ibv_device_attr& device_attr, const PathOverrides& overrides) {
+    PathConfig path;
+    path.mtu = overrides.mtu ? std::min(*overrides.mtu, port_attr.active_mtu) : port_attr.active_mtu;
+
+    bool ethernet = port_attr.link_layer == IBV_LINK_LAYER_ETHERNET;
+    if (overrides.gid_index) {
+        path.gid_index = *overrides.gid_index;
+        union ibv_gid gid = {};
+        struct ibv_gid_entry entry = {};
+        if (ibv_query_gid_ex(ctx, port_num, static_cast<uint32_t>(path.gid_index), &entry, 0) == 0) {
+            gid = entry.gid;
+            path.gid_type = entry.gid_type;
+        } else {
+            queryGidSysfs(ctx, port_num, path.gid_index, &gid, &path.gid_type);
+        }
+        path.ipv4 = isIpv4Mapped(gid);
+    } else if (ethernet) {
+        path.gid_index = selectGid(ctx, port_num, port_attr, overrides.prefer_ipv6, &path.gid_type, &path.ipv4);
+    }
+
+    // Routed RoCE v2 needs a real TTL; an InfiniBand GRH stays in the subnet
+    bool routed = path.gid_index >= 0 && path.gid_type == IBV_GID_TYPE_ROCE_V2;
+    path.hop_limit = overrides.hop_limit ? *overrides.hop_limit : routed ? defaultHopLimit(path.ipv4) : 1;
+
+    int init_depth = std::clamp(device_attr.max_qp_init_rd_atom, 1, 255);
+    int dest_depth = std::clamp(device_attr.max_qp_rd_atom, 1, 255);
+    if (overrides.rd_atomic) {
+        init_depth = std::clamp<int>(*overrides.rd_atomic, 1, init_depth);
+        dest_depth = std::clamp<int>(*overrides.rd_atomic, 1, dest_depth);
+    }
+    path.max_rd_atomic = static_cast<uint8_t>(init_depth);
+    path.max_dest_rd_atomic = static_cast<uint8_t>(dest_depth);
+
+    if (overrides.timeout) path.timeout = std::min<uint8_t>(*overrides.timeout, 31);
+    return path;
+}
+
+std::optional<enum ibv_mtu> mtuFromBytes(int bytes) {
+    switch (bytes) {
+        case 256: return IBV_MTU_256;
+        case 512: return IBV_MTU_512;
+        case 1024: return IBV_MTU_1024;
+        case 2048: return IBV_MTU_2048;
+        case 4096: return IBV_MTU_4096;
+        default: return std::nullopt;
+    }
+}
+
+int mtuBytes(enum ibv_mtu mtu) {
+    return 128 << static_cast<int>(mtu);
+}
+
+std::string describePath(const PathConfig& path) {
+    std::string gid = "no GRH";
+    if (path.gid_index >= 0) {
+        const char* type = path.gid_type == IBV_GID_TYPE_ROCE_V2 ? (path.ipv4 ? " RoCE v2 IPv4" : " RoCE v2 IPv6")
+                         : path.gid_type == IBV_GID_TYPE_ROCE_V1 ? " RoCE v1" : "";
+        gid = "GID " + std::to_string(path.gid_index) + type;
+    }
+    return "MTU " + std::to_string(mtuBytes(path.mtu)) + ", " + gid + ", hop limit " +
+           std::to_string(path.hop_limit) + ", read depth " + std::to_string(path.max_rd_atomic) + "/" +
+           std::to_string(path.max_dest_rd_atomic) + ", timeout " + std::to_string(path.timeout);
+}
@@ -0,0 +1,433 @@
+#include "reduction.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define AVX2_TARGET __attribute__((target("avx2,f16c")))
+#define AVX512_TARGET __attribute__((target("avx512f")))
+#endif
+
+namespace {
+
+// dst block kept in L1 while every source is folded into it
+constexpr size_t REDUCE_BLOCK_BYTES = 16 * 1024;
+
+using KernelFn = void (*)(void* dst, const void* src, size_t count);
+
+// Max/min pick src unless dst wins strictly, matching the x86 max/min instructions
+template <ReduceOp Op, typename T>
+inline T combine(T d, T s) {
+    if constexpr (Op == ReduceOp::Sum) {
+        if constexpr (std::is_integral<T>::value) {
+            return static_cast<T>(static_cast<uint32_t>(d) + static_cast<uint32_t>(s));
+        } else {
+            return d + s;
+        }
+    } else if constexpr (Op == ReduceOp::Max) {
+        return d > s ? d : s;
+    } else {
+        return d < s ? d : s;
+    }
+}
+
+inline float bitsToFloat(uint32_t bits) {
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+inline uint32_t floatToBits(float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+// Scalar element formats, also used for the SIMD tails
+
+struct F32 {
+    using Storage = float;
+    using Compute = float;
+    static float load(float v) { return v; }
+    static float store(float v) { return v; }
+};
+
+struct I32 {
+    using Storage = int32_t;
+    using Compute = int32_t;
+    static int32_t load(int32_t v) { return v; }
+    static int32_t store(int32_t v) { return v; }
+};
+
+struct BF16 {
+    using Storage = uint16_t;
+    using Compute = float;
+    static float load(uint16_t h) { return bitsToFloat(static_cast<uint32_t>(h) << 16); }
+    static uint16_t store(float f) {
+        uint32_t bits = floatToBits(f);
+        if ((bits & 0x7fffffff) > 0x7f800000) {
+            return static_cast<uint16_t>((bits >> 16) | 0x40);
+        }
+        bits += 0x7fff + ((bits >> 16) & 1);
+        return static_cast<uint16_t>(bits >> 16);
+    }
+};
+
+struct F16 {
+    using Storage = uint16_t;
+    using Compute = float;
+
+    static float load(uint16_t h) {
+        uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+        uint32_t exp = (h >> 10) & 0x1f;
+        uint32_t mant = h & 0x3ff;
+
+        if (exp == 0) {
+            if (mant == 0) return bitsToFloat(sign);
+            int32_t e = 1;
+            while ((mant & 0x400) == 0) {
+                mant <<= 1;
+                e--;
+            }
+            return bitsToFloat(sign | static_cast<uint32_t>(e + 112) << 23 | (mant & 0x3ff) << 13);
+        }
+        if (exp == 31) {
+            return bitsToFloat(sign | 0x7f800000 | mant << 13 | (mant ? 0x400000 : 0));
+        }
+        return bitsToFloat(sign | (exp + 112) << 23 | mant << 13);
+    }
+
+    static uint16_t store(float f) {
+        uint32_t bits = floatToBits(f);
+        uint32_t sign = (bits >> 16) & 0x8000;
+        uint32_t abs = bits & 0x7fffffff;
+
+        if (abs > 0x7f800000) {
+            return static_cast<uint16_t>(sign | 0x7e00 | ((abs >> 13) & 0x3ff));
+        }
+        if (abs >= 0x477ff000) {
+            return static_cast<uint16_t>(sign | 0x7c00);  // Rounds past 65504
+        }
+        if (abs <= 0x33000000) {
+            return static_cast<uint16_t>(sign);           // At or below half of the smallest subnormal
+        }
+
+        uint32_t result, rem, half;
+        if (abs < 0x38800000) {
+            // Subnormal result, in units of 2^-24
+            uint32_t mant = (abs & 0x7fffff) | 0x800000;
+            uint32_t shift = 126 - (abs >> 23);
+            result = mant >> shift;
+            rem = mant & ((1u << shift) - 1);
+            half = 1u << (shift - 1);
+        } else {
+            result = (abs - 0x38000000) >> 13;
+            rem = abs & 0x1fff;
+            half = 0x1000;
+        }
+        if (rem > half || (rem == half && (result & 1))) result++;
+        return static_cast<uint16_t>(sign | result);
+    }
+};
+
+template <typename Elem, ReduceOp Op>
+struct ScalarKernel {
+    static void run(void* dst, const void* src, size_t count) {
+        auto* d = static_cast<typename Elem::Storage*>(dst);
+        auto* s = static_cast<const typename Elem::Storage*>(src);
+        for (size_t i = 0; i < count; ++i) {
+            d[i] = Elem::store(combine<Op, typename Elem::Compute>(Elem::load(d[i]), Elem::load(s[i])));
+        }
+    }
+};
+
+#if defined(__x86_64__)
+
+// AVX2 lanes: 8 elements, half precision widened through F16C or shifts
+
+struct Avx2F32 {
+    using Scalar = F32;
+    using Vec = __m256;
+    static constexpr size_t WIDTH = 8;
+    AVX2_TARGET static Vec load(const float* p) { return _mm256_loadu_ps(p); }
+    AVX2_TARGET static void store(float* p, Vec v) { _mm256_storeu_ps(p, v); }
+    template <ReduceOp Op>
+    AVX2_TARGET static Vec combine(Vec d, Vec s) {
+        if constexpr (Op == ReduceOp::Sum) return _mm256_add_ps(d, s);
+        else if constexpr (Op == ReduceOp::Max) return _mm256_max_ps(d, s);
+        else return _mm256_min_ps(d, s);
+    }
+};
+
+struct Avx2I32 {
+    using Scalar = I32;
+    using Vec = __m256i;
+    static constexpr size_t WIDTH = 8;
+    AVX2_TARGET static Vec load(const int32_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+    AVX2_TARGET static void store(int32_t* p, Vec v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+    template <ReduceOp Op>
+    AVX2_TARGET static Vec combine(Vec d, Vec s) {
+        if constexpr (Op == ReduceOp::Sum) return _mm256_add_epi32(d, s);
+        else if constexpr (Op == ReduceOp::Max) return _mm256_max_epi32(d, s);
+        else return _mm256_min_epi32(d, s);
+    }
+};
+
+struct Avx2BF16 : Avx2F32 {
+    using Scalar = BF16;
+    AVX2_TARGET static Vec load(const uint16_t* p) {
+        __m256i wide = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+        return _mm256_castsi256_ps(_mm256_slli_epi32(wide, 16));
+    }
+    AVX2_TARGET static void store(uint16_t* p, Vec v) {
+        __m256i bits = _mm256_castps_si256(v);
+        __m256i lsb = _mm256_and_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(1));
+        __m256i rounded = _mm256_srli_epi32(_mm256_add_epi32(bits, _mm256_add_epi32(lsb, _mm256_set1_epi32(0x7fff))), 16);
+        __m256i quiet = _mm256_or_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(0x40));
+        __m256i abs = _mm256_and_si256(bits, _mm256_set1_epi32(0x7fffffff));
+        __m256i nan = _mm256_cmpgt_epi32(abs, _mm256_set1_epi32(0x7f800000));
+        __m256i out = _mm256_blendv_epi8(rounded, quiet, nan);
+        __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(out), _mm256_extracti128_si256(out, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p), packed);
+    }
+};
+
+struct Avx2F16 : Avx2F32 {
+    using Scalar = F16;
+    AVX2_TARGET static Vec load(const uint16_t* p) {
+        return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+    }
+    AVX2_TARGET static void store(uint16_t* p, Vec v) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+    }
+};
+
+template <typename V, ReduceOp Op>
+struct Avx2Kernel {
+    AVX2_TARGET static void run(void* dst, const void* src, size_t count) {
+        auto* d = static_cast<typename V::Scalar::Storage*>(dst);
+        auto* s = static_cast<const typename V::Scalar::Storage*>(src);
+        constexpr size_t W = V::WIDTH;
+        size_t i = 0;
+
+        // Four independent vectors per iteration to hide load latency
+        for (; i + 4 * W <= count; i += 4 * W) {
+            auto a0 = V::template combine<Op>(V::load(d + i), V::load(s + i));
+            auto a1 = V::template combine<Op>(V::load(d + i + W), V::load(s + i + W));
+            auto a2 = V::template combine<Op>(V::load(d + i + 2 * W), V::load(s + i + 2 * W));
+            auto a3 = V::template combine<Op>(V::load(d + i + 3 * W), V::load(s + i + 3 * W));
+            V::store(d + i, a0);
+            V::store(d + i + W, a1);
+            V::store(d + i + 2 * W, a2);
+            V::store(d + i + 3 * W, a3);
+        }
+        for (; i + W <= count; i += W) {
+            V::store(d + i, V::template combine<Op>(V::load(d + i), V::load(s + i)));
+        }
+        ScalarKernel<typename V::Scalar, Op>::run(d + i, s + i, count - i);
+    }
+};
+
+// AVX-512 lanes: 16 elements.
+// GCC 12 warns about the _mm512_undefined_* operands inside these intrinsics.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+struct Avx512F32 {
+    using Scalar = F32;
+    using Vec = __m512;
+    static constexpr size_t WIDTH = 16;
+    AVX512_TARGET static Vec load(const float* p) { return _mm512_loadu_ps(p); }
+    AVX512_TARGET static void store(float* p, Vec v) { _mm512_storeu_ps(p, v); }
+    template <ReduceOp Op>
+    AVX512_TARGET static Vec combine(Vec d, Vec s) {
+        if constexpr (Op == ReduceOp::Sum) return _mm512_add_ps(d, s);
+        else if constexpr (Op == ReduceOp::Max) return _mm512_max_ps(d, s);
+        else return _mm512_min_ps(d, s);
+    }
+};
+
+struct Avx512I32 {
+    using Scalar = I32;
+    using Vec = __m512i;
+    static constexpr size_t WIDTH = 16;
+    AVX512_TARGET static Vec load(const int32_t* p) { return _mm512_loadu_si512(p); }
+    AVX512_TARGET static void store(int32_t* p, Vec v) { _mm512_storeu_si512(p, v); }
+    template <ReduceOp Op>
+    AVX512_TARGET static Vec combine(Vec d, Vec s) {
+        if constexpr (Op == ReduceOp::Sum) return _mm512_add_epi32(d, s);
+        else if constexpr (Op == ReduceOp::Max) return _mm512_max_epi32(d, s);
+        else return _mm512_min_epi32(d, s);
+    }
+};
+
+struct Avx512BF16 : Avx512F32 {
+    using Scalar = BF16;
+    AVX512_TARGET static Vec load(const uint16_t* p) {
+        __m512i wide = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+        return _mm512_castsi512_ps(_mm512_slli_epi32(wide, 16));
+    }
+    AVX512_TARGET static void store(uint16_t* p, Vec v) {
+        __m512i bits = _mm512_castps_si512(v);
+        __m512i lsb = _mm512_and_si512(_mm512_srli_epi32(bits, 16), _mm512_set1_epi32(1));
+        __m512i rounded = _mm512_srli_epi32(_mm512_add_epi32(bits, _mm512_add_epi32(lsb, _mm512_set1_epi32(0x7fff))), 16);
+        __m512i quiet = _mm512_or_si512(_mm512_srli_epi32(bits, 16), _mm512_set1_epi32(0x40));
+        __m512i abs = _mm512_and_si512(bits, _mm512_set1_epi32(0x7fffffff));
+        __mmask16 nan = _mm512_cmpgt_epi32_mask(abs, _mm512_set1_epi32(0x7f800000));
+        __m512i out = _mm512_mask_blend_epi32(nan, rounded, quiet);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), _mm512_cvtepi32_epi16(out));
+    }
+};
+
+struct Avx512F16 : Avx512F32 {
+    using Scalar = F16;
+    AVX512_TARGET static Vec load(const uint16_t* p) {
+        return _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+    }
+    AVX512_TARGET static void store(uint16_t* p, Vec v) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), _mm512_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+    }
+};
+
+template <typename V, ReduceOp Op>
+struct Avx512Kernel {
+    AVX512_TARGET static void run(void* dst, const void* src, size_t count) {
+        auto* d = static_cast<typename V::Scalar::Storage*>(dst);
+        auto* s = static_cast<const typename V::Scalar::Storage*>(src);
+        constexpr size_t W = V::WIDTH;
+        size_t i = 0;
+
+        for (; i + 4 * W <= count; i += 4 * W) {
+            auto a0 = V::template combine<Op>(V::load(d + i), V::load(s + i));
+            auto a1 = V::template combine<Op>(V::load(d + i + W), V::load(s + i + W));
+            auto a2 = V::template combine<Op>(V::load(d + i + 2 * W), V::load(s + i + 2 * W));
+            auto a3 = V::template combine<Op>(V::load(d + i + 3 * W), V::load(s + i + 3 * W));
+            V::store(d + i, a0);
+            V::store(d + i + W, a1);
+            V::store(d + i + 2 * W, a2);
+            V::store(d + i + 3 * W, a3);
+        }
+        for (; i + W <= count; i += W) {
+            V::store(d + i, V::template combine<Op>(V::load(d + i), V::load(s + i)));
+        }
+        ScalarKernel<typename V::Scalar, Op>::run(d + i, s + i, count - i);
+    }
+};
+
+#pragma GCC diagnostic pop
+
+#endif // __x86_64__
+
+template <template <typename, ReduceOp> class Kernel, typename Elem>
+KernelFn pick(ReduceOp op) {
+    switch (op) {
+    case ReduceOp::Sum: return &Kernel<Elem, ReduceOp::Sum>::run;
+    case ReduceOp::Max: return &Kernel<Elem, ReduceOp::Max>::run;
+    case ReduceOp::Min: return &Kernel<Elem, ReduceOp::Min>::run;
+    }
+    throw std::runtime_error("Unknown reduce op");
+}
+
+KernelFn selectKernel(DataType type, ReduceOp op, SimdLevel level) {
+#if defined(__x86_64__)
+    if (level == SimdLevel::Avx512) {
+        switch (type) {
+        case DataType::Float32: return pick<Avx512Kernel, Avx512F32>(op);
+        case DataType::BFloat16: return pick<Avx512Kernel, Avx512BF16>(op);
+        case DataType::Float16: return pick<Avx512Kernel, Avx512F16>(op);
+        case DataType::Int32: return pick<Avx512Kernel, Avx512I32>(op);
+        }
+    }
+    if (level == SimdLevel::Avx2) {
+        switch (type) {
+        case DataType::Float32: return pick<Avx2Kernel, Avx2F32>(op);
+        case DataType::BFloat16: return pick<Avx2Kernel, Avx2BF16>(op);
+        case DataType::Float16: return pick<Avx2Kernel, Avx2F16>(op);
+        case DataType::Int32: return pick<Avx2Kernel, Avx2I32>(op);
+        }
+    }
+#endif
+    switch (type) {
+    case DataType::Float32: return pick<ScalarKernel, F32>(op);
+    case DataType::BFloat16: return pick<ScalarKernel, BF16>(op);
+    case DataType::Float16: return pick<ScalarKernel, F16>(op);
+    case DataType::Int32: return pick<ScalarKernel, I32>(op);
+    }
+    throw std::runtime_error("Unknown data type");
+}
+
+} // namespace
+
+size_t dataTypeSize(DataType type) {
+    switch (type) {
+    case DataType::Float32: return sizeof(float);
+    case DataType::BFloat16: return sizeof(uint16_t);
+    case DataType::Float16: return sizeof(uint16_t);
+    case DataType::Int32: return sizeof(int32_t);
+    }
+    throw std::runtime_error("Unknown data type");
+}
+
+SimdLevel detectSimdLevel() {
+#if defined(__x86_64__)
+    static const SimdLevel level = [] {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) return SimdLevel::Avx512;
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c")) return SimdLevel::Avx2;
+        return SimdLevel::Scalar;
+    }();
+    return level;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+const char* simdLevelName(SimdLevel level) {
+    switch (level) {
+    case SimdLevel::Scalar: return "scalar";
+    case SimdLevel::Avx2: return "avx2";
+    case SimdLevel::Avx512: return "avx512";
+    }
+    return "unknown";
+}
+
+void reduceBuffer(void* dst, const void* src, size_t count, DataType type, ReduceOp op, SimdLevel level) {
+    if (level > detectSimdLevel()) {
+        throw std::runtime_error(std::string("CPU does not support ") + simdLevelName(level));
+    }
+    selectKernel(type, op, level)(dst, src, count);
+}
+
+void Reducer::reduce(uint64_t dst_offset, const uint64_t* src_offsets, size_t sources, size_t bytes) {
+    for (size_t i = 0; i < sources; ++i) {
+        reduce(dst_offset, src_offsets[i], bytes);
+    }
+}
+
+HostReducer::HostReducer(uint8_t* base, DataType type, ReduceOp op, SimdLevel level)
+    : base_(base), type_(type), op_(op), level_(level) {
+    if (!base_) {
+        throw std::runtime_error("Host reduction needs a CPU mapped buffer");
+    }
+    if (level_ > detectSimdLevel()) {
+        throw std::runtime_error(std::string("CPU does not support ") + simdLevelName(level_));
+    }
+}
+
+void HostReducer::reduce(uint64_t dst_offset, uint64_t src_offset, size_t bytes) {
+    selectKernel(type_, op_, level_)(base_ + dst_offset, base_ + src_offset, bytes / dataTypeSize(type_));
+}
+
+void HostReducer::reduce(uint64_t dst_offset, const uint64_t* src_offsets, size_t sources, size_t bytes) {
+    KernelFn kernel = selectKernel(type_, op_, level_);
+    size_t elem = dataTypeSize(type_);
+
+    for (size_t pos = 0; pos < bytes; pos += REDUCE_BLOCK_BYTES) {
+        size_t len = std::min(REDUCE_BLOCK_BYTES, bytes - pos);
+        for (size_t i = 0; i < sources; ++i) {
+            kernel(base_ + dst_offset + pos, base_ + src_offsets[i] + pos, len / elem);
+        }
+    }
+}
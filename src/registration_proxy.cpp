@@ -0,0 +1,390 @@
+#include "registration_proxy.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+enum : uint8_t {
+    PROXY_HELLO = 'H',     // Reply carries the PD handle and the device's command fd
+    PROXY_REGISTER = 'M',  // Request carries the buffer fd
+    PROXY_RELEASE = 'D',
+};
+
+// Node-local, so host byte order throughout
+struct ProxyRequest {
+    uint8_t op;
+    uint64_t offset;
+    uint64_t length;
+    uint64_t iova;
+    uint32_t access;
+    uint32_t handle;
+} __attribute__((packed));
+
+struct ProxyReply {
+    int32_t status;  // 0 or an errno value
+    uint32_t handle;
+    uint32_t lkey;
+    uint32_t rkey;
+    uint64_t iova;
+} __attribute__((packed));
+
+socklen_t abstractAddress(const std::string& name, struct sockaddr_un& addr) {
+    addr = {};
+    addr.sun_family = AF_UNIX;
+    size_t len = std::min(name.size(), sizeof(addr.sun_path) - 1);
+    memcpy(addr.sun_path + 1, name.data(), len);
+    return static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) + 1 + len);
+}
+
+// One packet, with fd passed alongside when it is not -1
+bool sendPacket(int sock, const void* data, size_t len, int fd, int flags = 0) {
+    struct iovec iov = {const_cast<void*>(data), len};
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fd >= 0) {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+    return sendmsg(sock, &msg, MSG_NOSIGNAL | flags) == static_cast<ssize_t>(len);
+}
+
+// fd is set to a passed descriptor, -1 if none came
+bool recvPacket(int sock, void* data, size_t len, int& fd) {
+    struct iovec iov = {data, len};
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    fd = -1;
+    ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    struct cmsghdr* cmsg = n > 0 ? CMSG_FIRSTHDR(&msg) : nullptr;
+    if (cmsg && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    return n == static_cast<ssize_t>(len);
+}
+
+} // namespace
+
+RegistrationProxy::RegistrationProxy(const std::string& ib_dev_name, const std::string& socket_name,
+                                     std::optional<gid_t> group)
+    : group_(group) {
+    int num_devices = 0;
+    struct ibv_device** dev_list = ibv_get_device_list(&num_devices);
+    for (int i = 0; dev_list && i < num_devices && !ctx_; ++i) {
+        if (ib_dev_name.empty() || ib_dev_name == ibv_get_device_name(dev_list[i])) {
+            ctx_ = ibv_open_device(dev_list[i]);
+            if (ctx_) std::cout << "Opened IB device: " << ibv_get_device_name(dev_list[i]) << "\n";
+        }
+    }
+    if (dev_list) ibv_free_device_list(dev_list);
+    if (!ctx_) {
+        throw std::runtime_error("Failed to open IB device");
+    }
+
+    pd_ = ibv_alloc_pd(ctx_);
+    if (!pd_) {
+        cleanup();
+        throw std::runtime_error("Failed to allocate PD");
+    }
+
+    // Abstract namespace, nothing to clean up on disk
+    struct sockaddr_un addr;
+    socklen_t len = abstractAddress(socket_name, addr);
+    listen_fd_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0 || bind(listen_fd_, reinterpret_cast<struct sockaddr*>(&addr), len) || listen(listen_fd_, 64)) {
+        cleanup();
+        throw std::runtime_error("Failed to listen on @" + socket_name + ": " + strerror(errno));
+    }
+    std::cout << "✓ Registration proxy listening on @" << socket_name << "\n";
+}
+
+RegistrationProxy::~RegistrationProxy() {
+    cleanup();
+}
+
+void RegistrationProxy::cleanup() {
+    while (!clients_.empty()) {
+        disconnect(clients_.begin()->first);
+    }
+    if (listen_fd_ >= 0) {
+        close(listen_fd_);
+        listen_fd_ = -1;
+    }
+    if (pd_) {
+        ibv_dealloc_pd(pd_);
+        pd_ = nullptr;
+    }
+    if (ctx_) {
+        ibv_close_device(ctx_);
+        ctx_ = nullptr;
+    }
+}
+
+void RegistrationProxy::run() {
+    std::vector<struct pollfd> fds;
+    for (;;) {
+        fds.assign(1, {listen_fd_, POLLIN, 0});
+        for (const auto& client : clients_) {
+            fds.push_back({client.first, POLLIN, 0});
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("Registration proxy poll failed");
+        }
+        if (fds[0].revents & POLLIN) {
+            int client = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client >= 0 && !trusted(client)) {
+                close(client);
+            } else if (client >= 0) {
+                clients_[client];
+                report("connect");
+            }
+        }
+        for (size_t i = 1; i < fds.size(); ++i) {
+            if (fds[i].revents && !serve(fds[i].fd)) {
+                disconnect(fds[i].fd);
+            }
+        }
+    }
+}
+
+bool RegistrationProxy::serve(int client) {
+    ProxyRequest request = {};
+    int fd = -1;
+    if (!recvPacket(client, &request, sizeof(request), fd)) {
+        if (fd >= 0) close(fd);
+        return false;
+    }
+
+    ProxyReply reply = {};
+    uint32_t handle = 0;
+    switch (request.op) {
+        case PROXY_HELLO:
+            if (fd >= 0) close(fd);
+            reply.handle = pd_->handle;
+            // Importers share the context through a copy of its command fd
+            return sendPacket(client, &reply, sizeof(reply), ctx_->cmd_fd, MSG_DONTWAIT);
+        case PROXY_REGISTER:
+            errno = 0;
+            if (fd < 0) {
+                reply.status = EBADF;
+            } else if (registerBuffer(client, fd, request.offset, request.length, request.iova,
+                                      static_cast<int>(request.access), handle)) {
+                const Registration& reg = registrations_.at(by_handle_.at(handle));
+                reply.handle = handle;
+                reply.lkey = reg.mr->lkey;
+                reply.rkey = reg.mr->rkey;
+                reply.iova = reg.iova;
+            } else {
+                reply.status = errno ? errno : EINVAL;
+            }
+            if (fd >= 0) close(fd);
+            break;
+        case PROXY_RELEASE:
+            if (fd >= 0) close(fd);
+            if (!release(client, request.handle)) reply.status = EINVAL;
+            break;
+        default:
+            if (fd >= 0) close(fd);
+            reply.status = EINVAL;
+            break;
+    }
+    // A worker that stops reading is dropped rather than stalling the others
+    return sendPacket(client, &reply, sizeof(reply), -1, MSG_DONTWAIT);
+}
+
+bool RegistrationProxy::registerBuffer(int client, int fd, uint64_t offset, uint64_t length, uint64_t iova,
+                                       int access, uint32_t& handle) {
+    struct stat st;
+    if (length == 0 || fstat(fd, &st)) {
+        std::cerr << "Registration request without a usable buffer\n";
+        return false;
+    }
+
+    Key key{st.st_dev, st.st_ino, offset, length, access};
+    auto it = registrations_.find(key);
+    if (it == registrations_.end()) {
+        Registration reg = {nullptr, nullptr, length, iova, 0};
+        if (S_ISREG(st.st_mode)) {
+            // memfd (or any file): pin through a mapping of our own, keeping the worker's iova
+            reg.map = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, static_cast<off_t>(offset));
+            if (reg.map == MAP_FAILED) {
+                std::cerr << "Failed to map worker buffer: " << strerror(errno) << "\n";
+                return false;
+            }
+            reg.mr = ibv_reg_mr_iova(pd_, reg.map, length, iova, access);
+        } else {
+            reg.mr = ibv_reg_dmabuf_mr(pd_, offset, length, iova, fd, access);
+        }
+        if (!reg.mr) {
+            std::cerr << "Failed to register worker buffer: " << strerror(errno) << "\n";
+            if (reg.map) munmap(reg.map, length);
+            return false;
+        }
+        it = registrations_.emplace(key, reg).first;
+        by_handle_[reg.mr->handle] = key;
+    }
+
+    it->second.users++;
+    handle = it->second.mr->handle;
+    clients_[client].push_back(handle);
+    requested_bytes_ += length;
+    report("register");
+    return true;
+}
+
+bool RegistrationProxy::release(int client, uint32_t handle) {
+    // Only references the client holds itself
+    std::vector<uint32_t>& held = clients_[client];
+    auto it = std::find(held.begin(), held.end(), handle);
+    if (it == held.end()) {
+        std::cerr << "Release of MR handle " << handle << " the worker does not hold\n";
+        return false;
+    }
+    held.erase(it);
+    dropReference(handle);
+    report("release");
+    return true;
+}
+
+void RegistrationProxy::dropReference(uint32_t handle) {
+    auto key = by_handle_.find(handle);
+    if (key == by_handle_.end()) return;
+    Registration& reg = registrations_.at(key->second);
+    requested_bytes_ -= reg.length;
+    if (--reg.users > 0) return;
+
+    ibv_dereg_mr(reg.mr);
+    if (reg.map) munmap(reg.map, reg.length);
+    registrations_.erase(key->second);
+    by_handle_.erase(key);
+}
+
+// The abstract socket has no file permissions, so the peer's credentials
+// are all that keeps other users off the context, the PD and their MRs
+bool RegistrationProxy::trusted(int client) const {
+    struct ucred cred = {};
+    socklen_t len = sizeof(cred);
+    if (getsockopt(client, SOL_SOCKET, SO_PEERCRED, &cred, &len)) {
+        std::cerr << "Failed to read worker credentials: " << strerror(errno) << "\n";
+        return false;
+    }
+    if (cred.uid == 0 || cred.uid == geteuid() || (group_ && cred.gid == *group_)) {
+        return true;
+    }
+    std::cerr << "Rejected pid " << cred.pid << " (uid " << cred.uid << ", gid " << cred.gid << ")\n";
+    return false;
+}
+
+void RegistrationProxy::disconnect(int client) {
+    auto it = clients_.find(client);
+    if (it == clients_.end()) return;
+    for (uint32_t handle : it->second) {
+        dropReference(handle);
+    }
+    clients_.erase(it);
+    close(client);
+    report("disconnect");
+}
+
+void RegistrationProxy::report(const char* event) const {
+    size_t registered = 0, pinned = 0;
+    for (const auto& entry : registrations_) {
+        registered += entry.second.length;
+        if (entry.second.map) pinned += entry.second.length;
+    }
+    std::printf("%-10s %3zu workers %4zu MRs  %8.1f MB registered (%.1f MB host pinned) for %.1f MB requested\n",
+                event, clients_.size(), registrations_.size(), registered / 1048576.0, pinned / 1048576.0,
+                requested_bytes_ / 1048576.0);
+    std::fflush(stdout);
+}
+
+ProxyClient::ProxyClient(const std::string& socket_name) {
+    struct sockaddr_un addr;
+    socklen_t len = abstractAddress(socket_name, addr);
+    sock_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock_ < 0 || ::connect(sock_, reinterpret_cast<struct sockaddr*>(&addr), len)) {
+        if (sock_ >= 0) close(sock_);
+        throw std::runtime_error("No registration proxy at @" + socket_name);
+    }
+}
+
+ProxyClient::~ProxyClient() {
+    close(sock_);
+}
+
+struct ibv_context* ProxyClient::importDevice(uint32_t& pd_handle) {
+    ProxyRequest request = {};
+    request.op = PROXY_HELLO;
+    ProxyReply reply = {};
+    int cmd_fd = -1;
+    if (!sendPacket(sock_, &request, sizeof(request), -1) || !recvPacket(sock_, &reply, sizeof(reply), cmd_fd) ||
+        cmd_fd < 0) {
+        if (cmd_fd >= 0) close(cmd_fd);
+        throw std::runtime_error("Registration proxy did not share its device");
+    }
+    // The context owns cmd_fd from here on
+    struct ibv_context* ctx = ibv_import_device(cmd_fd);
+    if (!ctx) {
+        close(cmd_fd);
+        throw std::runtime_error("Failed to import the proxy's device context");
+    }
+    pd_handle = reply.handle;
+    return ctx;
+}
+
+ProxyRegistration ProxyClient::registerFd(int fd, uint64_t offset, uint64_t length, uint64_t iova, int access) {
+    ProxyRequest request = {};
+    request.op = PROXY_REGISTER;
+    request.offset = offset;
+    request.length = length;
+    request.iova = iova;
+    request.access = static_cast<uint32_t>(access);
+    ProxyReply reply = {};
+    int unused = -1;
+    if (!sendPacket(sock_, &request, sizeof(request), fd) || !recvPacket(sock_, &reply, sizeof(reply), unused)) {
+        throw std::runtime_error("Lost the registration proxy");
+    }
+    if (reply.status) {
+        throw std::runtime_error(std::string("Registration proxy refused the buffer: ") + strerror(reply.status));
+    }
+    return {reply.handle, reply.lkey, reply.rkey, reply.iova};
+}
+
+bool ProxyClient::release(uint32_t handle) {
+    ProxyRequest request = {};
+    request.op = PROXY_RELEASE;
+    request.handle = handle;
+    ProxyReply reply = {};
+    int unused = -1;
+    if (!sendPacket(sock_, &request, sizeof(request), -1) || !recvPacket(sock_, &reply, sizeof(reply), unused)) {
+        std::cerr << "Failed to release proxy registration " << handle << "\n";
+        return false;
+    }
+    if (reply.status) {
+        std::cerr << "Registration proxy refused to release " << handle << ": " << strerror(reply.status) << "\n";
+        return false;
+    }
+    return true;
+}
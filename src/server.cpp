@@ -1,4 +1,5 @@
 #include "server.hpp"
+#include "startup.hpp"
 #include <cstring>
 #include <stdexcept>
 #include <unistd.h> 
@@ -133,21 +134,19 @@ void DmabufServer::waitForClientFinish() {
 
 void DmabufServer::run() {
     try {
-        std::cout << "Initializing Gaudi DMA-buf...\n";
-        hpu_.initialize(buffer_size_);
+        // Device memory, the IB device and the TCP accept come up together
+        std::cout << "Initializing Gaudi DMA-buf and RDMA resources, waiting for client connection on port "
+                  << port_ << "...\n";
+        StartupProfile profile;
+        startInParallel(hpu_, buffer_size_, rdma_, ib_dev_name_.value_or(""), "", port_, &profile);
         if (hpu_.getDmabufFd() >= 0) {
             std::cout << "✓ Gaudi DMA-buf allocated (fd=" << hpu_.getDmabufFd() << ", va=0x" << std::hex << hpu_.getDeviceVa() << std::dec << ")\n";
         } else {
             std::cout << "✓ Using regular memory buffer\n";
         }
-
-        std::cout << "\nInitializing RDMA resources...\n";
-        rdma_.initialize(ib_dev_name_.value_or(""), hpu_);
         std::cout << "✓ RDMA resources initialized\n";
-
-        std::cout << "\nWaiting for client connection on port " << port_ << "...\n";
-        rdma_.connectQp("", port_);
         std::cout << "✓ Client connected\n";
+        profile.report(std::cout);
 
         initializeBuffer();
         communicationLoop();
@@ -0,0 +1,425 @@
+#include "shm_transport.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <poll.h>
+#include <sys/un.h>
+
+namespace {
+
+// Identity sent by both sides before anything is shared
+struct ShmHello {
+    char boot_id[40];
+    uint8_t usable;
+} __attribute__((packed));
+
+// Accompanies the two descriptors passed over the Unix socket
+struct ShmFdHeader {
+    uint64_t buffer_size;
+} __attribute__((packed));
+
+constexpr int SHM_ACCEPT_TIMEOUT_MS = 5000;
+
+std::string bootId() {
+    std::ifstream file("/proc/sys/kernel/random/boot_id");
+    std::string id;
+    std::getline(file, id);
+    return id;
+}
+
+// Both sides report whether a step worked; proceed only if both did
+bool agree(int sock, bool ok) {
+    char mine = ok ? '1' : '0', theirs = '0';
+    if (write(sock, &mine, 1) != 1 || read(sock, &theirs, 1) != 1) {
+        return false;
+    }
+    return ok && theirs == '1';
+}
+
+} // namespace
+
+ShmTransport::~ShmTransport() {
+    unmap();
+}
+
+void ShmTransport::unmap() {
+    if (remote_base_) {
+        munmap(remote_base_, remote_size_);
+        remote_base_ = nullptr;
+    }
+    if (outbound_) {
+        munmap(outbound_, sizeof(Ring));
+        outbound_ = nullptr;
+    }
+    if (inbound_) {
+        munmap(inbound_, sizeof(Ring));
+        inbound_ = nullptr;
+    }
+    if (inbound_fd_ >= 0) {
+        close(inbound_fd_);
+        inbound_fd_ = -1;
+    }
+}
+
+bool ShmTransport::connect(int sock, bool listener, bool enabled, const ShmRegion& local, uint64_t remote_addr) {
+    local_ = local;
+    remote_addr_ = remote_addr;
+
+    ShmHello hello = {}, peer = {};
+    std::string id = bootId();
+    strncpy(hello.boot_id, id.c_str(), sizeof(hello.boot_id) - 1);
+    hello.usable = enabled && !id.empty() && local_.fd >= 0 && local_.base;
+
+    if (write(sock, &hello, sizeof(hello)) != sizeof(hello) ||
+        read(sock, &peer, sizeof(peer)) != sizeof(peer)) {
+        throw std::runtime_error("Failed to exchange host identity");
+    }
+    if (!hello.usable || !peer.usable || strncmp(hello.boot_id, peer.boot_id, sizeof(hello.boot_id)) != 0) {
+        return false;
+    }
+
+    if (!agree(sock, createRing())) {
+        unmap();
+        return false;
+    }
+
+    int channel = -1;
+    bool ok = openUnixChannel(sock, listener, channel);
+    if (!agree(sock, ok)) {
+        if (channel >= 0) close(channel);
+        unmap();
+        return false;
+    }
+
+    ok = exchangeFds(channel);
+    close(channel);
+    if (!agree(sock, ok)) {
+        unmap();
+        return false;
+    }
+    return true;
+}
+
+bool ShmTransport::createRing() {
+    inbound_fd_ = memfd_create("gaudi-verbs-ring", MFD_CLOEXEC);
+    if (inbound_fd_ < 0 || ftruncate(inbound_fd_, sizeof(Ring)) != 0) {
+        std::cerr << "Failed to create shared-memory ring\n";
+        return false;
+    }
+    void* ring = mmap(nullptr, sizeof(Ring), PROT_READ | PROT_WRITE, MAP_SHARED, inbound_fd_, 0);
+    if (ring == MAP_FAILED) {
+        std::cerr << "Failed to map shared-memory ring\n";
+        return false;
+    }
+    inbound_ = static_cast<Ring*>(ring);
+    inbound_->head.store(0, std::memory_order_relaxed);
+    inbound_->tail.store(0, std::memory_order_relaxed);
+    return true;
+}
+
+bool ShmTransport::openUnixChannel(int sock, bool listener, int& channel) {
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    char name[sizeof(addr.sun_path)] = {};
+
+    if (listener) {
+        // Abstract namespace, nothing to clean up on disk
+        snprintf(name, sizeof(name), "gaudi-verbs-dmabuf-%d-%d", getpid(), sock);
+        memcpy(addr.sun_path + 1, name, strlen(name));
+        socklen_t len = offsetof(struct sockaddr_un, sun_path) + 1 + strlen(name);
+
+        int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listen_fd < 0 || bind(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), len) ||
+            listen(listen_fd, 1)) {
+            std::cerr << "Failed to listen on Unix socket\n";
+            name[0] = '\0';
+        }
+
+        if (write(sock, name, sizeof(name)) != sizeof(name) || !name[0]) {
+            if (listen_fd >= 0) close(listen_fd);
+            return false;
+        }
+
+        struct pollfd pfd = {listen_fd, POLLIN, 0};
+        if (poll(&pfd, 1, SHM_ACCEPT_TIMEOUT_MS) == 1) {
+            channel = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        }
+        close(listen_fd);
+    } else {
+        if (read(sock, name, sizeof(name)) != sizeof(name) || !name[0]) {
+            return false;
+        }
+        name[sizeof(name) - 2] = '\0';
+        memcpy(addr.sun_path + 1, name, strlen(name));
+        socklen_t len = offsetof(struct sockaddr_un, sun_path) + 1 + strlen(name);
+
+        channel = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (channel >= 0 && ::connect(channel, reinterpret_cast<struct sockaddr*>(&addr), len)) {
+            close(channel);
+            channel = -1;
+        }
+    }
+
+    if (channel < 0) {
+        std::cerr << "Failed to open Unix socket to local peer\n";
+        return false;
+    }
+    return true;
+}
+
+bool ShmTransport::exchangeFds(int channel) {
+    ShmFdHeader header = {local_.size};
+    int fds[2] = {local_.fd, inbound_fd_};
+
+    struct iovec iov = {&header, sizeof(header)};
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (sendmsg(channel, &msg, 0) != sizeof(header)) {
+        std::cerr << "Failed to send buffer descriptors\n";
+        return false;
+    }
+
+    ShmFdHeader peer = {};
+    iov = {&peer, sizeof(peer)};
+    memset(control, 0, sizeof(control));
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(channel, &msg, MSG_CMSG_CLOEXEC) != sizeof(peer)) {
+        std::cerr << "Failed to receive buffer descriptors\n";
+        return false;
+    }
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+        std::cerr << "Peer did not pass buffer descriptors\n";
+        return false;
+    }
+    int peer_fds[2];
+    memcpy(peer_fds, CMSG_DATA(cmsg), sizeof(peer_fds));
+
+    void* buffer = mmap(nullptr, peer.buffer_size, PROT_READ | PROT_WRITE, MAP_SHARED, peer_fds[0], 0);
+    void* ring = mmap(nullptr, sizeof(Ring), PROT_READ | PROT_WRITE, MAP_SHARED, peer_fds[1], 0);
+    close(peer_fds[0]);
+    close(peer_fds[1]);
+
+    if (buffer != MAP_FAILED) {
+        remote_base_ = static_cast<uint8_t*>(buffer);
+        remote_size_ = peer.buffer_size;
+    }
+    if (ring != MAP_FAILED) {
+        outbound_ = static_cast<Ring*>(ring);
+    }
+    if (!remote_base_ || !outbound_) {
+        std::cerr << "Failed to map peer buffer (no CPU access to its memory)\n";
+        return false;
+    }
+    return true;
+}
+
+void ShmTransport::setMainQp(uint32_t qp_num, const std::unordered_map<uint32_t, struct ibv_mr*>* host_mrs) {
+    qp_num_ = qp_num;
+    host_mrs_ = host_mrs;
+}
+
+// Host MRs are registered at their process addresses, the buffer at local_.addr
+uint8_t* ShmTransport::localPtr(uint32_t lkey, uint64_t addr, uint64_t length) const {
+    if (lkey != local_.lkey && host_mrs_) {
+        auto it = host_mrs_->find(lkey);
+        if (it != host_mrs_->end()) {
+            uint64_t base = reinterpret_cast<uintptr_t>(it->second->addr);
+            if (addr < base || length > it->second->length || addr - base > it->second->length - length) {
+                return nullptr;
+            }
+            return reinterpret_cast<uint8_t*>(static_cast<uintptr_t>(addr));
+        }
+    }
+    if (addr < local_.addr || addr - local_.addr + length > local_.size) return nullptr;
+    return static_cast<uint8_t*>(local_.base) + (addr - local_.addr);
+}
+
+// Once per connection, so a post the NIC would have taken doesn't fail quietly
+void ShmTransport::reportUnreachable(const char* what, uint32_t key, uint64_t addr) {
+    if (reported_) return;
+    reported_ = true;
+    std::cerr << "Intra-node transport cannot reach " << what << " 0x" << std::hex << addr << " (key 0x" << key
+              << ")" << std::dec << "; only the registered buffer and host MRs are shared\n";
+}
+
+uint8_t* ShmTransport::remotePtr(uint64_t addr, uint64_t length) const {
+    if (addr < remote_addr_ || addr - remote_addr_ + length > remote_size_) return nullptr;
+    return remote_base_ + (addr - remote_addr_);
+}
+
+void ShmTransport::complete(uint64_t wr_id, enum ibv_wc_opcode opcode, enum ibv_wc_status status,
+                            uint32_t byte_len, uint32_t imm_data, bool with_imm) {
+    struct ibv_wc wc = {};
+    wc.wr_id = wr_id;
+    wc.status = status;
+    wc.opcode = opcode;
+    wc.byte_len = byte_len;
+    wc.imm_data = imm_data;
+    wc.wc_flags = with_imm ? IBV_WC_WITH_IMM : 0;
+    wc.qp_num = qp_num_;
+    completions_.push_back(wc);
+}
+
+void ShmTransport::postSend(struct ibv_send_wr* wr, bool signal_all) {
+    for (; wr; wr = wr->next) {
+        PendingSend send;
+        send.wr = *wr;
+        send.wr.next = nullptr;
+        send.wr.sg_list = nullptr;
+        send.sges.assign(wr->sg_list, wr->sg_list + wr->num_sge);
+        if (signal_all) send.wr.send_flags |= IBV_SEND_SIGNALED;
+        pending_.push_back(std::move(send));
+    }
+    flushSends();
+}
+
+void ShmTransport::postReceive(struct ibv_recv_wr* wr) {
+    for (; wr; wr = wr->next) {
+        recvs_.push_back({wr->wr_id, std::vector<struct ibv_sge>(wr->sg_list, wr->sg_list + wr->num_sge)});
+    }
+}
+
+void ShmTransport::flushSends() {
+    // Later WRs wait behind a full ring to keep RC ordering
+    while (!pending_.empty() && execute(pending_.front())) {
+        pending_.pop_front();
+    }
+}
+
+bool ShmTransport::execute(const PendingSend& send) {
+    const struct ibv_send_wr& wr = send.wr;
+    bool signaled = wr.send_flags & IBV_SEND_SIGNALED;
+    bool uses_ring = wr.opcode == IBV_WR_RDMA_WRITE_WITH_IMM || wr.opcode == IBV_WR_SEND ||
+                     wr.opcode == IBV_WR_SEND_WITH_IMM;
+
+    uint64_t head = outbound_->head.load(std::memory_order_relaxed);
+    if (uses_ring && head - outbound_->tail.load(std::memory_order_acquire) >= SHM_RING_SLOTS) {
+        return false;
+    }
+
+    uint64_t total = 0;
+    for (const auto& sge : send.sges) {
+        if (!localPtr(sge.lkey, sge.addr, sge.length)) {
+            reportUnreachable("local SGE", sge.lkey, sge.addr);
+            complete(wr.wr_id, IBV_WC_SEND, IBV_WC_LOC_PROT_ERR, 0);
+            return true;
+        }
+        total += sge.length;
+    }
+
+    Slot& slot = outbound_->slots[head % SHM_RING_SLOTS];
+    enum ibv_wc_opcode opcode = IBV_WC_SEND;
+
+    switch (wr.opcode) {
+    case IBV_WR_RDMA_WRITE:
+    case IBV_WR_RDMA_WRITE_WITH_IMM:
+    case IBV_WR_RDMA_READ: {
+        opcode = wr.opcode == IBV_WR_RDMA_READ ? IBV_WC_RDMA_READ : IBV_WC_RDMA_WRITE;
+        uint8_t* remote = remotePtr(wr.wr.rdma.remote_addr, total);
+        if (!remote) {
+            reportUnreachable("remote address", wr.wr.rdma.rkey, wr.wr.rdma.remote_addr);
+            complete(wr.wr_id, opcode, IBV_WC_REM_ACCESS_ERR, 0);
+            return true;
+        }
+        for (const auto& sge : send.sges) {
+            if (wr.opcode == IBV_WR_RDMA_READ) {
+                memcpy(localPtr(sge.lkey, sge.addr, sge.length), remote, sge.length);
+            } else {
+                memcpy(remote, localPtr(sge.lkey, sge.addr, sge.length), sge.length);
+            }
+            remote += sge.length;
+        }
+        break;
+    }
+    case IBV_WR_SEND:
+    case IBV_WR_SEND_WITH_IMM: {
+        if (total > SHM_INLINE_MAX) {
+            complete(wr.wr_id, IBV_WC_SEND, IBV_WC_LOC_LEN_ERR, 0);
+            return true;
+        }
+        uint8_t* out = slot.data;
+        for (const auto& sge : send.sges) {
+            memcpy(out, localPtr(sge.lkey, sge.addr, sge.length), sge.length);
+            out += sge.length;
+        }
+        break;
+    }
+    default:
+        complete(wr.wr_id, IBV_WC_SEND, IBV_WC_LOC_QP_OP_ERR, 0);
+        return true;
+    }
+
+    if (uses_ring) {
+        slot.opcode = wr.opcode;
+        slot.imm_data = wr.imm_data;
+        slot.length = static_cast<uint32_t>(total);
+        outbound_->head.store(head + 1, std::memory_order_release);
+    }
+    if (signaled) {
+        complete(wr.wr_id, opcode, IBV_WC_SUCCESS, static_cast<uint32_t>(total));
+    }
+    return true;
+}
+
+void ShmTransport::receive() {
+    // Like RNR, ring entries wait until a receive is posted
+    while (!recvs_.empty()) {
+        uint64_t tail = inbound_->tail.load(std::memory_order_relaxed);
+        if (tail == inbound_->head.load(std::memory_order_acquire)) break;
+
+        const Slot& slot = inbound_->slots[tail % SHM_RING_SLOTS];
+        PendingRecv recv = std::move(recvs_.front());
+        recvs_.pop_front();
+
+        if (slot.opcode == IBV_WR_RDMA_WRITE_WITH_IMM) {
+            complete(recv.wr_id, IBV_WC_RECV_RDMA_WITH_IMM, IBV_WC_SUCCESS, slot.length, slot.imm_data, true);
+        } else {
+            enum ibv_wc_status status = IBV_WC_SUCCESS;
+            uint32_t copied = 0;
+            for (const auto& sge : recv.sges) {
+                if (copied == slot.length) break;
+                uint32_t len = std::min(sge.length, slot.length - copied);
+                uint8_t* dst = localPtr(sge.lkey, sge.addr, len);
+                if (!dst) {
+                    reportUnreachable("receive SGE", sge.lkey, sge.addr);
+                    status = IBV_WC_LOC_PROT_ERR;
+                    break;
+                }
+                memcpy(dst, slot.data + copied, len);
+                copied += len;
+            }
+            if (status == IBV_WC_SUCCESS && copied < slot.length) {
+                status = IBV_WC_LOC_LEN_ERR;
+            }
+            complete(recv.wr_id, IBV_WC_RECV, status, slot.length, slot.imm_data,
+                     slot.opcode == IBV_WR_SEND_WITH_IMM);
+        }
+        inbound_->tail.store(tail + 1, std::memory_order_release);
+    }
+}
+
+int ShmTransport::pollCompletions(struct ibv_wc* wc, int max_entries) {
+    flushSends();
+    receive();
+
+    int ne = 0;
+    while (ne < max_entries && !completions_.empty()) {
+        wc[ne++] = completions_.front();
+        completions_.pop_front();
+    }
+    return ne;
+}
@@ -0,0 +1,268 @@
+#include "staging_pipeline.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+
+namespace {
+
+constexpr uint32_t MAX_STAGING_DEPTH = 8;
+
+// No progress for this long means the peer or the copy engine is stuck
+constexpr std::chrono::seconds STAGING_IDLE_TIMEOUT(10);
+
+} // namespace
+
+StagingPipeline::StagingPipeline(RdmaVerbs& rdma, CopyEngine& engine, struct ibv_qp* qp,
+                                 const CmConData& remote, uint64_t staging_engine_addr,
+                                 size_t chunk_size, uint32_t depth)
+    : rdma_(rdma), engine_(engine), qp_(qp), remote_(remote),
+      staging_engine_addr_(staging_engine_addr), chunk_size_(chunk_size), depth_(depth) {
+    if (depth_ == 0 || depth_ > MAX_STAGING_DEPTH) {
+        throw std::runtime_error("Staging depth must be between 1 and " + std::to_string(MAX_STAGING_DEPTH));
+    }
+    if (chunk_size_ == 0 || chunk_size_ > UINT32_MAX || depth_ * chunk_size_ > rdma_.getRegionSize()) {
+        throw std::runtime_error("Staging slots do not fit the registered buffer");
+    }
+
+    // One receive per slot covers both credits and chunk notifications
+    for (uint32_t i = 0; i < depth_; ++i) {
+        postRecv();
+    }
+}
+
+void StagingPipeline::enableCodec(Codec& codec, uint32_t threads) {
+    if (!rdma_.getHostBuffer()) {
+        throw std::runtime_error("Codec stage needs a host-mapped staging buffer");
+    }
+    if (depth_ * (2 * chunk_size_ + sizeof(ChunkHeader)) > rdma_.getRegionSize()) {
+        throw std::runtime_error("Encoded staging slots do not fit the registered buffer");
+    }
+    codec_ = &codec;
+    pool_ = std::make_unique<CodecPool>(threads);
+}
+
+uint64_t StagingPipeline::chunkLength(uint64_t index, size_t length) const {
+    return std::min<uint64_t>(chunk_size_, length - index * chunk_size_);
+}
+
+// Runs on the codec pool; a chunk that does not shrink is stored as is
+void StagingPipeline::encodeChunk(uint64_t index, uint64_t length) {
+    const uint8_t* raw = hostSlot(slotOffset(index));
+    uint8_t* slot = hostSlot(encodedSlotOffset(index));
+    ChunkHeader header{static_cast<uint32_t>(length), 0};
+
+    size_t encoded = codec_->encode(raw, length, index * chunk_size_, slot + sizeof(header), length - 1);
+    if (encoded == 0) {
+        memcpy(slot + sizeof(header), raw, length);
+        encoded = length;
+    }
+    header.encoded_length = static_cast<uint32_t>(encoded);
+    memcpy(slot, &header, sizeof(header));
+}
+
+void StagingPipeline::decodeChunk(uint64_t index, uint64_t length) {
+    const uint8_t* slot = hostSlot(encodedSlotOffset(index));
+    uint8_t* raw = hostSlot(slotOffset(index));
+    ChunkHeader header;
+    memcpy(&header, slot, sizeof(header));
+
+    if (header.raw_length != length || header.encoded_length > length) {
+        throw std::runtime_error("Bad header on staged chunk " + std::to_string(index));
+    }
+    if (header.encoded_length == length) {
+        memcpy(raw, slot + sizeof(header), length);
+    } else {
+        codec_->decode(slot + sizeof(header), header.encoded_length, raw, length);
+    }
+}
+
+void StagingPipeline::postChunk(uint64_t index, uint64_t offset, uint64_t length) {
+    struct ibv_sge sge = {};
+    sge.addr = rdma_.getLocalAddr() + offset;
+    sge.length = static_cast<uint32_t>(length);
+    sge.lkey = rdma_.getLkey();
+
+    struct ibv_send_wr wr = {};
+    wr.wr_id = index;
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    wr.opcode = IBV_WR_RDMA_WRITE_WITH_IMM;
+    wr.send_flags = IBV_SEND_SIGNALED;
+    wr.imm_data = htonl(static_cast<uint32_t>(index));
+    wr.wr.rdma.remote_addr = remote_.addr + offset;
+    wr.wr.rdma.rkey = remote_.rkey;
+    rdma_.postSend(qp_, &wr);
+}
+
+void StagingPipeline::postCredit(uint64_t index) {
+    struct ibv_send_wr wr = {};
+    wr.wr_id = index;
+    wr.num_sge = 0;
+    wr.opcode = IBV_WR_SEND_WITH_IMM;
+    wr.send_flags = IBV_SEND_SIGNALED;
+    wr.imm_data = htonl(static_cast<uint32_t>(index));
+    rdma_.postSend(qp_, &wr);
+}
+
+void StagingPipeline::postRecv() {
+    struct ibv_recv_wr wr = {};
+    wr.num_sge = 0;
+    rdma_.postReceive(qp_, &wr);
+}
+
+StagingPipeline::Stats StagingPipeline::send(uint64_t device_src, size_t length, uint64_t tensor_id) {
+    Stats stats;
+    uint64_t chunks = (length + chunk_size_ - 1) / chunk_size_;
+    uint64_t next_copy = 0, next_encode = 0, next_write = 0, write_done = 0, credits = 0;
+    std::deque<uint64_t> copies, encodes;
+    double codec_start = pool_ ? pool_->cpuSeconds() : 0.0;
+    if (codec_) codec_->begin(length, tensor_id);
+    auto start = std::chrono::steady_clock::now();
+    auto last_progress = start;
+
+    while (write_done < chunks || credits < chunks) {
+        bool progressed = false;
+
+        // Stage the next chunks while local slots are free
+        while (next_copy < chunks && next_copy < write_done + depth_) {
+            uint64_t offset = next_copy * chunk_size_;
+            copies.push_back(engine_.copyAsync(staging_engine_addr_ + slotOffset(next_copy), device_src + offset,
+                                               chunkLength(next_copy, length),
+                                               CopyEngine::Direction::DeviceToHost));
+            next_copy++;
+            progressed = true;
+        }
+
+        if (codec_) {
+            // Encode staged chunks in order, then send them as the remote slots drain
+            while (!copies.empty() && engine_.done(copies.front())) {
+                uint64_t index = next_encode++;
+                uint64_t chunk = chunkLength(index, length);
+                encodes.push_back(pool_->submit([this, index, chunk] { encodeChunk(index, chunk); }));
+                copies.pop_front();
+                progressed = true;
+            }
+            while (!encodes.empty() && next_write < credits + depth_ && pool_->done(encodes.front())) {
+                ChunkHeader header;
+                memcpy(&header, hostSlot(encodedSlotOffset(next_write)), sizeof(header));
+                uint64_t wire = sizeof(header) + header.encoded_length;
+                postChunk(next_write, encodedSlotOffset(next_write), wire);
+                stats.wire_bytes += wire;
+                encodes.pop_front();
+                next_write++;
+                progressed = true;
+            }
+        } else {
+            // Send staged chunks whose remote slot has been drained
+            while (!copies.empty() && next_write < credits + depth_ && engine_.done(copies.front())) {
+                postChunk(next_write, slotOffset(next_write), chunkLength(next_write, length));
+                stats.wire_bytes += chunkLength(next_write, length);
+                copies.pop_front();
+                next_write++;
+                progressed = true;
+            }
+        }
+
+        struct ibv_wc wc[16];
+        int ne = rdma_.pollCompletions(wc, 16);
+        for (int i = 0; i < ne; ++i) {
+            if (wc[i].status != IBV_WC_SUCCESS) {
+                throw std::runtime_error("Staged send failed: " + std::string(ibv_wc_status_str(wc[i].status)));
+            }
+            if (wc[i].opcode == IBV_WC_RDMA_WRITE) {
+                write_done++;
+            } else if (wc[i].opcode == IBV_WC_RECV) {
+                credits++;
+                postRecv();
+            }
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (progressed || ne > 0) {
+            last_progress = now;
+        } else if (now - last_progress > STAGING_IDLE_TIMEOUT) {
+            throw std::runtime_error("Staged send timeout");
+        }
+    }
+
+    stats.chunks = chunks;
+    stats.bytes = length;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    stats.codec_seconds = pool_ ? pool_->cpuSeconds() - codec_start : 0.0;
+    return stats;
+}
+
+StagingPipeline::Stats StagingPipeline::receive(uint64_t device_dst, size_t length) {
+    Stats stats;
+    uint64_t chunks = (length + chunk_size_ - 1) / chunk_size_;
+    uint64_t arrived = 0, decoded = 0, done = 0;
+    std::deque<uint64_t> decodes, copies;
+    double codec_start = pool_ ? pool_->cpuSeconds() : 0.0;
+    if (codec_) codec_->begin(length, 0);
+    auto start = std::chrono::steady_clock::now();
+    auto last_progress = start;
+
+    while (done < chunks) {
+        bool progressed = false;
+
+        struct ibv_wc wc[16];
+        int ne = rdma_.pollCompletions(wc, 16);
+        for (int i = 0; i < ne; ++i) {
+            if (wc[i].status != IBV_WC_SUCCESS) {
+                throw std::runtime_error("Staged receive failed: " + std::string(ibv_wc_status_str(wc[i].status)));
+            }
+            if (wc[i].opcode != IBV_WC_RECV_RDMA_WITH_IMM) continue;
+
+            // RC delivers writes in order
+            uint64_t index = ntohl(wc[i].imm_data);
+            if (index != arrived) {
+                throw std::runtime_error("Staged chunk " + std::to_string(index) + " out of order");
+            }
+            postRecv();
+            stats.wire_bytes += wc[i].byte_len;
+            if (codec_) {
+                uint64_t chunk = chunkLength(index, length);
+                decodes.push_back(pool_->submit([this, index, chunk] { decodeChunk(index, chunk); }));
+            } else {
+                copies.push_back(engine_.copyAsync(device_dst + index * chunk_size_,
+                                                   staging_engine_addr_ + slotOffset(index),
+                                                   chunkLength(index, length),
+                                                   CopyEngine::Direction::HostToDevice));
+            }
+            arrived++;
+        }
+
+        // Decoded chunks go to the device in order
+        while (!decodes.empty() && pool_->done(decodes.front())) {
+            copies.push_back(engine_.copyAsync(device_dst + decoded * chunk_size_,
+                                               staging_engine_addr_ + slotOffset(decoded),
+                                               chunkLength(decoded, length),
+                                               CopyEngine::Direction::HostToDevice));
+            decodes.pop_front();
+            decoded++;
+            progressed = true;
+        }
+
+        // Hand slots back as soon as their data is in device memory
+        while (!copies.empty() && engine_.done(copies.front())) {
+            postCredit(done);
+            copies.pop_front();
+            done++;
+            progressed = true;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (progressed || ne > 0) {
+            last_progress = now;
+        } else if (now - last_progress > STAGING_IDLE_TIMEOUT) {
+            throw std::runtime_error("Staged receive timeout");
+        }
+    }
+
+    stats.chunks = chunks;
+    stats.bytes = length;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    stats.codec_seconds = pool_ ? pool_->cpuSeconds() - codec_start : 0.0;
+    return stats;
+}
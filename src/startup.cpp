@@ -0,0 +1,76 @@
+#include "startup.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <future>
+
+StartupProfile::Phase::Phase(StartupProfile* profile, const char* name)
+    : profile_(profile), name_(name), start_(profile ? std::chrono::steady_clock::now()
+                                                     : std::chrono::steady_clock::time_point{}) {}
+
+StartupProfile::Phase::~Phase() {
+    if (profile_) {
+        profile_->add(name_, start_, std::chrono::steady_clock::now());
+    }
+}
+
+StartupProfile::StartupProfile() : origin_(std::chrono::steady_clock::now()) {}
+
+void StartupProfile::add(const char* name, std::chrono::steady_clock::time_point start,
+                         std::chrono::steady_clock::time_point end) {
+    using ms = std::chrono::duration<double, std::milli>;
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.push_back({name, ms(start - origin_).count(), ms(end - start).count()});
+}
+
+void StartupProfile::report(std::ostream& out) const {
+    std::vector<Entry> entries;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries = entries_;
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.start_ms < b.start_ms; });
+
+    double wall = 0.0, work = 0.0;
+    char line[128];
+    out << "\nStartup phases (ms)          start  duration\n";
+    for (const Entry& e : entries) {
+        std::snprintf(line, sizeof(line), "  %-24s %9.2f %9.2f\n", e.name, e.start_ms, e.duration_ms);
+        out << line;
+        wall = std::max(wall, e.start_ms + e.duration_ms);
+        work += e.duration_ms;
+    }
+    std::snprintf(line, sizeof(line), "  %.2f ms wall clock for %.2f ms of phases\n", wall, work);
+    out << line;
+}
+
+void startInParallel(HpuManager& hpu, size_t size, RdmaVerbs& rdma, const std::string& ib_dev_name,
+                     const std::string& server_name, int port, StartupProfile* profile) {
+    hpu.setStartupProfile(profile);
+    rdma.setStartupProfile(profile);
+
+    // The RDMA object only hands its own members to each task
+    auto device = std::async(std::launch::async, [&] { rdma.openDevice(ib_dev_name); });
+    auto connection = std::async(std::launch::async, [&] { rdma.openConnection(server_name, port); });
+    std::exception_ptr failure;
+    try {
+        hpu.initialize(size);
+    } catch (...) {
+        failure = std::current_exception();
+    }
+    try {
+        device.get();
+    } catch (...) {
+        if (!failure) failure = std::current_exception();
+    }
+    // A server would otherwise sit in accept until some client turned up
+    if (failure) rdma.cancelConnection();
+    try {
+        connection.get();
+    } catch (...) {
+        if (!failure) failure = std::current_exception();
+    }
+    if (failure) std::rethrow_exception(failure);
+
+    rdma.registerBuffer(hpu);
+    rdma.connectQp(server_name, port);
+}
@@ -0,0 +1,265 @@
+#include "strided_transfer.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Keep single writes well under the port's max message size
+constexpr uint64_t MAX_WRITE_BYTES = 1ull << 30;
+static_assert(MAX_WRITE_BYTES <= UINT32_MAX, "A write must fit one SGE length");
+
+// Writes in flight per transfer, signaled every half window
+constexpr uint64_t WRITE_WINDOW = QP_DEPTH / 2;
+
+// Bytes [start, start + length) of a fragment stream
+std::vector<StridedTransfer::Fragment> sliceStream(const std::vector<StridedTransfer::Fragment>& frags,
+                                                   uint64_t start, uint64_t length) {
+    std::vector<StridedTransfer::Fragment> out;
+    uint64_t pos = 0;
+    for (const auto& frag : frags) {
+        uint64_t end = pos + frag.length;
+        if (end > start && pos < start + length) {
+            uint64_t from = std::max(pos, start);
+            uint64_t to = std::min(end, start + length);
+            out.push_back({frag.offset + (from - pos), to - from});
+        }
+        if (end >= start + length) break;
+        pos = end;
+    }
+    return out;
+}
+
+// SGEs per work request the QP was actually created with
+uint32_t sendSgeLimit(struct ibv_qp* qp) {
+    struct ibv_qp_attr attr = {};
+    struct ibv_qp_init_attr init_attr = {};
+    if (ibv_query_qp(qp, &attr, IBV_QP_CAP, &init_attr)) {
+        throw std::runtime_error("Failed to query QP capabilities");
+    }
+    return std::max(1u, attr.cap.max_send_sge);
+}
+
+} // namespace
+
+size_t TensorSlice::elements() const {
+    size_t count = 1;
+    for (size_t n : shape) count *= n;
+    return count;
+}
+
+std::vector<StridedTransfer::Fragment> StridedTransfer::fragments(const TensorSlice& slice) {
+    if (!slice.strides.empty() && slice.strides.size() != slice.shape.size()) {
+        throw std::runtime_error("Tensor slice shape and strides differ in rank");
+    }
+
+    std::vector<Fragment> frags;
+    if (slice.elements() == 0) return frags;
+
+    // (extent, stride) outermost first, dense strides when none given
+    std::vector<std::pair<size_t, size_t>> dims;
+    size_t dense = 1;
+    std::vector<size_t> strides = slice.strides;
+    if (strides.empty()) {
+        strides.resize(slice.shape.size());
+        for (size_t d = slice.shape.size(); d-- > 0;) {
+            strides[d] = dense;
+            dense *= slice.shape[d];
+        }
+    }
+    for (size_t d = 0; d < slice.shape.size(); ++d) {
+        if (slice.shape[d] != 1) dims.emplace_back(slice.shape[d], strides[d]);
+    }
+
+    // Fold dimensions that are contiguous with their inner neighbour
+    for (size_t d = dims.size(); d-- > 1;) {
+        if (dims[d - 1].second == dims[d].first * dims[d].second) {
+            dims[d - 1] = {dims[d - 1].first * dims[d].first, dims[d].second};
+            dims.erase(dims.begin() + d);
+        }
+    }
+
+    uint64_t frag_len = slice.elem_size;
+    if (!dims.empty() && dims.back().second == 1) {
+        frag_len *= dims.back().first;
+        dims.pop_back();
+    }
+
+    std::vector<size_t> idx(dims.size(), 0);
+    for (;;) {
+        uint64_t offset = slice.offset;
+        for (size_t d = 0; d < dims.size(); ++d) {
+            offset += static_cast<uint64_t>(idx[d]) * dims[d].second * slice.elem_size;
+        }
+        frags.push_back({offset, frag_len});
+
+        size_t d = dims.size();
+        while (d > 0 && ++idx[d - 1] == dims[d - 1].first) {
+            idx[--d] = 0;
+        }
+        if (d == 0) break;
+    }
+    return frags;
+}
+
+StridedTransfer::StridedTransfer(RdmaVerbs& rdma, HpuManager& hpu, size_t staging_size)
+    : rdma_(rdma), hpu_(hpu), staging_size_(staging_size) {
+    staging_ = static_cast<uint8_t*>(aligned_alloc(4096, staging_size_));
+    if (!staging_) {
+        throw std::runtime_error("Failed to allocate staging buffer");
+    }
+    staging_mr_ = rdma_.registerHostMemory(staging_, staging_size_);
+}
+
+StridedTransfer::~StridedTransfer() {
+    rdma_.deregisterMemory(staging_mr_);
+    free(staging_);
+}
+
+StridedTransfer::Stats StridedTransfer::write(struct ibv_qp* qp, const CmConData& remote, uint64_t remote_size,
+                                              const TensorSlice& src, const TensorSlice& dst) {
+    if (src.bytes() != dst.bytes()) {
+        throw std::runtime_error("Tensor slices differ in size");
+    }
+    std::vector<Fragment> src_frags = fragments(src);
+    std::vector<Fragment> dst_frags = fragments(dst);
+    if (src_frags.empty()) return {};
+
+    for (const auto& frag : src_frags) {
+        if (frag.offset + frag.length > rdma_.getRegionSize()) {
+            throw std::runtime_error("Tensor slice exceeds registered buffer");
+        }
+    }
+    for (const auto& frag : dst_frags) {
+        if (frag.offset + frag.length > remote_size) {
+            throw std::runtime_error("Tensor slice exceeds peer's registered buffer");
+        }
+    }
+
+    uint32_t max_sge = sendSgeLimit(qp);
+    if (hpu_.getBuffer() && src.bytes() / src_frags.size() < PACK_THRESHOLD) {
+        return writePacked(qp, remote, max_sge, src_frags, dst_frags);
+    }
+
+    Stats stats;
+    auto writes = plan(src_frags, rdma_.getLocalAddr(), rdma_.getLkey(), dst_frags, remote.addr, max_sge);
+    post(qp, remote.rkey, writes, stats);
+    return stats;
+}
+
+std::vector<StridedTransfer::WritePlan> StridedTransfer::plan(const std::vector<Fragment>& src,
+                                                              uint64_t local_base, uint32_t lkey,
+                                                              const std::vector<Fragment>& dst,
+                                                              uint64_t remote_base, uint32_t max_sge) const {
+    std::vector<WritePlan> writes;
+    uint64_t write_len = 0;
+
+    size_t i = 0, j = 0;
+    uint64_t si = 0, sj = 0;
+    while (i < src.size() && j < dst.size()) {
+        uint64_t len = std::min(src[i].length - si, dst[j].length - sj);
+        uint64_t local = local_base + src[i].offset + si;
+        uint64_t remote = remote_base + dst[j].offset + sj;
+
+        bool contiguous = !writes.empty() && remote == writes.back().remote_addr + write_len &&
+                          write_len < MAX_WRITE_BYTES;
+        bool merge = contiguous && writes.back().sges.back().addr + writes.back().sges.back().length == local;
+        if (!contiguous || (!merge && writes.back().sges.size() >= max_sge)) {
+            writes.push_back({remote, {}});
+            write_len = 0;
+            merge = false;
+        }
+        // Long fragments are split across writes; the rest is taken next pass
+        len = std::min(len, MAX_WRITE_BYTES - write_len);
+
+        if (merge) {
+            writes.back().sges.back().length += static_cast<uint32_t>(len);
+        } else {
+            writes.back().sges.push_back({local, static_cast<uint32_t>(len), lkey});
+        }
+        write_len += len;
+
+        si += len;
+        sj += len;
+        if (si == src[i].length) { ++i; si = 0; }
+        if (sj == dst[j].length) { ++j; sj = 0; }
+    }
+    return writes;
+}
+
+void StridedTransfer::post(struct ibv_qp* qp, uint32_t rkey, std::vector<WritePlan>& writes, Stats& stats) {
+    uint64_t posted = 0, completed = 0, since_signal = 0;
+    int polls = 0;
+
+    while (completed < writes.size()) {
+        // Post as much of the plan as the window allows, one doorbell per batch
+        size_t count = std::min<uint64_t>(WRITE_WINDOW - (posted - completed), writes.size() - posted);
+        if (count) {
+            std::vector<struct ibv_send_wr> wrs(count);
+            for (size_t k = 0; k < count; ++k) {
+                WritePlan& plan = writes[posted + k];
+                uint64_t seq = posted + k + 1;
+                bool signaled = seq == writes.size() || ++since_signal >= WRITE_WINDOW / 2;
+                if (signaled) since_signal = 0;
+
+                wrs[k] = {};
+                wrs[k].wr_id = seq;
+                wrs[k].sg_list = plan.sges.data();
+                wrs[k].num_sge = static_cast<int>(plan.sges.size());
+                wrs[k].opcode = IBV_WR_RDMA_WRITE;
+                wrs[k].send_flags = signaled ? static_cast<unsigned int>(IBV_SEND_SIGNALED) : 0u;
+                wrs[k].wr.rdma.remote_addr = plan.remote_addr;
+                wrs[k].wr.rdma.rkey = rkey;
+                wrs[k].next = k + 1 < count ? &wrs[k + 1] : nullptr;
+
+                stats.writes++;
+                stats.sges += plan.sges.size();
+                for (const auto& sge : plan.sges) stats.bytes += sge.length;
+            }
+            rdma_.postSend(qp, wrs.data());
+            posted += count;
+        }
+
+        struct ibv_wc wc[8];
+        int ne = rdma_.pollCompletions(wc, 8);
+        for (int k = 0; k < ne; ++k) {
+            if (wc[k].status != IBV_WC_SUCCESS) {
+                throw std::runtime_error("Strided write failed: " + std::string(ibv_wc_status_str(wc[k].status)));
+            }
+            // RC completes in order, everything up to wr_id is done
+            completed = std::max<uint64_t>(completed, wc[k].wr_id);
+        }
+        if (ne == 0 && ++polls > 1000000) {
+            throw std::runtime_error("Strided write timeout");
+        }
+    }
+}
+
+StridedTransfer::Stats StridedTransfer::writePacked(struct ibv_qp* qp, const CmConData& remote, uint32_t max_sge,
+                                                    const std::vector<Fragment>& src,
+                                                    const std::vector<Fragment>& dst) {
+    Stats stats;
+    const uint8_t* base = static_cast<const uint8_t*>(hpu_.getBuffer());
+    uint64_t staging_addr = reinterpret_cast<uintptr_t>(staging_);
+
+    size_t i = 0;
+    uint64_t si = 0, pos = 0;
+    while (i < src.size()) {
+        // Gather the next chunk of the source stream into staging
+        uint64_t filled = 0;
+        while (i < src.size() && filled < staging_size_) {
+            uint64_t len = std::min(src[i].length - si, staging_size_ - filled);
+            memcpy(staging_ + filled, base + src[i].offset + si, len);
+            filled += len;
+            si += len;
+            if (si == src[i].length) { ++i; si = 0; }
+        }
+
+        std::vector<Fragment> packed = {{0, filled}};
+        auto writes = plan(packed, staging_addr, staging_mr_->lkey, sliceStream(dst, pos, filled), remote.addr,
+                           max_sge);
+        post(qp, remote.rkey, writes, stats);
+        stats.packed_bytes += filled;
+        pos += filled;
+    }
+    return stats;
+}
@@ -0,0 +1,193 @@
+#include "tag_matcher.hpp"
+
+namespace {
+
+uint64_t mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+uint64_t exactKey(int source, uint64_t tag) {
+    return mix(tag) ^ (static_cast<uint64_t>(static_cast<uint32_t>(source)) * 0x9e3779b97f4a7c15ull);
+}
+
+uint64_t sourceKey(int source) {
+    return static_cast<uint32_t>(source);
+}
+
+} // namespace
+
+TagMatcher::TagMatcher(size_t buckets) {
+    size_t n = 1;
+    while (n < buckets) n <<= 1;
+    mask_ = n - 1;
+
+    posted_exact_.resize(n);
+    posted_any_src_.resize(n);
+    posted_any_tag_.resize(n);
+    unexpected_exact_.resize(n);
+    unexpected_tag_.resize(n);
+    unexpected_src_.resize(n);
+}
+
+size_t TagMatcher::bucket(uint64_t key) const {
+    return mix(key) & mask_;
+}
+
+bool TagMatcher::postReceive(int source, uint64_t tag, uint64_t cookie, Match* match) {
+    List* list;
+    int link;
+    if (source != ANY_SOURCE && tag != ANY_TAG) {
+        list = &unexpected_exact_[bucket(exactKey(source, tag))];
+        link = LINK_EXACT;
+    } else if (source == ANY_SOURCE && tag != ANY_TAG) {
+        list = &unexpected_tag_[bucket(tag)];
+        link = LINK_TAG;
+    } else if (source != ANY_SOURCE) {
+        list = &unexpected_src_[bucket(sourceKey(source))];
+        link = LINK_SRC;
+    } else {
+        list = &unexpected_all_;
+        link = LINK_ALL;
+    }
+
+    uint32_t idx = findUnexpected(*list, link, source, tag);
+    if (idx != NIL) {
+        const Node& node = nodes_[idx];
+        *match = {node.cookie, node.source, node.tag};
+        unlink(unexpected_exact_[bucket(exactKey(node.source, node.tag))], idx, LINK_EXACT);
+        unlink(unexpected_tag_[bucket(node.tag)], idx, LINK_TAG);
+        unlink(unexpected_src_[bucket(sourceKey(node.source))], idx, LINK_SRC);
+        unlink(unexpected_all_, idx, LINK_ALL);
+        freeNode(idx);
+        unexpected_count_--;
+        return true;
+    }
+
+    idx = allocNode(source, tag, cookie);
+    if (source != ANY_SOURCE && tag != ANY_TAG) {
+        append(posted_exact_[bucket(exactKey(source, tag))], idx, LINK_EXACT);
+    } else if (source == ANY_SOURCE && tag != ANY_TAG) {
+        append(posted_any_src_[bucket(tag)], idx, LINK_EXACT);
+    } else if (source != ANY_SOURCE) {
+        append(posted_any_tag_[bucket(sourceKey(source))], idx, LINK_EXACT);
+    } else {
+        append(posted_any_, idx, LINK_EXACT);
+    }
+    posted_count_++;
+    return false;
+}
+
+bool TagMatcher::arrive(int source, uint64_t tag, uint64_t cookie, Match* match) {
+    List* candidates[] = {
+        &posted_exact_[bucket(exactKey(source, tag))],
+        &posted_any_src_[bucket(tag)],
+        &posted_any_tag_[bucket(sourceKey(source))],
+        &posted_any_,
+    };
+
+    List* best_list = nullptr;
+    uint32_t best = NIL;
+    for (List* list : candidates) {
+        uint32_t idx = findPosted(*list, source, tag);
+        if (idx != NIL && (best == NIL || nodes_[idx].seq < nodes_[best].seq)) {
+            best = idx;
+            best_list = list;
+        }
+    }
+
+    if (best != NIL) {
+        // Report the message's own source and tag, not the receive's wildcards
+        *match = {nodes_[best].cookie, source, tag};
+        unlink(*best_list, best, LINK_EXACT);
+        freeNode(best);
+        posted_count_--;
+        return true;
+    }
+
+    uint32_t idx = allocNode(source, tag, cookie);
+    append(unexpected_exact_[bucket(exactKey(source, tag))], idx, LINK_EXACT);
+    append(unexpected_tag_[bucket(tag)], idx, LINK_TAG);
+    append(unexpected_src_[bucket(sourceKey(source))], idx, LINK_SRC);
+    append(unexpected_all_, idx, LINK_ALL);
+    unexpected_count_++;
+    return false;
+}
+
+uint32_t TagMatcher::findPosted(List& list, int source, uint64_t tag) const {
+    for (uint32_t idx = list.head; idx != NIL; idx = nodes_[idx].next[LINK_EXACT]) {
+        const Node& node = nodes_[idx];
+        if ((node.source == ANY_SOURCE || node.source == source) &&
+            (node.tag == ANY_TAG || node.tag == tag)) {
+            return idx;
+        }
+    }
+    return NIL;
+}
+
+uint32_t TagMatcher::findUnexpected(List& list, int link, int source, uint64_t tag) const {
+    for (uint32_t idx = list.head; idx != NIL; idx = nodes_[idx].next[link]) {
+        const Node& node = nodes_[idx];
+        if ((source == ANY_SOURCE || node.source == source) &&
+            (tag == ANY_TAG || node.tag == tag)) {
+            return idx;
+        }
+    }
+    return NIL;
+}
+
+uint32_t TagMatcher::allocNode(int source, uint64_t tag, uint64_t cookie) {
+    uint32_t idx;
+    if (free_nodes_.empty()) {
+        idx = static_cast<uint32_t>(nodes_.size());
+        nodes_.emplace_back();
+    } else {
+        idx = free_nodes_.back();
+        free_nodes_.pop_back();
+    }
+
+    Node& node = nodes_[idx];
+    node.source = source;
+    node.tag = tag;
+    node.seq = seq_++;
+    node.cookie = cookie;
+    for (int i = 0; i < LINK_COUNT; ++i) {
+        node.next[i] = NIL;
+        node.prev[i] = NIL;
+    }
+    return idx;
+}
+
+void TagMatcher::freeNode(uint32_t idx) {
+    free_nodes_.push_back(idx);
+}
+
+void TagMatcher::append(List& list, uint32_t idx, int link) {
+    Node& node = nodes_[idx];
+    node.prev[link] = list.tail;
+    node.next[link] = NIL;
+    if (list.tail != NIL) {
+        nodes_[list.tail].next[link] = idx;
+    } else {
+        list.head = idx;
+    }
+    list.tail = idx;
+}
+
+void TagMatcher::unlink(List& list, uint32_t idx, int link) {
+    Node& node = nodes_[idx];
+    if (node.prev[link] != NIL) {
+        nodes_[node.prev[link]].next[link] = node.next[link];
+    } else {
+        list.head = node.next[link];
+    }
+    if (node.next[link] != NIL) {
+        nodes_[node.next[link]].prev[link] = node.prev[link];
+    } else {
+        list.tail = node.prev[link];
+    }
+}
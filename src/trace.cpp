@@ -0,0 +1,358 @@
+#include "trace.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+struct TraceRing {
+    TraceRing(size_t capacity, uint32_t thread) : records(capacity), mask(capacity - 1), tid(thread) {}
+
+    std::vector<TraceRecord> records;
+    size_t mask;
+    uint32_t tid;
+    std::atomic<uint64_t> head{0};
+};
+
+// Rings outlive their threads so a flush at exit still sees them
+struct TraceRegistry {
+    std::mutex mutex;
+    std::vector<std::shared_ptr<TraceRing>> rings;
+    size_t capacity{Tracer::DEFAULT_CAPACITY};
+    std::string exit_path;
+};
+
+TraceRegistry& registry() {
+    static TraceRegistry* instance = new TraceRegistry;
+    return *instance;
+}
+
+thread_local TraceRing* local_ring = nullptr;
+
+TraceRing* threadRing() {
+    if (__builtin_expect(local_ring == nullptr, 0)) {
+        TraceRegistry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        auto ring = std::make_shared<TraceRing>(reg.capacity, static_cast<uint32_t>(syscall(SYS_gettid)));
+        reg.rings.push_back(ring);
+        local_ring = ring.get();
+    }
+    return local_ring;
+}
+
+// Copies the live part of a ring, then drops what the owner overwrote meanwhile
+std::vector<TraceRecord> snapshot(const TraceRing& ring) {
+    uint64_t capacity = ring.records.size();
+    uint64_t end = ring.head.load(std::memory_order_acquire);
+    uint64_t begin = end > capacity ? end - capacity : 0;
+
+    std::vector<TraceRecord> records;
+    records.reserve(end - begin);
+    for (uint64_t i = begin; i < end; ++i) {
+        records.push_back(ring.records[i & ring.mask]);
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t after = ring.head.load(std::memory_order_relaxed);
+    uint64_t valid = after > capacity ? after - capacity : 0;
+    if (valid > begin) {
+        records.erase(records.begin(), records.begin() + std::min<uint64_t>(valid - begin, records.size()));
+    }
+    return records;
+}
+
+struct KindInfo {
+    const char* name;
+    const char* category;
+    const char* id_name;     // nullptr when the field is unused
+    const char* value_name;
+    const char* code_name;
+};
+
+const KindInfo KINDS[] = {
+    {"post_send", "post", "wr_id", "bytes", "opcode"},
+    {"post_recv", "post", "wr_id", nullptr, nullptr},
+    {"doorbell", "post", "wr_id", nullptr, nullptr},
+    {"completion", "cq", "wr_id", "nic_timestamp", nullptr},
+    {"register", "memory", "lkey", "bytes", nullptr},
+    {"deregister", "memory", "lkey", nullptr, nullptr},
+    {"allocate", "memory", nullptr, "bytes", "device"},
+    {"map", "memory", "address", "bytes", nullptr},
+    {"export", "memory", "fd", "bytes", nullptr},
+    {"recover", "qp", "qp_num", "replayed", nullptr},
+};
+
+const KindInfo& info(TraceKind kind) {
+    return KINDS[static_cast<uint32_t>(kind)];
+}
+
+// Name/value pairs of a record's arguments
+std::vector<std::pair<const char*, uint64_t>> arguments(const TraceRecord& r) {
+    const KindInfo& k = info(r.kind);
+    std::vector<std::pair<const char*, uint64_t>> args;
+    if (k.id_name) args.emplace_back(k.id_name, r.id);
+    if (k.value_name) args.emplace_back(k.value_name, r.value);
+    if (r.kind == TraceKind::Completion) {
+        args.emplace_back("opcode", r.code & 0xffff);
+        args.emplace_back("status", r.code >> 16);
+    } else if (k.code_name) {
+        args.emplace_back(k.code_name, r.code);
+    }
+    return args;
+}
+
+void writeChromeJson(std::ostream& out, const std::vector<std::pair<uint32_t, std::vector<TraceRecord>>>& threads) {
+    int pid = getpid();
+    bool first = true;
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    out << std::fixed << std::setprecision(3);
+    for (const auto& thread : threads) {
+        for (const auto& r : thread.second) {
+            const KindInfo& k = info(r.kind);
+            out << (first ? "\n" : ",\n");
+            first = false;
+            out << "{\"name\":\"" << k.name << "\",\"cat\":\"" << k.category << "\",\"pid\":" << pid
+                << ",\"tid\":" << thread.first << ",\"ts\":" << r.start_ns / 1e3;
+            if (r.duration_ns) {
+                out << ",\"ph\":\"X\",\"dur\":" << r.duration_ns / 1e3;
+            } else {
+                out << ",\"ph\":\"i\",\"s\":\"t\"";
+            }
+            out << ",\"args\":{";
+            const char* separator = "";
+            for (const auto& arg : arguments(r)) {
+                out << separator << "\"" << arg.first << "\":" << arg.second;
+                separator = ",";
+            }
+            out << "}}";
+        }
+    }
+    out << "\n]}\n";
+}
+
+// Minimal protobuf encoding for the few Perfetto messages used
+class ProtoMessage {
+public:
+    void varint(uint32_t field, uint64_t value) {
+        key(field, 0);
+        raw(value);
+    }
+
+    void bytes(uint32_t field, const std::string& value) {
+        key(field, 2);
+        raw(value.size());
+        data_ += value;
+    }
+
+    void message(uint32_t field, const ProtoMessage& value) { bytes(field, value.data_); }
+
+    const std::string& data() const { return data_; }
+
+private:
+    void key(uint32_t field, uint32_t wire_type) { raw(static_cast<uint64_t>(field) << 3 | wire_type); }
+
+    void raw(uint64_t value) {
+        while (value >= 0x80) {
+            data_ += static_cast<char>(value | 0x80);
+            value >>= 7;
+        }
+        data_ += static_cast<char>(value);
+    }
+
+    std::string data_;
+};
+
+// Field numbers from perfetto/trace/trace_packet.proto and track_event.proto
+enum PerfettoField : uint32_t {
+    TRACE_PACKET = 1,
+    PACKET_TIMESTAMP = 8,
+    PACKET_SEQUENCE_ID = 10,
+    PACKET_TRACK_EVENT = 11,
+    PACKET_SEQUENCE_FLAGS = 13,
+    PACKET_TRACK_DESCRIPTOR = 60,
+    DESCRIPTOR_UUID = 1,
+    DESCRIPTOR_THREAD = 4,
+    THREAD_PID = 1,
+    THREAD_TID = 2,
+    EVENT_ANNOTATIONS = 4,
+    EVENT_TYPE = 9,
+    EVENT_TRACK_UUID = 11,
+    EVENT_CATEGORIES = 22,
+    EVENT_NAME = 23,
+    ANNOTATION_UINT = 3,
+    ANNOTATION_NAME = 10,
+};
+
+enum PerfettoEventType : uint64_t { SLICE_BEGIN = 1, SLICE_END = 2, INSTANT = 3 };
+
+constexpr uint64_t SEQ_INCREMENTAL_STATE_CLEARED = 1;
+
+struct SliceEdge {
+    uint64_t ts;
+    PerfettoEventType type;
+    const TraceRecord* record;
+};
+
+// Slices on a track must nest: at equal times ends go first, inner ones
+// (later begin) before outer; begins go outer (longer) first
+bool edgeBefore(const SliceEdge& a, const SliceEdge& b) {
+    if (a.ts != b.ts) return a.ts < b.ts;
+    if ((a.type == SLICE_END) != (b.type == SLICE_END)) return a.type == SLICE_END;
+    if (a.type == SLICE_END) return a.record->start_ns > b.record->start_ns;
+    return a.record->duration_ns > b.record->duration_ns;
+}
+
+void writePerfetto(std::ostream& out, const std::vector<std::pair<uint32_t, std::vector<TraceRecord>>>& threads) {
+    int pid = getpid();
+    uint32_t sequence = 0;
+    auto emit = [&out](const ProtoMessage& packet) {
+        ProtoMessage trace;
+        trace.message(TRACE_PACKET, packet);
+        out << trace.data();
+    };
+
+    for (const auto& thread : threads) {
+        uint64_t uuid = static_cast<uint64_t>(pid) << 32 | thread.first;
+        sequence++;
+
+        ProtoMessage descriptor, thread_descriptor, packet;
+        thread_descriptor.varint(THREAD_PID, static_cast<uint64_t>(pid));
+        thread_descriptor.varint(THREAD_TID, thread.first);
+        descriptor.varint(DESCRIPTOR_UUID, uuid);
+        descriptor.message(DESCRIPTOR_THREAD, thread_descriptor);
+        packet.varint(PACKET_SEQUENCE_ID, sequence);
+        packet.varint(PACKET_SEQUENCE_FLAGS, SEQ_INCREMENTAL_STATE_CLEARED);
+        packet.message(PACKET_TRACK_DESCRIPTOR, descriptor);
+        emit(packet);
+
+        std::vector<SliceEdge> edges;
+        for (const auto& r : thread.second) {
+            if (r.duration_ns) {
+                edges.push_back({r.start_ns, SLICE_BEGIN, &r});
+                edges.push_back({r.start_ns + r.duration_ns, SLICE_END, &r});
+            } else {
+                edges.push_back({r.start_ns, INSTANT, &r});
+            }
+        }
+        std::stable_sort(edges.begin(), edges.end(), edgeBefore);
+
+        for (const auto& edge : edges) {
+            ProtoMessage event, slice_packet;
+            event.varint(EVENT_TYPE, edge.type);
+            event.varint(EVENT_TRACK_UUID, uuid);
+            if (edge.type != SLICE_END) {
+                const KindInfo& k = info(edge.record->kind);
+                event.bytes(EVENT_CATEGORIES, k.category);
+                event.bytes(EVENT_NAME, k.name);
+                for (const auto& arg : arguments(*edge.record)) {
+                    ProtoMessage annotation;
+                    annotation.bytes(ANNOTATION_NAME, arg.first);
+                    annotation.varint(ANNOTATION_UINT, arg.second);
+                    event.message(EVENT_ANNOTATIONS, annotation);
+                }
+            }
+            slice_packet.varint(PACKET_TIMESTAMP, edge.ts);
+            slice_packet.varint(PACKET_SEQUENCE_ID, sequence);
+            slice_packet.message(PACKET_TRACK_EVENT, event);
+            emit(slice_packet);
+        }
+    }
+}
+
+bool endsWith(const std::string& s, const std::string& suffix) {
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+} // namespace
+
+void Tracer::enable(size_t capacity) {
+    size_t rounded = 1;
+    while (rounded < capacity) rounded <<= 1;
+    {
+        std::lock_guard<std::mutex> lock(registry().mutex);
+        registry().capacity = rounded;
+    }
+    enabled_.store(true, std::memory_order_relaxed);
+}
+
+void Tracer::disable() {
+    enabled_.store(false, std::memory_order_relaxed);
+}
+
+void Tracer::enableFromEnvironment() {
+    static std::once_flag once;
+    std::call_once(once, [] {
+        const char* path = std::getenv("HPU_TRACE");
+        if (!path || !*path) return;
+        registry().exit_path = path;
+        enable();
+        std::atexit([] {
+            const std::string& exit_path = registry().exit_path;
+            try {
+                size_t events = flush(exit_path);
+                std::cout << "✓ Wrote " << events << " trace events to " << exit_path << "\n";
+            } catch (const std::exception& e) {
+                std::cerr << "Trace flush failed: " << e.what() << "\n";
+            }
+        });
+        std::cout << "Tracing to " << path << "\n";
+    });
+}
+
+uint64_t Tracer::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Tracer::record(const TraceRecord& record) {
+    TraceRing* ring = threadRing();
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    ring->records[head & ring->mask] = record;
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+void Tracer::instant(TraceKind kind, uint64_t id, uint64_t value, uint32_t code) {
+    record({now(), 0, id, value, code, kind});
+}
+
+size_t Tracer::flush(const std::string& path, TraceFormat format) {
+    std::vector<std::shared_ptr<TraceRing>> rings;
+    {
+        std::lock_guard<std::mutex> lock(registry().mutex);
+        rings = registry().rings;
+    }
+
+    size_t events = 0;
+    std::vector<std::pair<uint32_t, std::vector<TraceRecord>>> threads;
+    for (const auto& ring : rings) {
+        threads.emplace_back(ring->tid, snapshot(*ring));
+        events += threads.back().second.size();
+    }
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("Failed to open trace file " + path);
+    }
+    if (format == TraceFormat::ChromeJson) {
+        writeChromeJson(out, threads);
+    } else {
+        writePerfetto(out, threads);
+    }
+    if (!out) {
+        throw std::runtime_error("Failed to write trace file " + path);
+    }
+    return events;
+}
+
+size_t Tracer::flush(const std::string& path) {
+    return flush(path, endsWith(path, ".json") ? TraceFormat::ChromeJson : TraceFormat::Perfetto);
+}
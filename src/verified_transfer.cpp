@@ -0,0 +1,187 @@
+#include "verified_transfer.hpp"
+#include "crc32c.hpp"
+#include <algorithm>
+#include <chrono>
+#include <unordered_map>
+
+namespace {
+
+// Receiver-to-sender immediates are a chunk index to resend, or this flag
+// once every chunk matched
+constexpr uint32_t VERIFIED_DONE = 1u << 31;
+
+// No progress for this long means the peer is gone
+constexpr std::chrono::seconds VERIFIED_IDLE_TIMEOUT(10);
+
+} // namespace
+
+VerifiedTransfer::VerifiedTransfer(CollectiveFabric& fabric, uint8_t* base, size_t chunk_size, uint32_t window)
+    : fabric_(fabric), base_(base), chunk_size_(chunk_size), window_(window) {
+    if (!base_) {
+        throw std::runtime_error("Verified transfers need a CPU mapped buffer");
+    }
+    if (chunk_size_ == 0 || chunk_size_ > UINT32_MAX || window_ == 0) {
+        throw std::runtime_error("Invalid verified transfer configuration");
+    }
+}
+
+uint64_t VerifiedTransfer::chunkLength(uint64_t index, size_t length) const {
+    return std::min<uint64_t>(chunk_size_, length - index * chunk_size_);
+}
+
+void VerifiedTransfer::postChunk(int peer, uint64_t index, uint64_t local_offset, uint64_t remote_offset,
+                                 size_t length) {
+    uint64_t begin = index * chunk_size_;
+    uint64_t bytes = chunkLength(index, length);
+    uint32_t crc = crc32c(base_ + local_offset + begin, bytes);
+    fabric_.write(peer, local_offset + begin, remote_offset + begin, static_cast<uint32_t>(bytes), crc);
+    outstanding_++;
+}
+
+void VerifiedTransfer::injectFault(uint8_t* chunk, uint64_t bytes) {
+    auto next = [this] {
+        fault_seed_ ^= fault_seed_ << 13;
+        fault_seed_ ^= fault_seed_ >> 7;
+        fault_seed_ ^= fault_seed_ << 17;
+        return fault_seed_;
+    };
+    if (bytes > 0 && (next() >> 11) * 0x1.0p-53 < fault_rate_) {
+        chunk[next() % bytes] ^= 0x01;
+    }
+}
+
+VerifiedTransfer::Stats VerifiedTransfer::send(int peer, uint64_t local_offset, uint64_t remote_offset,
+                                               size_t length) {
+    Stats stats;
+    uint64_t chunks = (length + chunk_size_ - 1) / chunk_size_;
+    if (chunks >= VERIFIED_DONE) {
+        throw std::runtime_error("Verified transfer has too many chunks");
+    }
+
+    uint64_t next = 0;
+    bool confirmed = false;
+    std::deque<uint64_t> resend;
+    std::unordered_map<uint64_t, uint32_t> attempts;
+    auto start = std::chrono::steady_clock::now();
+    auto last_progress = start;
+
+    while (!confirmed || outstanding_ > 0) {
+        bool progressed = false;
+
+        while (outstanding_ < window_ && next < chunks) {
+            postChunk(peer, next++, local_offset, remote_offset, length);
+            progressed = true;
+        }
+        // Only after every first copy, so arrivals past chunks are resends
+        while (outstanding_ < window_ && next == chunks && !resend.empty()) {
+            uint64_t index = resend.front();
+            resend.pop_front();
+            if (++attempts[index] > MAX_RETRANSMITS) {
+                throw std::runtime_error("Chunk " + std::to_string(index) + " failed verification " +
+                                         std::to_string(MAX_RETRANSMITS) + " times");
+            }
+            postChunk(peer, index, local_offset, remote_offset, length);
+            stats.retransmits++;
+            progressed = true;
+        }
+
+        CollectiveFabric::Event events[32];
+        int ne = fabric_.poll(events, 32);
+        for (int i = 0; i < ne; ++i) {
+            if (events[i].kind == CollectiveFabric::Event::Kind::WriteDone) {
+                outstanding_--;
+            } else if (events[i].peer != peer) {
+                throw std::runtime_error("Unexpected write from rank " + std::to_string(events[i].peer));
+            } else if (events[i].imm == VERIFIED_DONE) {
+                confirmed = true;
+            } else {
+                resend.push_back(events[i].imm);
+            }
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (progressed || ne > 0) {
+            last_progress = now;
+        } else if (now - last_progress > VERIFIED_IDLE_TIMEOUT) {
+            throw std::runtime_error("Verified send timeout");
+        }
+    }
+
+    stats.chunks = chunks;
+    stats.bytes = length;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+VerifiedTransfer::Stats VerifiedTransfer::receive(int peer, uint64_t offset, size_t length) {
+    Stats stats;
+    uint64_t chunks = (length + chunk_size_ - 1) / chunk_size_;
+    uint64_t first_copies = 0, verified = 0;
+    bool done_sent = false;
+    std::deque<uint64_t> mismatched, requested;
+    auto start = std::chrono::steady_clock::now();
+    auto last_progress = start;
+
+    while (!done_sent || outstanding_ > 0) {
+        bool progressed = false;
+
+        // Requests go out in the order the sender will answer them
+        while (outstanding_ < window_ && !mismatched.empty()) {
+            fabric_.write(peer, 0, 0, 0, static_cast<uint32_t>(mismatched.front()));
+            requested.push_back(mismatched.front());
+            mismatched.pop_front();
+            outstanding_++;
+            progressed = true;
+        }
+        if (!done_sent && verified == chunks && outstanding_ < window_) {
+            fabric_.write(peer, 0, 0, 0, VERIFIED_DONE);
+            outstanding_++;
+            done_sent = true;
+            progressed = true;
+        }
+
+        CollectiveFabric::Event events[32];
+        int ne = fabric_.poll(events, 32);
+        for (int i = 0; i < ne; ++i) {
+            if (events[i].kind == CollectiveFabric::Event::Kind::WriteDone) {
+                outstanding_--;
+                continue;
+            }
+            if (events[i].peer != peer) {
+                throw std::runtime_error("Unexpected write from rank " + std::to_string(events[i].peer));
+            }
+
+            uint64_t index;
+            if (first_copies < chunks) {
+                index = first_copies++;
+            } else if (!requested.empty()) {
+                index = requested.front();
+                requested.pop_front();
+                stats.retransmits++;
+            } else {
+                throw std::runtime_error("Verified chunk arrived that was not requested");
+            }
+
+            uint8_t* chunk = base_ + offset + index * chunk_size_;
+            uint64_t bytes = chunkLength(index, length);
+            if (fault_rate_ > 0.0) injectFault(chunk, bytes);
+            if (crc32c(chunk, bytes) == events[i].imm) {
+                verified++;
+            } else {
+                mismatched.push_back(index);
+            }
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (progressed || ne > 0) {
+            last_progress = now;
+        } else if (now - last_progress > VERIFIED_IDLE_TIMEOUT) {
+            throw std::runtime_error("Verified receive timeout");
+        }
+    }
+
+    stats.chunks = chunks;
+    stats.bytes = length;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
@@ -0,0 +1,136 @@
+#include "workload.hpp"
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+constexpr char WORKLOAD_MAGIC[8] = {'H', 'P', 'U', 'W', 'L', '0', '0', '2'};
+// Logs from before lkeys were recorded, read with lkey 0
+constexpr char WORKLOAD_MAGIC_V1[8] = {'H', 'P', 'U', 'W', 'L', '0', '0', '1'};
+
+// Buffered bytes written out at once
+constexpr size_t WORKLOAD_FLUSH_BYTES = 64 * 1024;
+
+uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void putVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out += static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+bool getVarint(const std::string& in, size_t& pos, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; pos < in.size() && shift < 64; shift += 7) {
+        uint8_t byte = static_cast<uint8_t>(in[pos++]);
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+} // namespace
+
+WorkloadRecorder::WorkloadRecorder(const std::string& path) : start_ns_(nowNs()), last_ns_(start_ns_) {
+    file_ = std::fopen(path.c_str(), "wb");
+    if (!file_) {
+        throw std::runtime_error("Failed to create workload log " + path);
+    }
+    buffer_.assign(WORKLOAD_MAGIC, sizeof(WORKLOAD_MAGIC));
+}
+
+WorkloadRecorder::~WorkloadRecorder() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    flushBuffer();
+    std::fclose(file_);
+}
+
+void WorkloadRecorder::record(uint32_t qp_num, int opcode, uint32_t lkey, uint64_t offset, uint32_t length) {
+    uint64_t now = nowNs();
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = peers_.find(qp_num);
+    if (it == peers_.end()) {
+        if (peers_.size() > UINT16_MAX) {
+            if (dropped_++ == 0) {
+                std::cerr << "Workload log is out of peer ids, ops to further QPs are not recorded\n";
+            }
+            return;
+        }
+        it = peers_.emplace(qp_num, static_cast<uint16_t>(peers_.size())).first;
+    }
+
+    // Posts from several threads may take the lock out of time order
+    uint64_t delta = now > last_ns_ ? now - last_ns_ : 0;
+    last_ns_ += delta;
+    putVarint(buffer_, delta);
+    putVarint(buffer_, it->second);
+    buffer_ += static_cast<char>(opcode);
+    putVarint(buffer_, length);
+    putVarint(buffer_, lkey);
+    putVarint(buffer_, offset);
+    count_++;
+
+    if (buffer_.size() >= WORKLOAD_FLUSH_BYTES) flushBuffer();
+}
+
+uint64_t WorkloadRecorder::count() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return count_;
+}
+
+uint64_t WorkloadRecorder::dropped() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return dropped_;
+}
+
+void WorkloadRecorder::flushBuffer() {
+    if (!buffer_.empty() && std::fwrite(buffer_.data(), 1, buffer_.size(), file_) != buffer_.size()) {
+        std::cerr << "Failed to write workload log\n";
+    }
+    buffer_.clear();
+}
+
+std::vector<WorkloadOp> WorkloadRecorder::load(const std::string& path) {
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        throw std::runtime_error("Failed to open workload log " + path);
+    }
+    std::string data;
+    char chunk[64 * 1024];
+    size_t n;
+    while ((n = std::fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        data.append(chunk, n);
+    }
+    std::fclose(file);
+
+    bool v1 = data.size() >= sizeof(WORKLOAD_MAGIC_V1) &&
+              memcmp(data.data(), WORKLOAD_MAGIC_V1, sizeof(WORKLOAD_MAGIC_V1)) == 0;
+    if (!v1 && (data.size() < sizeof(WORKLOAD_MAGIC) ||
+                memcmp(data.data(), WORKLOAD_MAGIC, sizeof(WORKLOAD_MAGIC)) != 0)) {
+        throw std::runtime_error(path + " is not a workload log");
+    }
+
+    std::vector<WorkloadOp> ops;
+    size_t pos = sizeof(WORKLOAD_MAGIC);
+    uint64_t time = 0;
+    while (pos < data.size()) {
+        uint64_t delta, peer, length, lkey = 0, offset;
+        bool ok = getVarint(data, pos, delta) && getVarint(data, pos, peer) && pos < data.size();
+        uint8_t opcode = ok ? static_cast<uint8_t>(data[pos++]) : 0;
+        ok = ok && getVarint(data, pos, length) && (v1 || getVarint(data, pos, lkey)) && getVarint(data, pos, offset);
+        if (!ok || peer > UINT16_MAX || length > UINT32_MAX || lkey > UINT32_MAX) {
+            throw std::runtime_error("Truncated or corrupt workload log " + path);
+        }
+        time += delta;
+        ops.push_back({time, offset, static_cast<uint32_t>(lkey), static_cast<uint32_t>(length),
+                       static_cast<uint16_t>(peer), opcode});
+    }
+    return ops;
+}
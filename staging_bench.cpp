@@ -0,0 +1,178 @@
+#include "staging_pipeline.hpp"
+#include <cmath>
+#include <cstring>
+
+// Host-staged transfer benchmark for devices without DMA-buf export.
+// Device memory is emulated with a host allocation and the mock copy engine,
+// optionally rate limited to the device's DMA bandwidth (-c GB/s).
+// After the plain runs at depth 1-3, each available codec runs at depth 2
+// on -t threads, reporting effective GB/s, wire ratio and codec CPU cost.
+// The payload is fp32 gradient-like data.
+//   ./staging_bench [-p port] [-k chunk] [-n bytes] [-c gbps] [-t threads]
+//   ./staging_bench <server> [-p port] [-k chunk] [-n bytes] [-c gbps] [-t threads]
+
+namespace {
+
+// Error feedback key of the one tensor the benchmark sends
+constexpr uint64_t GRADIENT_ID = 1;
+
+struct Options {
+    std::string server_name;
+    int port{20000};
+    std::optional<std::string> ib_dev_name;
+    size_t chunk_size{1024 * 1024};
+    size_t length{256 * 1024 * 1024};
+    double copy_gbps{0.0};
+    int iterations{4};
+    uint32_t codec_threads{2};
+};
+
+Options parseArguments(int argc, char* argv[]) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            opts.port = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            opts.ib_dev_name = argv[++i];
+        } else if (std::strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+            opts.chunk_size = std::strtoull(argv[++i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            opts.length = std::strtoull(argv[++i], nullptr, 0) / sizeof(float) * sizeof(float);
+        } else if (std::strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            opts.copy_gbps = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            opts.iterations = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            opts.codec_threads = static_cast<uint32_t>(std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "-h") == 0) {
+            std::cout << "Usage: " << argv[0]
+                      << " [server] [-p port] [-d ib_dev] [-k chunk] [-n bytes] [-c copy_gbps] [-i iterations]"
+                      << " [-t codec_threads]\n";
+            std::exit(0);
+        } else if (opts.server_name.empty()) {
+            opts.server_name = argv[i];
+        }
+    }
+    return opts;
+}
+
+float gradient(size_t i) {
+    return std::sin(i * 0.001f) * 0.01f * (1 + i % 7);
+}
+
+// Largest deviation from the sent pattern, relative to its range
+double maxError(const float* data, size_t count) {
+    double error = 0.0;
+    for (size_t i = 0; i < count; ++i) {
+        error = std::max(error, std::fabs(static_cast<double>(data[i]) - gradient(i)));
+    }
+    return error / 0.07;
+}
+
+void syncPeer(int sock) {
+    char byte = 'S';
+    if (write(sock, &byte, 1) != 1 || read(sock, &byte, 1) != 1) {
+        throw std::runtime_error("Failed to sync with peer");
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        Options opts = parseArguments(argc, argv);
+        std::cout << "Host Staging Pipeline Benchmark\n===============================\n";
+
+        // Three plain slots, or two staging plus two encoded slots
+        HpuManager hpu;
+        RdmaVerbs rdma;
+        hpu.initialize(4 * opts.chunk_size + 4096);
+        rdma.initialize(opts.ib_dev_name.value_or(""), hpu);
+        rdma.connectQp(opts.server_name, opts.port);
+        if (!hpu.getBuffer()) {
+            throw std::runtime_error("Staging needs a CPU mapped buffer");
+        }
+
+        uint8_t* device = static_cast<uint8_t*>(aligned_alloc(4096, opts.length));
+        if (!device) {
+            throw std::runtime_error("Failed to allocate emulated device memory");
+        }
+        float* values = reinterpret_cast<float*>(device);
+        size_t count = opts.length / sizeof(float);
+        bool sender = !opts.server_name.empty();
+        for (size_t i = 0; i < count; ++i) {
+            values[i] = sender ? gradient(i) : 0.0f;
+        }
+
+        HostCopyEngine engine(opts.copy_gbps);
+        uint64_t device_addr = reinterpret_cast<uintptr_t>(device);
+        uint64_t staging_addr = reinterpret_cast<uintptr_t>(hpu.getBuffer());
+
+        if (sender) {
+            std::cout << "\ndepth      chunk        GB/s\n";
+        }
+        for (uint32_t depth = 1; depth <= 3; ++depth) {
+            StagingPipeline pipeline(rdma, engine, rdma.getQp(), rdma.getRemoteProps(),
+                                     staging_addr, opts.chunk_size, depth);
+            syncPeer(rdma.getSock());
+
+            double seconds = 0.0;
+            for (int it = 0; it < opts.iterations; ++it) {
+                auto stats = sender ? pipeline.send(device_addr, opts.length)
+                                    : pipeline.receive(device_addr, opts.length);
+                seconds += stats.seconds;
+            }
+            if (sender) {
+                std::printf("%5u %9zuK %11.2f\n", depth, opts.chunk_size / 1024,
+                            static_cast<double>(opts.length) * opts.iterations / seconds / 1e9);
+            }
+            syncPeer(rdma.getSock());
+        }
+
+        if (!sender) {
+            bool ok = maxError(values, count) == 0.0;
+            std::cout << (ok ? "✓ Received data verified\n" : "✗ Received data mismatch\n");
+        }
+
+        if (sender) {
+            std::cout << "\ncodec     wire%        GB/s   wire GB/s   codec CPU s/GB\n";
+        }
+        for (auto type : {CodecType::Lz4, CodecType::Bf16, CodecType::Fp8}) {
+            if (!codecAvailable(type)) continue;
+            auto codec = makeCodec(type);
+            StagingPipeline pipeline(rdma, engine, rdma.getQp(), rdma.getRemoteProps(),
+                                     staging_addr, opts.chunk_size, 2);
+            pipeline.enableCodec(*codec, opts.codec_threads);
+            if (!sender) memset(device, 0, opts.length);
+            syncPeer(rdma.getSock());
+
+            StagingPipeline::Stats total;
+            for (int it = 0; it < opts.iterations; ++it) {
+                // Every iteration is the next step of the same gradient
+                auto stats = sender ? pipeline.send(device_addr, opts.length, GRADIENT_ID)
+                                    : pipeline.receive(device_addr, opts.length);
+                total.bytes += stats.bytes;
+                total.wire_bytes += stats.wire_bytes;
+                total.seconds += stats.seconds;
+                total.codec_seconds += stats.codec_seconds;
+            }
+            if (sender) {
+                std::printf("%-6s %8.1f %11.2f %11.2f %16.3f\n", codecName(type),
+                            100.0 * total.wire_bytes / total.bytes, total.bytes / total.seconds / 1e9,
+                            total.wire_bytes / total.seconds / 1e9, total.codec_seconds / (total.bytes / 1e9));
+            } else {
+                // Lossy codecs stay within their rounding step plus the carried residual
+                double tolerance = type == CodecType::Bf16 ? 0.01 : type == CodecType::Fp8 ? 0.1 : 0.0;
+                double error = maxError(values, count);
+                std::cout << (error <= tolerance ? "✓ " : "✗ ") << codecName(type)
+                          << " data verified, max error " << error * 100 << "% of range\n";
+            }
+            syncPeer(rdma.getSock());
+        }
+        free(device);
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "staging_bench failed: " << e.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,211 @@
+#include "strided_transfer.hpp"
+#include <chrono>
+#include <cstring>
+
+// Strided tensor slice benchmark.
+// The source views its buffer as fp32 tensors and writes three slices into
+// the destination's buffer, -i times each: a column block of a matrix
+// (kilobyte rows gathered with SGEs), an 8-column stripe written transposed
+// (4-byte fragments, packed through staging) and a 3-D sub-block. After
+// each case the destination checks every element against the source pattern.
+//   ./strided_bench [-p port] [-d ib_dev]                # destination
+//   ./strided_bench <server> [-p port] [-d ib_dev] [-i iterations]
+
+namespace {
+
+constexpr size_t BUFFER_SIZE = 32 * 1024 * 1024;
+constexpr size_t ELEM = sizeof(uint32_t);
+constexpr size_t DST_BASE = 16 * 1024 * 1024;  // Destination slices land in the upper half
+
+struct Options {
+    std::string server_name;
+    int port{20000};
+    std::optional<std::string> ib_dev_name;
+    int iterations{100};
+};
+
+struct Case {
+    const char* name;
+    TensorSlice src;
+    TensorSlice dst;
+};
+
+Options parseArguments(int argc, char* argv[]) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            opts.port = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            opts.ib_dev_name = argv[++i];
+        } else if (std::strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            opts.iterations = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-h") == 0) {
+            std::cout << "Usage: " << argv[0] << " [server] [-p port] [-d ib_dev] [-i iterations]\n";
+            std::exit(0);
+        } else if (opts.server_name.empty()) {
+            opts.server_name = argv[i];
+        }
+    }
+    if (opts.iterations <= 0) {
+        throw std::runtime_error("Iterations must be positive");
+    }
+    return opts;
+}
+
+// Both sides build the same cases, the source from the lower half of its buffer
+std::vector<Case> makeCases() {
+    std::vector<Case> cases;
+    // Rows 100-611, columns 64-319 of a 1024x1024 matrix, into a dense 512x256 one
+    cases.push_back({"column block", {(100 * 1024 + 64) * ELEM, {512, 256}, {1024, 1}, ELEM},
+                     {DST_BASE, {512, 256}, {}, ELEM}});
+    // Columns 8-15 of the matrix, into an 8x1024 matrix as its transpose
+    cases.push_back({"stripe, transposed", {8 * ELEM, {1024, 8}, {1024, 1}, ELEM},
+                     {DST_BASE, {1024, 8}, {1, 1024}, ELEM}});
+    // [4:12, 32:96, 64:192] of a 16x256x256 tensor, into a dense 8x64x128 one
+    cases.push_back({"3-d block", {(4 * 65536 + 32 * 256 + 64) * ELEM, {8, 64, 128}, {65536, 256, 1}, ELEM},
+                     {DST_BASE, {8, 64, 128}, {}, ELEM}});
+    return cases;
+}
+
+uint32_t pattern(uint64_t word) {
+    return static_cast<uint32_t>(word * 2654435761u + 1);
+}
+
+// Byte offset of every element, in row-major index order
+std::vector<uint64_t> elementOffsets(const TensorSlice& slice) {
+    std::vector<size_t> strides = slice.strides;
+    if (strides.empty()) {
+        strides.resize(slice.shape.size());
+        size_t dense = 1;
+        for (size_t d = slice.shape.size(); d-- > 0;) {
+            strides[d] = dense;
+            dense *= slice.shape[d];
+        }
+    }
+    std::vector<uint64_t> offsets;
+    std::vector<size_t> idx(slice.shape.size(), 0);
+    for (size_t n = 0; n < slice.elements(); ++n) {
+        uint64_t offset = slice.offset;
+        for (size_t d = 0; d < idx.size(); ++d) offset += idx[d] * strides[d] * slice.elem_size;
+        offsets.push_back(offset);
+        for (size_t d = idx.size(); d-- > 0 && ++idx[d] == slice.shape[d];) idx[d] = 0;
+    }
+    return offsets;
+}
+
+size_t countMismatches(const uint8_t* host, const Case& c) {
+    std::vector<uint64_t> src = elementOffsets(c.src);
+    std::vector<uint64_t> dst = elementOffsets(c.dst);
+    size_t bad = 0;
+    for (size_t n = 0; n < src.size(); ++n) {
+        uint32_t value;
+        memcpy(&value, host + dst[n], sizeof(value));
+        if (value != pattern(src[n] / ELEM)) bad++;
+    }
+    return bad;
+}
+
+void sendByte(int sock, char byte) {
+    if (write(sock, &byte, 1) != 1) {
+        throw std::runtime_error("Failed to signal peer");
+    }
+}
+
+char readByte(int sock) {
+    char byte;
+    if (read(sock, &byte, 1) != 1) {
+        throw std::runtime_error("Peer went away");
+    }
+    return byte;
+}
+
+void runDestination(RdmaVerbs& rdma) {
+    uint8_t* host = rdma.getHostBuffer();
+    int sock = rdma.getSock();
+    bool all_ok = true;
+    for (const Case& c : makeCases()) {
+        if (host) memset(host + DST_BASE, 0, BUFFER_SIZE - DST_BASE);
+        sendByte(sock, 'R');
+        readByte(sock);
+        size_t bad = host ? countMismatches(host, c) : 0;
+        if (!host) {
+            std::cout << "Buffer is device memory, " << c.name << " not checked\n";
+        } else if (bad) {
+            std::cout << "✗ " << c.name << ": " << bad << " of " << c.dst.elements() << " elements wrong\n";
+        } else {
+            std::cout << "✓ " << c.name << ": " << c.dst.elements() << " elements checked\n";
+        }
+        all_ok = all_ok && bad == 0;
+        sendByte(sock, bad ? 'F' : 'K');
+    }
+    if (!all_ok) {
+        throw std::runtime_error("Slices landed wrong");
+    }
+}
+
+void runSource(const Options& opts, RdmaVerbs& rdma, HpuManager& hpu, struct ibv_qp* qp, const CmConData& remote) {
+    uint8_t* host = rdma.getHostBuffer();
+    if (host) {
+        for (uint64_t w = 0; w < DST_BASE / ELEM; ++w) {
+            uint32_t value = pattern(w);
+            memcpy(host + w * ELEM, &value, sizeof(value));
+        }
+    } else {
+        std::cout << "Buffer is device memory, the destination check will fail\n";
+    }
+
+    StridedTransfer transfer(rdma, hpu);
+    int sock = rdma.getSock();
+    bool all_ok = true;
+    std::printf("\n%-20s %10s %10s %10s %10s %10s\n", "slice", "bytes", "writes", "sges", "packed", "GB/s");
+    for (const Case& c : makeCases()) {
+        readByte(sock);
+        StridedTransfer::Stats stats;
+        auto start = std::chrono::steady_clock::now();
+        for (int it = 0; it < opts.iterations; ++it) {
+            stats = transfer.write(qp, remote, BUFFER_SIZE, c.src, c.dst);
+        }
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        sendByte(sock, 'D');
+        bool ok = readByte(sock) == 'K';
+        all_ok = all_ok && ok;
+        std::printf("%-20s %10zu %10llu %10llu %10llu %10.2f%s\n", c.name, c.src.bytes(),
+                    static_cast<unsigned long long>(stats.writes), static_cast<unsigned long long>(stats.sges),
+                    static_cast<unsigned long long>(stats.packed_bytes),
+                    c.src.bytes() * static_cast<double>(opts.iterations) / secs / 1e9, ok ? "" : "  MISMATCH");
+    }
+    if (!all_ok) {
+        throw std::runtime_error("Destination found slices that landed wrong");
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        Options opts = parseArguments(argc, argv);
+        std::cout << "Strided Transfer Benchmark\n==========================\n";
+
+        HpuManager hpu;
+        RdmaVerbs rdma;
+        hpu.initialize(BUFFER_SIZE);
+        rdma.initialize(opts.ib_dev_name.value_or(""), hpu);
+        rdma.connectQp(opts.server_name, opts.port);
+
+        // A QP of its own, with as many SGEs as the device allows
+        struct ibv_qp* qp = rdma.createQp(QP_DEPTH, rdma.getMaxSge());
+        CmConData remote = rdma.connectQp(qp);
+
+        if (opts.server_name.empty()) {
+            std::cout << "Serving as destination, waiting for slices...\n";
+            runDestination(rdma);
+        } else {
+            runSource(opts, rdma, hpu, qp, remote);
+        }
+        rdma.destroyQp(qp);
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "strided_bench failed: " << e.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,243 @@
+#include "tag_matcher.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+// Tag matcher benchmark.
+// First replays a random mix of receives (exact, ANY_SOURCE, ANY_TAG and
+// both) and arrivals on the matcher and on a linear MPI-ordered reference,
+// starting from -r pending receives, and checks every result agrees. Then
+// reports ns per operation with 64 and -r entries pending: arrivals
+// matching posted receives, and receives matching unexpected messages,
+// each followed by a replacement so the pending count stays fixed.
+//   ./tag_bench [-r pending] [-s sources] [-i iterations] [-c check_ops]
+
+namespace {
+
+struct Options {
+    size_t pending{4096};
+    int sources{64};
+    int iterations{1000000};
+    int check_ops{200000};
+};
+
+Options parseArguments(int argc, char* argv[]) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            opts.pending = std::strtoull(argv[++i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            opts.sources = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            opts.iterations = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            opts.check_ops = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-h") == 0) {
+            std::cout << "Usage: " << argv[0] << " [-r pending] [-s sources] [-i iterations] [-c check_ops]\n";
+            std::exit(0);
+        }
+    }
+    if (opts.pending == 0 || opts.sources <= 0 || opts.iterations <= 0 || opts.check_ops < 0) {
+        throw std::runtime_error("Pending count, sources and iterations must be positive");
+    }
+    return opts;
+}
+
+// Scans everything in posting order; slow but obviously MPI-ordered
+class ReferenceMatcher {
+public:
+    bool postReceive(int source, uint64_t tag, uint64_t cookie, TagMatcher::Match* match) {
+        for (auto it = unexpected_.begin(); it != unexpected_.end(); ++it) {
+            if ((source == ANY_SOURCE || it->source == source) && (tag == ANY_TAG || it->tag == tag)) {
+                *match = {it->cookie, it->source, it->tag};
+                unexpected_.erase(it);
+                return true;
+            }
+        }
+        posted_.push_back({source, tag, cookie});
+        return false;
+    }
+
+    bool arrive(int source, uint64_t tag, uint64_t cookie, TagMatcher::Match* match) {
+        for (auto it = posted_.begin(); it != posted_.end(); ++it) {
+            if ((it->source == ANY_SOURCE || it->source == source) && (it->tag == ANY_TAG || it->tag == tag)) {
+                *match = {it->cookie, source, tag};
+                posted_.erase(it);
+                return true;
+            }
+        }
+        unexpected_.push_back({source, tag, cookie});
+        return false;
+    }
+
+private:
+    struct Entry {
+        int source;
+        uint64_t tag;
+        uint64_t cookie;
+    };
+    std::vector<Entry> posted_;
+    std::vector<Entry> unexpected_;
+};
+
+bool sameResult(bool a, const TagMatcher::Match& ma, bool b, const TagMatcher::Match& mb) {
+    return a == b && (!a || (ma.cookie == mb.cookie && ma.source == mb.source && ma.tag == mb.tag));
+}
+
+// Few distinct tags so that receives and messages collide often
+size_t crossCheck(const Options& opts) {
+    std::mt19937_64 rng(7);
+    constexpr uint64_t TAGS = 16;
+    TagMatcher matcher;
+    ReferenceMatcher reference;
+    uint64_t cookie = 0;
+    size_t mismatches = 0;
+
+    auto receive = [&](bool wild) {
+        int source = static_cast<int>(rng() % opts.sources);
+        uint64_t tag = rng() % TAGS;
+        if (wild) {
+            unsigned kind = rng() % 3;
+            if (kind != 1) source = ANY_SOURCE;
+            if (kind != 0) tag = ANY_TAG;
+        }
+        TagMatcher::Match got = {}, want = {};
+        bool a = matcher.postReceive(source, tag, cookie, &got);
+        bool b = reference.postReceive(source, tag, cookie, &want);
+        cookie++;
+        if (!sameResult(a, got, b, want)) mismatches++;
+    };
+
+    for (size_t i = 0; i < opts.pending; ++i) {
+        receive(rng() % 8 == 0);
+    }
+    for (int op = 0; op < opts.check_ops; ++op) {
+        if (rng() % 2) {
+            receive(rng() % 8 == 0);
+        } else {
+            int source = static_cast<int>(rng() % opts.sources);
+            uint64_t tag = rng() % TAGS;
+            TagMatcher::Match got = {}, want = {};
+            bool a = matcher.arrive(source, tag, cookie, &got);
+            bool b = reference.arrive(source, tag, cookie, &want);
+            cookie++;
+            if (!sameResult(a, got, b, want)) mismatches++;
+        }
+    }
+    std::printf("%d operations from %zu pending (%zu posted, %zu unexpected at the end): %zu mismatches\n",
+                opts.check_ops, opts.pending, matcher.postedCount(), matcher.unexpectedCount(), mismatches);
+    return mismatches;
+}
+
+enum class Kind { Exact, AnySource, AnyTag };
+
+const char* kindName(Kind kind) {
+    switch (kind) {
+        case Kind::Exact: return "exact";
+        case Kind::AnySource: return "ANY_SOURCE";
+        case Kind::AnyTag: return "ANY_TAG";
+    }
+    return "?";
+}
+
+struct Key {
+    int source;
+    uint64_t tag;
+};
+
+// Every pending entry has a tag of its own, so each operation has exactly one match
+Key keyFor(const Options& opts, uint64_t n) {
+    return {static_cast<int>(n % opts.sources), n};
+}
+
+// ns per operation; posted selects arrivals against posted receives, else
+// receives against unexpected messages. Wrong matches are added to misses.
+double timeMatching(const Options& opts, size_t pending, Kind kind, bool posted, size_t& misses) {
+    TagMatcher matcher;
+    std::vector<Key> keys(pending);
+    uint64_t next = 0;
+    TagMatcher::Match match;
+
+    auto queue = [&](size_t slot) {
+        Key key = keyFor(opts, next++);
+        keys[slot] = key;
+        if (!posted) {
+            matcher.arrive(key.source, key.tag, key.tag, &match);
+        } else if (kind == Kind::Exact) {
+            matcher.postReceive(key.source, key.tag, key.tag, &match);
+        } else if (kind == Kind::AnySource) {
+            matcher.postReceive(ANY_SOURCE, key.tag, key.tag, &match);
+        } else {
+            // The source's oldest receive always matches first
+            matcher.postReceive(key.source, ANY_TAG, key.tag, &match);
+        }
+    };
+    for (size_t i = 0; i < pending; ++i) {
+        queue(i);
+    }
+
+    std::mt19937_64 rng(11);
+    std::vector<uint32_t> picks(opts.iterations);
+    for (auto& pick : picks) pick = static_cast<uint32_t>(rng() % pending);
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t slot : picks) {
+        Key key = keys[slot];
+        bool hit;
+        if (posted) {
+            hit = matcher.arrive(key.source, key.tag, 0, &match);
+            // ANY_TAG receives are consumed in posting order within a source
+            if (kind == Kind::AnyTag) {
+                hit = hit && match.source == key.source;
+            } else {
+                hit = hit && match.cookie == key.tag;
+            }
+        } else {
+            int source = kind == Kind::AnySource ? ANY_SOURCE : key.source;
+            uint64_t tag = kind == Kind::AnyTag ? ANY_TAG : key.tag;
+            hit = matcher.postReceive(source, tag, 0, &match) && match.source == key.source;
+            if (kind != Kind::AnyTag) hit = hit && match.cookie == key.tag;
+        }
+        if (!hit) misses++;
+        queue(slot);
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return secs * 1e9 / (2.0 * opts.iterations);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        Options opts = parseArguments(argc, argv);
+        std::cout << "Tag Matcher Benchmark\n=====================\n";
+
+        size_t mismatches = crossCheck(opts);
+
+        size_t misses = 0;
+        std::cout << "\nns per operation (match plus replacement)\n";
+        std::printf("%-12s %-12s %10s %10s\n", "receive", "against", "pending", "ns/op");
+        for (size_t pending : {static_cast<size_t>(64), opts.pending}) {
+            for (auto kind : {Kind::Exact, Kind::AnySource, Kind::AnyTag}) {
+                for (bool posted : {true, false}) {
+                    double ns = timeMatching(opts, pending, kind, posted, misses);
+                    std::printf("%-12s %-12s %10zu %10.1f\n", kindName(kind), posted ? "arrivals" : "unexpected",
+                                pending, ns);
+                }
+            }
+        }
+        if (misses) {
+            std::cout << misses << " timed operations matched the wrong entry\n";
+        }
+        return mismatches || misses ? 1 : 0;
+    } catch (const std::exception& e) {
+        std::cerr << "tag_bench failed: " << e.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,202 @@
+#include "hpuverbs.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+// Per-request remote access through type-2 memory windows. The owner first
+// times -n grant/revoke pairs (bind and local invalidate, each waited for)
+// against registering and deregistering an MR over the same -s bytes. Then
+// it serves -r requests from the tenant: each gets a window over its own
+// slot of the buffer, delivered over TCP. The tenant writes the slot and
+// sends with invalidate, which retires the rkey on the owner side without
+// another work request.
+//   ./window_bench [-p port] [-d ib_dev] [-s bytes] [-n iterations]   # owner
+//   ./window_bench <server> [-p port] [-d ib_dev] [-s bytes] [-r requests]
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string server_name;
+    int port{20000};
+    std::optional<std::string> ib_dev_name;
+    size_t request_size{64 * 1024};
+    int iterations{10000};
+    int requests{1000};
+};
+
+// What a tenant needs to reach one slot
+struct GrantInfo {
+    uint64_t addr;
+    uint32_t rkey;
+} __attribute__((packed));
+
+Options parseArguments(int argc, char* argv[]) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            opts.port = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            opts.ib_dev_name = argv[++i];
+        } else if (std::strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            opts.request_size = std::strtoull(argv[++i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            opts.iterations = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            opts.requests = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-h") == 0) {
+            std::cout << "Usage: " << argv[0] << " [server] [-p port] [-d ib_dev] [-s bytes] [-n iterations]"
+                      << " [-r requests]\n";
+            std::exit(0);
+        } else if (opts.server_name.empty()) {
+            opts.server_name = argv[i];
+        }
+    }
+    if (opts.request_size == 0 || opts.request_size > RDMA_BUFFER_SIZE || opts.iterations <= 0 || opts.requests <= 0) {
+        throw std::runtime_error("Request size must fit the " + std::to_string(RDMA_BUFFER_SIZE) + " byte buffer");
+    }
+    return opts;
+}
+
+struct ibv_wc waitCompletion(RdmaVerbs& rdma) {
+    struct ibv_wc wc;
+    while (rdma.pollCompletions(&wc, 1) == 0) {
+    }
+    if (wc.status != IBV_WC_SUCCESS) {
+        throw std::runtime_error(std::string("Work request failed: ") + ibv_wc_status_str(wc.status));
+    }
+    return wc;
+}
+
+double median(std::vector<double>& samples) {
+    std::sort(samples.begin(), samples.end());
+    return samples[samples.size() / 2];
+}
+
+void timeGrants(const Options& opts, RdmaVerbs& rdma, struct ibv_qp* qp) {
+    std::vector<double> window_us, mr_us;
+    for (int i = 0; i < opts.iterations; ++i) {
+        auto start = Clock::now();
+        AccessGrant grant = rdma.grantAccess(qp, 0, opts.request_size, IBV_ACCESS_REMOTE_WRITE, true);
+        waitCompletion(rdma);
+        rdma.revokeAccess(grant, true);
+        waitCompletion(rdma);
+        window_us.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+    }
+    std::printf("\nWindow bind + invalidate:   %10.2f us median\n", median(window_us));
+
+    // Device memory can only be registered through its DMA-buf
+    if (!rdma.getHostBuffer()) {
+        std::cout << "Buffer is device memory, skipping the MR comparison\n";
+        return;
+    }
+    int mr_iterations = std::min(opts.iterations, 1000);
+    for (int i = 0; i < mr_iterations; ++i) {
+        auto start = Clock::now();
+        struct ibv_mr* mr = rdma.registerHostMemory(rdma.getHostBuffer(), opts.request_size);
+        rdma.deregisterMemory(mr);
+        mr_us.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+    }
+    std::printf("MR register + deregister:   %10.2f us median\n", median(mr_us));
+}
+
+void serveRequests(const Options& opts, RdmaVerbs& rdma, struct ibv_qp* qp) {
+    size_t slots = rdma.getRegionSize() / opts.request_size;
+    int sock = rdma.getSock();
+    int verified = 0;
+
+    auto start = Clock::now();
+    for (int r = 0; r < opts.requests; ++r) {
+        struct ibv_recv_wr recv = {};
+        recv.num_sge = 0;
+        rdma.postReceive(qp, &recv);
+
+        size_t offset = (r % slots) * opts.request_size;
+        // An occasional signaled bind frees the send queue slots of the rest
+        AccessGrant grant = rdma.grantAccess(qp, offset, opts.request_size, IBV_ACCESS_REMOTE_WRITE, r % 64 == 63);
+        GrantInfo info = {htonll(grant.addr), htonl(grant.rkey)};
+        if (write(sock, &info, sizeof(info)) != sizeof(info)) {
+            throw std::runtime_error("Failed to send grant");
+        }
+
+        struct ibv_wc wc;
+        do {
+            wc = waitCompletion(rdma);
+        } while (wc.opcode != IBV_WC_RECV);
+        if (!(wc.wc_flags & IBV_WC_WITH_INV) || wc.invalidated_rkey != grant.rkey) {
+            throw std::runtime_error("Request completed without invalidating its window");
+        }
+        rdma.releaseAccess(grant);
+        const uint8_t* host = rdma.getHostBuffer();
+        uint8_t expected = static_cast<uint8_t>(r);
+        if (host && host[offset] == expected && host[offset + opts.request_size - 1] == expected) {
+            verified++;
+        }
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::printf("%d requests in %.3f s (%.0f/s), %d slots verified\n", opts.requests, seconds, opts.requests / seconds,
+                verified);
+}
+
+void runTenant(const Options& opts, RdmaVerbs& rdma, struct ibv_qp* qp) {
+    int sock = rdma.getSock();
+    for (int r = 0; r < opts.requests; ++r) {
+        GrantInfo info;
+        if (read(sock, &info, sizeof(info)) != sizeof(info)) {
+            throw std::runtime_error("Owner went away");
+        }
+        if (rdma.getHostBuffer()) {
+            memset(rdma.getHostBuffer(), static_cast<uint8_t>(r), opts.request_size);
+        }
+
+        struct ibv_sge sge = {};
+        sge.addr = rdma.getLocalAddr();
+        sge.length = static_cast<uint32_t>(opts.request_size);
+        sge.lkey = rdma.getLkey();
+        struct ibv_send_wr done = {};
+        done.opcode = IBV_WR_SEND_WITH_INV;
+        done.send_flags = IBV_SEND_SIGNALED;
+        done.invalidate_rkey = ntohl(info.rkey);
+        struct ibv_send_wr data = {};
+        data.opcode = IBV_WR_RDMA_WRITE;
+        data.sg_list = &sge;
+        data.num_sge = 1;
+        data.wr.rdma.remote_addr = ntohll(info.addr);
+        data.wr.rdma.rkey = ntohl(info.rkey);
+        data.next = &done;
+        rdma.postSend(qp, &data);
+        waitCompletion(rdma);
+    }
+    std::cout << "✓ " << opts.requests << " requests written through their windows\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        Options opts = parseArguments(argc, argv);
+        std::cout << "Memory Window Benchmark\n=======================\n";
+
+        HpuManager hpu;
+        RdmaVerbs rdma;
+        hpu.initialize(RDMA_BUFFER_SIZE);
+        rdma.initialize(opts.ib_dev_name.value_or(""), hpu);
+        rdma.connectQp(opts.server_name, opts.port);
+        // A QP of its own so co-located runs still go through the NIC
+        struct ibv_qp* qp = rdma.createQp();
+        rdma.connectQp(qp);
+
+        if (opts.server_name.empty()) {
+            timeGrants(opts, rdma, qp);
+            serveRequests(opts, rdma, qp);
+        } else {
+            runTenant(opts, rdma, qp);
+        }
+        rdma.destroyQp(qp);
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "window_bench failed: " << e.what() << "\n";
+        return 1;
+    }
+}